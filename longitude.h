@@ -7,69 +7,159 @@
 #ifndef LONGITUDE_HEADER
 #define LONGITUDE_HEADER
 
-#include <HardwareSerial.h>
+#include <stddef.h>
+#include "longitude_hal.h" // all board access goes through here, except the display
+#include "longitude_protocol.h"
+#include "longitude_events.h"
+#include "longitude_math.h" // also has the laser geometry (LASER_OFFSET_UM, RANGE_OFFSET_UM)
+#include "longitude_profile.h" // PROFILE, and the SPAN_* macros
+#include "longitude_task.h"
+#include "longitude_trace.h" // TRACE, the HAL's log of every input
 
 #define VERSION 1.04
 
-#define LASER_OFFSET 0.060L // distance in meters between the two lasers
-#define RANGE_OFFSET 0.165L // distance in meters from back of device to front of laser
+// set to 1 to run the measurement math in integers (the Teensy 3.2 has no FPU and
+// emulates doubles in software), or 0 for the original double-precision math;
+// -DFIXED_POINT=0 on the command line picks it too
+#ifndef FIXED_POINT
+#define FIXED_POINT 1
+#endif
+
+#define bat_pin 14         // we measure battery voltage through analog pin 0 (A0)
+#define backlight_pin 6    // the display's LED input, switched by a transistor (PWM)
 
-#define bat_pin A0         // we measure battery voltage through analog pin 0
+// angle sensor ADC resolution (bits) while aiming, and for the final capture
+#define AIM_RESOLUTION     12
+#define CAPTURE_RESOLUTION 18
 
 // we're using active-low logic for the buttons; these make the code more readable
-#define ACTIVE LOW
-#define INACTIVE HIGH
+#define ACTIVE 0   // pin level
+#define INACTIVE 1
 
 // FSM states
-extern enum FSM { STATE_INIT, STATE_IDLE, WAIT_LASER_ON, STATE_LASERS_ON, STATE_ONE_LASER, WAIT_MEASURE, STATE_MEASURE, WAIT_IDLE } state;
+extern enum FSM { STATE_INIT, STATE_IDLE, WAIT_LASER_ON, STATE_LASERS_ON, STATE_ONE_LASER, WAIT_MEASURE, STATE_MEASURE, WAIT_IDLE,
+                  STATE_TRACKING, TRACKING, STATE_CALIBRATE, WAIT_CALIBRATE, WAIT_BOOT, WAIT_LASERS, STATE_CAPTURE,
+                  WAIT_CAPTURE, WAIT_TRACKING } state;
+
+// laser transactions: which command we sent, and how far along the reply is
+enum LASER_CMD { LASER_CMD_ON, LASER_CMD_MEASURE, LASER_CMD_OFF };
+enum LASER_XACT { XACT_IDLE, XACT_WAIT_REPLY, XACT_WAIT_RESULT, XACT_DONE };
 
 // laser object
 struct laser
 {
     uint8_t id;           // identify the laser (0 is left, 1 is right)
-    HardwareSerial *port; // serial port associated with laser
+    uint8_t port;         // serial port associated with laser (HAL_UART_*)
     bool enabled;         // on/off status
     double last_measurement;
+    uint32_t last_distance_um;  // same measurement, in integer micrometers
+    struct laser_parser rx;     // receive buffer for the serial protocol
+    enum LASER_CMD cmd;         // command of the current/last transaction
+    enum LASER_XACT xact;       // transaction progress
+    enum LASER_FRAME result;    // how the last transaction ended
+    uint32_t xact_start;        // micros() when the command went out
+    uint32_t latency_us;        // command-to-result time of the last transaction
 };
 
-// button object
+// button object; presses and releases reach the FSM as events
 struct btn
 {
-    volatile bool state;   // ACTIVE or INACTIVE
+    uint8_t id;                 // BTN_MEASURE or BTN_MODE, the event argument
     uint8_t pin;   
+    volatile bool down;         // debounced position
+    volatile uint32_t changed;  // millis() of the last accepted edge
 };
 extern struct btn b_measure; // button to measure and select
 extern struct btn b_mode;    // button to switch mode
 
+// melodies for beep()
+enum BEEPS { booting, finished, mode_change, special, beethoven, charge };
+
 // measurement display units; we use these to index into the data[] conversion array
 extern enum UNITS { meter, foot, inch } unit;
 
 // unit bookkeeping
 struct unit_conversion
 {
-    const char *id;            // unit identifier, e.g., "ft"
-    double (*convert)(double); // conversion routine
+    const char *id;                // unit identifier, e.g., "ft"
+    uint32_t (*convert)(uint32_t); // micrometers to thousandths of the unit
 };
 extern struct unit_conversion data[];
 
 // global vars
 extern double measured_length;
+extern uint32_t measured_length_um;
 extern uint8_t voltage_percentage;
 extern struct laser laser_left;
 extern struct laser laser_right;
 extern double angle_offset;
 extern double angle;
+extern int32_t angle_offset_mdeg;
+extern int32_t angle_mdeg;
+extern int32_t angle_code;
+extern bool angle_zeroed;
+extern uint8_t capture_shots;
+extern uint32_t capture_us;
+extern uint32_t capture_se_target_um;
+extern uint32_t measured_ci_um;
+extern uint32_t tracking_rate_milli;
+extern uint32_t tracking_latency_us;
+extern uint8_t measure_faults;
+extern uint8_t cal_step;
+extern uint8_t cal_taken;
+extern uint32_t cal_last_um;
+
+// why the last measurement came to nothing, as bits of measure_faults (0: it
+// didn't); a laser's bit is 1 << its id
+enum MEASURE_FAULT { FAULT_LEFT = 0x01, FAULT_RIGHT = 0x02, FAULT_ANGLE = 0x04 };
+
+// longitude.ino
+void compute_length(void);
+
+// longitude_capture.cpp
+void capture_start(void);
+
+// longitude_tracking.cpp
+void tracking_start(void);
+bool tracking_service(void);
+void tracking_shown(void);
+void tracking_stop(void);
+void tracking_hold(void);
+
+// longitude_calibration.cpp
+void calibration_start(void);
+uint32_t calibration_reference_um(void);
+bool calibration_take(void);
+bool calibration_skip(void);
+bool calibration_finish(void);
+void angle_calibration_start(void);
+bool angle_calibration_running(void);
+bool angle_calibration_ready(void);
+bool angle_calibration_take(int32_t);
+bool angle_calibration_finish(void);
+void angle_calibration_clear(void);
 
 // longitude_lasers.c
 void laser_setup(struct laser *, struct laser *);
-void laser_on(struct laser *);
-void laser_measure(struct laser *);
-void laser_read_data(struct laser *);
+enum LASER_FRAME laser_poll(struct laser *);
+void laser_start(struct laser *, enum LASER_CMD);
+void laser_start_all(struct laser *, struct laser *, enum LASER_CMD);
+void laser_finish_all(struct laser *, struct laser *);
+bool laser_service(struct laser *);
+bool laser_all_done(struct laser *, struct laser *);
+uint8_t laser_job_faults(void);
+bool laser_failed(const struct laser *);
 
 // longitude_adc.c
 int adc_setup(void);
-void get_angle(void);
-void zero_angle(void);
+int adc_set_resolution(uint8_t);
+uint8_t adc_resolution(void);
+bool adc_found(void);
+bool adc_settled(void);
+bool adc_stalled(void);
+bool get_angle(void);
+bool get_angle_code(int32_t *);
+void zero_angle_start(void);
 
 // longitude_buttons.c
 void button_setup(void);
@@ -79,19 +169,66 @@ void display_setup(void);
 void update_display(void);
 void single_laser_message(void);
 void show_bat_percent(void);
-void show_bat_level_100(void);
-void show_bat_level_75(void);
-void show_bat_level_50(void);
-void show_bat_level_25(void);
-void show_bat_level_15(void);
+void show_bat_level(uint8_t);
+void update_battery(void);
+void display_sleep(bool);
+void display_splash(void);
+void display_splash_skip(void);
 
 // longitude_battery.c
-void update_bat_level(void); 
+void battery_setup(void);
+void battery_service(void);
+void update_bat_level(void);
+uint16_t battery_mv(void);
+
+// longitude_power.cpp; inactivity timeouts in seconds, 0 for never
+extern uint16_t power_dim_s;
+extern uint16_t power_display_off_s;
+extern uint16_t power_lasers_off_s;
+
+void power_setup(void);
+bool power_activity(void);
+void power_service(void);
+
+// longitude_sound.cpp
+void beep(BEEPS);
+bool sound_busy(void);
+
+// longitude_config.cpp; the key numbers are stored in the EEPROM, so new keys
+// go at the end and retired ones keep their number
+enum CONFIG_KEY { CONFIG_ANGLE_OFFSET, CONFIG_UNIT, CONFIG_CAL, CONFIG_ANGLE_CAL, CONFIG_KEYS };
 
-// longitude_config.cpp
 void load_config(void);
-void save_config(const char *);
+void config_changed(uint8_t);
+void config_service(void);
+void config_flush(void);
 void clear_config(void);
 void print_config(void);
 
+// longitude_link.cpp; host to device frame types, which are also what EV_COMMAND
+// carries (LINK_UNIT with the unit in the top four bits)
+enum LINK_CMD { LINK_PING = 1, LINK_STREAM, LINK_MEASURE, LINK_ZERO, LINK_UNIT, LINK_BATCH, LINK_STOP, LINK_PROFILE,
+                LINK_ANGLE_CAL };
+
+// LINK_ANGLE_CAL's first payload byte; ANGLE_CAL_POINT is followed by the angle
+// in millidegrees (int32)
+enum ANGLE_CAL_OP { ANGLE_CAL_START, ANGLE_CAL_POINT, ANGLE_CAL_FINISH, ANGLE_CAL_CLEAR };
+
+#define LINK_ARG(cmd, x) ((cmd) | (x) << 4)
+
+void link_setup(void);
+void link_service(void);
+void link_measurement(uint8_t);
+void link_fault(uint8_t);
+void link_laser_frame(const struct laser *, uint8_t);
+
+// longitude_history.cpp; the kind is stored with each record, so the same rule
+// applies, and there's room for four
+enum HISTORY_KIND { HISTORY_BURST, HISTORY_RANGE, HISTORY_TRACK };
+
+void history_setup(void);
+void history_add(uint8_t);
+uint32_t history_size(uint32_t *);
+void history_export(void);
+
 #endif
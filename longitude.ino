@@ -7,19 +7,51 @@
 #include <math.h>
 #include "longitude.h"
 
-#define BEEP_PIN 3 // speaker output pin
+// holding the measure button this long with the lasers on starts tracking mode
+#define TRACK_HOLD_MS 800
 
-enum BEEPS { booting, finished, mode_change, special, beethoven, charge };
+// holding the mode button this long with the lasers on starts calibration; in
+// calibration, it ends it
+#define CAL_HOLD_MS 2000
 
-// local state variable (EEPROM config)
-static bool unit_changed = false;
+// holding the mode button this long with the lasers off sends the measurement
+// history over USB
+#define EXPORT_HOLD_MS 2000
+
+// measure button went down in WAIT_MEASURE, and when; we act on the release
+static bool measure_armed = false;
+static uint32_t measure_down;
+
+// same for the mode button (rangefinder or export, zero the angle or calibrate)
+static bool mode_armed = false;
+static uint32_t mode_down;
+
+// where WAIT_LASERS goes once the lasers have done as they were told
+static enum FSM lasers_next;
+
+// the burst in WAIT_CAPTURE measures a calibration reference, not a length
+static bool capture_reference = false;
+
+// uncomment to print the cycle cost of both measurement math paths at boot
+//#define MATH_BENCH
+
+// the profiler keeps a span per state (longitude_profile.h)
+static_assert( WAIT_TRACKING + 1 == SPAN_COUNT - SPAN_STATE, "SPAN_COUNT has a span per FSM state" );
 
 // local routines
-static double calc_length(double theta, double a, double b);
-static double to_meter(double);
-static double to_feet(double);
-static double to_inch(double);
-static void beep(BEEPS);
+static bool pressed(const struct event *, uint8_t);
+static bool released(const struct event *, uint8_t);
+static bool remote(const struct event *, uint8_t);
+static bool lasers_idle(const struct event *);
+static void host_setting(const struct event *);
+static void lasers_on(enum FSM);
+static void lasers_off(enum FSM);
+static void measure(void);
+static void record(uint8_t);
+static void measure_failed(uint8_t);
+#ifdef MATH_BENCH
+static void math_bench(void);
+#endif
 
 /* globals */
 // the laser "objects"
@@ -28,125 +60,381 @@ struct laser laser_right;
 
 // array of unit conversion stuff, indexed by 'unit' enum
 struct unit_conversion data[] = {
-    { "m",  &to_meter },
-    { "ft", &to_feet },
-    { "in", &to_inch },
+    { "m",  &um_to_milli_meter },
+    { "ft", &um_to_milli_foot },
+    { "in", &um_to_milli_inch },
 };
 
 enum FSM state;
 enum UNITS unit;
 double measured_length;
+uint32_t measured_length_um;
 double angle_offset;
 double angle;
+int32_t angle_offset_mdeg;
+int32_t angle_mdeg;
+uint8_t measure_faults;
 
 void loop()
 {
-    // program behavior is driven by an FSM
+    struct event ev;
+
+    PROFILE_PASS_BEGIN( state );
+
+    // settings changed a while ago go to the EEPROM (its timer's event woke us)
+    config_service();
+
+    // commands from a host on USB come back around as EV_COMMAND events
+    link_service();
+
+    // a new battery level goes on the screen (its timer's event woke us)
+    battery_service();
+
+    // dim or wake the display, or sleep right here until a button
+    power_service();
+
+    // a step of whatever's waiting on a device (lasers, ADC, the splash screen)
+    task_service();
+
+    // program behavior is driven by an FSM; the WAIT_* states sleep until an
+    // event arrives (the tasks keep running meanwhile), and drop any they have
+    // no use for
     switch(state)
     {
         case STATE_INIT:
 
-            beep( booting );
+            beep( booting );  // plays on by itself
             update_display(); // shows splash screen
-            state = STATE_IDLE;
+            display_splash(); // until the boot is done, at least
+            state = WAIT_BOOT;
             break;
 
-        case STATE_IDLE:
-
-            update_display(); // shows idle screen
+        case WAIT_BOOT: // the splash screen is up until the angle ADC answers, or gives up
 
-            if ( unit_changed )
+            if ( !task_running(TASK_SPLASH) && !task_running(TASK_ADC) )
             {
-              save_config( "unit" );
-              unit_changed = false;
+                SPAN_SINCE_RESET(SPAN_BOOT_READY);
+
+                if ( adc_found() )
+                    state = STATE_IDLE;
+                else
+                    measure_failed( FAULT_ANGLE ); // no angles, so no lengths; the rangefinder still works
+
+                break;
             }
 
+            task_wait( &ev ); // their EV_TASK brings us back
+
+            if ( ev.type == EV_BTN_DOWN ) // no waiting on a splash screen held up longer
+                display_splash_skip();
+
+            break;
+
+        case STATE_IDLE:
+
+            update_display(); // shows idle screen
+            mode_armed = false;
             state = WAIT_LASER_ON;                
             break;
             
-        case WAIT_LASER_ON: // spin here until user presses a button
-            
-            if ( b_measure.state == ACTIVE ) // user wants a measurement, light up the fires
+        case WAIT_LASER_ON: // wait here until user presses a button
+
+            task_wait( &ev );
+
+            if ( pressed(&ev, BTN_MEASURE) ) // user wants a measurement, light up the fires
             {
                 beep( mode_change );
-                laser_on( &laser_left );
-                laser_on( &laser_right );
+                lasers_on( STATE_LASERS_ON );
+            }
+            else if ( remote(&ev, LINK_MEASURE) ) // the host doesn't need to aim
+            {
+                capture_reference = false;
+                lasers_on( STATE_CAPTURE );
+            }
+            else if ( pressed(&ev, BTN_MODE) ) // a click or a hold; the release tells which
+            {
+                mode_armed = true;
+                mode_down = ev.time;
+            }
+            else if ( released(&ev, BTN_MODE) && mode_armed && ev.time - mode_down >= EXPORT_HOLD_MS )
+            {
+                mode_armed = false;
 
-                state = STATE_LASERS_ON;
-                b_measure.state = INACTIVE;
+                beep( mode_change );
+                history_export();
+                beep( finished );
+
+                state = STATE_IDLE;
             }
-            else if ( b_mode.state == ACTIVE ) // rangefinder mode
+            else if ( released(&ev, BTN_MODE) && mode_armed ) // rangefinder mode
             {
-                beep( special );
-                laser_on( &laser_left );
+                mode_armed = false;
 
-                b_mode.state = INACTIVE;
-                state = STATE_ONE_LASER;
+                beep( special );
                 single_laser_message();
+
+                laser_start_all( &laser_left, NULL, LASER_CMD_ON );
+                lasers_next = STATE_ONE_LASER;
+                state = WAIT_LASERS;
+            }
+            else
+            {
+                host_setting( &ev );
             }
 
             break;
 
         case STATE_ONE_LASER: // user is aiming a single laser
 
-             if ( b_measure.state == ACTIVE )
-             {
-                  laser_measure( &laser_left );
-                  laser_read_data( &laser_left );
+             task_wait( &ev );
 
+             if ( task_running(TASK_LASERS) ) // the shot isn't in yet
+             {
+                  break;
+             }
+             else if ( pressed(&ev, BTN_MEASURE) )
+             {
+                  laser_start_all( &laser_left, NULL, LASER_CMD_MEASURE );
+             }
+             else if ( task_done(&ev, TASK_LASERS) && laser_failed(&laser_left) ) // no distance to show
+             {
+                  measure_failed( FAULT_LEFT );
+             }
+             else if ( task_done(&ev, TASK_LASERS) ) // the shot
+             {
                   beep( finished );
 
-                  measured_length = laser_left.last_measurement + RANGE_OFFSET;
+                  measured_length_um = laser_left.last_distance_um + RANGE_OFFSET_UM;
+                  capture_shots = 0; // a single shot, no statistics
+                  record( HISTORY_RANGE );
 
-                  b_measure.state = INACTIVE;
                   state = STATE_MEASURE;
              }
+             else if ( lasers_idle(&ev) ) // nobody's aiming it
+             {
+                  lasers_off( STATE_IDLE );
+             }
 
              break;
 
+        case WAIT_LASERS: // the lasers go on or off (TASK_LASERS); buttons are dropped
+
+            task_wait( &ev );
+
+            if ( !task_done(&ev, TASK_LASERS) )
+                break;
+
+            // a module that didn't light up: say which, rather than aim in the dark
+            if ( laser_job_faults() )
+                measure_failed( laser_job_faults() );
+            else
+                state = lasers_next;
+
+            break;
+
         case STATE_LASERS_ON: // user is aiming the lasers
 
             update_display(); // we show idle screen + laser on messege 
+            measure_armed = false;
+            mode_armed = false;
             state = WAIT_MEASURE;                 
             break;
             
-        case WAIT_MEASURE: // spin here until user presses the red button
+        case WAIT_MEASURE: // wait here until user clicks (or holds) the red button
 
-            if ( b_measure.state == ACTIVE ) // user wants a measurement
+            task_wait( &ev );
+
+            if ( task_running(TASK_ZERO) ) // the zero isn't in yet
+            {
+                break;
+            }
+            else if ( pressed(&ev, BTN_MEASURE) ) // a click or a hold; the release tells which
+            {
+                measure_armed = true;
+                measure_down = ev.time;
+            }
+            else if ( released(&ev, BTN_MEASURE) && measure_armed && ev.time - measure_down >= TRACK_HOLD_MS )
+            {
+                measure_armed = false;
+                state = STATE_TRACKING;
+            }
+            else if ( (released(&ev, BTN_MEASURE) && measure_armed) || remote(&ev, LINK_MEASURE) ) // user wants a measurement
+            {
+                measure_armed = false;
+                measure();
+            }
+            else if ( pressed(&ev, BTN_MODE) ) // mode click zeroes the angle sensor, mode hold calibrates
             {
-                // take the sensitive angle measurement while the system is quiescent
-                get_angle();
+                mode_armed = true;
+                mode_down = ev.time;
+            }
+            else if ( released(&ev, BTN_MODE) && mode_armed && ev.time - mode_down >= CAL_HOLD_MS )
+            {
+                mode_armed = false;
+                state = STATE_CALIBRATE;
+                calibration_start();
+                beep( mode_change );
+            }
+            else if ( released(&ev, BTN_MODE) && mode_armed ) // clicking the mode button while the lasers are on will zero the angle sensor
+            {
+                mode_armed = false;
+                zero_angle_start();
+            }
+            else if ( task_done(&ev, TASK_ZERO) && !angle_zeroed ) // the angle sensor didn't answer
+            {
+                measure_failed( FAULT_ANGLE );
+            }
+            else if ( task_done(&ev, TASK_ZERO) )
+            {
+                beep( special );
 
-                // the lasers require time to take a measurement, so we'll send the measure command first (these return quickly)
-                laser_measure( &laser_left );
-                laser_measure( &laser_right );
+                // store the new offset in the EEPROM
+                config_changed( CONFIG_ANGLE_OFFSET );
+            }
+            else if ( lasers_idle(&ev) ) // nobody's aiming them; back to the idle screen
+            {
+                lasers_off( STATE_IDLE );
+            }
+            else
+            {
+                host_setting( &ev );
+            }
+            
+            break;
 
-                beep( mode_change );
+        case STATE_CALIBRATE: // ask for the next reference length
+
+            update_display();
+            mode_armed = false;
+            state = WAIT_CALIBRATE;
+            break;
+
+        case WAIT_CALIBRATE: // click to measure the reference, mode to skip it, hold mode to finish
+
+            task_wait( &ev );
+
+            if ( pressed(&ev, BTN_MEASURE) ) // compensation is off, so this is the length straight from the geometry
+            {
+                capture_reference = true;
+                state = STATE_CAPTURE;
+            }
+            else if ( pressed(&ev, BTN_MODE) )
+            {
+                mode_armed = true;
+                mode_down = ev.time;
+            }
+            else if ( released(&ev, BTN_MODE) && mode_armed )
+            {
+                mode_armed = false;
+
+                if ( ev.time - mode_down >= CAL_HOLD_MS || calibration_skip() )
+                    state = STATE_IDLE;
+                else
+                    state = STATE_CALIBRATE;
+            }
+            else if ( lasers_idle(&ev) ) // a measure command lights them again
+            {
+                lasers_off( WAIT_CALIBRATE );
+            }
+
+            // told to stop: store the new table, or keep the old one
+            if ( state == STATE_IDLE )
+                beep( calibration_finish() ? beethoven : charge );
+
+            break;
+
+        case STATE_CAPTURE: // start a burst
+
+            // switch the angle sensor to full resolution; its samples accumulate
+            // in the background while the lasers measure
+            adc_set_resolution( CAPTURE_RESOLUTION );
 
-                // check the serial buses for measurement data (these block until the data arrives)
-                laser_read_data( &laser_left );
-                laser_read_data( &laser_right );
+            beep( mode_change ); // plays in the background while we wait
 
+            // paired laser/angle shots until the mean is good enough (longitude_capture.cpp)
+            capture_start();
+            state = WAIT_CAPTURE;
+            break;
+
+        case WAIT_CAPTURE: // the burst runs as TASK_CAPTURE; buttons are dropped
+
+            task_wait( &ev );
+
+            if ( !task_done(&ev, TASK_CAPTURE) )
+                break;
+
+            if ( capture_reference && measure_faults ) // no reading; ask for the reference again
+            {
+                adc_set_resolution( AIM_RESOLUTION );
+                state = STATE_CALIBRATE;
+            }
+            else if ( capture_reference )
+            {
+                adc_set_resolution( AIM_RESOLUTION );
                 beep( finished );
 
-                measured_length = calc_length( angle, laser_left.last_measurement, laser_right.last_measurement );
+                state = calibration_take() ? STATE_IDLE : STATE_CALIBRATE;
 
-                b_measure.state = INACTIVE;
-                state = STATE_MEASURE;
+                // out of references: store the new table, or keep the old one
+                if ( state == STATE_IDLE )
+                    beep( calibration_finish() ? beethoven : charge );
             }
-            else if ( b_mode.state == ACTIVE ) // pressing the mode button while the lasers are on will zero the angle sensor
+            else if ( measure_faults ) // every shot failed
             {
-                zero_angle();
-                beep( special );
+                measure_failed( measure_faults );
+            }
+            else
+            {
+                record( HISTORY_BURST );
+                beep( finished );
+                state = STATE_MEASURE;
+            }
 
-                // store the new offset in the EEPROM
-                save_config( "angle" );
+            break;
+
+        case STATE_TRACKING: // the lasers measure back to back from here on
 
-                b_mode.state = INACTIVE;
+            beep( mode_change );
+            tracking_start();
+            update_display(); // live measure screen
+            state = TRACKING;
+            break;
+
+        case TRACKING: // refresh the length whenever both lasers have a new distance
+
+            if ( event_get(&ev) )
+            {
+                if ( pressed(&ev, BTN_MEASURE) ) // hold the reading, once the shots in flight are in
+                {
+                    tracking_stop();
+                    state = WAIT_TRACKING;
+                }
             }
-            
+            else if ( tracking_service() )
+            {
+                update_display();
+                tracking_shown();
+            }
+            else
+            {
+                event_idle(); // until the next byte from a laser, or a button
+            }
+
             break;
-            
+
+        case WAIT_TRACKING: // the last shots land (TASK_LASERS); buttons are dropped
+
+            task_wait( &ev );
+
+            if ( !task_done(&ev, TASK_LASERS) )
+                break;
+
+            tracking_hold();
+            record( HISTORY_TRACK );
+            beep( finished );
+            state = STATE_MEASURE;
+            break;
+
         case STATE_MEASURE:
 
             update_display(); // show the measured length
@@ -154,22 +442,35 @@ void loop()
 
             break;
 
-        case WAIT_IDLE: // spin here until user presses the red button
+        case WAIT_IDLE: // wait here until user presses the red button
+
+            task_wait( &ev );
 
-            if ( b_measure.state == ACTIVE ) // user wants to move to main screen
+            if ( pressed(&ev, BTN_MEASURE) ) // user wants to move to main screen
             {
                 beep( mode_change );
-                b_measure.state = INACTIVE;
                 state = STATE_IDLE;
             }
-            else if ( b_mode.state == ACTIVE ) // user wants to change units
+            else if ( pressed(&ev, BTN_MODE) ) // user wants to change units
             {
                 beep( special );
                 unit = (UNITS)((unit + 1) % 3);
                 update_display();
 
-                unit_changed = true; // we'll write the new units to the EEPROM in the IDLE state
-                b_mode.state = INACTIVE;
+                config_changed( CONFIG_UNIT ); // written once the user stops clicking
+            }
+            else if ( remote(&ev, LINK_MEASURE) ) // straight to the next measurement
+            {
+                capture_reference = false;
+                lasers_on( STATE_CAPTURE );
+            }
+            else if ( lasers_idle(&ev) ) // a shot that failed left them lit
+            {
+                lasers_off( WAIT_IDLE );
+            }
+            else
+            {
+                host_setting( &ev );
             }
             break;
 
@@ -177,152 +478,194 @@ void loop()
             state = STATE_INIT;
             break;
     }
+
+    PROFILE_PASS_END();
 }
 
+// nothing here waits on a device: the ADC powers up as TASK_ADC while the rest
+// carries on, and the boot is over once it answers (see WAIT_BOOT)
 void setup()
 {
+#if PROFILE
+    profile_setup(); // first, so the boot's stages are timed
+#endif
+    SPAN_SINCE_RESET(SPAN_BOOT_CORE);
+
+    trace_start(); // before anything reads an input
+    event_init();  // before anything that posts to it
+    task_init();   // and anything that starts one
+
+    SPAN_BEGIN(SPAN_BOOT_DEVICES);
     adc_setup();
     button_setup();
-    display_setup();
     laser_setup( &laser_left, &laser_right );
 
-    // set the internal ADC to use a 32-sample moving average
-    analogReadAveraging(32);
+    // start sampling the battery (the only user of the internal ADC)
+    battery_setup();
+    SPAN_END(SPAN_BOOT_DEVICES);
+
+    // the panel's own power-up is the longest wait, and the ADC's is under it
+    SPAN_BEGIN(SPAN_BOOT_DISPLAY);
+    display_setup();
+    SPAN_END(SPAN_BOOT_DISPLAY);
 
     // set defaults (unit and angle_offset will be overwritten by config, if available)
     unit = meter; // 'meter', 'foot', or 'inch'
     angle_offset = 0.0;
+    angle_offset_mdeg = 0;
     measured_length = 0.0;
+    measured_length_um = 0;
     state = STATE_INIT;
     
-    // download config values from EEPROM
+    // download config values from EEPROM, before the first frame is drawn
+    SPAN_BEGIN(SPAN_BOOT_CONFIG);
     load_config();
+    SPAN_END(SPAN_BOOT_CONFIG);
+
+    // find where the measurement history left off
+    SPAN_BEGIN(SPAN_BOOT_HISTORY);
+    history_setup();
+    SPAN_END(SPAN_BOOT_HISTORY);
+
+    // listen for a host on USB
+    link_setup();
+
+    // backlight up, and start counting idle time
+    power_setup();
+
+#ifdef MATH_BENCH
+    math_bench();
+#endif
 }
 
-// when the user points the lasers at the ends of an object, there is an
-// implicit triangle formed by the two laser dots and the center of the device.
-// since the laser modules tell us the distances to the dots -- giving us the
-// length of each leg -- and the angle sensor tells us the angle between the
-// legs, we can solve for the length between the two laser dots using the law
-// of cosines.  since the lasers are physically offset from each other (not
-// coincident), we add the distance between them to the derived length.
+// length from the latest laser distances and angle
+void compute_length(void)
+{
+    SPAN_BEGIN(SPAN_LENGTH);
+
+#if FIXED_POINT
+    measured_length_um = calc_length_um( angle_mdeg, laser_left.last_distance_um, laser_right.last_distance_um );
+#else
+    measured_length = calc_length( angle, laser_left.last_measurement, laser_right.last_measurement );
+    measured_length_um = (uint32_t)lround( measured_length * 1000000.0 );
+#endif
+
+    SPAN_END(SPAN_LENGTH);
+}
 
-static double calc_length(double theta, double a, double b)
+// a press of the given button; releases and other events don't count
+static bool pressed(const struct event *ev, uint8_t button)
 {
-    double phi, len;
-
-    // convert degrees to radians (where pi/180 = 0.0174...)
-    phi = theta * 0.017453292519943295L;
-
-    // solve the triangle
-    len = sqrt( a*a + b*b - 2*a*b*cos(phi) );
-
-    len += LASER_OFFSET;
-
-    /* system error compensation
-     * 
-     * the minimum length we can measure is equal to the LASER_OFFSET, which is
-     * presently 6 cm.  after careful measurement, we determined that the system
-     * error is a constant 6.3 cm for lengths greater than 31 cm.  for lengths
-     * between 7 cm and 31 cm, we performed a linear regression on the data, giving
-     * us a function y = f(x), mapping the true length x to Longitude's notion of
-     * the length y.  taking the inverse of this function gave us the function below.
-     */
-    if ( (len >= 0.07) && (len < 0.31) )
+    return ev->type == EV_BTN_DOWN && ev->arg == button;
+}
+
+static bool released(const struct event *ev, uint8_t button)
+{
+    return ev->type == EV_BTN_UP && ev->arg == button;
+}
+
+// a command from the host (longitude_link.cpp)
+static bool remote(const struct event *ev, uint8_t cmd)
+{
+    return ev->type == EV_COMMAND && (ev->arg & 0x0F) == cmd;
+}
+
+// the power manager's timeout for lasers left lit (longitude_power.cpp)
+static bool lasers_idle(const struct event *ev)
+{
+    return ev->type == EV_TIMER && ev->arg == TIMER_LASERS;
+}
+
+// the host's zero and unit commands, taken in any state that waits for the user
+static void host_setting(const struct event *ev)
+{
+    if ( remote(ev, LINK_ZERO) )
     {
-        len = 1.065L * len + 0.00324L;
+        zero_angle_start();
     }
-    else if ( len >= 0.31 ) // for larger lengths, system error is a constant 6.3 cm
+    else if ( task_done(ev, TASK_ZERO) && angle_zeroed )
     {
-        len += 0.063L; 
+        config_changed( CONFIG_ANGLE_OFFSET );
+    }
+    else if ( remote(ev, LINK_UNIT) )
+    {
+        unit = (UNITS)(ev->arg >> 4);
+        config_changed( CONFIG_UNIT );
+
+        if ( state == WAIT_IDLE ) // the length is on the screen
+            update_display();
     }
-    
-    return len;
 }
 
-// unit conversion routines; each is passed a double-precision value in units of meters
-double to_meter(double m)
+// power both modules up together; WAIT_LASERS goes to 'next' once the slower
+// one has answered
+static void lasers_on(enum FSM next)
 {
-    return m;
+    laser_start_all( &laser_left, &laser_right, LASER_CMD_ON );
+
+    // fast, coarse angle samples while the user aims; the ADC switches over
+    // while the lasers power up
+    adc_set_resolution( AIM_RESOLUTION );
+
+    lasers_next = next;
+    state = WAIT_LASERS;
 }
 
-double to_feet(double m)
+// whichever are lit; one that doesn't answer stays enabled, for the next timeout
+static void lasers_off(enum FSM next)
 {
-    return (m * 3.280839895013123359L);
+    laser_start_all( laser_left.enabled ? &laser_left : NULL, laser_right.enabled ? &laser_right : NULL, LASER_CMD_OFF );
+
+    lasers_next = next;
+    state = WAIT_LASERS;
 }
 
-double to_inch(double m)
+// a burst measurement, with the lasers on
+static void measure(void)
 {
-    return (m * 39.37007874015748031L);
+    capture_reference = false;
+    state = STATE_CAPTURE;
 }
 
-// make some noise
-static void beep(BEEPS action)
+// a finished measurement goes to the history, and to the host if one listens
+static void record(uint8_t kind)
 {
-  switch (action)
-  {
-    case booting: // g, d, a, b
-      tone( BEEP_PIN, 196, 250 );
-      delay( 300 );
-      tone( BEEP_PIN, 294, 250 );
-      delay( 300 );
-      tone( BEEP_PIN, 440, 1000 );
-      delay( 600 );
-      tone( BEEP_PIN, 494, 1000 );
-      break;
-      
-    case charge: // charge! fanfare
-      tone( BEEP_PIN, 196, 100 );
-      delay( 150 );
-      tone( BEEP_PIN, 262, 100 );
-      delay( 150 );
-      tone( BEEP_PIN, 330, 100 );
-      delay( 150 );
-      tone( BEEP_PIN, 392, 300 );
-      delay( 300 );
-      tone( BEEP_PIN, 330, 50 );
-      delay( 150 );
-      tone( BEEP_PIN, 392, 500 );
-      delay( 500 );
-      tone( BEEP_PIN, 523, 500 );
-      break;
-
-    case beethoven: // beethoven's 5th
-      tone( BEEP_PIN, 311, 100 );
-      delay( 200 );
-      tone( BEEP_PIN, 311, 100 );
-      delay( 200 );
-      tone( BEEP_PIN, 311, 100 );
-      delay( 200 );
-      tone( BEEP_PIN, 262, 1000 );
-      delay( 1000 );
-      tone( BEEP_PIN, 294, 150 );
-      delay( 200 );
-      tone( BEEP_PIN, 294, 150 );
-      delay( 200 );
-      tone( BEEP_PIN, 294, 150 );
-      delay( 200 );
-      tone( BEEP_PIN, 247, 1250 );
-      break;
-      
-    case finished: // a short trill
-      tone( BEEP_PIN, 2000, 50 );
-      delay( 50 );
-      tone( BEEP_PIN, 3000, 150 );
-      delay( 50 );
-      tone( BEEP_PIN, 1000, 50 );
-      break;
-      
-    case mode_change: // quick beep
-      tone( BEEP_PIN, 5500, 10 );
-      break;
-
-    case special: // a grunt
-      tone( BEEP_PIN, 300, 10 );
-      break;
-      
-    default:
-      return;
-  }
+    measure_faults = 0;
+
+    history_add( kind );
+    link_measurement( kind );
+    trace_result( kind );
 }
 
+// no length: the measure screen says what failed instead, nothing goes to the
+// history, and a host waiting on it hears why
+static void measure_failed(uint8_t faults)
+{
+    measure_faults = faults;
+    link_fault( faults );
+    state = STATE_MEASURE;
+}
+
+#ifdef MATH_BENCH
+// time one length calculation and one angle conversion on each path with the
+// DWT cycle counter; volatile inputs keep the compiler from folding them away
+static void math_bench(void)
+{
+    volatile double theta = 37.5, a = 1.234, b = 2.345, v = 0.8, vmax = 1.92;
+    volatile int32_t theta_mdeg = 37500, uv = 800000, vmax_uv = 1920000;
+    volatile uint32_t a_um = 1234000, b_um = 2345000;
+    uint32_t t0, len_d, len_f, ang_d, ang_f;
+
+    ARM_DEMCR |= ARM_DEMCR_TRCENA;
+    ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+
+    t0 = ARM_DWT_CYCCNT; calc_length( theta, a, b );                len_d = ARM_DWT_CYCCNT - t0;
+    t0 = ARM_DWT_CYCCNT; calc_length_um( theta_mdeg, a_um, b_um );  len_f = ARM_DWT_CYCCNT - t0;
+    t0 = ARM_DWT_CYCCNT; calc_angle( v, vmax );                     ang_d = ARM_DWT_CYCCNT - t0;
+    t0 = ARM_DWT_CYCCNT; calc_angle_mdeg( uv, vmax_uv );            ang_f = ARM_DWT_CYCCNT - t0;
+
+    Serial.begin(115200);
+    Serial.printf( "[MATH] length: %lu cycles (double), %lu cycles (fixed)\n", len_d, len_f );
+    Serial.printf( "[MATH] angle:  %lu cycles (double), %lu cycles (fixed)\n", ang_d, ang_f );
+}
+#endif
@@ -1,129 +1,217 @@
 /*
- * Longitude MCP3421 ADC driver and angle calculation
+ * Longitude MCP342x ADC driver and angle calculation
  * 
  * Javier Lombillo
  * November 2016
  */
 
-#include <i2c_t3.h> // i2c library
+#include <math.h>
 #include "longitude.h"
+#include "longitude_mcp342x.h"
+#include "longitude_filter.h"
 
 // I2C address for MCP3421
 #define ADC_ADDRESS 0x68    // default address is 0110 1000
 
-// [MCP3421 resolution details]
-//
-// resolution | data rate | min code | max code | LSB (uV) | measured rate
-// -----------------------------------------------------------------------
-//  18-bit     3.75 SPS     -131072    131071     15.625       4.15 SPS
-//  16-bit       15 SPS     -32768     32767      62.500      16.50 SPS
-//  14-bit       60 SPS     -8192      8191      250.000      64.47 SPS
-//  12-bit      240 SPS     -2048      2047     1000.000     235.85 SPS
-
-// set to N = {12, 14, 16, 18} for native (non-oversampled) resolution, e.g., 18 for 18-bit
+// the converter's formats, register layout and decoding live in longitude_mcp342x.h
+
+// set to N = {12, 14, 16, 18} for the boot-time resolution, e.g., 18 for 18-bit.
+// the FSM switches at runtime with adc_set_resolution(), see AIM_RESOLUTION and
+// CAPTURE_RESOLUTION in longitude.h
 #define RESOLUTION 16
 
+// the converter doesn't answer its address until it has powered up; it's asked
+// every ADC_PROBE_MS, for up to ADC_POWER_UP_MS
+#define ADC_POWER_UP_MS 500
+#define ADC_PROBE_MS    2
+
+// the zero's backstop; a converter that stops answering ends it well before
+#define ZERO_TIMEOUT_MS 3000
+
+// a converter that hasn't delivered a sample in this many conversion times has
+// stopped answering (unplugged, or it never powered up); nothing waits on it
+#define ADC_STALL_CONVERSIONS 3
+
+// PGA gain policy
+typedef pga_x1 adc_pga;
+
+// number of input channels we convert: 1 for the MCP3421, up to 2 or 4 on the
+// MCP3422/3424.  the converter handles one channel per conversion, so the sampler
+// rotates through them and tags each sample with its channel.  the angle sensor
+// is on channel 0.
+#define ADC_CHANNELS 1
+#define ANGLE_CHANNEL 0
+
 // the MCP3421 is a delta-sigma converter, which uses oversampling internally, so
 // there's little benefit in adding another oversampling/decimation layer here.
 // there is, however, significant dc-stability advantage in averaging. this comes
 // at the cost of reduced throughput (less effective samples-per-second rate).
 //
-// we implement a simple moving-average filter here; to enable it, set WINDOW_SIZE
-// below to the desired window size in samples (1 disables the filter).
-#define WINDOW_SIZE 4
-
-// maximum positive code for each resolution
-#define ADC_MAX18 0x1FFFF
-#define ADC_MAX16 0x7FFF
-#define ADC_MAX14 0x1FFF
-#define ADC_MAX12 0x7FF
-
-#if RESOLUTION == 18
-  #define LSB 0.000015625L  // 15.625 uV
-  #define PACKET_SIZE 4     // 3 bytes of data, 1 byte of config
-  #define ADC_RES 0x0C      // config bits
-  #define ADC_MAX 0x1FFFF   // maximum positive code
-#elif RESOLUTION == 16
-  #define LSB 0.0000625L    // 62.5 uV
-  #define PACKET_SIZE 3     // 2 bytes of data, 1 byte of config
-  #define ADC_RES 0x08      // config bits
-  #define ADC_MAX 0x7FFF
-#elif RESOLUTION == 14
-  #define LSB 0.00025L      // 250 uV
-  #define PACKET_SIZE 3
-  #define ADC_RES 0x04
-  #define ADC_MAX 0x1FFF
-#else
-  #define LSB 0.001L        // 1 mV steps at 12-bits resolution
-  #define PACKET_SIZE 3
-  #define ADC_RES 0x00
-  #define ADC_MAX 0x7FF
-#endif
+// each channel's samples run through one of the streaming filters in longitude_filter.h
+// as they arrive; ANGLE_FILTER picks which.  WINDOW_SIZE is the boxcar/median window
+// in samples (1 disables the filter) and the number of samples we let the filter
+// settle after a resolution change; the EMA uses EMA_SHIFT, and the Kalman filter
+// its noise variances (codes^2, Q8).
+#define ANGLE_FILTER FILTER_BOXCAR
+#define WINDOW_SIZE  4
+#define EMA_SHIFT    2
+#define KALMAN_Q     (1 << FILTER_Q)
+#define KALMAN_R     (64 << FILTER_Q)
+
+// the runtime view of one MCP342x<> specialisation, so we can switch resolutions
+// on the fly; each entry points at code generated for that exact format
+struct adc_format
+{
+    uint8_t bits;
+    uint8_t packet;
+    uint32_t poll_us;
+    uint8_t (*config)(uint8_t, bool);
+    int32_t (*decode18)(const uint8_t *);
+    bool (*fresh)(const uint8_t *);
+};
 
-// MCP3421 configuration register
-// ------------------------------
-// bit #   :  7    | 6   5  | 4    | 3   2  | 1   0
-// bit name:  /RDY | C1  C0 | /O,C | S1  S0 | G1  G0
-// desc    :  flag | chans  | mode | res    | pga
-//
-// PGA gain | bits [1:0] values
-// ---------------------
-//   unity    00
-//      2x    01
-//      4x    10
-//      8x    11
-//
-// resolution | bits [3:2] values
-// ------------------------------
-//    12 bits   00
-//    14 bits   01
-//    16 bits   10
-//    18 bits   11
+#define ADC_FORMAT(n) { n, MCP342x<n, adc_pga>::packet, MCP342x<n, adc_pga>::poll_us, \
+                        &MCP342x<n, adc_pga>::config, &MCP342x<n, adc_pga>::decode18, &MCP342x<n, adc_pga>::fresh }
+
+static const struct adc_format formats[] = { ADC_FORMAT(12), ADC_FORMAT(14), ADC_FORMAT(16), ADC_FORMAT(18) };
+
+// all samples are kept in 18-bit units, so this is the LSB for every resolution
+static const double LSB = MCP342x<18, adc_pga>::lsb_pv * 1e-12;  // volts
+static const uint32_t LSB_PV = MCP342x<18, adc_pga>::lsb_pv;    // picovolts
+
+// the format we're running at; written from the main loop only
+static const struct adc_format * volatile fmt;
+
+// [background acquisition]
 //
-// conversion mode | bit [4] value
-// -------------------------------
-//        one-shot   0
-//      continuous   1
+// the ADC runs in continuous mode and converts on its own.  a timer interrupt
+// kicks off a non-blocking I2C read twice per conversion; when the read completes,
+// the I2C callback checks /RDY and, if the result is new, drops it into a
+// timestamped ring and through the channel's filter.  get_angle() just picks up
+// the latest filter output, so a measurement no longer stalls for conversions.
+
+#define ADC_RING_SIZE 16   // power of two
+
+struct adc_sample
+{
+    int32_t code;    // conversion code, in 18-bit units
+    uint32_t time;   // millis() when we read it
+    uint8_t channel;
+    uint8_t bits;    // resolution it was converted at
+};
+
+static struct adc_sample ring[ADC_RING_SIZE];
+static volatile uint32_t ring_count; // samples written since boot; newest is at (ring_count - 1)
+
+// per-channel filters, run from the I2C interrupt
+static struct filter filters[ADC_CHANNELS];
+static volatile int32_t filtered[ADC_CHANNELS];    // latest filter output, 18-bit units
+static volatile uint32_t filtered_n[ADC_CHANNELS]; // samples filtered at the current resolution
+static volatile uint32_t sample_ms; // millis() of the last sample, or of the last resolution switch
+static bool found;                  // the converter took the last resolution switch
 
-// set rest of default config bits here
-#define ADC_RDY   0x80  // 7th bit high initiates conversion in one-shot mode
-#define ADC_CHANS 0x00  // single-channel ADC, so bits 5 and 6 are zero
-#define ADC_MODE  0x00  // one-shot mode
-#define ADC_PGA   0x00  // unity gain
+static volatile uint8_t channel;        // channel the ADC is converting
+static volatile bool channel_pending;   // config write owed to the ADC before the next read
 
-// ADC configuration
-static uint8_t adcConfig = ADC_RDY | ADC_CHANS | ADC_MODE | ADC_RES | ADC_PGA;
+// the filtered code the last get_angle() worked from, for the host link
+int32_t angle_code;
 
-// buffer to hold bytes returned from the ADC
+bool angle_zeroed;        // the last zero_angle_start() took
+static uint8_t zero_bits; // resolution to go back to after it
+
+// buffer to hold bytes returned from the ADC (filled from the I2C interrupt)
 static uint8_t buff[4];
 
 // private (local) functions
-static void startConversion(void);
-static int32_t getData(void);
-static bool conversionBusy(void);
-static double get_sensor_voltage(void);
-static double get_battery(void);
-static double sensor_max(double);
+static const struct adc_format *find_format(uint8_t);
+static uint8_t adc_start_task(struct task *);
+static uint8_t zero_task(struct task *);
+static void adc_poll(void);
+static void adc_read_done(void);
+static bool get_sensor_code(uint8_t, int32_t *);
+static int32_t nominal_code(int32_t, int32_t);
+#if FIXED_POINT
+static int32_t sensor_uv(int32_t);
+#else
+static double sensor_voltage(int32_t);
+#endif
 
-// returns 1 on success, 0 on failure
+// sampling starts as soon as the converter has powered up, as TASK_ADC, while
+// the rest of the boot carries on; returns 1
 int adc_setup(void)
 {
-    // setup for master mode, pins 18/19, external pullups, 400kHz, 200ms default timeout
-    Wire.begin(I2C_MASTER, 0x00, I2C_PINS_18_19, I2C_PULLUP_EXT, 400000);
-    Wire.setDefaultTimeout(200000); // 200ms
+    hal_i2c_begin(400000);
+
+    ring_count = 0;
+    fmt = find_format(RESOLUTION);
+    sample_ms = hal_millis();
+    hal_i2c_on_read(adc_read_done);
+
+    for ( uint8_t ch = 0; ch < ADC_CHANNELS; ch++ )
+    {
+        if ( ANGLE_FILTER == FILTER_KALMAN )
+            filter_kalman_init(&filters[ch], KALMAN_Q, KALMAN_R);
+        else
+            filter_init(&filters[ch], ANGLE_FILTER, ANGLE_FILTER == FILTER_EMA ? EMA_SHIFT : WINDOW_SIZE);
+    }
+
+    task_start(TASK_ADC, adc_start_task, ADC_POWER_UP_MS);
+
+    return 1;
+}
+
+// a NAK on the configuration write means it isn't up yet; one that never
+// answers leaves adc_found() false for WAIT_BOOT to report
+static uint8_t adc_start_task(struct task *t)
+{
+    TASK_BEGIN(t);
+
+    while ( !adc_set_resolution(RESOLUTION) && !task_expired(t) )
+        TASK_SLEEP(t, ADC_PROBE_MS);
+
+    TASK_END(t);
+}
+
+// switch the converter to N-bit resolution and (re)start background sampling;
+// returns 1 on success, 0 on failure
+int adc_set_resolution(uint8_t bits)
+{
+    const struct adc_format *f = find_format(bits);
+
+    if ( f == NULL )
+      return 0;
+
+    hal_timer_stop(HAL_TIMER_ADC);
+    hal_i2c_finish(); // let any read in flight land before we touch the config
 
-    delay(500);
-    
-    Wire.beginTransmission(ADC_ADDRESS);
-    Wire.write(adcConfig);
-    Wire.endTransmission(I2C_STOP);
+    fmt = f;
+    channel = 0;
+    channel_pending = false;
+    sample_ms = hal_millis();
 
-    if ( Wire.getError() )
+    // samples at the old resolution mean nothing to the filters now
+    for ( uint8_t ch = 0; ch < ADC_CHANNELS; ch++ )
+    {
+        filter_reset(&filters[ch]);
+        filtered_n[ch] = 0;
+    }
+
+    found = hal_i2c_write(ADC_ADDRESS, fmt->config(channel, true));
+
+    if ( !found )
       return 0;
 
+    hal_timer_start(HAL_TIMER_ADC, fmt->poll_us / ADC_CHANNELS, adc_poll);
+
     return 1;
 }
 
+// resolution the converter is running at
+uint8_t adc_resolution(void)
+{
+    return fmt->bits;
+}
+
 
 // voltage-to-angle conversion
 // ---------------------------
@@ -151,138 +239,273 @@ int adc_setup(void)
 //    y = (90 * x - 7.2) / (vmax - 0.08)
 //
 // where vmax = 1.92 (for battery > 5.125), or vmax = 0.383*battery - 0.064.
+//
+// the math itself is in longitude_math.cpp, in double and fixed-point flavors.  the
+// battery voltage is the one longitude_battery.cpp keeps filtered, so there's no
+// internal ADC read here.
+//
+// a device with an angle calibration (see angle_cal_set()) skips the line: the
+// code is scaled up to what it would be at vmax = 1.92, by the same model, and
+// looked up in its table.  the table gives the true angle, so the zero offset
+// only has the mounting left to take up.
+
+// the nominal output range, in microvolts
+#define SENSOR_MIN_UV 80000
+#define SENSOR_MAX_UV 1920000
+
+// false, leaving the angle as it was, if the converter stops answering before
+// the filter has settled
+#if FIXED_POINT
+bool get_angle(void)
+{
+    int32_t uv;      // angle sensor output, microvolts
+    int32_t vmax_uv; // sensor's maximum output, microvolts
+
+    SPAN_BEGIN(SPAN_GET_ANGLE);
 
-void get_angle(void)
+    if ( !get_sensor_code(ANGLE_CHANNEL, &angle_code) )
+    {
+        SPAN_END(SPAN_GET_ANGLE);
+        return false;
+    }
+
+    vmax_uv    = sensor_max_uv( battery_mv() );
+    uv         = sensor_uv(angle_code);
+
+    // set the global 'angle_mdeg' var
+    if ( angle_cal.n )
+        angle_mdeg = angle_lut_mdeg( nominal_code(angle_code, vmax_uv) ) + angle_offset_mdeg;
+    else
+        angle_mdeg = calc_angle_mdeg( uv, vmax_uv ) + angle_offset_mdeg;
+
+    if ( angle_mdeg < 0 ) angle_mdeg = 0;
+
+    SPAN_END(SPAN_GET_ANGLE);
+    return true;
+}
+#else
+bool get_angle(void)
 {
     double voltage; // angle sensor output voltage
     double vbat;    // battery voltage
     double vmax;    // sensor's maximum output
 
-    vbat    = get_battery();
-    vmax    = sensor_max( vbat );
-    voltage = get_sensor_voltage();
+    SPAN_BEGIN(SPAN_GET_ANGLE);
+
+    if ( !get_sensor_code(ANGLE_CHANNEL, &angle_code) )
+    {
+        SPAN_END(SPAN_GET_ANGLE);
+        return false;
+    }
+
+    vbat       = battery_mv() / 1000.0; // filtered in the background (longitude_battery.cpp)
+    vmax       = sensor_max( vbat );
+    voltage    = sensor_voltage(angle_code);
 
     // set the global 'angle' var
-    angle = (90.0L * voltage - 7.2L) / (vmax - 0.08L);
+    if ( angle_cal.n )
+        angle = angle_lut_mdeg( nominal_code(angle_code, (int32_t)lround(vmax * 1e6)) ) / 1000.0;
+    else
+        angle = calc_angle( voltage, vmax );
     angle += angle_offset;
 
     if ( angle < 0 ) angle = 0.0;
-    
-    return;
+
+    angle_mdeg = (int32_t)lround( angle * 1000.0 );
+
+    SPAN_END(SPAN_GET_ANGLE);
+    return true;
 }
+#endif
 
 // the idea here is to give the user a way to zero the angle sensor for a more
 // precise measurement.  while in the laser-aiming state, pressing the mode button
-// calls this function, which takes an angle measurement and saves the offset for
-// future calculations
-void zero_angle(void)
+// starts this, which takes an angle measurement and saves the offset for future
+// calculations.  the offset sticks around, so it's worth a full-resolution
+// window, about a second at 18 bits: it runs as TASK_ZERO, and the state machine
+// gets EV_TASK when it's done, with angle_zeroed saying whether it took
+void zero_angle_start(void)
 {
-    angle_offset = 0.0; // zero the old offset before we calculate a new one
-    get_angle();
-    angle_offset = 0.0 - angle;
+    angle_zeroed = false;
+    zero_bits = adc_resolution();
+
+    adc_set_resolution(CAPTURE_RESOLUTION);
+
+    task_start(TASK_ZERO, zero_task, ZERO_TIMEOUT_MS);
 }
 
-// query the ADC for the angle sensor voltage
-static double get_sensor_voltage(void)
+// an angle sensor that stops answering keeps the old offset
+static uint8_t zero_task(struct task *t)
 {
-    int32_t sum = 0;
-    int32_t result;
-    uint16_t count;
+    double offset = angle_offset;
+    int32_t offset_mdeg = angle_offset_mdeg;
+
+    TASK_BEGIN(t);
+
+    TASK_WAIT_UNTIL(t, adc_settled() || adc_stalled());
 
-    for ( count = 0; count < WINDOW_SIZE; count++ )
+    // zero the old offset before we calculate a new one; the filter has
+    // settled, so get_angle() doesn't wait
+    angle_offset = 0.0;
+    angle_offset_mdeg = 0;
+
+    angle_zeroed = adc_settled() && get_angle();
+
+    if ( !angle_zeroed )
     {
-        startConversion();
-        sum += getData();
+        angle_offset = offset;
+        angle_offset_mdeg = offset_mdeg;
     }
-  
-#if WINDOW_SIZE > 1
-    // round the averaged result
-    result = (sum + (WINDOW_SIZE / 2)) / WINDOW_SIZE;
+    else
+    {
+#if FIXED_POINT
+        angle_offset_mdeg = 0 - angle_mdeg;
+        angle_offset = angle_offset_mdeg / 1000.0; // the config stores degrees
 #else
-    result = sum;
+        angle_offset = 0.0 - angle;
+        angle_offset_mdeg = (int32_t)lround( angle_offset * 1000.0 );
 #endif
+    }
+
+    adc_set_resolution(zero_bits);
 
-    return ((double)result * LSB);
+    TASK_END(t);
 }
 
-// getData() blocks while waiting for a conversion to finish, parses
-// the data bytes (see datasheet for the gory details), and returns the
-// resulting code
-static int32_t getData(void)
+// the angle filter has settled since the last resolution switch, so get_angle()
+// won't wait; for tasks, which mustn't
+bool adc_settled(void)
 {
-    uint8_t  sign1; // holds 8 sign-extended bits
-    uint16_t sign2; // holds 16 sign-extended bits
-    int32_t  data;  // stores the conversion code
-    
-    // wait for conversion to be finished
-    while ( conversionBusy() == true );
-
-    // only 18-bit data needs special handling
-    switch (RESOLUTION)
+    return filtered_n[ANGLE_CHANNEL] >= WINDOW_SIZE;
+}
+
+// the converter answered the last resolution switch (and the boot's probe)
+bool adc_found(void)
+{
+    return found;
+}
+
+// no sample for ADC_STALL_CONVERSIONS conversion times, so adc_settled() may
+// never come; what a task waiting on it gives up on
+bool adc_stalled(void)
+{
+    // poll_us is about half a conversion
+    return hal_millis() - sample_ms > ADC_STALL_CONVERSIONS * 2 * fmt->poll_us / 1000;
+}
+
+// the filtered angle code, scaled to the sensor's nominal maximum: what the
+// angle calibration records.  waits like get_angle() if the filter hasn't
+// settled, and fails like it
+bool get_angle_code(int32_t *code)
+{
+    int32_t raw;
+
+    if ( !get_sensor_code(ANGLE_CHANNEL, &raw) )
+        return false;
+
+    *code = nominal_code( raw, sensor_max_uv(battery_mv()) );
+    return true;
+}
+
+// latest filtered code of a channel.  right after a resolution switch (or at
+// boot) this waits for WINDOW_SIZE samples so the filter has settled; false if
+// the converter stalls first
+static bool get_sensor_code(uint8_t ch, int32_t *code)
+{
+    while ( filtered_n[ch] < WINDOW_SIZE )
     {
-      case 18:
-        sign1 = buff[0] & 0x80 ? 0xFF : 0;
-        data = (sign1 << 24) + (buff[0] << 16) + (buff[1] << 8) + buff[2];
-        break;
-    
-      default:
-        sign2 = buff[0] & 0x80 ? 0xFFFF : 0;
-        data = (sign2 << 16) + (buff[0] << 8) + buff[1];
-        break;
+        if ( adc_stalled() )
+            return false;
+
+        event_idle(); // each sample arrives by I2C interrupt
     }
 
-    return data;
+    *code = filtered[ch];
+    return true;
 }
 
-// conversionBusy() reads from the ADC and checks the /RDY flag
-static bool conversionBusy(void)
+// a code read with the sensor's maximum at vmax_uv to the code it would read at
+// the nominal maximum; the 0 degree output stays put
+static int32_t nominal_code(int32_t code, int32_t vmax_uv)
 {
-    uint8_t i = 0;
-    bool conversion_busy;
+    const int32_t lo = (int32_t)(SENSOR_MIN_UV * 1000000LL / LSB_PV);
+    const int32_t hi = (int32_t)(SENSOR_MAX_UV * 1000000LL / LSB_PV);
+    int32_t top = (int32_t)(vmax_uv * 1000000LL / LSB_PV);
 
-    Wire.requestFrom(ADC_ADDRESS, PACKET_SIZE);
+    if ( vmax_uv >= SENSOR_MAX_UV )
+        return code;
 
-    while( Wire.available() )
-        buff[i++] = Wire.readByte();
-
-    // the /RDY flag (7th bit in config) is low when conversion done
-    conversion_busy = buff[PACKET_SIZE - 1] >> 7;
+    return lo + (int32_t)((int64_t)(code - lo) * (hi - lo) / (top - lo));
+}
 
-    return conversion_busy;
+#if FIXED_POINT
+// a code in microvolts
+static int32_t sensor_uv(int32_t code)
+{
+    return (int32_t)(((int64_t)code * LSB_PV) / 1000000);
 }
+#else
+static double sensor_voltage(int32_t code)
+{
+    return ((double)code * LSB);
+}
+#endif
 
-// a single-shot conversion is triggered by writing a 1 to the /RDY bit in the config
-static void startConversion(void)
+// timer interrupt: ask the ADC for its latest result, unless the previous
+// transfer is still on the bus.  with several channels, a channel switch is
+// written to the ADC first, in place of a read.
+static void adc_poll(void)
 {
-    Wire.beginTransmission(ADC_ADDRESS);
-    Wire.write(adcConfig |= 128);
-    Wire.endTransmission(I2C_STOP);
+    if ( !hal_i2c_done() )
+        return;
 
-    if (Wire.getError())
-        Serial.print("WRITE FAIL in startConversion()\n");
+    if ( channel_pending )
+    {
+        channel_pending = false;
+        hal_i2c_write_async(ADC_ADDRESS, fmt->config(channel, true));
+        return;
+    }
+
+    hal_i2c_request(ADC_ADDRESS, fmt->packet);
 }
 
-// the angle sensor's max voltage output scales with the battery voltage
-// once the battery falls below 5.125V.  this function returns the battery
-// voltage as calculated from the (internal) ADC count; we multiply by two
-// because the actual voltage is halved by a resistor divider before the adc
-// sees it:
-//    voltage = count * LSB * 2
-//            = count * (3.3/2^10) * 2
-//            = count * 0.0064453125
-static double get_battery(void)
+// I2C interrupt: the read requested by adc_poll() has completed
+static void adc_read_done(void)
 {
-    return ((double)analogRead(bat_pin) * 0.0064453125L);
+    uint8_t i = hal_i2c_read(buff, sizeof buff);
+    uint32_t n;
+
+    // fresh() checks /RDY, which is low only if this result hasn't been read yet,
+    // and that the result was converted at the resolution we're running at
+    if ( i < fmt->packet || !fmt->fresh(buff) )
+        return;
+
+    n = ring_count & (ADC_RING_SIZE - 1);
+    ring[n].code = fmt->decode18(buff);
+    ring[n].time = hal_millis();
+    sample_ms = ring[n].time;
+    ring[n].channel = channel;
+    ring[n].bits = fmt->bits;
+    ring_count = ring_count + 1;
+
+    filtered[channel] = filter_update(&filters[channel], ring[n].code);
+    filtered_n[channel] = filtered_n[channel] + 1;
+
+    // the angle is good to read once the window has filled at this resolution
+    if ( filtered_n[channel] == WINDOW_SIZE && channel == ANGLE_CHANNEL )
+        event_post( EV_ADC_READY, fmt->bits, hal_millis() );
+
+#if ADC_CHANNELS > 1
+    channel = (channel + 1) % ADC_CHANNELS;
+    channel_pending = true;
+#endif
 }
 
-// maximum sensor output is nominally 1.92V (after the voltage divider). however,
-// once battery voltage falls below 5.125V, sensor max becomes a linear function
-// of the battery voltage.  the function in the else clause is a linear interpolation
-// derived from measurements.
-static double sensor_max(double vbat)
+static const struct adc_format *find_format(uint8_t bits)
 {
-    if ( vbat > 5.125 )
-      return 1.92L;
-    else
-      return (0.383L * vbat - 0.064L);
+    for ( uint8_t i = 0; i < sizeof formats / sizeof formats[0]; i++ )
+        if ( formats[i].bits == bits )
+            return &formats[i];
+
+    return NULL;
 }
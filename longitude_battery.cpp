@@ -5,102 +5,141 @@
  * February 2017
  */
 #include "longitude.h"
-#include "Arduino.h"
 
 // we measure battery level using the internal Teensy ADC at 10-bit resolution (vref = 3.3V).
-// the nominal 6V battery voltage is dropped to 3V before the ADC pin, which corresponds to
-// an ADC count of 931.  the device will continue running down to VCC = 3.3V, below which the
-// display stops working. so 3.3V is our minimum battery voltage, corresponding to 512 ADC counts.
-#define BATTERY_MAX    (931)
-#define BATTERY_MIN    (512)
+// the nominal 6V battery voltage is dropped to 3V before the ADC pin.  the device will
+// continue running down to VCC = 3.3V, below which the display stops working.
+//
+// the battery is sampled on a timer and low-pass filtered; everyone else (the angle
+// sensor's max output, the icon, the host link) gets the filtered voltage from memory, so
+// nothing waits for the internal ADC.
+#define BATTERY_SAMPLE_MS    250
+#define BATTERY_FILTER_SHIFT 3    // a new sample weighs 1/8: a couple of seconds to settle
+#define BATTERY_AVERAGING    8    // hardware averaging per sample; the filter does the rest
+
+// the percentage is shown in steps of 5, and only moves to another step once the state of
+// charge is past the halfway point by the hysteresis (both in tenths of a percent), so a
+// battery sitting on a boundary doesn't flicker between two
+#define BATTERY_STEP         50
+#define BATTERY_HYSTERESIS   10
+
+// state of charge (tenths of a percent) against the voltage under load, for a pack of four
+// alkaline cells, highest voltage first.  alkalines sag steadily rather than holding a
+// plateau, but not linearly; 3.3V is empty, since the display gives out there
+static const struct { uint16_t mv, soc; } discharge[] =
+{
+  { 6200, 1000 },
+  { 5800,  900 },
+  { 5400,  750 },
+  { 5200,  650 },
+  { 5000,  550 },
+  { 4800,  450 },
+  { 4600,  350 },
+  { 4400,  250 },
+  { 4200,  170 },
+  { 4000,  100 },
+  { 3700,   40 },
+  { 3300,    0 },
+};
+
+// lowest shown percentage for each icon fill level above 0
+static const uint8_t icon_level[] = { 20, 35, 70, 90 };
 
 uint8_t voltage_percentage;
 
-static void get_bat_level(void)
+static uint32_t filter;               // filtered mV << BATTERY_FILTER_SHIFT (the timer's)
+static volatile uint16_t filtered_mv;
+static volatile uint8_t shown;        // percentage on the screen, a multiple of 5
+static volatile bool redraw;          // shown changed, and the screen doesn't know
+
+static uint16_t sample_mv(void);
+static uint16_t state_of_charge(uint16_t);
+static void battery_tick(void);
+
+void battery_setup(void)
+{
+  hal_analog_averaging(BATTERY_AVERAGING);
+
+  // start the filter at the first reading, rather than ramping up from zero
+  filtered_mv = sample_mv();
+  filter = (uint32_t)filtered_mv << BATTERY_FILTER_SHIFT;
+  shown = (state_of_charge(filtered_mv) + BATTERY_STEP / 2) / BATTERY_STEP * BATTERY_STEP / 10;
+
+  hal_timer_start( HAL_TIMER_BATTERY, BATTERY_SAMPLE_MS * 1000UL, battery_tick );
+}
+
+// filtered battery voltage in millivolts
+uint16_t battery_mv(void)
 {
-  uint16_t bat_read = analogRead(bat_pin); // analog pins are input by default, so no need to use pinMode
+  return filtered_mv;
+}
 
-  voltage_percentage = map(bat_read, BATTERY_MIN, BATTERY_MAX, 0, 100); // scale 0 to 100%
+// call from the main loop; the timer's event wakes it up when the level changes
+void battery_service(void)
+{
+  if ( !redraw || state == STATE_INIT ) // the splash screen draws it when it's done
+    return;
 
-  return;
+  redraw = false;
+  update_battery();
 }
 
+// hand the shown level to the battery widgets; they're only redrawn if it changed
 void update_bat_level(void)
 {
-  get_bat_level();
-  
-  // display battery icon and level on the upper right corner of the screen.
-  // the battery icon has less granularity than the % displayed, which has
-  // less granularity than the actual battery %.
-  if (voltage_percentage > 95)
-  {
-    voltage_percentage = 100;
-    show_bat_level_100();
-  }
-  else if (voltage_percentage <= 95 && voltage_percentage > 90)
-  {
-    voltage_percentage = 95;
-    show_bat_level_100();
-  }
-  else if (voltage_percentage <= 90 && voltage_percentage > 85)
-  {
-    voltage_percentage = 90;
-    show_bat_level_100();
-  }
-  else if (voltage_percentage <= 85 && voltage_percentage > 75)
-  {
-    voltage_percentage = 85;
-    show_bat_level_75();
-  }
-  else if (voltage_percentage <= 75 && voltage_percentage > 70)
-  {
-    voltage_percentage = 75;
-    show_bat_level_75();
-  }
-  else if (voltage_percentage <= 70 && voltage_percentage > 65)
-  {
-    voltage_percentage = 70;
-    show_bat_level_75();
-  }
-  else if (voltage_percentage <= 65 && voltage_percentage > 60)
-  {
-    voltage_percentage = 65;
-    show_bat_level_50();
-  }
-  else if (voltage_percentage <= 60 && voltage_percentage > 55)
-  {
-    voltage_percentage = 60;
-    show_bat_level_50();
-  }
-  else if (voltage_percentage <= 55 && voltage_percentage > 50)
-  {
-    voltage_percentage = 55;
-		show_bat_level_50();
-  }
-  else if (voltage_percentage <= 50 && voltage_percentage > 40)
-  {
-    voltage_percentage = 50;
-    show_bat_level_50();
-  }
-  else if (voltage_percentage <= 40 && voltage_percentage > 30)
-  {
-    voltage_percentage = 40;
-    show_bat_level_50();
-  }
-  else if (voltage_percentage <= 30 && voltage_percentage > 25)
-  {
-    voltage_percentage = 30;
-    show_bat_level_25();
-  }
-  else if (voltage_percentage <= 25 && voltage_percentage > 15)
-  {
-    voltage_percentage = 20;
-    show_bat_level_25();
-  }
-  else
+  uint8_t level = 0;
+
+  voltage_percentage = shown;
+
+  while ( level < sizeof icon_level && voltage_percentage >= icon_level[level] )
+    level++;
+
+  show_bat_level(level);
+}
+
+// battery voltage in millivolts: the divider halves it before the 10-bit ADC,
+// so it's count * (3300 / 1024) * 2 = count * 825 / 128, exactly
+static uint16_t sample_mv(void)
+{
+  return (hal_analog_read(bat_pin) * 825UL) / 128; // analog pins are input by default
+}
+
+// interpolated from the discharge table
+static uint16_t state_of_charge(uint16_t mv)
+{
+  uint8_t i;
+
+  if ( mv >= discharge[0].mv )
+    return discharge[0].soc;
+
+  for ( i = 1; i < sizeof discharge / sizeof discharge[0] - 1 && mv < discharge[i].mv; i++ )
+    ;
+
+  if ( mv <= discharge[i].mv )
+    return discharge[i].soc;
+
+  return discharge[i].soc + (uint32_t)(mv - discharge[i].mv) * (discharge[i - 1].soc - discharge[i].soc)
+                                      / (discharge[i - 1].mv - discharge[i].mv);
+}
+
+// timer interrupt: the only user of the internal ADC, so the read is safe here
+static void battery_tick(void)
+{
+  uint16_t soc;
+
+  filter += sample_mv() - (filter >> BATTERY_FILTER_SHIFT);
+  filtered_mv = filter >> BATTERY_FILTER_SHIFT;
+
+  soc = state_of_charge( filtered_mv );
+
+  if ( soc + BATTERY_STEP / 2 + BATTERY_HYSTERESIS >= shown * 10 && soc <= shown * 10 + BATTERY_STEP / 2 + BATTERY_HYSTERESIS )
+    return;
+
+  shown = (soc + BATTERY_STEP / 2) / BATTERY_STEP * BATTERY_STEP / 10;
+
+  if ( !redraw )
   {
-    voltage_percentage = 15;
-    show_bat_level_15();
+    redraw = true;
+    event_post( EV_TIMER, TIMER_BATTERY, hal_millis() );
   }
 }
-
@@ -5,7 +5,8 @@
  * February 2017
  */
 #include "longitude.h"
-#include "Arduino.h"
+
+#define DEBOUNCE_MS 20
 
 struct btn b_measure;                  
 struct btn b_mode;
@@ -13,44 +14,78 @@ struct btn b_mode;
 void ISR_measure(void);
 void ISR_mode(void);
 
+static void button_edge(struct btn *);
+static void debounce_tick(void);
+
 void button_setup(void)
 {
   // declare button pins
+  b_measure.id  = BTN_MEASURE;
   b_measure.pin = 5;
+  b_mode.id     = BTN_MODE;
   b_mode.pin    = 4;
 
-  // initialize buttons as inactive 
-  b_measure.state = INACTIVE;
-  b_mode.state    = INACTIVE;
-
-  // enable the internal pull-up resistors
-  pinMode(b_measure.pin, INPUT_PULLUP);
-  pinMode(b_mode.pin, INPUT_PULLUP);
-  
-  // interrupt on button press
-  attachInterrupt( b_measure.pin, ISR_measure, ACTIVE );
-  attachInterrupt( b_mode.pin, ISR_mode, ACTIVE );
+  // initialize buttons as released
+  b_measure.down    = false;
+  b_measure.changed = 0;
+  b_mode.down       = false;
+  b_mode.changed    = 0;
+
+  // enable the internal pull-up resistors, and interrupt on press and on release
+  hal_button_attach( b_measure.pin, ISR_measure );
+  hal_button_attach( b_mode.pin, ISR_mode );
 }
 
 void ISR_measure(void)
 {
-    static unsigned long lastIRQ = 0;
-    unsigned long currentIRQ = millis();
+    button_edge( &b_measure );
+}
+
+void ISR_mode(void)
+{
+    button_edge( &b_mode );
+}
+
+// post a down or up event when the button settles into a new position.  simple,
+// effective software debounce: edges within DEBOUNCE_MS of the last accepted one
+// are contact bounce and not taken.  but the last of them may be real (a click
+// shorter than the window, or the bounce ending on the other level), and no
+// edge will come after it, so the timer looks at the pin again once the window
+// is over.  the buttons are active-low.
+static void button_edge(struct btn *b)
+{
+    uint32_t now = hal_millis();
+    bool down = (hal_pin_read(b->pin) == ACTIVE);
+
+    if ( down == b->down )
+        return;
 
-    // simple, effective software debounce
-    if ( (currentIRQ - lastIRQ) > 20 )
-        b_measure.state = ACTIVE;
+    if ( (now - b->changed) <= DEBOUNCE_MS )
+    {
+        // (re)starting it pushes the look out past this edge
+        hal_timer_start( HAL_TIMER_BUTTONS, (DEBOUNCE_MS + 1) * 1000UL, debounce_tick );
+        return;
+    }
 
-    lastIRQ = currentIRQ;
+    b->down = down;
+    b->changed = now;
+
+    // a press that wakes the display does nothing else (longitude_power.cpp)
+    if ( power_activity() && down )
+        return;
+
+    event_post( down ? EV_BTN_DOWN : EV_BTN_UP, b->id, now );
 }
 
-void ISR_mode(void)
+// timer interrupt, once: take whatever level the buttons settled on.  a button
+// still inside its window starts the timer again.
+static void debounce_tick(void)
 {
-    static unsigned long lastIRQ = 0;
-    unsigned long currentIRQ = millis();
+    uint32_t irq = hal_irq_save(); // the pin interrupts run button_edge() too
 
-    if ( (currentIRQ - lastIRQ) > 20 )
-        b_mode.state = ACTIVE;
+    hal_timer_stop( HAL_TIMER_BUTTONS );
+    button_edge( &b_measure );
+    button_edge( &b_mode );
 
-    lastIRQ = currentIRQ;
+    hal_irq_restore( irq );
 }
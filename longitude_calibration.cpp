@@ -0,0 +1,180 @@
+/*
+ * Longitude calibration mode
+ *
+ * The user measures a set of reference lengths (a tape, gauge blocks, marks on
+ * a wall) one after another.  each reference is taken as a burst with the
+ * compensation switched off, and the computed lengths are fit into a new
+ * compensation table (see cal_fit() in longitude_math.cpp), which goes to the
+ * EEPROM.  references can be skipped; the mode ends after the last one, or
+ * earlier on request.
+ *
+ * the angle sensor is calibrated on the bench, from the host (LINK_ANGLE_CAL):
+ * the device sits in a fixture that's set to known angles in turn, and at each
+ * the sensor's code is recorded at full resolution.  the points become the
+ * device's linearisation table (see angle_cal_set() in longitude_math.cpp).
+ */
+#include "longitude.h"
+
+// the references asked for, in millimeters, in order
+static const uint16_t cal_refs_mm[] = { 100, 200, 300, 500, 1000, 2000 };
+
+#define CAL_REFS (sizeof cal_refs_mm / sizeof cal_refs_mm[0])
+
+static_assert(CAL_REFS <= CAL_POINTS_MAX, "one knot per reference");
+
+uint8_t cal_step;      // index of the reference being asked for
+uint8_t cal_taken;     // references measured so far
+uint32_t cal_last_um;  // computed length of the last reference
+
+static uint32_t raw_um[CAL_REFS];
+static uint32_t ref_um[CAL_REFS];
+static struct cal_table saved; // put back if the calibration doesn't pan out
+
+// compensation off until we're done
+void calibration_start(void)
+{
+    saved = length_cal;
+    length_cal.n = 0;
+
+    cal_step = 0;
+    cal_taken = 0;
+    cal_last_um = 0;
+}
+
+// the reference to measure next, in micrometers; 0 once they've all been offered
+uint32_t calibration_reference_um(void)
+{
+    return cal_step < CAL_REFS ? cal_refs_mm[cal_step] * 1000UL : 0;
+}
+
+// record measured_length_um (uncompensated, from a burst) as the current
+// reference; returns true when there are no more to ask for
+bool calibration_take(void)
+{
+    raw_um[cal_taken] = measured_length_um;
+    ref_um[cal_taken] = calibration_reference_um();
+    cal_last_um = measured_length_um;
+    cal_taken++;
+
+    return ++cal_step >= CAL_REFS;
+}
+
+bool calibration_skip(void)
+{
+    return ++cal_step >= CAL_REFS;
+}
+
+// fit and store the new table; returns false, with the old table back in place,
+// if nothing was measured or the measurements don't make a usable table
+bool calibration_finish(void)
+{
+    struct cal_table fit;
+
+    if ( cal_taken && cal_fit(&fit, raw_um, ref_um, cal_taken) )
+    {
+        length_cal = fit;
+        config_changed( CONFIG_CAL );
+        config_flush(); // worth keeping right away
+        return true;
+    }
+
+    length_cal = saved;
+    return false;
+}
+
+// [angle calibration]
+
+static struct angle_cal angle_points;
+static uint8_t angle_bits;    // resolution to go back to
+static bool angle_running;
+static bool angle_armed;      // a filter window for the next point has been started
+
+void angle_calibration_start(void)
+{
+    if ( !angle_running )
+        angle_bits = adc_resolution();
+
+    angle_points.n = 0;
+    angle_running = true;
+    angle_armed = false;
+}
+
+bool angle_calibration_running(void)
+{
+    return angle_running;
+}
+
+// the first call for a point starts a fresh filter window at full resolution,
+// so nothing read while the fixture was moving gets in; true once it's full
+bool angle_calibration_ready(void)
+{
+    if ( !angle_armed || adc_resolution() != CAPTURE_RESOLUTION )
+    {
+        adc_set_resolution(CAPTURE_RESOLUTION);
+        angle_armed = true;
+    }
+
+    return adc_settled();
+}
+
+// record the sensor's code as the given angle, once angle_calibration_ready();
+// the angles have to come in increasing order.  returns false, recording
+// nothing, if the point doesn't fit after the last one
+bool angle_calibration_take(int32_t mdeg)
+{
+    uint8_t n = angle_points.n;
+    int32_t code;
+
+    if ( !angle_running || n >= ANGLE_CAL_POINTS_MAX )
+        return false;
+
+    angle_armed = false;
+
+    if ( !get_angle_code(&code) )
+        return false;
+
+    if ( n > 0 && (code <= angle_points.code[n - 1] || mdeg <= angle_points.mdeg[n - 1]) )
+        return false;
+
+    angle_points.code[n] = code;
+    angle_points.mdeg[n] = mdeg;
+    angle_points.n++;
+
+    return true;
+}
+
+// put the points in use and store them.  the zero offset was taken against the
+// old curve, so it goes.  returns false, with the old table still in place, if
+// there aren't enough points for a table
+bool angle_calibration_finish(void)
+{
+    bool ok = angle_running && angle_points.n >= 2 && angle_cal_set(&angle_points);
+
+    if ( ok )
+    {
+        angle_offset = 0.0;
+        angle_offset_mdeg = 0;
+
+        config_changed( CONFIG_ANGLE_CAL );
+        config_changed( CONFIG_ANGLE_OFFSET );
+        config_flush(); // worth keeping right away
+    }
+
+    if ( angle_running )
+        adc_set_resolution(angle_bits);
+
+    angle_running = false;
+
+    return ok;
+}
+
+// back to the nominal straight line
+void angle_calibration_clear(void)
+{
+    struct angle_cal none = {};
+
+    angle_cal_set(&none);
+
+    config_changed( CONFIG_ANGLE_CAL );
+    config_flush();
+}
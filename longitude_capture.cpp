@@ -0,0 +1,164 @@
+/*
+ * Longitude burst capture
+ *
+ * A measurement is a burst of paired shots: both lasers measure, the angle is
+ * read, and the length is computed for that pair.  outliers are rejected (see
+ * burst_stats() in longitude_math.cpp) and the burst stops as soon as the mean
+ * is known well enough, so a steady target costs four shots and a noisy one up
+ * to CAPTURE_SHOTS_MAX.  a burst without a single good shot has
+ * no length: it leaves measure_faults saying which lasers failed.  so does a
+ * laser that doesn't answer at all, at once: it isn't asked again every shot.
+ */
+#include "longitude.h"
+
+// shots per burst; CAPTURE_SHOTS_MAX 1 gives the old single-shot measurement
+#define CAPTURE_SHOTS_MIN 3
+#define CAPTURE_SHOTS_MAX 10
+
+// stop once the mean is known to this standard error, 0 to always take every
+// shot.  it's judged by the 95% interval, which has to be within the 1.96 SE
+// it would be with the spread known: with few shots, Student's t makes that
+// harder, so three that happen to agree don't end a burst on their own
+#define CAPTURE_SE_TARGET_UM 300
+
+// the backstop for a burst that never ends: a laser that times out ends it at
+// once, so this is CAPTURE_SHOTS_MAX shots that each end in a module's error
+// report, "about 5 seconds" (longitude_lasers.cpp); it keeps the shots it has
+#define CAPTURE_TIMEOUT_MS 75000UL
+
+static_assert(CAPTURE_SHOTS_MAX <= BURST_MAX, "burst_stats() takes at most BURST_MAX samples");
+
+uint32_t capture_se_target_um = CAPTURE_SE_TARGET_UM;
+uint8_t capture_shots;   // shots the last burst took (0: not a burst measurement)
+uint32_t measured_ci_um; // 95% confidence half-width of measured_length_um
+uint32_t capture_us;     // how long the last burst took
+
+// the burst in progress (a task's locals don't last)
+static uint32_t samples[CAPTURE_SHOTS_MAX];
+static uint8_t n;
+static uint8_t failed; // MEASURE_FAULT bits of the lasers that missed a shot
+static uint8_t silent; // and of those that stopped answering, which ends the burst
+static uint32_t start;
+#if PROFILE
+static uint32_t burst_cycles, shot_cycles;
+#endif
+
+static uint8_t capture_task(struct task *);
+static void capture_finish(void);
+
+// start a burst; it runs as TASK_CAPTURE and leaves its mean in
+// measured_length_um, or measure_faults set.  the state machine gets EV_TASK
+// when it's done
+void capture_start(void)
+{
+    capture_shots = 0;
+    measured_ci_um = 0;
+    measure_faults = 0;
+    n = 0;
+    failed = 0;
+    silent = 0;
+    start = hal_micros();
+
+    SPAN_MARK(burst_cycles);
+
+    task_start( TASK_CAPTURE, capture_task, CAPTURE_TIMEOUT_MS );
+}
+
+static uint8_t capture_task(struct task *t)
+{
+    struct burst_stats st;
+
+    TASK_BEGIN(t);
+
+    while ( capture_shots < CAPTURE_SHOTS_MAX )
+    {
+        // both lasers at once; the angle samples keep coming in the background
+        SPAN_MARK(shot_cycles);
+        laser_start( &laser_left, LASER_CMD_MEASURE );
+        laser_start( &laser_right, LASER_CMD_MEASURE );
+
+        TASK_WAIT_UNTIL(t, laser_all_done( &laser_left, &laser_right ));
+
+        if ( task_expired(t) ) // keep what we have
+            break;
+
+        SPAN_SINCE(SPAN_LASER_SHOT, shot_cycles);
+
+        capture_shots++;
+
+        // no answer at all: unplugged or dead, and the next shot would only wait
+        // out the same timeout
+        if ( laser_left.result == LASER_TIMEOUT )
+            silent |= FAULT_LEFT;
+        if ( laser_right.result == LASER_TIMEOUT )
+            silent |= FAULT_RIGHT;
+
+        if ( silent )
+            break;
+
+        // a shot with a laser error doesn't count toward the statistics
+        if ( laser_failed(&laser_left) )
+            failed |= FAULT_LEFT;
+        if ( laser_failed(&laser_right) )
+            failed |= FAULT_RIGHT;
+
+        if ( laser_failed(&laser_left) || laser_failed(&laser_right) )
+            continue;
+
+        // the first shot can beat the angle filter's first full window
+        TASK_WAIT_UNTIL(t, adc_settled() || adc_stalled());
+
+        if ( !get_angle() ) // the angle sensor has stopped answering
+        {
+            silent |= FAULT_ANGLE;
+            break;
+        }
+
+        compute_length();
+        samples[n++] = measured_length_um;
+
+        if ( n < CAPTURE_SHOTS_MIN )
+            continue;
+
+        burst_stats( samples, n, &st );
+
+        if ( (uint64_t)st.ci_um * 1000 < (uint64_t)capture_se_target_um * 1960 )
+            break;
+    }
+
+    capture_finish();
+
+    TASK_END(t);
+}
+
+static void capture_finish(void)
+{
+    struct burst_stats st;
+
+    capture_us = hal_micros() - start;
+
+    // a laser or the angle sensor gone quiet, whatever came before it: report it
+    if ( silent )
+    {
+        measure_faults = silent;
+        return;
+    }
+
+    // nothing but errors: no length, just which lasers let us down (both, if
+    // the burst ran out of time before either answered)
+    if ( n == 0 )
+    {
+        measure_faults = failed ? failed : FAULT_LEFT | FAULT_RIGHT;
+        return;
+    }
+
+    burst_stats( samples, n, &st );
+
+    measured_length_um = st.mean_um;
+    measured_ci_um = st.ci_um;
+#if !FIXED_POINT
+    measured_length = st.mean_um / 1000000.0;
+#endif
+
+    SPAN_SINCE(SPAN_CAPTURE, burst_cycles);
+}
@@ -1,91 +1,403 @@
 /*
  * Longitude EEPROM configuration stuff
- * 
+ *
+ * The settings are kept as a log of typed key/value records.  a change appends
+ * a record for that key, with a sequence number and a CRC, and at boot the
+ * newest valid record of each key wins.  the log has two halves: when the
+ * active one fills up, the current value of every key is copied to the start
+ * of the other and appending carries on there.  writes go round the whole log
+ * instead of landing on the same few cells, and a write cut short by a power
+ * loss fails its CRC, which leaves the previous record in charge.
+ *
+ * changes are coalesced: config_changed() only marks the key, and its record
+ * goes out once the settings have been left alone for CONFIG_COALESCE_MS, so
+ * clicking through the units costs one record rather than one per click.
+ *
  * Javier Lombillo
  * March 2017
  */
-#include <EEPROM.h>
 #include <string.h>
-#include "Arduino.h"
+#include <math.h>
+#if defined(ARDUINO)
+#include "Arduino.h" // Serial, for print_config()
+#endif
 #include "longitude.h"
+#include "longitude_crc.h"
 
-#define CONFIG_ADDR_START 0 // base EEPROM address of configuration data
+#define CONFIG_ADDR_START 0    // base EEPROM address of the log
+#define CONFIG_LOG_SIZE   1024 // both halves
+#define CONFIG_HALF       (CONFIG_LOG_SIZE / 2)
 
-// magic bytes to signify a valid Longitude configuration
-static const uint16_t CONFIG_SIGNATURE = 0xBEEF;
+// quiet time before changed settings are written
+#define CONFIG_COALESCE_MS 3000
 
-// addresses of the configuration variables
-static const uint16_t CONFIG_ADDR_ANGLE_OFFSET = CONFIG_ADDR_START        + sizeof CONFIG_SIGNATURE;
-static const uint16_t CONFIG_ADDR_UNIT         = CONFIG_ADDR_ANGLE_OFFSET + sizeof angle_offset;
+// records: header, value, CRC-16 of the two
+#define RECORD_MARK      0xC5
+#define CONFIG_SCHEMA    1  // bump when a key's encoding changes; records of other schemas are skipped
+#define RECORD_VALUE_MAX 80
 
-static void store_double_eeprom(uint32_t, double);
-static double load_double_eeprom(uint32_t);
+struct record_header
+{
+  uint8_t mark;    // RECORD_MARK
+  uint8_t schema;  // CONFIG_SCHEMA when written
+  uint8_t key;     // CONFIG_KEY
+  uint8_t len;     // value bytes
+  uint32_t seq;    // increases with every record, across both halves
+};
+
+#define RECORD_SIZE(len) (sizeof(struct record_header) + (len) + sizeof(uint16_t))
+
+// one record of each key has to fit in half a half, or compaction could thrash
+static_assert(sizeof(struct cal_table) <= RECORD_VALUE_MAX, "compensation table fits a record");
+static_assert(sizeof(struct angle_cal) <= RECORD_VALUE_MAX, "angle calibration fits a record");
+static_assert(RECORD_SIZE(sizeof(double)) + RECORD_SIZE(1) + RECORD_SIZE(sizeof(struct cal_table))
+              + RECORD_SIZE(sizeof(struct angle_cal)) <= CONFIG_HALF / 2, "live settings fit a log half");
+
+// the layout before the log: a signature and fixed addresses
+static const uint16_t LEGACY_SIGNATURE     = 0xBEEF;
+static const uint16_t LEGACY_CAL_SIGNATURE = 0xCA1B;
+static const uint16_t LEGACY_ADDR_ANGLE    = 2;
+static const uint16_t LEGACY_ADDR_UNIT     = 10;
+static const uint16_t LEGACY_ADDR_CAL_SIG  = 12;
+static const uint16_t LEGACY_ADDR_CAL      = 14;
+
+// newest record of a key found by a scan
+struct newest
+{
+  bool found;
+  uint8_t half;
+  uint16_t pos;
+  uint32_t seq;
+};
 
-// download default configuration from EEPROM
+static uint8_t active;          // half being appended to
+static uint16_t head;           // next free byte in it
+static uint32_t next_seq = 1;
+static uint8_t dirty;           // bit per key: changed since its last record
+static volatile bool flush_due; // the coalescing timer ran out
+
+static uint16_t scan_half(uint8_t, struct newest *, uint32_t *);
+static void append(uint8_t);
+static void write_record(uint8_t);
+static void compact(void);
+static uint8_t encode(uint8_t, uint8_t *);
+static bool decode(uint8_t, const uint8_t *, uint8_t);
+static bool load_legacy(void);
+static void coalesce_tick(void);
+
+// find the newest record of every key, and pick up where the log left off
 void load_config(void)
 {
-  // first check if a config actually exists by looking for
-  // the CONFIG_SIGNATURE; if it doesn't exist, store the
-  // default config
-  if ( eeprom_read_word(CONFIG_ADDR_START) != CONFIG_SIGNATURE )
+  struct newest newest[CONFIG_KEYS];
+  struct record_header hdr;
+  uint8_t value[RECORD_VALUE_MAX];
+  uint32_t max_seq[2] = { 0, 0 };
+  uint16_t heads[2];
+  uint8_t key;
+
+  memset( newest, 0, sizeof newest );
+
+  heads[0] = scan_half( 0, newest, &max_seq[0] );
+  heads[1] = scan_half( 1, newest, &max_seq[1] );
+
+  dirty = 0;
+  flush_due = false;
+
+  if ( max_seq[0] == 0 && max_seq[1] == 0 )
   {
-    eeprom_write_word( CONFIG_ADDR_START, CONFIG_SIGNATURE );
-    store_double_eeprom( CONFIG_ADDR_ANGLE_OFFSET, angle_offset );
-    eeprom_write_word( (uint16_t *)CONFIG_ADDR_UNIT, unit );
+    // no log yet: take over the old layout, if there is one, or store the
+    // defaults.  the records go to the second half, so the old layout stays
+    // readable until they're all down.
+    load_legacy();
+
+    active = 1;
+    head = 0;
+    next_seq = 1;
+    dirty = (1 << CONFIG_KEYS) - 1;
   }
   else
   {
-    angle_offset = load_double_eeprom( CONFIG_ADDR_ANGLE_OFFSET );
-    unit = (UNITS)eeprom_read_word( (uint16_t *)CONFIG_ADDR_UNIT );
+    active = max_seq[1] > max_seq[0];
+    head = heads[active];
+    next_seq = (max_seq[0] > max_seq[1] ? max_seq[0] : max_seq[1]) + 1;
+
+    for ( key = 0; key < CONFIG_KEYS; key++ )
+    {
+      if ( newest[key].found )
+      {
+        hal_eeprom_read( CONFIG_ADDR_START + newest[key].half * CONFIG_HALF + newest[key].pos, &hdr, sizeof hdr );
+        hal_eeprom_read( CONFIG_ADDR_START + newest[key].half * CONFIG_HALF + newest[key].pos + sizeof hdr, value, hdr.len );
+      }
+
+      // a key that's missing or unusable gets its default written; one whose
+      // newest record is in the other half (a compaction was cut short) is
+      // copied over, so that half can be reused
+      if ( !newest[key].found || !decode(key, value, hdr.len) || newest[key].half != active )
+        dirty |= 1 << key;
+    }
   }
+
+  if ( dirty )
+    config_flush();
 }
 
-// write the specified config value to EEPROM
-void save_config(const char *var)
+// a setting's RAM variable changed; its record is written after a quiet spell
+void config_changed(uint8_t key)
 {
-  if ( !strcmp(var, "angle") )
-  {
-    store_double_eeprom( CONFIG_ADDR_ANGLE_OFFSET, angle_offset );
-  }
-  else if ( !strcmp(var, "unit") )
+  dirty |= 1 << key;
+  flush_due = false;
+
+  // (re)starting the timer pushes the write out again
+  hal_timer_start( HAL_TIMER_CONFIG, CONFIG_COALESCE_MS * 1000UL, coalesce_tick );
+}
+
+// call from the main loop; the timer's event wakes it up when a write is due
+void config_service(void)
+{
+  if ( flush_due )
+    config_flush();
+}
+
+// write whatever is pending now
+void config_flush(void)
+{
+  SPAN_BEGIN(SPAN_CONFIG);
+
+  hal_timer_stop( HAL_TIMER_CONFIG );
+  flush_due = false;
+
+  for ( uint8_t key = 0; key < CONFIG_KEYS; key++ )
   {
-    eeprom_write_word( (uint16_t *)CONFIG_ADDR_UNIT, unit );
+    if ( dirty & (1 << key) )
+    {
+      dirty &= ~(1 << key);
+      append( key );
+    }
   }
+
+  SPAN_END(SPAN_CONFIG);
 }
 
-// print the config for debugging purposes
+// print the config for debugging purposes (on the board only)
 void print_config(void)
 {
-  uint16_t sig = 0, u = 0;
-  double a = 0.0;
+#if defined(ARDUINO)
   const char *units[] = { "meters", "feet", "inches" };
 
-  sig = eeprom_read_word( CONFIG_ADDR_START );
-  a = load_double_eeprom( CONFIG_ADDR_ANGLE_OFFSET );
-  u = eeprom_read_word( (uint16_t *)CONFIG_ADDR_UNIT );
-  
-  Serial.printf( "Config [%X]: angle offset: %0.4f, sensor floor: %0.4fV units: %s\n", sig, a, units[u] );
+  Serial.printf( "Config: angle offset: %0.4f, units: %s\n", angle_offset, units[unit] );
+
+  for ( uint8_t i = 0; i < length_cal.n; i++ )
+    Serial.printf( "Compensation: at %lu um add %ld um\n", length_cal.raw_um[i], length_cal.corr_um[i] );
+
+  for ( uint8_t i = 0; i < angle_cal.n; i++ )
+    Serial.printf( "Angle: code %ld is %ld mdeg\n", angle_cal.code[i], angle_cal.mdeg[i] );
+
+  Serial.printf( "Config log: half %u, %u of %u bytes used, next record %lu, pending %02X\n",
+                 active, head, CONFIG_HALF, next_seq, dirty );
+#endif
 }
 
-// calling this overwrites the magic bytes signature in the EEPROM, forcing a
-// default config on the next boot
+// calling this invalidates both halves of the log (and the old layout), forcing
+// a default config on the next boot
 void clear_config(void)
 {
-  eeprom_write_word( CONFIG_ADDR_START, 0 );
+  uint8_t zero = 0;
+
+  hal_eeprom_write( CONFIG_ADDR_START, &zero, 1 );
+  hal_eeprom_write( CONFIG_ADDR_START + CONFIG_HALF, &zero, 1 );
 }
 
-// store a double-precision (64-bit) value in the EEPROM
-static void store_double_eeprom(uint32_t addr, double val)
+// walk a half's records from the start; the first one that doesn't check out
+// ends the log.  returns where it ends, which is where the next record goes.
+static uint16_t scan_half(uint8_t half, struct newest *newest, uint32_t *max_seq)
 {
-  eeprom_write_block( (const void *)&val, (void *)addr, (uint32_t)sizeof(val) );
+  struct record_header hdr;
+  uint8_t value[RECORD_VALUE_MAX + sizeof(uint16_t)];
+  uint32_t base = CONFIG_ADDR_START + half * CONFIG_HALF;
+  uint16_t pos = 0, crc;
+
+  while ( pos + RECORD_SIZE(0) <= CONFIG_HALF )
+  {
+    hal_eeprom_read( base + pos, &hdr, sizeof hdr );
+
+    if ( hdr.mark != RECORD_MARK || hdr.len > RECORD_VALUE_MAX || pos + RECORD_SIZE(hdr.len) > CONFIG_HALF )
+      break;
+
+    hal_eeprom_read( base + pos + sizeof hdr, value, hdr.len + sizeof crc );
+    memcpy( &crc, value + hdr.len, sizeof crc );
+
+    if ( crc != crc16(crc16(CRC16_INIT, &hdr, sizeof hdr), value, hdr.len) )
+      break;
+
+    if ( hdr.seq > *max_seq )
+      *max_seq = hdr.seq;
+
+    // keys from a newer firmware, or an old encoding, are stepped over
+    if ( hdr.schema == CONFIG_SCHEMA && hdr.key < CONFIG_KEYS
+         && (!newest[hdr.key].found || hdr.seq > newest[hdr.key].seq) )
+    {
+      newest[hdr.key].found = true;
+      newest[hdr.key].half = half;
+      newest[hdr.key].pos = pos;
+      newest[hdr.key].seq = hdr.seq;
+    }
+
+    pos += RECORD_SIZE(hdr.len);
+  }
+
+  return pos;
+}
+
+// a record at the head of the log, moving to the other half if it's full
+static void append(uint8_t key)
+{
+  uint8_t value[RECORD_VALUE_MAX];
+
+  if ( head + RECORD_SIZE(encode(key, value)) > CONFIG_HALF )
+    compact(); // writes this key too
+  else
+    write_record( key );
 }
 
-// load a double-precision value from the EEPROM
-static double load_double_eeprom(uint32_t addr)
+static void write_record(uint8_t key)
 {
-  double x;
-  
-  eeprom_read_block( (void *)&x, (const void *)addr, (uint32_t)sizeof(x) );
+  uint8_t rec[RECORD_SIZE(RECORD_VALUE_MAX)];
+  struct record_header hdr;
+  uint16_t crc;
 
-  return x;
+  hdr.mark = RECORD_MARK;
+  hdr.schema = CONFIG_SCHEMA;
+  hdr.key = key;
+  hdr.len = encode( key, rec + sizeof hdr );
+  hdr.seq = next_seq++;
+
+  memcpy( rec, &hdr, sizeof hdr );
+  crc = crc16( CRC16_INIT, rec, sizeof hdr + hdr.len );
+  memcpy( rec + sizeof hdr + hdr.len, &crc, sizeof crc );
+
+  // one write, CRC last: a partial record never checks out
+  hal_eeprom_write( CONFIG_ADDR_START + active * CONFIG_HALF + head, rec, RECORD_SIZE(hdr.len) );
+  head += RECORD_SIZE(hdr.len);
+}
+
+// every key's current value to the start of the other half.  the old half is
+// left as it is: until the copies are all down, its records are still the
+// newest of the keys not yet copied.
+static void compact(void)
+{
+  active ^= 1;
+  head = 0;
+
+  for ( uint8_t key = 0; key < CONFIG_KEYS; key++ )
+    write_record( key );
+
+  dirty = 0;
+}
+
+// RAM variable to record value; returns its length
+static uint8_t encode(uint8_t key, uint8_t *buf)
+{
+  switch ( key )
+  {
+    case CONFIG_ANGLE_OFFSET:
+      memcpy( buf, &angle_offset, sizeof angle_offset );
+      return sizeof angle_offset;
+
+    case CONFIG_UNIT:
+      buf[0] = (uint8_t)unit;
+      return 1;
+
+    case CONFIG_CAL:
+      memcpy( buf, &length_cal, sizeof length_cal );
+      return sizeof length_cal;
+
+    case CONFIG_ANGLE_CAL:
+      memcpy( buf, &angle_cal, sizeof angle_cal );
+      return sizeof angle_cal;
+  }
+
+  return 0;
+}
+
+// record value to RAM variable, if it's the right type and makes sense
+static bool decode(uint8_t key, const uint8_t *buf, uint8_t len)
+{
+  struct cal_table t;
+  struct angle_cal a;
+
+  switch ( key )
+  {
+    case CONFIG_ANGLE_OFFSET:
+      if ( len != sizeof angle_offset )
+        return false;
+
+      memcpy( &angle_offset, buf, len );
+      angle_offset_mdeg = (int32_t)lround( angle_offset * 1000.0 );
+      return true;
+
+    case CONFIG_UNIT:
+      if ( len != 1 || buf[0] > inch )
+        return false;
+
+      unit = (UNITS)buf[0];
+      return true;
+
+    case CONFIG_CAL:
+      if ( len != sizeof t )
+        return false;
+
+      memcpy( &t, buf, len );
+
+      if ( !cal_valid(&t) )
+        return false;
+
+      length_cal = t;
+      return true;
+
+    case CONFIG_ANGLE_CAL:
+      if ( len != sizeof a )
+        return false;
+
+      memcpy( &a, buf, len );
+
+      return angle_cal_set( &a ); // builds its table
+  }
+
+  return false;
+}
+
+// the pre-log layout: the signature, the angle offset (double), the unit (16
+// bits) and, behind a second signature, the compensation table
+static bool load_legacy(void)
+{
+  uint16_t sig, u;
+  struct cal_table t;
+
+  hal_eeprom_read( CONFIG_ADDR_START, &sig, sizeof sig );
+
+  if ( sig != LEGACY_SIGNATURE )
+    return false;
+
+  hal_eeprom_read( LEGACY_ADDR_ANGLE, &angle_offset, sizeof angle_offset );
+  angle_offset_mdeg = (int32_t)lround( angle_offset * 1000.0 );
+
+  hal_eeprom_read( LEGACY_ADDR_UNIT, &u, sizeof u );
+  if ( u <= inch )
+    unit = (UNITS)u;
+
+  hal_eeprom_read( LEGACY_ADDR_CAL_SIG, &sig, sizeof sig );
+  hal_eeprom_read( LEGACY_ADDR_CAL, &t, sizeof t );
+
+  if ( sig == LEGACY_CAL_SIGNATURE && cal_valid(&t) )
+    length_cal = t;
+
+  return true;
+}
+
+// interrupt context: no EEPROM work here, just wake the main loop
+static void coalesce_tick(void)
+{
+  hal_timer_stop( HAL_TIMER_CONFIG );
+  flush_due = true;
+  event_post( EV_TIMER, TIMER_CONFIG, hal_millis() );
 }
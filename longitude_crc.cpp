@@ -0,0 +1,50 @@
+/*
+ * Longitude checksums
+ */
+#include "longitude_crc.h"
+
+uint8_t crc8(uint8_t crc, const void *data, uint32_t n)
+{
+    const uint8_t *p = (const uint8_t *)data;
+
+    while ( n-- )
+    {
+        crc ^= *p++;
+
+        for ( uint8_t i = 0; i < 8; i++ )
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+
+    return crc;
+}
+
+uint16_t crc16(uint16_t crc, const void *data, uint32_t n)
+{
+    const uint8_t *p = (const uint8_t *)data;
+
+    while ( n-- )
+    {
+        crc ^= (uint16_t)*p++ << 8;
+
+        for ( uint8_t i = 0; i < 8; i++ )
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+
+    return crc;
+}
+
+// the same CRC as zlib's crc32(), which the host tools use to check it
+uint32_t crc32(uint32_t crc, const void *data, uint32_t n)
+{
+    const uint8_t *p = (const uint8_t *)data;
+
+    while ( n-- )
+    {
+        crc ^= *p++;
+
+        for ( uint8_t i = 0; i < 8; i++ )
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320UL : crc >> 1;
+    }
+
+    return crc;
+}
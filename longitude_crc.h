@@ -0,0 +1,22 @@
+/*
+ * Longitude checksums
+ *
+ * Bitwise CRCs for the EEPROM settings, the measurement history and the data
+ * sent to a host.  the blocks are small, or checked rarely, so no tables.
+ */
+#ifndef LONGITUDE_CRC_HEADER
+#define LONGITUDE_CRC_HEADER
+
+#include <stdint.h>
+
+// each takes the CRC so far, so a block can be checked in pieces; start with
+// the _INIT value
+#define CRC8_INIT  0x00
+#define CRC16_INIT 0xFFFF
+#define CRC32_INIT 0xFFFFFFFFUL
+
+uint8_t crc8(uint8_t, const void *, uint32_t);    // polynomial 0x07
+uint16_t crc16(uint16_t, const void *, uint32_t); // CCITT, polynomial 0x1021
+uint32_t crc32(uint32_t, const void *, uint32_t); // IEEE 802.3, reflected; finish with ~
+
+#endif
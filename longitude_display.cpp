@@ -5,6 +5,7 @@
  * March 2017
  */
 #include "longitude.h"
+#include "longitude_glyphs.h"
 #include <ILI9341_t3.h>
 #include <font_TimesNewRomanItalic.h>
 #include <font_Arial.h>
@@ -20,26 +21,176 @@
 
 ILI9341_t3 tft = ILI9341_t3(TFT_CS, TFT_DC, TFT_RST, TFT_MOSI, TFT_SCLK, TFT_MISO);
 
+// [retained widgets]
+//
+// everything on the normal screens is a widget from the table below.  the show_*
+// routines don't draw; they say which widgets they want and what the text fields
+// should read.  flush() then compares that with what's already on the glass and
+// only touches the pixels of widgets that appeared, disappeared or changed, so a
+// unit change rewrites a few numbers rather than all 320x240 pixels.
+//
+// a screen starts with begin_frame(), which drops every widget that isn't
+// re-requested; overlays (lasers on, rangefinder) just put their widgets on top
+// of the current screen.
+
+enum WIDGET_KIND { W_TEXT, W_BOX, W_HLINE, W_BATTERY };
+
+enum WIDGET_ID
+{
+    HEADER, HEADER_LINE,                                      // every screen
+    LAST_LABEL, LAST_BOX, LAST_VALUE, LAST_UNIT,              // idle screen
+    LASER_STATE, LASER_BOX,
+    HINT_1, HINT_2,                                           // instructions
+    LENGTH_LABEL, LENGTH_BOX, LENGTH_VALUE, LENGTH_UNIT,      // measure screen
+    LENGTH_CI, LENGTH_SHOTS,
+    ANGLE_LABEL, ANGLE_VALUE,
+    LASER1_LABEL, LASER1_VALUE, LASER2_LABEL, LASER2_VALUE,
+    CAL_TITLE, CAL_REF, CAL_LAST,                             // calibration screen
+    FAULT_TITLE, FAULT_1, FAULT_2,                            // failed measurement
+    BAT_ICON, BAT_PERCENT, BAT_SIGN,                          // battery (persistent)
+    WIDGET_COUNT
+};
+
+// how long the splash screen stays up at least; at 0 it's only up while the
+// boot is still going
+#define SPLASH_MS 0
+
+#define WIDGET_TEXT_MAX 36
+#define PERSIST 0x01 // survives begin_frame()
+
+struct widget
+{
+    uint8_t kind;
+    int16_t x, y, w, h;              // position; size of shapes
+    const ILI9341_t3_font_t *font;   // text only
+    uint16_t color;
+    const char *text;                // fixed text, for labels
+    uint8_t flags;
+};
+
+// in WIDGET_ID order
+static const struct widget widgets[WIDGET_COUNT] =
+{
+    { W_TEXT,    50,   4,   0,   0, &Arial_14,          ILI9341_RED,   "Divide by Zero Electronics", 0 }, // HEADER
+    { W_HLINE,    2,  20, 328,   1, NULL,               ILI9341_RED,   NULL, 0 }, // HEADER_LINE
+    { W_TEXT,    20,  50,   0,   0, &LiberationSans_16, ILI9341_WHITE, "Last Measurement:", 0 }, // LAST_LABEL
+    { W_BOX,     10,  40, 200,  65, NULL,               ILI9341_WHITE, NULL, 0 }, // LAST_BOX
+    { W_TEXT,    40,  70,   0,   0, &LiberationSans_28, ILI9341_WHITE, NULL, 0 }, // LAST_VALUE
+    { W_TEXT,   160,  80,   0,   0, &LiberationSans_16, ILI9341_WHITE, NULL, 0 }, // LAST_UNIT
+    { W_TEXT,    20, 130,   0,   0, &LiberationSans_18, ILI9341_WHITE, NULL, 0 }, // LASER_STATE
+    { W_BOX,     10, 122, 240,  30, NULL,               ILI9341_WHITE, NULL, 0 }, // LASER_BOX
+    { W_TEXT,    10, 190,   0,   0, &Arial_14,          ILI9341_WHITE, NULL, 0 }, // HINT_1
+    { W_TEXT,    10, 210,   0,   0, &Arial_14,          ILI9341_WHITE, NULL, 0 }, // HINT_2
+    { W_TEXT,    20,  50,   0,   0, &LiberationSans_28, ILI9341_WHITE, "Length:", 0 }, // LENGTH_LABEL
+    { W_BOX,     10,  30, 200, 110, NULL,               ILI9341_WHITE, NULL, 0 }, // LENGTH_BOX
+    { W_TEXT,    40,  90,   0,   0, &LiberationSans_28, ILI9341_WHITE, NULL, 0 }, // LENGTH_VALUE
+    { W_TEXT,   180, 100,   0,   0, &LiberationSans_20, ILI9341_WHITE, NULL, 0 }, // LENGTH_UNIT
+    { W_TEXT,   220,  95,   0,   0, &Arial_14,          ILI9341_WHITE, NULL, 0 }, // LENGTH_CI
+    { W_TEXT,   220, 115,   0,   0, &Arial_14,          ILI9341_WHITE, NULL, 0 }, // LENGTH_SHOTS
+    { W_TEXT,   100, 150,   0,   0, &Arial_14,          ILI9341_WHITE, "Angle: ", 0 }, // ANGLE_LABEL
+    { W_TEXT,   160, 150,   0,   0, &Arial_14,          ILI9341_WHITE, NULL, 0 }, // ANGLE_VALUE
+    { W_TEXT,    10, 180,   0,   0, &Arial_14,          ILI9341_WHITE, "Laser 1: ", 0 }, // LASER1_LABEL
+    { W_TEXT,    90, 180,   0,   0, &Arial_14,          ILI9341_WHITE, NULL, 0 }, // LASER1_VALUE
+    { W_TEXT,   170, 180,   0,   0, &Arial_14,          ILI9341_WHITE, "Laser 2: ", 0 }, // LASER2_LABEL
+    { W_TEXT,   245, 180,   0,   0, &Arial_14,          ILI9341_WHITE, NULL, 0 }, // LASER2_VALUE
+    { W_TEXT,    20,  40,   0,   0, &LiberationSans_20, ILI9341_WHITE, "Calibration", 0 }, // CAL_TITLE
+    { W_TEXT,    20,  80,   0,   0, &LiberationSans_16, ILI9341_WHITE, NULL, 0 }, // CAL_REF
+    { W_TEXT,    20, 120,   0,   0, &Arial_14,          ILI9341_WHITE, NULL, 0 }, // CAL_LAST
+    { W_TEXT,    20,  50,   0,   0, &LiberationSans_20, ILI9341_RED,   NULL, 0 }, // FAULT_TITLE
+    { W_TEXT,    20,  95,   0,   0, &LiberationSans_16, ILI9341_WHITE, NULL, 0 }, // FAULT_1
+    { W_TEXT,    20, 125,   0,   0, &LiberationSans_16, ILI9341_WHITE, NULL, 0 }, // FAULT_2
+    { W_BATTERY, 245, 40,  20,  30, NULL,               ILI9341_WHITE, NULL, PERSIST }, // BAT_ICON
+    { W_TEXT,   268,  50,   0,   0, &Arial_14,          ILI9341_WHITE, NULL, PERSIST }, // BAT_PERCENT
+    { W_TEXT,   300,  50,   0,   0, &Arial_14,          ILI9341_WHITE, "%", PERSIST }, // BAT_SIGN
+};
+
+// what each widget currently shows, and what it should show after the next flush()
+struct widget_state
+{
+    char text[WIDGET_TEXT_MAX];
+    int16_t value;   // battery level
+    int16_t drawn_w; // width of the text on the glass
+    bool want;       // requested for the current screen
+    bool drawn;      // on the glass right now
+    bool dirty;      // contents changed since it was drawn
+};
+
+static struct widget_state ws[WIDGET_COUNT];
+
+// set when something outside the widget table (the splash screen) owns pixels
+static bool foreign_pixels = false;
+static bool full_clear = false;
+
+static bool splash_skipped; // display_splash_skip()
+
+// battery icon fill levels, from empty-ish to full
+static const struct { int16_t y, h; uint16_t color; } bat_fill[] =
+{
+    { 65,  3, ILI9341_RED },
+    { 60,  8, ILI9341_YELLOW },
+    { 55, 13, ILI9341_GREEN },
+    { 50, 18, ILI9341_GREEN },
+    { 42, 26, ILI9341_GREEN },
+};
+
 static void show_splash_screen(void);
+static uint8_t splash_task(struct task *);
 static void show_idle_screen(void);
 static void show_laser_on_screen(void);
 static void show_measure_screen(void);
+static void show_tracking_screen(void);
+static void show_calibration_screen(void);
+static void show_fault_screen(void);
+static const char *laser_reading(const struct laser *);
+static const char *laser_trouble(enum LASER_FRAME);
+static void begin_frame(void);
+static void put(uint8_t);
+static void put_text(uint8_t, const char *);
+static void flush(void);
+static uint8_t widget_rects(uint8_t, int16_t [][4]);
+static bool widgets_touch(uint8_t, uint8_t);
+static void mark_touching(uint8_t);
+static void erase(uint8_t);
+static void draw(uint8_t);
+static const char *fixed(int32_t, uint8_t);
+static const char *format_fixed(uint32_t, uint8_t, bool);
+
+// what the numeric readouts use (see longitude_glyphs.cpp): lengths, the units
+// beside them, and the angle, laser, battery and burst ("+/- 0.3 mm", "n = 12")
+// readouts
+static constexpr struct glyph_set readout_glyphs[] =
+{
+    { &LiberationSans_28, "0123456789.-" },
+    { &LiberationSans_20, "mftin" },
+    { &LiberationSans_16, "mftin" },
+    { &Arial_14,          "0123456789.-%+/ =min" },
+};
+
+#define READOUT_GLYPH_SETS (sizeof readout_glyphs / sizeof readout_glyphs[0])
+
+static_assert( glyph_chars(readout_glyphs, READOUT_GLYPH_SETS) <= GLYPH_MAX,
+               "the glyph cache can't hold every readout character" );
 
 void display_setup(void)
 {
     // initiate Display
     tft.begin();
     tft.setRotation(3); //SPI connectors facing left
+
+    // unpack what the numeric readouts use
+    for ( uint8_t i = 0; i < READOUT_GLYPH_SETS; i++ )
+        glyph_cache(readout_glyphs[i].font, readout_glyphs[i].chars);
 }
 
 // what we show on the screen depends on our state
 void update_display(void)
 {
+    SPAN_BEGIN(SPAN_DISPLAY);
+
     switch(state)
     {
         case STATE_INIT:
-            show_splash_screen();
-            delay(3000); // let them bask in the splashscreen glory
+            show_splash_screen(); // display_splash() keeps it up
             update_bat_level();
             show_bat_percent();
             break;
@@ -57,6 +208,16 @@ void update_display(void)
         case STATE_MEASURE:
             show_measure_screen();
             break;
+
+        case STATE_TRACKING:
+        case TRACKING:
+            show_tracking_screen();
+            break;
+
+        case STATE_CALIBRATE:
+        case WAIT_CALIBRATE:
+            show_calibration_screen();
+            break;
             
         case WAIT_IDLE:
             show_measure_screen();
@@ -69,6 +230,10 @@ void update_display(void)
             update_bat_level();
             show_bat_percent();
     }
+
+    flush();
+
+    SPAN_END(SPAN_DISPLAY);
 }
 
 static void show_splash_screen(void)
@@ -103,6 +268,12 @@ static void show_splash_screen(void)
   tft.setTextColor( ILI9341_RED, ILI9341_BLACK );
   tft.setCursor( 150, 165 );
   tft.printf( "v%0.2f", VERSION );
+
+  // the splash isn't made of widgets: the glass no longer matches our records
+  for ( uint8_t i = 0; i < WIDGET_COUNT; i++ )
+    ws[i].drawn = false;
+
+  foreign_pixels = true;
   
   return;
 }
@@ -110,63 +281,41 @@ static void show_splash_screen(void)
 static void show_idle_screen(void)
 {
   // this screen should include the result of the last measurement, if any.
-  // (the variable 'measured_length', which stores the result, has scope here)
+  // (the variable 'measured_length_um', which stores the result, has scope here)
+  begin_frame();
+
+  put(HEADER);
+  put(HEADER_LINE);
 
-  //Display underlined time name atop the screen  
-  tft.setFont(Arial_14);
-  tft.fillScreen(ILI9341_BLACK);  
-  tft.setTextColor(ILI9341_RED, ILI9341_BLACK);
-  tft.setCursor(50,4);
-  tft.println("Divide by Zero Electronics");
-  tft.drawFastHLine(2,20,328,ILI9341_RED); //red underline
-  
   //show last measurement
-  tft.setTextColor(ILI9341_WHITE, ILI9341_BLACK);
-  tft.setFont(LiberationSans_16); 
-  tft.setCursor(20,50);
-  tft.println("Last Measurement:");
-  tft.drawRect(10,40,200,65,ILI9341_WHITE); // white rectangle
-  tft.setCursor(160,80);
-  tft.println( data[unit].id ); 
-  tft.setFont(LiberationSans_28); 
-  tft.setCursor(40,70); 
-  tft.println( data[unit].convert(measured_length) );
+  put(LAST_LABEL);
+  put(LAST_BOX);
+  put_text(LAST_UNIT, data[unit].id);
+  put_text(LAST_VALUE, fixed( data[unit].convert(measured_length_um), 2 ));
   
   //show laser state = OFF
-  tft.setFont(LiberationSans_18); 
-  tft.setCursor(20,130);
-  tft.println("Laser State:  OFF");
-  tft.drawRect(10,122,240,30,ILI9341_WHITE); //white rectangle
+  put_text(LASER_STATE, "Laser State:  OFF");
+  put(LASER_BOX);
   
   //show instructions;
-  tft.setFont(Arial_14);
-  tft.setCursor(10,190);
-  tft.println("Click once to turn lasers ON");
+  put_text(HINT_1, "Click once to turn lasers ON");
 
   //show mode change  
-  tft.setCursor(10,210);
-  tft.println("Press Mode for Range Finder");    
+  put_text(HINT_2, "Mode for Range Finder, hold: export");
   return;   
 }
 
 static void show_laser_on_screen(void)
 {
+  // overlay on the idle screen
   //show laser state = ON
-  tft.setFont(LiberationSans_18); 
-  tft.setCursor(20,130);
-  tft.fillRect(10,122,240,30,ILI9341_BLACK); //black block to clear pervious message
-  tft.println("Laser State:  ON ");
-  tft.drawRect(10,122,240,30,ILI9341_WHITE); // white rectangle  
+  put_text(LASER_STATE, "Laser State:  ON ");
   
   //show instructions;
-  tft.setFont(Arial_14);
-  tft.fillRect(10,180,310,100,ILI9341_BLACK); //black block to clear pervious message
-  tft.setCursor(10,190);
-  tft.println("Click once to take a measurement");
+  put_text(HINT_1, "Click to measure, hold to track");
   
   //show mode change  
-  tft.setCursor(10,210);
-  tft.println("Press Mode to zero laser");
+  put_text(HINT_2, "Mode to zero laser, hold: calibrate");
   return;
 }
 
@@ -175,97 +324,490 @@ static void show_measure_screen(void)
   // this screen should show the result of the last measurement and
   // put the processor to sleep for a second or so. after the
   // processor wakes up, it will be in STATE_IDLE.
-  // Display underlined time name atop the screen  
-  tft.setFont(Arial_14);
-  tft.fillScreen(ILI9341_BLACK);  
-  tft.setTextColor(ILI9341_RED, ILI9341_BLACK);
-  tft.setCursor(50,4);
-  tft.println("Divide by Zero Electronics");
-  tft.drawFastHLine(2,20,328,ILI9341_RED);
+  if ( measure_faults ) // there's no result; what went wrong instead
+  {
+    show_fault_screen();
+    return;
+  }
+
+  begin_frame();
+
+  put(HEADER);
+  put(HEADER_LINE);
 
   // display length calculation
-  tft.setTextColor(ILI9341_WHITE, ILI9341_BLACK);
-  tft.setFont(LiberationSans_28);
-  tft.setCursor(20,50);
-  tft.println("Length:");
-  tft.drawRect(10,30,200,110,ILI9341_WHITE);
-  tft.setCursor(40,90);
-  tft.printf( "%0.3f", data[unit].convert(measured_length) );
-  tft.setFont(LiberationSans_20);
-  tft.setCursor(180,100);
-  tft.println( data[unit].id );
+  put(LENGTH_LABEL);
+  put(LENGTH_BOX);
+  put_text(LENGTH_VALUE, fixed( data[unit].convert(measured_length_um), 3 ));
+  put_text(LENGTH_UNIT, data[unit].id);
+
+  // uncertainty of a burst measurement: 95% interval, in mm or inches
+  if ( capture_shots > 1 )
+  {
+    char line[WIDGET_TEXT_MAX];
+
+    strcpy(line, "+/- ");
+    if ( unit == meter )
+    {
+      strcat(line, fixed( measured_ci_um, 1 ));
+      strcat(line, " mm");
+    }
+    else
+    {
+      strcat(line, fixed( um_to_milli_inch(measured_ci_um), 3 ));
+      strcat(line, " in");
+    }
+    put_text(LENGTH_CI, line);
+
+    strcpy(line, "n = ");
+    strcat(line, format_fixed( capture_shots, 0, false ));
+    put_text(LENGTH_SHOTS, line);
+  }
 
   // Display individual lasers and angle
-  tft.setFont(Arial_14);
-  tft.setCursor(100,150);
-  tft.println("Angle: ");
-  tft.setCursor(160,150);
-  tft.print(angle);
-  tft.setCursor(10,180);
-  tft.println("Laser 1: ");
-  tft.setCursor(90,180);
-  tft.print( data[unit].convert(laser_left.last_measurement), 3 );
-  tft.setCursor(170,180);
-  tft.println("Laser 2: ");
-  tft.setCursor(245,180);
-  tft.print( data[unit].convert(laser_right.last_measurement), 3 );
+  put(ANGLE_LABEL);
+  put_text(ANGLE_VALUE, fixed( angle_mdeg, 2 ));
+  put(LASER1_LABEL);
+  put_text(LASER1_VALUE, laser_reading(&laser_left));
+  put(LASER2_LABEL);
+  put_text(LASER2_VALUE, laser_reading(&laser_right));
 
    //show mode change  
-  tft.setFont(Arial_14);
-  tft.setCursor(10,210);
-  tft.println("Press Mode to change units");
+  put_text(HINT_2, "Press Mode to change units");
   
   return;
 }
+
+// the measure screen, refreshed live, with how fast it's keeping up.  the figures
+// are for the previous update: this one's latency isn't known until it's drawn.
+static void show_tracking_screen(void)
+{
+  char line[WIDGET_TEXT_MAX];
+
+  show_measure_screen();
+
+  strcpy(line, fixed( tracking_rate_milli, 1 ));
+  strcat(line, "/s, ");
+  strcat(line, format_fixed( tracking_latency_us / 1000, 0, false ));
+  strcat(line, " ms - click to hold");
+
+  put_text(HINT_2, line);
+}
+
+// which reference to measure next, and what the last one came out as (in mm:
+// the references are metric, whatever the display unit)
+static void show_calibration_screen(void)
+{
+  char line[WIDGET_TEXT_MAX];
+
+  begin_frame();
+
+  put(HEADER);
+  put(HEADER_LINE);
+  put(CAL_TITLE);
+
+  strcpy(line, "Measure ");
+  strcat(line, format_fixed( calibration_reference_um() / 1000, 0, false ));
+  strcat(line, " mm reference");
+  put_text(CAL_REF, line);
+
+  if ( cal_taken )
+  {
+    strcpy(line, "Last: ");
+    strcat(line, fixed( cal_last_um, 1 ));
+    strcat(line, " mm, ");
+    strcat(line, format_fixed( cal_taken, 0, false ));
+    strcat(line, " taken");
+    put_text(CAL_LAST, line);
+  }
+
+  put_text(HINT_1, "Click to measure the reference");
+  put_text(HINT_2, "Mode skips it, hold Mode to finish");
+}
+
+// a measurement that came to nothing (measure_faults): which part failed, and how
+static void show_fault_screen(void)
+{
+  char line[WIDGET_TEXT_MAX];
+  uint8_t row = FAULT_1;
+
+  begin_frame();
+
+  put(HEADER);
+  put(HEADER_LINE);
+
+  if ( measure_faults & FAULT_ANGLE )
+  {
+    put_text(FAULT_TITLE, "Angle sensor not responding");
+  }
+  else
+  {
+    put_text(FAULT_TITLE, (measure_faults & FAULT_LEFT) && (measure_faults & FAULT_RIGHT) ? "Lasers failed" : "Laser failed");
+
+    if ( measure_faults & FAULT_LEFT )
+    {
+      strcpy(line, "Laser 1: ");
+      strcat(line, laser_trouble(laser_left.result));
+      put_text(row++, line);
+    }
+
+    if ( measure_faults & FAULT_RIGHT )
+    {
+      strcpy(line, "Laser 2: ");
+      strcat(line, laser_trouble(laser_right.result));
+      put_text(row, line);
+    }
+  }
+
+  put_text(HINT_1, "Click to go back");
+}
+
+// a laser's distance for the readouts, or dashes if its last shot had none
+static const char *laser_reading(const struct laser *laser)
+{
+  if ( laser->result != LASER_DISTANCE )
+    return "--";
+
+  return fixed( data[unit].convert(laser->last_distance_um), 3 );
+}
+
+// what a failed transaction's result means for the user
+static const char *laser_trouble(enum LASER_FRAME result)
+{
+  switch ( result )
+  {
+    case LASER_TOO_CLOSE:      return "target too close";
+    case LASER_NO_ECHO:        return "no echo";
+    case LASER_TOO_STRONG:     return "reflection too strong";
+    case LASER_TOO_MUCH_LIGHT: return "too much light";
+    case LASER_TIMEOUT:        return "not answering";
+    default:                   return "bad reply";
+  }
+}
+
 void single_laser_message(void)
 {
-  tft.setFont(Arial_14);
-  tft.fillRect(10,180,310,100,ILI9341_BLACK); //black block to clear pervious message
-  tft.setCursor(10,190);
-  tft.println("Click once to take a measurement");
+  put_text(HINT_1, "Click once to take a measurement");
   
   //show mode change  
-  tft.setCursor(10,210);
-  tft.println("Now in Range Finder Mode");
+  put_text(HINT_2, "Now in Range Finder Mode");
+
+  flush();
 }
-// display battery icon and percentage
+
+// display battery percentage (drawn with the next screen update)
 void show_bat_percent(void)
 { 
-  tft.setTextColor(ILI9341_WHITE, ILI9341_BLACK);
-  tft.setFont(Arial_14);
-  tft.fillRect(267,49,40,20,ILI9341_BLACK); // clear previous percentage
-  tft.setCursor(268,50);
-  tft.print(voltage_percentage);
-  tft.setCursor(300,50);
-  tft.print("%");  
+  put_text(BAT_PERCENT, format_fixed( voltage_percentage, 0, false ));
+  put(BAT_SIGN);
+}
+
+// redraw just the battery icon and percentage, on whatever screen is up
+// (longitude_battery.cpp calls this when the level it shows changes)
+void update_battery(void)
+{
+  update_bat_level();
+  show_bat_percent();
+  flush();
+}
+
+// the panel's sleep mode (longitude_power.cpp turns the backlight off first);
+// it keeps the picture, so waking it needs no redraw
+void display_sleep(bool sleep)
+{
+  tft.sleep(sleep);
+}
+
+// let them bask in the splashscreen glory, as TASK_SPLASH, so the rest of the
+// boot carries on meanwhile
+void display_splash(void)
+{
+  splash_skipped = false;
+  task_start(TASK_SPLASH, splash_task, SPLASH_MS + 1000);
+}
+
+// a button press: the user has seen enough of it
+void display_splash_skip(void)
+{
+  splash_skipped = true;
+}
+
+static uint8_t splash_task(struct task *t)
+{
+  TASK_BEGIN(t);
+
+  t->wake = hal_millis() + SPLASH_MS;
+  TASK_WAIT_UNTIL(t, splash_skipped || (int32_t)(hal_millis() - t->wake) >= 0);
+
+  TASK_END(t);
+}
+
+// display battery icon; level is 0 (nearly empty) to 4 (full)
+void show_bat_level(uint8_t level)
+{
+  if ( level >= sizeof bat_fill / sizeof bat_fill[0] )
+    level = sizeof bat_fill / sizeof bat_fill[0] - 1;
+
+  put(BAT_ICON);
+
+  if ( ws[BAT_ICON].value != level )
+  {
+    ws[BAT_ICON].value = level;
+    ws[BAT_ICON].dirty = true;
+  }
+}
+
+// start a new screen: everything not requested again before flush() goes away
+static void begin_frame(void)
+{
+  for ( uint8_t i = 0; i < WIDGET_COUNT; i++ )
+    if ( !(widgets[i].flags & PERSIST) )
+      ws[i].want = false;
+
+  // the splash screen left pixels we know nothing about
+  if ( foreign_pixels )
+  {
+    foreign_pixels = false;
+    full_clear = true;
+  }
+}
+
+// request a widget as it is (labels, shapes)
+static void put(uint8_t id)
+{
+  if ( widgets[id].text && strcmp(ws[id].text, widgets[id].text) )
+  {
+    strncpy( ws[id].text, widgets[id].text, WIDGET_TEXT_MAX );
+    ws[id].text[WIDGET_TEXT_MAX - 1] = '\0';
+    ws[id].dirty = true;
+  }
+
+  ws[id].want = true;
+}
+
+// request a text widget with new contents; it's only redrawn if they differ
+static void put_text(uint8_t id, const char *text)
+{
+  if ( strncmp(text, ws[id].text, WIDGET_TEXT_MAX - 1) )
+  {
+    strncpy( ws[id].text, text, WIDGET_TEXT_MAX );
+    ws[id].text[WIDGET_TEXT_MAX - 1] = '\0';
+    ws[id].dirty = true;
+  }
+
+  ws[id].want = true;
+}
+
+// bring the glass in line with the widget requests
+static void flush(void)
+{
+  uint8_t i;
+  bool again;
+
+  if ( full_clear )
+  {
+    tft.fillScreen(ILI9341_BLACK);
+    full_clear = false;
+
+    for ( i = 0; i < WIDGET_COUNT; i++ )
+      ws[i].drawn = false;
+  }
+
+  // take down whatever is no longer wanted, and shapes that are about to change.
+  // erasing can clip a neighbour, which then has to be redrawn too, so repeat
+  // until settled.  text that is merely changing is overwritten in place by draw().
+  do
+  {
+    again = false;
+
+    for ( i = 0; i < WIDGET_COUNT; i++ )
+    {
+      if ( ws[i].drawn && (!ws[i].want || (ws[i].dirty && widgets[i].kind != W_TEXT)) )
+      {
+        erase(i);
+        mark_touching(i);
+        again = true;
+      }
+    }
+  } while ( again );
+
+  // text first, so shape outlines end up on top of any text background
+  for ( i = 0; i < WIDGET_COUNT; i++ )
+  {
+    if ( ws[i].want && (!ws[i].drawn || ws[i].dirty) && widgets[i].kind == W_TEXT )
+    {
+      if ( ws[i].drawn )
+        mark_touching(i); // the old text's area
+
+      draw(i);
+      mark_touching(i);   // the new text's area
+    }
+  }
+
+  for ( i = 0; i < WIDGET_COUNT; i++ )
+    if ( ws[i].want && (!ws[i].drawn || ws[i].dirty) && widgets[i].kind != W_TEXT )
+      draw(i);
 }
-void show_bat_level_100(void){
-  tft.fillRoundRect(247,42,16,26,3,ILI9341_BLACK);
-  tft.drawRoundRect(245,40,20,30,5,ILI9341_WHITE);
-  tft.fillRoundRect(247,42,16,26,3,ILI9341_GREEN);
+
+// the pixel areas a widget covers on the glass: a box is only its four edges,
+// so a box around text doesn't count as touching the text
+static uint8_t widget_rects(uint8_t id, int16_t r[][4])
+{
+  const struct widget *w = &widgets[id];
+
+  switch ( w->kind )
+  {
+    case W_TEXT:
+      r[0][0] = w->x; r[0][1] = w->y; r[0][2] = ws[id].drawn_w; r[0][3] = w->font->line_space;
+      return 1;
+
+    case W_BOX:
+      r[0][0] = w->x;            r[0][1] = w->y;            r[0][2] = w->w; r[0][3] = 1;
+      r[1][0] = w->x;            r[1][1] = w->y + w->h - 1; r[1][2] = w->w; r[1][3] = 1;
+      r[2][0] = w->x;            r[2][1] = w->y;            r[2][2] = 1;    r[2][3] = w->h;
+      r[3][0] = w->x + w->w - 1; r[3][1] = w->y;            r[3][2] = 1;    r[3][3] = w->h;
+      return 4;
+
+    default:
+      r[0][0] = w->x; r[0][1] = w->y; r[0][2] = w->w; r[0][3] = w->h;
+      return 1;
+  }
 }
 
-void show_bat_level_75(void){
-  tft.fillRoundRect(247,42,16,26,3,ILI9341_BLACK);
-  tft.drawRoundRect(245,40,20,30,5,ILI9341_WHITE);
-  tft.fillRoundRect(247,50,16,18,3,ILI9341_GREEN);
+static bool widgets_touch(uint8_t a, uint8_t b)
+{
+  int16_t ra[4][4], rb[4][4];
+  uint8_t na = widget_rects(a, ra);
+  uint8_t nb = widget_rects(b, rb);
+
+  for ( uint8_t i = 0; i < na; i++ )
+    for ( uint8_t j = 0; j < nb; j++ )
+      if ( ra[i][0] < rb[j][0] + rb[j][2] && rb[j][0] < ra[i][0] + ra[i][2] &&
+           ra[i][1] < rb[j][1] + rb[j][3] && rb[j][1] < ra[i][1] + ra[i][3] )
+        return true;
+
+  return false;
 }
 
-void show_bat_level_50(void){
-  tft.fillRoundRect(247,42,16,26,3,ILI9341_BLACK);
-  tft.drawRoundRect(245,40,20,30,5,ILI9341_WHITE);
-  tft.fillRoundRect(247,55,16,13,3,ILI9341_GREEN);
+// an erased widget may have taken pixels of its neighbours with it
+static void mark_touching(uint8_t id)
+{
+  for ( uint8_t i = 0; i < WIDGET_COUNT; i++ )
+    if ( i != id && ws[i].drawn && widgets_touch(id, i) )
+      ws[i].dirty = true;
+}
+
+static void erase(uint8_t id)
+{
+  const struct widget *w = &widgets[id];
+
+  switch ( w->kind )
+  {
+    case W_TEXT:
+      tft.fillRect(w->x, w->y, ws[id].drawn_w, w->font->line_space, ILI9341_BLACK);
+      break;
+
+    case W_BOX:
+      tft.drawRect(w->x, w->y, w->w, w->h, ILI9341_BLACK);
+      break;
+
+    case W_HLINE:
+      tft.drawFastHLine(w->x, w->y, w->w, ILI9341_BLACK);
+      break;
+
+    case W_BATTERY:
+      tft.fillRect(w->x, w->y, w->w, w->h, ILI9341_BLACK);
+      break;
+  }
+
+  ws[id].drawn = false;
 }
 
-void show_bat_level_25(void){
-  tft.fillRoundRect(247,42,16,26,3,ILI9341_BLACK);
-  tft.drawRoundRect(245,40,20,30,5,ILI9341_WHITE);
-  tft.fillRoundRect(247,60,16,8,3,ILI9341_YELLOW);
+static void draw(uint8_t id)
+{
+  const struct widget *w = &widgets[id];
+  int16_t old_w, new_w;
+
+  switch ( w->kind )
+  {
+    case W_TEXT:
+      old_w = ws[id].drawn ? ws[id].drawn_w : 0;
+
+      // cached glyphs are drawn as opaque cells, so they overwrite the old text
+      new_w = glyph_draw(w->font, w->x, w->y, ws[id].text, w->color, ILI9341_BLACK);
+
+      if ( new_w < 0 ) // something not in the cache: the slow path, erasing first
+      {
+        if ( ws[id].drawn )
+          erase(id);
+
+        tft.setFont(*w->font);
+        tft.setTextColor(w->color, ILI9341_BLACK);
+        tft.setCursor(w->x, w->y);
+        tft.print(ws[id].text);
+        new_w = tft.getCursorX() - w->x;
+      }
+      else if ( old_w > new_w ) // the old text was longer; clear the tail
+      {
+        tft.fillRect(w->x + new_w, w->y, old_w - new_w, w->font->line_space, ILI9341_BLACK);
+      }
+
+      ws[id].drawn_w = new_w;
+      break;
+
+    case W_BOX:
+      tft.drawRect(w->x, w->y, w->w, w->h, w->color);
+      break;
+
+    case W_HLINE:
+      tft.drawFastHLine(w->x, w->y, w->w, w->color);
+      break;
+
+    case W_BATTERY:
+      tft.drawRoundRect(w->x, w->y, w->w, w->h, 5, w->color);
+      tft.fillRoundRect(w->x + 2, bat_fill[ws[id].value].y, w->w - 4, bat_fill[ws[id].value].h, 3, bat_fill[ws[id].value].color);
+      break;
+  }
+
+  ws[id].drawn = true;
+  ws[id].dirty = false;
 }
 
-void show_bat_level_15(void){
-  tft.fillRoundRect(247,42,16,26,3,ILI9341_BLACK);
-  tft.drawRoundRect(245,40,20,30,5,ILI9341_WHITE);
-  tft.fillRoundRect(247,65,16,3,3,ILI9341_RED);
+// format a value given in thousandths with 1 to 3 decimals
+static const char *fixed(int32_t milli, uint8_t decimals)
+{
+  static const int32_t scale[] = { 1000, 100, 10, 1 };
+  int32_t div = scale[decimals];
+  bool negative = milli < 0;
+
+  if ( negative )
+    milli = -milli;
+
+  // round to the requested precision
+  return format_fixed( (milli + div / 2) / div, decimals, negative );
 }
 
+// integer to decimal string with an implied decimal point, e.g. (12345, 3) is
+// "12.345"; built right to left, without going through printf
+static const char *format_fixed(uint32_t v, uint8_t decimals, bool negative)
+{
+  static char buf[16];
+  char *p = &buf[sizeof buf - 1];
+  uint8_t digits = 0;
+
+  *p = '\0';
+
+  do
+  {
+    *--p = '0' + v % 10;
+    v /= 10;
+
+    if ( ++digits == decimals )
+      *--p = '.';
+  } while ( v || digits <= decimals );
+
+  if ( negative )
+    *--p = '-';
+
+  return p;
+}
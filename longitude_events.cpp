@@ -0,0 +1,145 @@
+/*
+ * Longitude event queue
+ *
+ * A bounded lock-free queue (after Vyukov): each slot carries a sequence number
+ * that says whether it's free for the producer at a given position or holds an
+ * event for the consumer.  producers claim a position with compare-and-swap, so
+ * any interrupt, or the main loop, can post without masking interrupts, even if
+ * it preempts another post.  there is a single consumer, the main loop.
+ */
+#include "longitude_events.h"
+#include "longitude_hal.h"
+#include "longitude_profile.h"
+
+#define MASK (EVENT_QUEUE_SIZE - 1)
+
+struct slot
+{
+    uint32_t seq;
+    struct event ev;
+};
+
+static struct slot slots[EVENT_QUEUE_SIZE];
+static uint32_t head;      // next position to claim (producers)
+static uint32_t tail;      // next position to take (consumer)
+static uint32_t overflows; // events dropped on a full queue
+static uint32_t latency;   // longest an event has waited to be taken, ms
+
+void event_init(void)
+{
+    for ( uint32_t i = 0; i < EVENT_QUEUE_SIZE; i++ )
+        __atomic_store_n( &slots[i].seq, i, __ATOMIC_RELAXED );
+
+    __atomic_store_n( &head, 0, __ATOMIC_RELAXED );
+    tail = 0;
+    overflows = 0;
+    latency = 0;
+}
+
+// safe from any context; returns false (and counts it) if the queue is full
+bool event_post(uint8_t type, uint8_t arg, uint32_t time)
+{
+    uint32_t pos = __atomic_load_n( &head, __ATOMIC_RELAXED );
+    struct slot *s;
+    int32_t diff;
+
+    for ( ;; )
+    {
+        s = &slots[pos & MASK];
+        diff = (int32_t)(__atomic_load_n( &s->seq, __ATOMIC_ACQUIRE ) - pos);
+
+        if ( diff == 0 ) // free at this position; try to claim it
+        {
+            if ( __atomic_compare_exchange_n( &head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+                break;
+        }
+        else if ( diff < 0 ) // consumer hasn't freed it yet: full
+        {
+            __atomic_fetch_add( &overflows, 1, __ATOMIC_RELAXED );
+            return false;
+        }
+        else // another producer got there first
+        {
+            pos = __atomic_load_n( &head, __ATOMIC_RELAXED );
+        }
+    }
+
+    s->ev.type = type;
+    s->ev.arg = arg;
+    s->ev.time = time;
+
+    // publish to the consumer
+    __atomic_store_n( &s->seq, pos + 1, __ATOMIC_RELEASE );
+
+    return true;
+}
+
+// main loop only; returns false if there is nothing queued.  a slot that has
+// been claimed but not yet published stops the consumer there, so events come
+// off in the order their positions were claimed.
+bool event_get(struct event *ev)
+{
+    struct slot *s = &slots[tail & MASK];
+
+    if ( __atomic_load_n( &s->seq, __ATOMIC_ACQUIRE ) != tail + 1 )
+        return false;
+
+    *ev = s->ev;
+
+    if ( hal_millis() - ev->time > latency )
+        latency = hal_millis() - ev->time;
+
+    // hand the slot back to producers for its next lap
+    __atomic_store_n( &s->seq, tail + EVENT_QUEUE_SIZE, __ATOMIC_RELEASE );
+    tail++;
+
+    return true;
+}
+
+// main loop only: true if something has been posted, or is being posted, that
+// event_get() hasn't taken yet
+bool event_pending(void)
+{
+    return __atomic_load_n( &head, __ATOMIC_ACQUIRE ) != tail;
+}
+
+// take the next event, sleeping until an interrupt if there is none.  interrupts
+// are masked around the check so an event posted just after it still ends the
+// sleep (a pending interrupt wakes the core even while masked) instead of being
+// slept through; it's then handled as soon as they're unmasked.
+void event_wait(struct event *ev)
+{
+    while ( !event_get(ev) )
+    {
+        hal_irq_off();
+
+        if ( __atomic_load_n( &slots[tail & MASK].seq, __ATOMIC_ACQUIRE ) != tail + 1 )
+        {
+            SPAN_BEGIN(SPAN_SLEEP);
+            hal_sleep();
+            SPAN_END(SPAN_SLEEP);
+        }
+
+        hal_irq_on();
+    }
+}
+
+// sleep until the next interrupt of any kind, for loops that poll something
+// other than the queue.  the 1 ms system tick bounds the nap.
+void event_idle(void)
+{
+    SPAN_BEGIN(SPAN_SLEEP);
+    hal_sleep();
+    SPAN_END(SPAN_SLEEP);
+}
+
+uint32_t event_overflows(void)
+{
+    return __atomic_load_n( &overflows, __ATOMIC_RELAXED );
+}
+
+// main loop only; how far the loop has fallen behind, at worst
+uint32_t event_latency_max(void)
+{
+    return latency;
+}
@@ -0,0 +1,48 @@
+/*
+ * Longitude event queue
+ *
+ * Interrupt handlers (buttons, ADC, timers) and the main loop post events
+ * here; the state machine in longitude.ino takes them off in order and sleeps
+ * while there are none.  No Arduino dependencies; sleeping is done by the HAL.
+ */
+#ifndef LONGITUDE_EVENTS_HEADER
+#define LONGITUDE_EVENTS_HEADER
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define EVENT_QUEUE_SIZE 16 // power of 2
+
+enum EVENT_TYPE
+{
+    EV_NONE,
+    EV_BTN_DOWN,  // arg: BTN_MEASURE or BTN_MODE
+    EV_BTN_UP,    // arg: same
+    EV_LASER,     // a laser transaction finished; arg: laser id
+    EV_ADC_READY, // a full filter window at the new resolution; arg: bits
+    EV_TIMER,     // a timer ran out; arg: which (TIMER_*)
+    EV_USB,       // bytes from the host are waiting
+    EV_COMMAND,   // a host command for the state machine; arg: LINK_* (longitude_link.cpp)
+    EV_TASK       // a task finished; arg: TASK_* (longitude_task.h)
+};
+
+enum BUTTON_ID { BTN_MEASURE, BTN_MODE };
+enum TIMER_ID { TIMER_SOUND, TIMER_CONFIG, TIMER_BATTERY, TIMER_POWER, TIMER_LASERS };
+
+struct event
+{
+    uint8_t type;  // EVENT_TYPE
+    uint8_t arg;
+    uint32_t time; // millis() when it was posted
+};
+
+void event_init(void);
+bool event_post(uint8_t type, uint8_t arg, uint32_t time);
+bool event_get(struct event *);
+bool event_pending(void);
+void event_wait(struct event *);
+void event_idle(void);
+uint32_t event_overflows(void);
+uint32_t event_latency_max(void);
+
+#endif
@@ -0,0 +1,181 @@
+/*
+ * Longitude fixed-point streaming filters
+ */
+#include "longitude_filter.h"
+
+// every filter takes integer samples (ADC codes) one at a time and returns its
+// current estimate in the same units.  there's no floating point anywhere; the
+// IIR and Kalman state carry FILTER_Q fractional bits so small corrections don't
+// round away.
+//
+// on the Cortex-M4 we lean on the DSP extension for saturating adds (qadd/qsub)
+// and the rounding high-word multiply (smmulr) in the Kalman update; elsewhere
+// (e.g., a host build) the portable versions below do the same arithmetic.
+
+#define ONE (1L << FILTER_Q)
+
+static inline int32_t sat_add(int32_t a, int32_t b)
+{
+#if defined(__ARM_ARCH_7EM__)
+    int32_t r;
+    asm ( "qadd %0, %1, %2" : "=r" (r) : "r" (a), "r" (b) );
+    return r;
+#else
+    int64_t r = (int64_t)a + b;
+    return r > INT32_MAX ? INT32_MAX : r < INT32_MIN ? INT32_MIN : (int32_t)r;
+#endif
+}
+
+static inline int32_t sat_sub(int32_t a, int32_t b)
+{
+#if defined(__ARM_ARCH_7EM__)
+    int32_t r;
+    asm ( "qsub %0, %1, %2" : "=r" (r) : "r" (a), "r" (b) );
+    return r;
+#else
+    int64_t r = (int64_t)a - b;
+    return r > INT32_MAX ? INT32_MAX : r < INT32_MIN ? INT32_MIN : (int32_t)r;
+#endif
+}
+
+// a * b, where b is a Q31 fraction in [0, 1)
+static inline int32_t mul_q31(int32_t a, int32_t b)
+{
+#if defined(__ARM_ARCH_7EM__)
+    int32_t r;
+    asm ( "smmulr %0, %1, %2" : "=r" (r) : "r" (a), "r" (b) ); // (a*b + 2^31) >> 32
+    return sat_add( r, r );
+#else
+    return (int32_t)(((int64_t)a * b + (1LL << 30)) >> 31);
+#endif
+}
+
+// Q(FILTER_Q) back to integer, rounding to nearest
+static inline int32_t from_q(int32_t y)
+{
+    return (y + (ONE / 2)) >> FILTER_Q;
+}
+
+static int32_t median(const struct filter *);
+
+// set up a filter; param is the window length for boxcar and median (clamped to
+// FILTER_WINDOW_MAX) and the shift for the EMA.  Kalman filters use filter_kalman_init().
+void filter_init(struct filter *f, enum FILTER_TYPE type, uint8_t param)
+{
+    f->type = type;
+    f->n = param < 1 ? 1 : param > FILTER_WINDOW_MAX ? FILTER_WINDOW_MAX : param;
+    f->shift = param > 30 ? 30 : param;
+    f->q = 0;
+    f->r = ONE;
+
+    filter_reset( f );
+}
+
+// q and r are the process and measurement noise variances, in codes^2, Q(FILTER_Q)
+void filter_kalman_init(struct filter *f, int32_t q, int32_t r)
+{
+    filter_init( f, FILTER_KALMAN, 0 );
+
+    f->q = q;
+    f->r = r > 0 ? r : 1;
+    f->p = f->r;
+}
+
+// forget the signal history, keeping the configuration
+void filter_reset(struct filter *f)
+{
+    f->idx = 0;
+    f->count = 0;
+    f->sum = 0;
+    f->y = 0;
+    f->p = f->r;
+}
+
+// push one sample through; returns the new estimate
+int32_t filter_update(struct filter *f, int32_t x)
+{
+    int32_t k;
+
+    switch ( f->type )
+    {
+        case FILTER_BOXCAR:
+
+            // add the new sample and drop the one that falls out of the window
+            if ( f->count >= f->n )
+                f->sum = sat_sub( f->sum, f->win[f->idx] );
+
+            f->sum = sat_add( f->sum, x );
+            f->win[f->idx] = x;
+            f->idx = (f->idx + 1) % f->n;
+            f->count++;
+
+            k = f->count < f->n ? (int32_t)f->count : f->n;
+
+            // round the averaged result
+            return (f->sum + (k / 2)) / k;
+
+        case FILTER_EMA:
+
+            if ( f->count++ == 0 ) // start from the first sample rather than from zero
+                f->y = x * ONE;
+            else
+                f->y = sat_add( f->y, (x * ONE - f->y) >> f->shift );
+
+            return from_q( f->y );
+
+        case FILTER_MEDIAN:
+
+            f->win[f->idx] = x;
+            f->idx = (f->idx + 1) % f->n;
+            f->count++;
+
+            return median( f );
+
+        case FILTER_KALMAN:
+
+            if ( f->count++ == 0 )
+            {
+                f->y = x * ONE;
+                return x;
+            }
+
+            // predict: the signal is constant, only our uncertainty grows
+            f->p = sat_add( f->p, f->q );
+
+            // gain k = p / (p + r), as a Q31 fraction
+            k = (int32_t)(((int64_t)f->p << 31) / ((int64_t)f->p + f->r));
+
+            // correct
+            f->y = sat_add( f->y, mul_q31( x * ONE - f->y, k ) );
+            f->p = sat_sub( f->p, mul_q31( f->p, k ) );
+
+            return from_q( f->y );
+    }
+
+    return x;
+}
+
+// median of the samples in the window (the mean of the middle two, for an
+// even count); insertion sort, since the window is tiny
+static int32_t median(const struct filter *f)
+{
+    int32_t s[FILTER_WINDOW_MAX];
+    int32_t v;
+    uint8_t n = f->count < f->n ? (uint8_t)f->count : f->n;
+    uint8_t i, j;
+
+    for ( i = 0; i < n; i++ )
+    {
+        v = f->win[i];
+
+        for ( j = i; j > 0 && s[j - 1] > v; j-- )
+            s[j] = s[j - 1];
+
+        s[j] = v;
+    }
+
+    if ( n & 1 )
+        return s[n / 2];
+
+    return (s[n / 2 - 1] + s[n / 2] + 1) / 2;
+}
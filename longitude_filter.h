@@ -0,0 +1,41 @@
+/*
+ * Longitude fixed-point streaming filters
+ */
+#ifndef LONGITUDE_FILTER_HEADER
+#define LONGITUDE_FILTER_HEADER
+
+#include <stdint.h>
+
+#define FILTER_WINDOW_MAX 16 // longest boxcar/median window
+#define FILTER_Q 8           // fractional bits kept in the EMA and Kalman state
+
+enum FILTER_TYPE
+{
+    FILTER_BOXCAR, // moving average over n samples, kept as a running sum
+    FILTER_EMA,    // exponential IIR, alpha = 2^-shift
+    FILTER_MEDIAN, // median of the last n samples
+    FILTER_KALMAN  // 1-D Kalman filter for a constant signal
+};
+
+// one struct covers every filter type; only the fields a type uses are touched
+struct filter
+{
+    enum FILTER_TYPE type;
+    uint8_t n;          // window length (boxcar, median)
+    uint8_t shift;      // EMA smoothing
+    uint8_t idx;        // next slot in win[]
+    uint32_t count;     // samples seen since reset
+    int32_t win[FILTER_WINDOW_MAX];
+    int32_t sum;        // boxcar running sum
+    int32_t y;          // EMA/Kalman estimate, Q(FILTER_Q)
+    int32_t p;          // Kalman error covariance, Q(FILTER_Q)
+    int32_t q;          // Kalman process noise, Q(FILTER_Q)
+    int32_t r;          // Kalman measurement noise, Q(FILTER_Q)
+};
+
+void filter_init(struct filter *, enum FILTER_TYPE, uint8_t);
+void filter_kalman_init(struct filter *, int32_t, int32_t);
+void filter_reset(struct filter *);
+int32_t filter_update(struct filter *, int32_t);
+
+#endif
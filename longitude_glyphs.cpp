@@ -0,0 +1,233 @@
+/*
+ * Longitude glyph cache for numeric readouts
+ */
+#include "longitude_glyphs.h"
+
+// the measurement readouts are nearly all digits, and ILI9341_t3 unpacks every
+// glyph from the compressed font bitstream and plots it a run of pixels at a time,
+// every time it's printed.  instead, we unpack the handful of characters the
+// readouts use once, at boot, into plain 1-bit bitmaps, and draw each character
+// as a single block write of its whole cell (background included), which also
+// saves erasing the old text first.
+//
+// the font format is the one ILI9341_t3's drawFontChar() reads: a bit-packed
+// index into a bit-packed stream of glyphs, each with a small header (width,
+// height, offsets, advance) and rows that are either literal or repeated.
+//
+// the bitmaps live in RAM (see glyph_ram()), not flash: they're decoded from
+// PJRC's font arrays, which come with the Teensyduino library rather than this
+// sketch, and the Arduino IDE build has no step to generate const tables from
+// them; checked-in tables would quietly go stale with the library's fonts.
+// subsetting the fonts wouldn't save flash either, as the labels still draw
+// every other character of the same faces.
+
+#define GLYPH_CELL_MAX 1600  // pixels in the largest cell we'll blit
+
+extern ILI9341_t3 tft;
+
+struct glyph
+{
+    const ILI9341_t3_font_t *font;
+    char c;
+    uint8_t width, height;  // bitmap size
+    int8_t xoffset;         // bitmap position relative to the cursor
+    int8_t top;             // first bitmap row, relative to the top of the line
+    uint8_t delta;          // cursor advance
+    uint16_t bits;          // offset of the bitmap in pool[], rows padded to bytes
+};
+
+static struct glyph glyphs[GLYPH_MAX];
+static uint8_t glyph_count;
+static uint8_t dropped;     // asked for, but not cached
+static uint8_t pool[GLYPH_POOL];
+static uint16_t pool_used;
+static uint16_t cell[GLYPH_CELL_MAX];
+
+static uint32_t fetchbit(const uint8_t *, uint32_t);
+static uint32_t fetchbits_unsigned(const uint8_t *, uint32_t, uint32_t);
+static int32_t fetchbits_signed(const uint8_t *, uint32_t, uint32_t);
+static bool unpack(const ILI9341_t3_font_t *, char, struct glyph *);
+static const struct glyph *find(const ILI9341_t3_font_t *, char);
+
+// unpack the given characters of a font into the cache.  characters that don't
+// fit (or that the font doesn't have) are left to the normal text path, and
+// counted: see glyph_dropped()
+void glyph_cache(const ILI9341_t3_font_t *font, const char *chars)
+{
+    for ( ; *chars; chars++ )
+    {
+        if ( find(font, *chars) )
+            continue;
+
+        if ( glyph_count < GLYPH_MAX && unpack(font, *chars, &glyphs[glyph_count]) )
+            glyph_count++;
+        else
+            dropped++;
+    }
+}
+
+// RAM the cache takes, and how much of its bitmap pool is in use
+uint16_t glyph_ram(uint16_t *pool_bytes)
+{
+    *pool_bytes = pool_used;
+
+    return sizeof glyphs + sizeof pool + sizeof cell;
+}
+
+// characters glyph_cache() couldn't take; anything but 0 means some readouts
+// draw the slow way
+uint8_t glyph_dropped(void)
+{
+    return dropped;
+}
+
+// draw a string at (x, y) from the cache, background and all; returns the width
+// drawn, or -1 (having drawn nothing) if any character isn't cached
+int16_t glyph_draw(const ILI9341_t3_font_t *font, int16_t x, int16_t y, const char *s, uint16_t fg, uint16_t bg)
+{
+    const struct glyph *g;
+    const uint8_t *row;
+    const char *p;
+    int16_t w, h = font->line_space;
+    int16_t gx, gy, bx, by, start = x;
+    uint8_t stride;
+    bool on;
+
+    for ( p = s; *p; p++ )
+    {
+        g = find(font, *p);
+
+        if ( g == NULL || (int32_t)g->delta * h > GLYPH_CELL_MAX )
+            return -1;
+    }
+
+    for ( p = s; *p; p++ )
+    {
+        g = find(font, *p);
+        w = g->delta;
+        stride = (g->width + 7) / 8;
+
+        for ( gy = 0; gy < h; gy++ )
+        {
+            by = gy - g->top;
+            row = (by >= 0 && by < g->height) ? &pool[g->bits + by * stride] : NULL;
+
+            for ( gx = 0; gx < w; gx++ )
+            {
+                bx = gx - g->xoffset;
+                on = row && bx >= 0 && bx < g->width && (row[bx >> 3] & (0x80 >> (bx & 7)));
+
+                cell[gy * w + gx] = on ? fg : bg;
+            }
+        }
+
+        tft.writeRect(x, y, w, h, cell);
+        x += w;
+    }
+
+    return x - start;
+}
+
+static const struct glyph *find(const ILI9341_t3_font_t *font, char c)
+{
+    for ( uint8_t i = 0; i < glyph_count; i++ )
+        if ( glyphs[i].font == font && glyphs[i].c == c )
+            return &glyphs[i];
+
+    return NULL;
+}
+
+// decode one character into a 1-bit bitmap in the pool
+static bool unpack(const ILI9341_t3_font_t *font, char ch, struct glyph *g)
+{
+    uint32_t c = (uint8_t)ch;
+    uint32_t bitoffset, width, height, delta, stride, y, x, n, i;
+    int32_t xoffset, yoffset;
+    const uint8_t *data;
+    uint8_t *dst;
+
+    if ( c >= font->index1_first && c <= font->index1_last )
+        bitoffset = (c - font->index1_first) * font->bits_index;
+    else if ( c >= font->index2_first && c <= font->index2_last )
+        bitoffset = (c - font->index2_first + font->index1_last - font->index1_first + 1) * font->bits_index;
+    else
+        return false;
+
+    data = font->data + fetchbits_unsigned(font->index, bitoffset, font->bits_index);
+
+    if ( fetchbits_unsigned(data, 0, 3) != 0 ) // only encoding 0 exists
+        return false;
+
+    bitoffset = 3;
+    width   = fetchbits_unsigned(data, bitoffset, font->bits_width);   bitoffset += font->bits_width;
+    height  = fetchbits_unsigned(data, bitoffset, font->bits_height);  bitoffset += font->bits_height;
+    xoffset = fetchbits_signed(data, bitoffset, font->bits_xoffset);   bitoffset += font->bits_xoffset;
+    yoffset = fetchbits_signed(data, bitoffset, font->bits_yoffset);   bitoffset += font->bits_yoffset;
+    delta   = fetchbits_unsigned(data, bitoffset, font->bits_delta);   bitoffset += font->bits_delta;
+
+    stride = (width + 7) / 8;
+
+    if ( pool_used + stride * height > GLYPH_POOL || width > 255 || height > 255 || delta > 255 )
+        return false;
+
+    g->font = font;
+    g->c = ch;
+    g->width = width;
+    g->height = height;
+    g->xoffset = xoffset;
+    g->top = font->cap_height - height - yoffset;
+    g->delta = delta;
+    g->bits = pool_used;
+
+    dst = &pool[pool_used];
+    memset(dst, 0, stride * height);
+
+    // each row is either literal (0) or repeated n times (1 + 3-bit count)
+    for ( y = 0; y < height; y += n )
+    {
+        n = 1;
+
+        if ( fetchbit(data, bitoffset++) )
+        {
+            n = fetchbits_unsigned(data, bitoffset, 3) + 2;
+            bitoffset += 3;
+        }
+
+        for ( x = 0; x < width; x++ )
+            if ( fetchbit(data, bitoffset + x) )
+                for ( i = 0; i < n && y + i < height; i++ )
+                    dst[(y + i) * stride + (x >> 3)] |= 0x80 >> (x & 7);
+
+        bitoffset += width;
+    }
+
+    pool_used += stride * height;
+
+    return true;
+}
+
+// bit readers for the packed font data, most significant bit first
+static uint32_t fetchbit(const uint8_t *p, uint32_t index)
+{
+    return (p[index >> 3] >> (7 - (index & 7))) & 1;
+}
+
+static uint32_t fetchbits_unsigned(const uint8_t *p, uint32_t index, uint32_t required)
+{
+    uint32_t val = 0;
+
+    while ( required-- )
+        val = (val << 1) | fetchbit(p, index++);
+
+    return val;
+}
+
+static int32_t fetchbits_signed(const uint8_t *p, uint32_t index, uint32_t required)
+{
+    uint32_t val = fetchbits_unsigned(p, index, required);
+
+    if ( required && (val & (1UL << (required - 1))) )
+        return (int32_t)val - (int32_t)(1UL << required);
+
+    return (int32_t)val;
+}
@@ -0,0 +1,36 @@
+/*
+ * Longitude glyph cache for numeric readouts
+ */
+#ifndef LONGITUDE_GLYPHS_HEADER
+#define LONGITUDE_GLYPHS_HEADER
+
+#include <ILI9341_t3.h>
+
+#define GLYPH_MAX  48   // cached characters, all fonts
+#define GLYPH_POOL 2048 // bytes of bitmap storage
+
+// a font, and the characters of it to cache
+struct glyph_set
+{
+    const ILI9341_t3_font_t *font;
+    const char *chars;
+};
+
+// how many characters a list of sets asks for, so the caller can check it
+// against GLYPH_MAX when it compiles
+constexpr uint16_t glyph_length(const char *s)
+{
+    return *s ? 1 + glyph_length(s + 1) : 0;
+}
+
+constexpr uint16_t glyph_chars(const struct glyph_set *sets, uint8_t n)
+{
+    return n ? glyph_length(sets->chars) + glyph_chars(sets + 1, n - 1) : 0;
+}
+
+void glyph_cache(const ILI9341_t3_font_t *, const char *);
+int16_t glyph_draw(const ILI9341_t3_font_t *, int16_t, int16_t, const char *, uint16_t, uint16_t);
+uint8_t glyph_dropped(void);
+uint16_t glyph_ram(uint16_t *);
+
+#endif
@@ -0,0 +1,110 @@
+/*
+ * Longitude hardware abstraction
+ *
+ * Everything the firmware needs from the board, apart from the display (but
+ * including its backlight), goes through these calls: the clock and the
+ * sleep modes, the laser UARTs, the I2C bus to the angle ADC, the internal ADC,
+ * the buttons, the speaker, five periodic timers, the EEPROM, the real-time
+ * clock, USB serial to a host, and the spare program flash that holds the
+ * measurement history.  longitude_hal_teensy.cpp maps them onto the Teensy
+ * libraries; longitude_hal_host.cpp simulates them on a PC with a virtual clock.
+ *
+ * No Arduino dependencies.
+ */
+#ifndef LONGITUDE_HAL_HEADER
+#define LONGITUDE_HAL_HEADER
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// laser serial ports
+#define HAL_UART_LEFT  0
+#define HAL_UART_RIGHT 1
+
+// periodic timers.  the board has a hardware timer each for the first three;
+// the others run off the 1 ms system tick, so their periods are rounded to
+// whole milliseconds and they can't go faster than that
+enum HAL_TIMER { HAL_TIMER_ADC, HAL_TIMER_SOUND, HAL_TIMER_CONFIG, HAL_TIMER_BATTERY, HAL_TIMER_POWER, HAL_TIMER_BUTTONS,
+                 HAL_TIMER_COUNT };
+
+// time
+uint32_t hal_millis(void);
+uint32_t hal_micros(void);
+void hal_delay(uint32_t ms);
+void hal_sleep(void); // until the next interrupt
+void hal_stop(void);  // deeper: until a button, with the clocks and timers stopped
+void hal_irq_off(void);
+void hal_irq_on(void);
+uint32_t hal_irq_save(void);      // masks them, from any context, and returns
+void hal_irq_restore(uint32_t);   // what hal_irq_restore() puts back
+
+// cycle counter, for the profiler: free-running and wrapping, hal_cycles_hz()
+// counts a second
+void hal_cycles_start(void);
+uint32_t hal_cycles(void);
+uint32_t hal_cycles_hz(void);
+
+// laser UARTs
+void hal_uart_begin(uint8_t port, uint32_t baud);
+int hal_uart_available(uint8_t port);
+int hal_uart_read(uint8_t port);
+void hal_uart_write(uint8_t port, const char *);
+
+// I2C master.  reads are non-blocking: hal_i2c_request() starts one and the
+// callback runs (in interrupt context) once the bytes are in.
+void hal_i2c_begin(uint32_t hz);
+bool hal_i2c_write(uint8_t addr, uint8_t byte);       // blocking; true on ACK
+void hal_i2c_write_async(uint8_t addr, uint8_t byte); // returns at once
+void hal_i2c_request(uint8_t addr, uint8_t n);
+void hal_i2c_on_read(void (*)(void));
+uint8_t hal_i2c_read(uint8_t *buf, uint8_t max);      // bytes of the last request
+bool hal_i2c_done(void);                              // bus idle
+void hal_i2c_finish(void);                            // wait for the bus to go idle
+
+// periodic timer interrupts
+void hal_timer_start(uint8_t timer, uint32_t period_us, void (*)(void));
+void hal_timer_stop(uint8_t timer);
+
+// internal ADC
+void hal_analog_averaging(uint8_t samples);
+uint16_t hal_analog_read(uint8_t pin); // 10 bits
+
+// buttons: input with pull-up, isr runs on either edge
+void hal_button_attach(uint8_t pin, void (*isr)(void));
+uint8_t hal_pin_read(uint8_t pin);
+
+// speaker
+void hal_tone(uint8_t pin, uint16_t hz, uint32_t ms);
+
+// display backlight, 0 (off) to 255 (full)
+void hal_backlight(uint8_t pin, uint8_t level);
+
+// EEPROM
+void hal_eeprom_read(uint32_t addr, void *buf, uint32_t n);
+void hal_eeprom_write(uint32_t addr, const void *buf, uint32_t n);
+
+// real-time clock, seconds since 1970 (counts from 0 if it was never set)
+uint32_t hal_rtc_seconds(void);
+
+// USB serial to a host computer.  writes return once the bytes are queued;
+// reads take what has arrived, without waiting.  the callback runs (in
+// interrupt context) within a millisecond of bytes arriving, and again every
+// millisecond while any are left unread.
+void hal_usb_write(const void *buf, uint32_t n);
+uint32_t hal_usb_read(void *buf, uint32_t max);
+void hal_usb_on_receive(void (*)(void));
+bool hal_usb_connected(void); // a host has the port open
+
+// history flash: HAL_HISTORY_SECTORS sectors of HAL_HISTORY_SECTOR bytes, at the
+// top of the Teensy 3.2's program flash (the sketch has to stay below it).
+// erased bytes read 0xFF; programming takes aligned 32-bit words and can only
+// clear bits.  both stop the CPU, interrupts included, while the flash is busy:
+// about 70 us a word, and 15 ms (at worst 115) a sector erase.
+#define HAL_HISTORY_SECTOR  2048
+#define HAL_HISTORY_SECTORS 32
+bool hal_history_usable(void); // false if the sketch runs into it
+void hal_history_read(uint32_t offset, void *buf, uint32_t n);
+bool hal_history_erase(uint16_t sector);
+bool hal_history_program(uint32_t offset, const void *buf, uint32_t n);
+
+#endif
@@ -0,0 +1,1275 @@
+/*
+ * Longitude hardware abstraction: host simulation
+ *
+ * A virtual clock drives everything: periodic timers, laser modules answering
+ * their commands after a scripted delay, an MCP3421 converting at its data rate,
+ * button presses, and I2C reads completing.  whatever is due next is run by
+ * sim_advance() (or by hal_sleep()/hal_delay() from the firmware), in order, as
+ * an interrupt handler would be.  single-threaded, so masking is a no-op.
+ *
+ * or, with sim_replay(), a trace recorded on the board stands in for the
+ * models: its UART and USB bytes and button edges arrive when they did, and the
+ * ADC, the battery and the EEPROM read what they read then.
+ */
+#if !defined(ARDUINO)
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+#include "longitude_hal.h"
+#include "longitude_hal_host.h"
+#include "longitude_mcp342x.h"
+#include "longitude_trace.h"
+
+#define NEVER UINT64_MAX
+
+#define UART_COUNT   2
+#define UART_RX_SIZE 64  // power of 2
+#define PEER_FRAMES  4   // frames a module may have in flight
+#define PINS         40
+#define PRESSES      16
+
+#define LASER_REPLY_US   2000   // command to reply frame
+#define LASER_ON_US      300000 // reply to lights-on confirmation
+#define I2C_BYTE_US      25     // 400kHz, with start/stop overhead
+#define ADC_POWER_UP_US  1000   // the MCP3421 NAKs its address until then
+
+// the module's answers
+#define FRAME_REPLY           "$00023335&"
+#define FRAME_ON_CONFIRM      "$0003260130&"
+#define FRAME_MEASURE_CONFIRM "$00022123&"
+#define FRAME_OFF_CONFIRM     "$0003260029&"
+#define CMD_ON                "$0003260130&"
+#define CMD_MEASURE           "$00022123&"
+#define CMD_OFF               "$0003260029&"
+
+static uint64_t now_us;
+
+// [timers]
+struct timer
+{
+    uint64_t due;
+    uint32_t period;
+    void (*fn)(void);
+};
+static struct timer timers[HAL_TIMER_COUNT];
+
+// [laser peers]
+struct peer_frame
+{
+    uint64_t due;
+    char text[24];
+};
+
+struct uart
+{
+    char rx[UART_RX_SIZE]; // delivered, waiting for the firmware
+    uint32_t rx_head, rx_tail;
+    char cmd[24];          // command being written by the firmware
+    uint8_t cmd_len;
+    struct peer_frame out[PEER_FRAMES];
+    uint32_t distance_mm;
+    uint32_t measure_us;
+    uint32_t sigma_um;
+    uint16_t outliers;     // per mille
+    bool unplugged;
+    bool lit;              // beam on, for aiming
+    uint64_t measuring_until;
+};
+static struct uart uarts[UART_COUNT];
+
+// [MCP3421]
+static struct
+{
+    uint8_t config;
+    uint64_t started;    // when the current config was written
+    uint32_t reads;      // conversions already handed out since then
+    int32_t input_uv;
+    bool unplugged;
+} adc;
+
+static struct
+{
+    uint64_t due;        // pending read completes
+    uint8_t want;
+    uint8_t buf[4];
+    uint8_t len, pos;
+    void (*on_read)(void);
+} i2c;
+static struct sim_i2c i2c_stats;
+
+// [pins]
+static uint16_t analog_mv[PINS];
+static uint8_t pin_level[PINS];
+static void (*pin_isr[PINS])(void);
+
+struct press
+{
+    uint64_t due;
+    uint8_t pin;
+    uint8_t level;
+};
+static struct press presses[PRESSES];
+
+static uint64_t at_due;          // sim_at()
+static void (*at_fn)(void);
+
+static uint32_t tones;
+static uint32_t rng = 2463534242u;
+static uint8_t eeprom[SIM_EEPROM_SIZE];
+static uint32_t eeprom_wear[SIM_EEPROM_SIZE];
+static int32_t eeprom_budget = -1;
+static uint8_t history[HAL_HISTORY_SECTORS * HAL_HISTORY_SECTOR];
+static uint32_t history_erases[HAL_HISTORY_SECTORS];
+static bool history_overlap;
+static uint32_t rtc_base;
+static uint8_t usb[HAL_HISTORY_SECTORS * HAL_HISTORY_SECTOR + 4096]; // room for a history export
+static uint32_t usb_n;
+static uint8_t usb_rx[4096];
+static uint32_t usb_rx_n;
+static uint32_t (*usb_in)(uint8_t *, uint32_t);
+static void (*usb_out)(const uint8_t *, uint32_t);
+static void (*usb_on_receive)(void);
+
+// [replay]: one cursor per kind of input walks the trace
+struct cursor
+{
+    uint32_t pos;           // where the event after this one starts
+    struct trace_event ev;  // the next one of its kind, if more
+    uint8_t kind;
+    bool more;
+};
+
+static struct
+{
+    bool on;
+    uint8_t *buf;           // the events, a copy
+    uint32_t n;
+    uint64_t end_us;        // the last event, or a gap in the trace
+    struct cursor uart, usb, pin, i2c, analog, host;
+    uint16_t analog_value[PINS]; // the last read, by pin
+    uint8_t packet[4];      // the last I2C read handed out
+    uint8_t packet_len;
+    bool usb_host;
+} replay;
+
+// [power accounting]
+static struct sim_power power;
+static uint8_t mcu_mode; // SIM_MCU_*, while the clock moves
+static uint8_t backlight;
+static bool panel_asleep;
+static uint64_t tone_until;
+
+static void clock_to(uint64_t);
+static void peer_send(struct uart *, uint64_t, const char *);
+static void peer_command(struct uart *);
+static bool run_next(uint64_t);
+static void adc_read_packet(void);
+static uint32_t noisy_mm(struct uart *);
+static void cursor_start(struct cursor *, uint8_t);
+static void cursor_next(struct cursor *);
+static uint64_t replay_due(void);
+static void replay_input(void);
+static void replay_packet(void);
+static void replay_prefill(void);
+
+// [harness controls]
+
+void sim_reset(void)
+{
+    now_us = 0;
+    memset( timers, 0, sizeof timers );
+    memset( uarts, 0, sizeof uarts );
+    memset( &adc, 0, sizeof adc );
+    memset( &i2c, 0, sizeof i2c );
+    memset( &i2c_stats, 0, sizeof i2c_stats );
+    memset( presses, 0, sizeof presses );
+    memset( pin_isr, 0, sizeof pin_isr );
+    memset( analog_mv, 0, sizeof analog_mv );
+    memset( pin_level, 1, sizeof pin_level ); // pulled up
+    memset( eeprom, 0xFF, sizeof eeprom );    // erased
+    memset( eeprom_wear, 0, sizeof eeprom_wear );
+    eeprom_budget = -1;
+    memset( history, 0xFF, sizeof history );
+    memset( history_erases, 0, sizeof history_erases );
+    history_overlap = false;
+    rtc_base = 1488326400; // March 1, 2017
+    usb_n = 0;
+    usb_rx_n = 0;
+    usb_in = NULL;
+    usb_out = NULL;
+    usb_on_receive = NULL;
+    tones = 0;
+    rng = 2463534242u;
+
+    for ( uint8_t i = 0; i < HAL_TIMER_COUNT; i++ )
+        timers[i].due = NEVER;
+
+    for ( uint8_t p = 0; p < UART_COUNT; p++ )
+    {
+        uarts[p].distance_mm = 1000;
+        uarts[p].measure_us = 400000;
+
+        for ( uint8_t f = 0; f < PEER_FRAMES; f++ )
+            uarts[p].out[f].due = NEVER;
+    }
+
+    i2c.due = NEVER;
+    adc.config = 0x90; // power-on default: continuous, 12-bit
+
+    for ( uint8_t i = 0; i < PRESSES; i++ )
+        presses[i].due = NEVER;
+
+    at_due = NEVER;
+    at_fn = NULL;
+
+    free( replay.buf );
+    memset( &replay, 0, sizeof replay );
+
+    memset( &power, 0, sizeof power );
+    mcu_mode = SIM_MCU_RUN;
+    backlight = 255; // until the firmware says otherwise
+    panel_asleep = false;
+    tone_until = 0;
+}
+
+void sim_advance(uint32_t us)
+{
+    uint64_t until = now_us + us;
+
+    while ( run_next(until) )
+        ;
+
+    clock_to( until );
+}
+
+uint64_t sim_now_us(void)
+{
+    return now_us;
+}
+
+void sim_laser_distance(uint8_t port, uint32_t mm)
+{
+    uarts[port].distance_mm = mm;
+}
+
+void sim_laser_measure_time(uint8_t port, uint32_t ms)
+{
+    uarts[port].measure_us = ms * 1000;
+}
+
+void sim_laser_unplugged(uint8_t port, bool unplugged)
+{
+    uarts[port].unplugged = unplugged;
+}
+
+void sim_laser_line(uint8_t port, const char *s)
+{
+    struct uart *u = &uarts[port];
+
+    while ( *s && u->rx_head - u->rx_tail < UART_RX_SIZE )
+        u->rx[u->rx_head++ & (UART_RX_SIZE - 1)] = *s++;
+}
+
+void sim_laser_noise(uint8_t port, uint32_t sigma_um, uint16_t outliers_per_mille)
+{
+    uarts[port].sigma_um = sigma_um;
+    uarts[port].outliers = outliers_per_mille;
+}
+
+void sim_adc_input_uv(int32_t uv)
+{
+    adc.input_uv = uv;
+}
+
+void sim_adc_unplugged(bool unplugged)
+{
+    adc.unplugged = unplugged;
+}
+
+const struct sim_i2c *sim_i2c_stats(void)
+{
+    return &i2c_stats;
+}
+
+void sim_i2c_clear(void)
+{
+    memset( &i2c_stats, 0, sizeof i2c_stats );
+}
+
+void sim_analog_mv(uint8_t pin, uint16_t mv)
+{
+    analog_mv[pin] = mv;
+}
+
+void sim_press(uint8_t pin, uint32_t at_ms, uint32_t hold_ms)
+{
+    uint8_t n = 0;
+
+    for ( uint8_t i = 0; i < PRESSES && n < 2; i++ )
+    {
+        if ( presses[i].due != NEVER )
+            continue;
+
+        presses[i].pin = pin;
+        presses[i].level = (n == 0) ? 0 : 1;
+        presses[i].due = (uint64_t)(n == 0 ? at_ms : at_ms + hold_ms) * 1000;
+        n++;
+    }
+}
+
+void sim_at(uint32_t at_ms, void (*fn)(void))
+{
+    at_due = (uint64_t)at_ms * 1000;
+    at_fn = fn;
+}
+
+uint32_t sim_tones(void)
+{
+    return tones;
+}
+
+const struct sim_power *sim_power_states(void)
+{
+    return &power;
+}
+
+uint8_t *sim_eeprom(void)
+{
+    return eeprom;
+}
+
+const uint32_t *sim_eeprom_wear(void)
+{
+    return eeprom_wear;
+}
+
+void sim_eeprom_cut(int32_t n)
+{
+    eeprom_budget = n;
+}
+
+uint8_t *sim_history(void)
+{
+    return history;
+}
+
+const uint32_t *sim_history_erases(void)
+{
+    return history_erases;
+}
+
+void sim_history_overlap(bool on)
+{
+    history_overlap = on;
+}
+
+void sim_rtc_set(uint32_t seconds)
+{
+    rtc_base = seconds - (uint32_t)(now_us / 1000000);
+}
+
+const uint8_t *sim_usb_take(uint32_t *n)
+{
+    *n = usb_n;
+    usb_n = 0;
+
+    return usb;
+}
+
+void sim_usb_send(const void *buf, uint32_t n)
+{
+    if ( usb_rx_n + n > sizeof usb_rx )
+        n = sizeof usb_rx - usb_rx_n;
+
+    memcpy( usb_rx + usb_rx_n, buf, n );
+    usb_rx_n += n;
+
+    if ( usb_rx_n && usb_on_receive )
+        usb_on_receive();
+}
+
+void sim_usb_pipe(uint32_t (*in)(uint8_t *, uint32_t), void (*out)(const uint8_t *, uint32_t))
+{
+    usb_in = in;
+    usb_out = out;
+}
+
+// take the board's inputs from a trace (TRACE_MAGIC and its events) from now
+// on; call after sim_reset(), before the firmware's setup().  the laser modules
+// go quiet.  false if it isn't a trace this firmware can read.
+bool sim_replay(const uint8_t *trace, uint32_t n)
+{
+    struct trace_event ev = {};
+    uint32_t magic = sizeof TRACE_MAGIC - 1;
+
+    if ( n < magic || memcmp(trace, TRACE_MAGIC, magic) )
+        return false;
+
+    if ( !trace_next(trace + magic, n - magic, 0, &ev) || ev.kind != TRACE_BOOT || ev.data[0] != TRACE_FORMAT )
+        return false;
+
+    free( replay.buf );
+    memset( &replay, 0, sizeof replay );
+
+    replay.buf = (uint8_t *)malloc( n - magic );
+    replay.n = n - magic;
+    memcpy( replay.buf, trace + magic, replay.n );
+    replay.on = true;
+
+    cursor_start( &replay.uart, TRACE_UART );
+    cursor_start( &replay.usb, TRACE_USB );
+    cursor_start( &replay.pin, TRACE_PIN );
+    cursor_start( &replay.i2c, TRACE_I2C );
+    cursor_start( &replay.analog, TRACE_ANALOG );
+    cursor_start( &replay.host, TRACE_USB_HOST );
+
+    replay_prefill();
+
+    return true;
+}
+
+// ms since boot that the trace runs to: its last event, or a gap
+uint32_t sim_replay_end_ms(void)
+{
+    return (uint32_t)((replay.end_us + 999) / 1000);
+}
+
+// [scheduler]
+
+// run whichever thing falls due first, if it's due by 'until'
+static bool run_next(uint64_t until)
+{
+    uint64_t due = NEVER;
+    int kind = -1, idx = 0, sub = 0;
+
+    for ( int t = 0; t < HAL_TIMER_COUNT; t++ )
+        if ( timers[t].due < due ) { due = timers[t].due; kind = 0; idx = t; }
+
+    for ( int p = 0; p < UART_COUNT; p++ )
+        for ( int f = 0; f < PEER_FRAMES; f++ )
+            if ( uarts[p].out[f].due < due ) { due = uarts[p].out[f].due; kind = 1; idx = p; sub = f; }
+
+    if ( i2c.due < due ) { due = i2c.due; kind = 2; }
+
+    for ( int i = 0; i < PRESSES; i++ )
+        if ( presses[i].due < due ) { due = presses[i].due; kind = 3; idx = i; }
+
+    if ( at_due < due ) { due = at_due; kind = 4; }
+
+    if ( replay_due() < due ) { due = replay_due(); kind = 5; }
+
+    if ( kind < 0 || due > until )
+        return false;
+
+    clock_to( due );
+
+    switch ( kind )
+    {
+        case 0: // timer interrupt
+            timers[idx].due += timers[idx].period;
+            timers[idx].fn();
+            break;
+
+        case 1: // a frame arrives at the UART
+        {
+            struct uart *u = &uarts[idx];
+            const char *s = u->out[sub].text;
+
+            while ( *s && u->rx_head - u->rx_tail < UART_RX_SIZE )
+                u->rx[u->rx_head++ & (UART_RX_SIZE - 1)] = *s++;
+
+            u->out[sub].due = NEVER;
+            break;
+        }
+
+        case 2: // I2C read complete
+            i2c.due = NEVER;
+            adc_read_packet();
+            if ( i2c.on_read )
+                i2c.on_read();
+            break;
+
+        case 3: // button edge
+            presses[idx].due = NEVER;
+            pin_level[presses[idx].pin] = presses[idx].level;
+            if ( pin_isr[presses[idx].pin] )
+                pin_isr[presses[idx].pin]();
+            break;
+
+        case 4: // the harness's
+            at_due = NEVER;
+            at_fn();
+            break;
+
+        case 5: // the trace's
+            replay_input();
+            break;
+    }
+
+    return true;
+}
+
+// [time]
+
+uint32_t hal_millis(void)
+{
+    return (uint32_t)(now_us / 1000);
+}
+
+uint32_t hal_micros(void)
+{
+    return (uint32_t)now_us;
+}
+
+void hal_delay(uint32_t ms)
+{
+    sim_advance(ms * 1000);
+}
+
+// wake for the next thing that's due, or the 1 ms system tick
+void hal_sleep(void)
+{
+    uint8_t buf[256];
+    uint32_t n;
+
+    if ( usb_in && (n = usb_in(buf, sizeof buf)) > 0 )
+        sim_usb_send( buf, n );
+
+    mcu_mode = SIM_MCU_WAIT;
+
+    if ( !run_next(now_us + 1000) )
+        clock_to( now_us + 1000 );
+
+    mcu_mode = SIM_MCU_RUN;
+}
+
+// nothing runs until a button edge (or sim_at()), and the timers stand still, so whatever
+// they (and the peripherals) had due moves out by the time asleep.  with no
+// press coming, it wakes straight away, as it would on a stray interrupt.
+void hal_stop(void)
+{
+    uint64_t wake = NEVER, gap;
+
+    for ( int i = 0; i < PRESSES; i++ )
+        if ( presses[i].due < wake )
+            wake = presses[i].due;
+
+    if ( at_due < wake )
+        wake = at_due;
+
+    if ( replay.pin.more && replay.pin.ev.us < wake )
+        wake = replay.pin.ev.us;
+
+    if ( wake == NEVER || wake <= now_us )
+        return;
+
+    gap = wake - now_us;
+
+    for ( int t = 0; t < HAL_TIMER_COUNT; t++ )
+        if ( timers[t].due != NEVER )
+            timers[t].due += gap;
+
+    for ( int p = 0; p < UART_COUNT; p++ )
+        for ( int f = 0; f < PEER_FRAMES; f++ )
+            if ( uarts[p].out[f].due != NEVER )
+                uarts[p].out[f].due += gap;
+
+    if ( i2c.due != NEVER )
+        i2c.due += gap;
+
+    mcu_mode = SIM_MCU_STOP;
+    clock_to( wake );
+    mcu_mode = SIM_MCU_RUN;
+
+    run_next( now_us ); // the button's interrupt
+}
+
+// move the clock on, charging the time to whatever was powered meanwhile
+static void clock_to(uint64_t t)
+{
+    uint64_t dt;
+
+    if ( t <= now_us )
+        return;
+
+    dt = t - now_us;
+
+    power.mcu_us[mcu_mode] += dt;
+    power.backlight_us += dt * backlight / 255;
+
+    if ( !panel_asleep )
+        power.panel_on_us += dt;
+
+    if ( tone_until > now_us )
+        power.tone_us += (tone_until < t ? tone_until : t) - now_us;
+
+    for ( int p = 0; p < UART_COUNT; p++ )
+    {
+        if ( uarts[p].lit )
+            power.laser_lit_us[p] += dt;
+
+        if ( uarts[p].measuring_until > now_us )
+            power.laser_measuring_us[p] += (uarts[p].measuring_until < t ? uarts[p].measuring_until : t) - now_us;
+    }
+
+    now_us = t;
+}
+
+// real time, not the virtual clock: the profiler times the simulator's own
+// work, in nanoseconds
+void hal_cycles_start(void)
+{
+}
+
+uint32_t hal_cycles(void)
+{
+    return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+uint32_t hal_cycles_hz(void)
+{
+    return 1000000000;
+}
+
+void hal_irq_off(void)
+{
+}
+
+void hal_irq_on(void)
+{
+}
+
+uint32_t hal_irq_save(void)
+{
+    return 0;
+}
+
+void hal_irq_restore(uint32_t)
+{
+}
+
+// [laser UARTs]
+
+void hal_uart_begin(uint8_t, uint32_t)
+{
+}
+
+int hal_uart_available(uint8_t port)
+{
+    return (int)(uarts[port].rx_head - uarts[port].rx_tail);
+}
+
+int hal_uart_read(uint8_t port)
+{
+    struct uart *u = &uarts[port];
+
+    int c;
+
+    if ( u->rx_head == u->rx_tail )
+        return -1;
+
+    c = u->rx[u->rx_tail++ & (UART_RX_SIZE - 1)];
+
+#if TRACE
+    trace_uart( port, c );
+#endif
+
+    return c;
+}
+
+// the module sees the command byte by byte and acts on the closing '&'
+void hal_uart_write(uint8_t port, const char *s)
+{
+    struct uart *u = &uarts[port];
+
+    for ( ; *s; s++ )
+    {
+        if ( *s == '$' )
+            u->cmd_len = 0;
+
+        if ( u->cmd_len < sizeof u->cmd - 1 )
+            u->cmd[u->cmd_len++] = *s;
+
+        if ( *s == '&' )
+        {
+            u->cmd[u->cmd_len] = '\0';
+            peer_command( u );
+            u->cmd_len = 0;
+        }
+    }
+}
+
+static void peer_command(struct uart *u)
+{
+    char frame[24];
+    uint32_t mm, sum;
+
+    if ( u->unplugged || replay.on ) // a replay's answers are in the trace
+        return;
+
+    if ( !strcmp(u->cmd, CMD_ON) )
+    {
+        peer_send( u, now_us + LASER_REPLY_US, FRAME_REPLY );
+        peer_send( u, now_us + LASER_REPLY_US + LASER_ON_US, FRAME_ON_CONFIRM );
+        u->lit = true;
+    }
+    else if ( !strcmp(u->cmd, CMD_OFF) )
+    {
+        peer_send( u, now_us + LASER_REPLY_US, FRAME_REPLY );
+        peer_send( u, now_us + 2 * LASER_REPLY_US, FRAME_OFF_CONFIRM );
+        u->lit = false;
+    }
+    else if ( !strcmp(u->cmd, CMD_MEASURE) )
+    {
+        // the beam goes off with the result
+        peer_send( u, now_us + LASER_REPLY_US, FRAME_REPLY );
+        peer_send( u, now_us + 2 * LASER_REPLY_US, FRAME_MEASURE_CONFIRM );
+        u->lit = false;
+        u->measuring_until = now_us + u->measure_us;
+
+        mm = noisy_mm( u );
+
+        // $ 0006 21 DDDDDDDD SS &, the checksum being the sum of the pairs
+        sum = 6 + 21 + mm / 1000000 + (mm / 10000) % 100 + (mm / 100) % 100 + mm % 100;
+
+        frame[0] = '$';
+        memcpy( frame + 1, "000621", 6 );
+        for ( int i = 14; i >= 7; i--, mm /= 10 )
+            frame[i] = '0' + mm % 10;
+        frame[15] = '0' + (sum / 10) % 10;
+        frame[16] = '0' + sum % 10;
+        frame[17] = '&';
+        frame[18] = '\0';
+
+        peer_send( u, now_us + u->measure_us, frame );
+    }
+}
+
+// xorshift32; the sequence restarts with sim_reset(), so runs are repeatable
+static uint32_t random32(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+
+    return rng;
+}
+
+static uint32_t noisy_mm(struct uart *u)
+{
+    double um = u->distance_mm * 1000.0, r1, r2;
+
+    if ( u->sigma_um )
+    {
+        // Box-Muller
+        r1 = (random32() + 1.0) / 4294967297.0;
+        r2 = random32() / 4294967296.0;
+        um += u->sigma_um * sqrt(-2.0 * log(r1)) * cos(2.0 * M_PI * r2);
+    }
+
+    if ( u->outliers && random32() % 1000 < u->outliers )
+        um += (random32() & 1 ? 1 : -1) * (50000.0 + random32() % 450000);
+
+    return um < 1000.0 ? 1 : (uint32_t)lround(um / 1000.0);
+}
+
+static void peer_send(struct uart *u, uint64_t due, const char *text)
+{
+    for ( uint8_t f = 0; f < PEER_FRAMES; f++ )
+    {
+        if ( u->out[f].due == NEVER )
+        {
+            strcpy( u->out[f].text, text );
+            u->out[f].due = due;
+            return;
+        }
+    }
+}
+
+// [I2C, with the MCP3421 on the other end]
+
+void hal_i2c_begin(uint32_t)
+{
+}
+
+// a config write restarts conversions
+bool hal_i2c_write(uint8_t, uint8_t byte)
+{
+    i2c_stats.writes++;
+    i2c_stats.bus_us += 2 * I2C_BYTE_US;
+
+    if ( now_us < ADC_POWER_UP_US || adc.unplugged )
+    {
+        i2c_stats.naks++;
+        return false;
+    }
+
+    adc.config = byte;
+    adc.started = now_us;
+    adc.reads = 0;
+
+    return true;
+}
+
+void hal_i2c_write_async(uint8_t addr, uint8_t byte)
+{
+    hal_i2c_write( addr, byte );
+}
+
+void hal_i2c_request(uint8_t, uint8_t n)
+{
+    i2c.want = n;
+    i2c.due = now_us + (uint64_t)(n + 1) * I2C_BYTE_US;
+    i2c_stats.reads++;
+    i2c_stats.bus_us += (uint64_t)(n + 1) * I2C_BYTE_US;
+}
+
+void hal_i2c_on_read(void (*fn)(void))
+{
+    i2c.on_read = fn;
+}
+
+uint8_t hal_i2c_read(uint8_t *buf, uint8_t max)
+{
+    uint8_t n = 0;
+
+    while ( i2c.pos < i2c.len && n < max )
+        buf[n++] = i2c.buf[i2c.pos++];
+
+#if TRACE
+    trace_i2c( buf, n );
+#endif
+
+    return n;
+}
+
+bool hal_i2c_done(void)
+{
+    return i2c.due == NEVER;
+}
+
+void hal_i2c_finish(void)
+{
+    if ( i2c.due != NEVER )
+        sim_advance( (uint32_t)(i2c.due - now_us) );
+}
+
+// fill the read buffer the way the converter would: the latest result and the
+// config byte, with /RDY clear only if a conversion finished since the last read
+static void adc_read_packet(void)
+{
+    static const uint32_t period_us[] = { 4167, 16667, 66667, 266667 }; // 240/60/15/3.75 SPS
+    uint8_t res = (adc.config >> 2) & 0x03;
+    uint8_t bits = 12 + 2 * res;
+    uint32_t done = (uint32_t)((now_us - adc.started) / period_us[res]);
+    int32_t max = (1L << (bits - 1)) - 1;
+    // LSB is 2.048 V / 2^(bits-1), i.e. 1000 uV at 12 bits down to 15.625 uV at 18
+    int64_t code = ((int64_t)adc.input_uv << (bits - 1)) / 2048000;
+    uint8_t config = adc.config & ~MCP342X_RDY;
+    uint64_t latency;
+
+    if ( replay.on )
+    {
+        replay_packet();
+        return;
+    }
+
+    i2c.len = 0;
+    i2c.pos = 0;
+
+    if ( adc.unplugged )
+        return;
+
+    if ( code > max ) code = max;
+    if ( code < -max - 1 ) code = -max - 1;
+
+    if ( done <= adc.reads )
+    {
+        config |= MCP342X_RDY; // nothing new
+    }
+    else
+    {
+        adc.reads = done;
+
+        latency = now_us - (adc.started + (uint64_t)done * period_us[res]);
+        i2c_stats.samples++;
+        i2c_stats.latency_us += latency;
+        if ( latency > i2c_stats.latency_max_us )
+            i2c_stats.latency_max_us = (uint32_t)latency;
+    }
+
+    if ( bits == 18 )
+        i2c.buf[i2c.len++] = (uint8_t)(code >> 16);
+
+    i2c.buf[i2c.len++] = (uint8_t)(code >> 8);
+    i2c.buf[i2c.len++] = (uint8_t)code;
+    i2c.buf[i2c.len++] = config;
+
+    if ( i2c.len > i2c.want )
+        i2c.len = i2c.want;
+}
+
+// [timers]
+
+void hal_timer_start(uint8_t timer, uint32_t period_us, void (*fn)(void))
+{
+    timers[timer].period = period_us;
+    timers[timer].fn = fn;
+    timers[timer].due = now_us + period_us;
+}
+
+void hal_timer_stop(uint8_t timer)
+{
+    timers[timer].due = NEVER;
+}
+
+// [internal ADC, buttons, speaker]
+
+void hal_analog_averaging(uint8_t)
+{
+}
+
+uint16_t hal_analog_read(uint8_t pin)
+{
+    uint16_t v = (uint16_t)((uint32_t)analog_mv[pin] * 1024 / 3300);
+
+    // the value read last, by now, in the trace
+    for ( ; replay.analog.more && replay.analog.ev.us <= now_us; cursor_next(&replay.analog) )
+        replay.analog_value[replay.analog.ev.data[0] % PINS] = replay.analog.ev.data[1] | replay.analog.ev.data[2] << 8;
+
+    if ( replay.on )
+        v = replay.analog_value[pin];
+
+#if TRACE
+    trace_analog( pin, v );
+#endif
+
+    return v;
+}
+
+void hal_button_attach(uint8_t pin, void (*isr)(void))
+{
+    pin_isr[pin] = isr;
+}
+
+uint8_t hal_pin_read(uint8_t pin)
+{
+#if TRACE
+    trace_pin( pin, pin_level[pin] );
+#endif
+
+    return pin_level[pin];
+}
+
+void hal_tone(uint8_t, uint16_t, uint32_t ms)
+{
+    tones++;
+
+    if ( now_us + ms * 1000ULL > tone_until )
+        tone_until = now_us + ms * 1000ULL;
+}
+
+void hal_backlight(uint8_t, uint8_t level)
+{
+    backlight = level;
+}
+
+void sim_panel_sleep(bool asleep)
+{
+    panel_asleep = asleep;
+}
+
+// [EEPROM]
+
+void hal_eeprom_read(uint32_t addr, void *buf, uint32_t n)
+{
+    if ( addr + n > SIM_EEPROM_SIZE )
+        return;
+
+    memcpy( buf, eeprom + addr, n );
+
+#if TRACE
+    trace_eeprom( addr, buf, n );
+#endif
+}
+
+// byte by byte, in order, so a power cut leaves the first part written
+void hal_eeprom_write(uint32_t addr, const void *buf, uint32_t n)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+
+    if ( addr + n > SIM_EEPROM_SIZE )
+        return;
+
+    for ( uint32_t i = 0; i < n && eeprom_budget != 0; i++ )
+    {
+        if ( eeprom[addr + i] != p[i] )
+        {
+            eeprom[addr + i] = p[i];
+            eeprom_wear[addr + i]++;
+        }
+
+        if ( eeprom_budget > 0 )
+            eeprom_budget--;
+    }
+}
+
+// [RTC and USB]
+
+uint32_t hal_rtc_seconds(void)
+{
+    uint32_t s = rtc_base + (uint32_t)(now_us / 1000000);
+
+#if TRACE
+    trace_rtc( s );
+#endif
+
+    return s;
+}
+
+void hal_usb_write(const void *buf, uint32_t n)
+{
+    if ( usb_out )
+    {
+        usb_out( (const uint8_t *)buf, n );
+        return;
+    }
+
+    if ( usb_n + n <= sizeof usb )
+    {
+        memcpy( usb + usb_n, buf, n );
+        usb_n += n;
+    }
+}
+
+uint32_t hal_usb_read(void *buf, uint32_t max)
+{
+    uint32_t n = usb_rx_n < max ? usb_rx_n : max;
+
+    memcpy( buf, usb_rx, n );
+    memmove( usb_rx, usb_rx + n, usb_rx_n - n );
+    usb_rx_n -= n;
+
+#if TRACE
+    trace_usb( buf, n );
+#endif
+
+    return n;
+}
+
+// called as bytes arrive rather than from a 1 ms tick
+void hal_usb_on_receive(void (*fn)(void))
+{
+    usb_on_receive = fn;
+}
+
+// a real host is on the pipe, or was in the trace
+bool hal_usb_connected(void)
+{
+    bool connected = usb_in != NULL;
+
+    for ( ; replay.host.more && replay.host.ev.us <= now_us; cursor_next(&replay.host) )
+        replay.usb_host = replay.host.ev.arg;
+
+    if ( replay.on )
+        connected = replay.usb_host;
+
+#if TRACE
+    trace_usb_host( connected );
+#endif
+
+    return connected;
+}
+
+// [history flash]: the same rules as the real one
+
+bool hal_history_usable(void)
+{
+    return !history_overlap;
+}
+
+void hal_history_read(uint32_t offset, void *buf, uint32_t n)
+{
+    if ( offset + n <= sizeof history )
+        memcpy( buf, history + offset, n );
+}
+
+bool hal_history_erase(uint16_t sector)
+{
+    if ( sector >= HAL_HISTORY_SECTORS )
+        return false;
+
+    memset( history + sector * HAL_HISTORY_SECTOR, 0xFF, HAL_HISTORY_SECTOR );
+    history_erases[sector]++;
+
+    return true;
+}
+
+bool hal_history_program(uint32_t offset, const void *buf, uint32_t n)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+
+    if ( ((offset | n) & 3) || offset + n > sizeof history )
+        return false;
+
+    // programming can only clear bits
+    for ( uint32_t i = 0; i < n; i++ )
+        history[offset + i] &= p[i];
+
+    return true;
+}
+
+// [replay]
+
+static void cursor_start(struct cursor *c, uint8_t kind)
+{
+    memset( c, 0, sizeof *c );
+    c->kind = kind;
+
+    cursor_next( c );
+}
+
+// on to the next event of the cursor's kind.  a trace with a gap stops there,
+// since the inputs that went missing would throw everything after it off.
+static void cursor_next(struct cursor *c)
+{
+    uint32_t next;
+
+    while ( (next = trace_next(replay.buf, replay.n, c->pos, &c->ev)) != 0 && c->ev.kind != TRACE_LOST )
+    {
+        c->pos = next;
+
+        if ( c->ev.kind == c->kind )
+        {
+            c->more = true;
+            return;
+        }
+    }
+
+    c->more = false;
+}
+
+// the next byte or button edge
+static uint64_t replay_due(void)
+{
+    uint64_t due = NEVER;
+
+    if ( replay.uart.more && replay.uart.ev.us < due )
+        due = replay.uart.ev.us;
+    if ( replay.usb.more && replay.usb.ev.us < due )
+        due = replay.usb.ev.us;
+    if ( replay.pin.more && replay.pin.ev.us < due )
+        due = replay.pin.ev.us;
+
+    return due;
+}
+
+// bytes that were read at the time go into the UARTs and USB together; a button
+// edge runs its interrupt, which reads the level
+static void replay_input(void)
+{
+    struct cursor *c;
+    struct uart *u;
+
+    for ( c = &replay.uart; c->more && c->ev.us <= now_us; cursor_next(c) )
+    {
+        u = &uarts[c->ev.arg % UART_COUNT];
+
+        if ( u->rx_head - u->rx_tail < UART_RX_SIZE )
+            u->rx[u->rx_head++ & (UART_RX_SIZE - 1)] = c->ev.data[0];
+    }
+
+    for ( c = &replay.usb; c->more && c->ev.us <= now_us; cursor_next(c) )
+        sim_usb_send( c->ev.data, c->ev.n );
+
+    c = &replay.pin;
+
+    if ( c->more && c->ev.us <= now_us )
+    {
+        uint8_t pin = c->ev.data[0] % PINS;
+
+        pin_level[pin] = c->ev.data[1];
+        cursor_next( c );
+
+        if ( pin_isr[pin] )
+            pin_isr[pin]();
+    }
+}
+
+// a read completing: the oldest read by now that had a new result, skipping the
+// ones that didn't.  with none left, the last one again, with /RDY set, so
+// reads that come sooner than they did on the board find nothing new.
+static void replay_packet(void)
+{
+    struct cursor *c = &replay.i2c;
+    bool fresh = false;
+
+    for ( ; !fresh && c->more && c->ev.us <= now_us; cursor_next(c) )
+    {
+        replay.packet_len = c->ev.n < sizeof replay.packet ? c->ev.n : sizeof replay.packet;
+        memcpy( replay.packet, c->ev.data, replay.packet_len );
+
+        fresh = replay.packet_len && !(replay.packet[replay.packet_len - 1] & MCP342X_RDY);
+    }
+
+    i2c.len = replay.packet_len < i2c.want ? replay.packet_len : i2c.want;
+    i2c.pos = 0;
+    memcpy( i2c.buf, replay.packet, i2c.len );
+
+    if ( !fresh && replay.packet_len )
+        replay.packet[replay.packet_len - 1] |= MCP342X_RDY;
+}
+
+// the EEPROM as the first read of each byte found it, the battery's pin at its
+// first value, and the clock as it was; and where the trace ends
+static void replay_prefill(void)
+{
+    static bool seen[SIM_EEPROM_SIZE];
+    bool rtc = false, analog[PINS] = {};
+    struct trace_event ev = {};
+    uint32_t pos = 0, next, addr;
+
+    memset( seen, 0, sizeof seen );
+
+    while ( (next = trace_next(replay.buf, replay.n, pos, &ev)) != 0 && ev.kind != TRACE_LOST )
+    {
+        pos = next;
+        replay.end_us = ev.us;
+
+        switch ( ev.kind )
+        {
+            case TRACE_EEPROM:
+                addr = ev.data[0] | ev.data[1] << 8;
+
+                for ( uint32_t i = 2; i < ev.n && addr < SIM_EEPROM_SIZE; i++, addr++ )
+                {
+                    if ( !seen[addr] )
+                        eeprom[addr] = ev.data[i];
+                    seen[addr] = true;
+                }
+                break;
+
+            case TRACE_ANALOG:
+                if ( ev.data[0] < PINS && !analog[ev.data[0]] )
+                {
+                    replay.analog_value[ev.data[0]] = ev.data[1] | ev.data[2] << 8;
+                    analog[ev.data[0]] = true;
+                }
+                break;
+
+            case TRACE_RTC:
+                if ( !rtc )
+                {
+                    memcpy( &rtc_base, ev.data, 4 );
+                    rtc_base -= (uint32_t)(ev.us / 1000000);
+                    rtc = true;
+                }
+                break;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,126 @@
+/*
+ * Longitude hardware abstraction: host simulation controls
+ *
+ * The host implementation of longitude_hal.h runs on a virtual clock that only
+ * moves when the firmware waits (hal_delay, hal_sleep) or the harness calls
+ * sim_advance(), so simulated time passes as fast as the PC can compute it.
+ * Interrupt handlers run synchronously as the clock passes their due time.
+ */
+#ifndef LONGITUDE_HAL_HOST_HEADER
+#define LONGITUDE_HAL_HOST_HEADER
+
+#include <stdint.h>
+
+#define SIM_EEPROM_SIZE 2048 // Teensy 3.2
+
+// clock
+void sim_reset(void);
+void sim_advance(uint32_t us);
+uint64_t sim_now_us(void);
+
+// laser module peers: what the next measurement on a port returns (millimeters,
+// or one of the module's 15..18 error codes), and how long a measurement takes.
+// a port that is "unplugged" never answers.
+void sim_laser_distance(uint8_t port, uint32_t mm);
+void sim_laser_measure_time(uint8_t port, uint32_t ms);
+void sim_laser_unplugged(uint8_t port, bool);
+
+// bytes on a laser port's line right now, as if the module had sent them:
+// noise, half a frame, several frames at once
+void sim_laser_line(uint8_t port, const char *);
+
+// measurement noise: gaussian with the given sigma, plus the odd wild reading
+// (off by 5 to 50 cm) per thousand shots.  the module still reports whole mm.
+void sim_laser_noise(uint8_t port, uint32_t sigma_um, uint16_t outliers_per_mille);
+
+// MCP3421 model: input voltage at the converter, in microvolts.  an unplugged
+// converter NAKs its writes and sends nothing back.
+void sim_adc_input_uv(int32_t uv);
+void sim_adc_unplugged(bool);
+
+// the I2C bus to it, counted since sim_reset() or sim_i2c_clear(): transactions, how long they kept
+// the bus busy, and how long each new conversion sat in the converter before a
+// read brought it in
+struct sim_i2c
+{
+    uint32_t writes;         // configuration writes, answered or not
+    uint32_t naks;
+    uint32_t reads;
+    uint32_t samples;        // reads that brought in a new conversion
+    uint64_t bus_us;
+    uint64_t latency_us;     // conversion done to read complete, summed over samples
+    uint32_t latency_max_us;
+};
+
+const struct sim_i2c *sim_i2c_stats(void);
+void sim_i2c_clear(void); // count from now
+
+// internal ADC pin voltage, in millivolts (3.3V reference, 10 bits)
+void sim_analog_mv(uint8_t pin, uint16_t mv);
+
+// buttons: press (pin low) at an absolute time, release hold_ms later
+void sim_press(uint8_t pin, uint32_t at_ms, uint32_t hold_ms);
+
+// the harness's own interrupt: fn runs once, at an absolute time, as a handler
+// would (it also wakes hal_stop(), as a stray interrupt would on the board)
+void sim_at(uint32_t at_ms, void (*fn)(void));
+
+// speaker: notes started so far
+uint32_t sim_tones(void);
+
+// power accounting, for an energy model: how long each part spent in each of
+// its power states.  the firmware's own computing takes no simulated time, so
+// the MCU only counts as running in hal_delay() and the harness's sim_advance().
+enum SIM_MCU { SIM_MCU_RUN, SIM_MCU_WAIT, SIM_MCU_STOP };
+
+struct sim_power
+{
+    uint64_t mcu_us[3];             // by SIM_MCU
+    uint64_t laser_lit_us[2];       // beam on for aiming, by port
+    uint64_t laser_measuring_us[2];
+    uint64_t tone_us;
+    uint64_t backlight_us;          // at full brightness, or the equivalent
+    uint64_t panel_on_us;           // display controller out of its sleep mode
+};
+
+const struct sim_power *sim_power_states(void);
+
+// the display model (tools/host/ILI9341_t3.cpp) reports the panel's sleep mode
+void sim_panel_sleep(bool);
+
+// EEPROM contents, for seeding and inspection, and how many times each byte
+// has been written (like the Teensy core, writing the value a byte already
+// holds doesn't count)
+uint8_t *sim_eeprom(void);
+const uint32_t *sim_eeprom_wear(void);
+
+// power loss: only the next n bytes written reach the EEPROM (-1: no limit)
+void sim_eeprom_cut(int32_t n);
+
+// history flash contents, and how often each sector has been erased
+uint8_t *sim_history(void);
+const uint32_t *sim_history_erases(void);
+
+// as if the sketch had grown into the history flash (hal_history_usable())
+void sim_history_overlap(bool);
+
+// the real-time clock reads this plus the simulated time
+void sim_rtc_set(uint32_t seconds);
+
+// everything written to USB serial since the last call
+const uint8_t *sim_usb_take(uint32_t *n);
+
+// bytes from the host, for the firmware to read
+void sim_usb_send(const void *buf, uint32_t n);
+
+// or connect USB serial to a real host: the firmware's writes go to 'out' as
+// they happen, and every hal_sleep() asks 'in' for more bytes (non-blocking)
+void sim_usb_pipe(uint32_t (*in)(uint8_t *, uint32_t), void (*out)(const uint8_t *, uint32_t));
+
+// replay a trace recorded with TRACE built in (longitude_trace.h): after
+// sim_reset(), before setup().  false if it isn't one.  sim_replay_end_ms()
+// is when it runs out.
+bool sim_replay(const uint8_t *trace, uint32_t n);
+uint32_t sim_replay_end_ms(void);
+
+#endif
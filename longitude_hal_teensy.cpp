@@ -0,0 +1,505 @@
+/*
+ * Longitude hardware abstraction: Teensy 3.2
+ */
+#if defined(TEENSYDUINO)
+
+#include "Arduino.h"
+#include <i2c_t3.h>
+#include <IntervalTimer.h>
+#include <EEPROM.h>
+#include <string.h>
+#include "longitude_hal.h"
+#include "longitude_trace.h"
+
+static HardwareSerial *const uarts[] = { &Serial2, &Serial3 };
+
+// the four PIT channels are shared by the timers before HAL_TIMER_BATTERY and
+// tone(); the rest count down on the 1 ms system tick (see [timers])
+#define PIT_TIMERS HAL_TIMER_BATTERY
+
+static IntervalTimer timers[PIT_TIMERS];
+
+static void systick_chain(void);
+static uint64_t rtc_ticks(void);
+
+// [time]
+
+uint32_t hal_millis(void)
+{
+    return millis();
+}
+
+uint32_t hal_micros(void)
+{
+    return micros();
+}
+
+void hal_delay(uint32_t ms)
+{
+    delay(ms);
+}
+
+void hal_sleep(void)
+{
+    __asm__ volatile ( "wfi" ::: "memory" );
+}
+
+// normal stop mode: the core, the PLL, SysTick and the PITs all stop, and a pin
+// change (the buttons) wakes it through the AWIC.  call with interrupts masked,
+// like hal_sleep(); the wakeup interrupt runs once they're unmasked.  millis()
+// stood still meanwhile, so it's moved on by what the RTC, which keeps running
+// from its own 32 kHz crystal, says passed.
+void hal_stop(void)
+{
+    uint64_t before = rtc_ticks();
+
+    SMC_PMCTRL = (SMC_PMCTRL & ~SMC_PMCTRL_STOPM(7)) | SMC_PMCTRL_STOPM(0);
+    (void)SMC_PMCTRL; // the write has to land before the wfi
+    SCB_SCR |= SCB_SCR_SLEEPDEEP;
+
+    __asm__ volatile ( "wfi" ::: "memory" );
+
+    SCB_SCR &= ~SCB_SCR_SLEEPDEEP;
+
+    // the MCG comes back in PBE mode: once the PLL has locked again, run from it
+    while ( !(MCG_S & MCG_S_LOCK0) )
+        ;
+    MCG_C1 &= ~MCG_C1_CLKS(3);
+    while ( (MCG_S & MCG_S_CLKST_MASK) != MCG_S_CLKST(3) )
+        ;
+
+    systick_millis_count += (uint32_t)((rtc_ticks() - before) * 1000 / 32768);
+}
+
+// the RTC in 32768ths of a second; the prescaler carries into the seconds, so
+// read those again if they moved on in between
+static uint64_t rtc_ticks(void)
+{
+    uint32_t s, p;
+
+    do
+    {
+        s = RTC_TSR;
+        p = RTC_TPR;
+    } while ( s != RTC_TSR );
+
+    return (uint64_t)s * 32768 + (p & 0x7FFF);
+}
+
+void hal_irq_off(void)
+{
+    __disable_irq();
+}
+
+void hal_irq_on(void)
+{
+    __enable_irq();
+}
+
+// PRIMASK, so an interrupt handler (or code already masked) stays masked
+uint32_t hal_irq_save(void)
+{
+    uint32_t primask;
+
+    __asm__ volatile ( "mrs %0, primask" : "=r" (primask) :: "memory" );
+    __disable_irq();
+
+    return primask;
+}
+
+void hal_irq_restore(uint32_t primask)
+{
+    if ( !primask )
+        __enable_irq();
+}
+
+// the DWT counts core clocks
+void hal_cycles_start(void)
+{
+    ARM_DEMCR |= ARM_DEMCR_TRCENA;
+    ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+}
+
+uint32_t hal_cycles(void)
+{
+    return ARM_DWT_CYCCNT;
+}
+
+uint32_t hal_cycles_hz(void)
+{
+    return F_CPU;
+}
+
+// [laser UARTs]
+
+void hal_uart_begin(uint8_t port, uint32_t baud)
+{
+    uarts[port]->begin(baud);
+}
+
+int hal_uart_available(uint8_t port)
+{
+    return uarts[port]->available();
+}
+
+int hal_uart_read(uint8_t port)
+{
+    int c = uarts[port]->read();
+
+#if TRACE
+    trace_uart( port, c );
+#endif
+
+    return c;
+}
+
+void hal_uart_write(uint8_t port, const char *s)
+{
+    uarts[port]->print(s);
+}
+
+// [I2C]
+
+void hal_i2c_begin(uint32_t hz)
+{
+    // master mode, pins 18/19, external pullups, 200ms default timeout
+    Wire.begin(I2C_MASTER, 0x00, I2C_PINS_18_19, I2C_PULLUP_EXT, hz);
+    Wire.setDefaultTimeout(200000);
+}
+
+bool hal_i2c_write(uint8_t addr, uint8_t byte)
+{
+    Wire.beginTransmission(addr);
+    Wire.write(byte);
+    Wire.endTransmission(I2C_STOP);
+
+    return !Wire.getError();
+}
+
+void hal_i2c_write_async(uint8_t addr, uint8_t byte)
+{
+    Wire.beginTransmission(addr);
+    Wire.write(byte);
+    Wire.sendTransmission(I2C_STOP);
+}
+
+void hal_i2c_request(uint8_t addr, uint8_t n)
+{
+    Wire.sendRequest(addr, n, I2C_STOP);
+}
+
+void hal_i2c_on_read(void (*fn)(void))
+{
+    Wire.onReqFromDone(fn);
+}
+
+uint8_t hal_i2c_read(uint8_t *buf, uint8_t max)
+{
+    uint8_t i = 0;
+
+    while ( Wire.available() && i < max )
+        buf[i++] = Wire.readByte();
+
+#if TRACE
+    trace_i2c( buf, i );
+#endif
+
+    return i;
+}
+
+bool hal_i2c_done(void)
+{
+    return Wire.done();
+}
+
+void hal_i2c_finish(void)
+{
+    Wire.finish();
+}
+
+// [timers]
+
+// the tick timers' periods are whole milliseconds, and they run from the
+// SysTick interrupt, whose vector is chained (the core keeps the vector table in
+// RAM) to keep millis() going
+struct tick_timer
+{
+    volatile uint32_t period; // ms; 0 is stopped
+    volatile uint32_t left;
+    void (*fn)(void);
+};
+static struct tick_timer ticks[HAL_TIMER_COUNT - PIT_TIMERS];
+
+static void (*systick_core)(void);
+static void (*usb_on_receive)(void);
+
+static void systick(void)
+{
+    struct tick_timer *t;
+
+    systick_core(); // millis()
+
+    for ( uint8_t i = 0; i < HAL_TIMER_COUNT - PIT_TIMERS; i++ )
+    {
+        t = &ticks[i];
+
+        if ( t->period && --t->left == 0 )
+        {
+            t->left = t->period;
+            t->fn();
+        }
+    }
+
+    if ( usb_on_receive && Serial.available() > 0 )
+        usb_on_receive();
+}
+
+static void systick_chain(void)
+{
+    if ( systick_core )
+        return;
+
+    systick_core = _VectorsRam[15];
+    _VectorsRam[15] = systick;
+}
+
+void hal_timer_start(uint8_t timer, uint32_t period_us, void (*fn)(void))
+{
+    struct tick_timer *t;
+
+    if ( timer < PIT_TIMERS )
+    {
+        timers[timer].begin(fn, period_us);
+        return;
+    }
+
+    t = &ticks[timer - PIT_TIMERS];
+
+    t->period = 0;
+    t->fn = fn;
+    t->left = period_us >= 2000 ? period_us / 1000 : 1;
+    t->period = t->left;
+
+    systick_chain();
+}
+
+void hal_timer_stop(uint8_t timer)
+{
+    if ( timer < PIT_TIMERS )
+        timers[timer].end();
+    else
+        ticks[timer - PIT_TIMERS].period = 0;
+}
+
+// [internal ADC]
+
+void hal_analog_averaging(uint8_t samples)
+{
+    analogReadAveraging(samples);
+}
+
+uint16_t hal_analog_read(uint8_t pin)
+{
+    uint16_t v = analogRead(pin);
+
+#if TRACE
+    trace_analog( pin, v );
+#endif
+
+    return v;
+}
+
+// [buttons and speaker]
+
+void hal_button_attach(uint8_t pin, void (*isr)(void))
+{
+    pinMode(pin, INPUT_PULLUP);
+    attachInterrupt(pin, isr, CHANGE);
+}
+
+uint8_t hal_pin_read(uint8_t pin)
+{
+    uint8_t level = digitalRead(pin);
+
+#if TRACE
+    trace_pin( pin, level );
+#endif
+
+    return level;
+}
+
+void hal_tone(uint8_t pin, uint16_t hz, uint32_t ms)
+{
+    tone(pin, hz, ms);
+}
+
+void hal_backlight(uint8_t pin, uint8_t level)
+{
+    analogWrite(pin, level);
+}
+
+// [EEPROM]
+
+void hal_eeprom_read(uint32_t addr, void *buf, uint32_t n)
+{
+    eeprom_read_block(buf, (const void *)addr, n);
+
+#if TRACE
+    trace_eeprom( addr, buf, n );
+#endif
+}
+
+void hal_eeprom_write(uint32_t addr, const void *buf, uint32_t n)
+{
+    eeprom_write_block(buf, (void *)addr, n);
+}
+
+// [RTC and USB]
+
+uint32_t hal_rtc_seconds(void)
+{
+    uint32_t s = Teensy3Clock.get();
+
+#if TRACE
+    trace_rtc( s );
+#endif
+
+    return s;
+}
+
+void hal_usb_write(const void *buf, uint32_t n)
+{
+    Serial.write( (const uint8_t *)buf, n );
+}
+
+uint32_t hal_usb_read(void *buf, uint32_t max)
+{
+    uint8_t *p = (uint8_t *)buf;
+    uint32_t n = 0;
+
+    while ( n < max && Serial.available() > 0 )
+        p[n++] = Serial.read();
+
+#if TRACE
+    trace_usb( p, n );
+#endif
+
+    return n;
+}
+
+// DTR: a program on the host has the port open
+bool hal_usb_connected(void)
+{
+    bool dtr = Serial.dtr();
+
+#if TRACE
+    trace_usb_host( dtr );
+#endif
+
+    return dtr;
+}
+
+// the USB stack has no receive hook, so we check from the 1 ms system tick
+// (see [timers]) rather than taking one of the PIT channels
+void hal_usb_on_receive(void (*fn)(void))
+{
+    usb_on_receive = fn;
+    systick_chain();
+}
+
+// [history flash]
+//
+// the MK20DX256 has one program flash block, which can't be read while it's
+// being programmed or erased, so the wait for the flash controller runs from
+// RAM with interrupts off (their handlers are in flash).
+
+#define HISTORY_FLASH_BASE (0x40000 - HAL_HISTORY_SECTORS * HAL_HISTORY_SECTOR)
+
+// where the sketch ends in flash (mk20dx256.ld): its code, and after it the
+// initial values of its data, which the startup code copies to RAM
+extern "C" unsigned long _etext, _sdata, _edata;
+
+#define FTFL_CMD_PROGRAM_LONGWORD 0x06
+#define FTFL_CMD_ERASE_SECTOR     0x09
+
+FASTRUN static uint8_t flash_launch(void)
+{
+    uint8_t status;
+
+    __disable_irq();
+
+    FTFL_FSTAT = FTFL_FSTAT_CCIF;
+    while ( !(FTFL_FSTAT & FTFL_FSTAT_CCIF) )
+        ;
+
+    status = FTFL_FSTAT & (FTFL_FSTAT_ACCERR | FTFL_FSTAT_FPVIOL | FTFL_FSTAT_MGSTAT0);
+
+    __enable_irq();
+
+    return status;
+}
+
+static bool flash_command(uint8_t cmd, uint32_t addr, const uint8_t *word)
+{
+    bool ok;
+
+    while ( !(FTFL_FSTAT & FTFL_FSTAT_CCIF) )
+        ;
+
+    FTFL_FSTAT = FTFL_FSTAT_ACCERR | FTFL_FSTAT_FPVIOL; // clear old errors
+
+    FTFL_FCCOB0 = cmd;
+    FTFL_FCCOB1 = addr >> 16;
+    FTFL_FCCOB2 = addr >> 8;
+    FTFL_FCCOB3 = addr;
+
+    if ( word ) // byte 3 first: FCCOB7 holds the byte at the lowest address
+    {
+        FTFL_FCCOB4 = word[3];
+        FTFL_FCCOB5 = word[2];
+        FTFL_FCCOB6 = word[1];
+        FTFL_FCCOB7 = word[0];
+    }
+
+    ok = flash_launch() == 0;
+
+    FMC_PFB0CR |= 0x00F80000; // invalidate the flash cache and prefetch buffer
+
+    return ok;
+}
+
+// a sketch grown into the history sectors would have them erased under it
+bool hal_history_usable(void)
+{
+    uintptr_t end = (uintptr_t)&_etext + ((uintptr_t)&_edata - (uintptr_t)&_sdata);
+
+    return end <= HISTORY_FLASH_BASE;
+}
+
+void hal_history_read(uint32_t offset, void *buf, uint32_t n)
+{
+    memcpy( buf, (const void *)(HISTORY_FLASH_BASE + offset), n );
+}
+
+bool hal_history_erase(uint16_t sector)
+{
+    return flash_command( FTFL_CMD_ERASE_SECTOR, HISTORY_FLASH_BASE + sector * HAL_HISTORY_SECTOR, NULL );
+}
+
+bool hal_history_program(uint32_t offset, const void *buf, uint32_t n)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+
+    if ( (offset | n) & 3 )
+        return false;
+
+    for ( ; n; n -= 4, p += 4, offset += 4 )
+    {
+        if ( !flash_command(FTFL_CMD_PROGRAM_LONGWORD, HISTORY_FLASH_BASE + offset, p) )
+            return false;
+    }
+
+    return true;
+}
+
+#endif
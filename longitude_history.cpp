@@ -0,0 +1,321 @@
+/*
+ * Longitude measurement history
+ *
+ * Every measurement is kept in the history flash (hal_history_* in
+ * longitude_hal.h): length, both laser distances, angle, battery voltage, unit
+ * and RTC time.  each field is stored as its difference from the previous
+ * record, zigzag and varint encoded, so a typical record takes 12 to 16 bytes
+ * and the 64 KB ring holds several thousand.
+ *
+ * the flash is used as a ring of sectors.  when the newest one fills up, the
+ * oldest is erased and takes its place.  each sector starts a fresh delta
+ * chain, so it decodes on its own and losing one loses nothing else.
+ *
+ * holding Mode on the idle screen sends the whole history to USB serial in
+ * one go, with a CRC-32; tools/longitude_history.py turns it into CSV.
+ *
+ * if the sketch has grown into the history flash (hal_history_usable()),
+ * nothing is kept, and the export is empty: erasing a sector would erase code.
+ */
+#include <string.h>
+#include "longitude.h"
+#include "longitude_crc.h"
+
+// sector layout: a header, then records on 32-bit boundaries (what the flash
+// programs), each [payload length][payload][CRC-8 of both], padded with 0xFF.
+// a length of 0xFF is erased flash: the end of the sector's records.
+#define SECTOR_MAGIC   0x484C // "LH"
+#define SECTOR_VERSION 1
+
+struct sector_header
+{
+    uint16_t magic;
+    uint8_t version;
+    uint8_t unused;
+    uint32_t seq;    // increases with every sector opened; the highest is the newest
+};
+
+#define RECORD_PAYLOAD_MAX 32
+#define RECORD_SIZE(len)   (((len) + 2 + 3) & ~3)
+
+// the fields, in the order they're encoded, and their resolution
+enum HISTORY_FIELD { F_TIME, F_LENGTH, F_LEFT, F_RIGHT, F_ANGLE, F_BATTERY, FIELDS };
+
+static const uint16_t field_scale[FIELDS] =
+{
+    1,     // seconds
+    10,    // length, in 10 um
+    1000,  // laser distances, in mm (what the modules report)
+    1000,
+    10,    // angle, in 10 millidegrees
+    10,    // battery, in 10 mV
+};
+
+// the export: "LGH1", then per sector, oldest first, a 16-bit byte count and
+// that many bytes; a count of 0, and the CRC-32 of everything before it
+static const char EXPORT_MAGIC[4] = { 'L', 'G', 'H', '1' };
+
+static bool usable;            // the flash is ours (see above)
+static uint16_t cur;           // sector being appended to
+static uint32_t cur_seq;
+static uint16_t wr;            // next free byte in it
+static int32_t prev[FIELDS];   // last record's values, scaled
+
+static bool sector_valid(uint16_t, uint32_t *);
+static uint16_t sector_end(uint16_t, int32_t *, uint16_t *);
+static void open_sector(uint16_t, uint32_t);
+static uint8_t encode(const int32_t *, uint8_t, uint8_t *);
+static uint8_t put_varint(uint8_t *, uint32_t);
+static uint8_t get_varint(const uint8_t *, uint8_t, uint32_t *);
+
+// find the newest sector, and the end of its records
+void history_setup(void)
+{
+    uint32_t seq;
+    bool found = false;
+
+    if ( !(usable = hal_history_usable()) )
+        return;
+
+    for ( uint16_t s = 0; s < HAL_HISTORY_SECTORS; s++ )
+    {
+        if ( sector_valid(s, &seq) && (!found || seq > cur_seq) )
+        {
+            cur = s;
+            cur_seq = seq;
+            found = true;
+        }
+    }
+
+    if ( found )
+        wr = sector_end( cur, prev, NULL );
+    else
+        open_sector( 0, 1 ); // first boot: nothing to keep
+}
+
+// record the measurement on the screen; kind is a HISTORY_KIND
+void history_add(uint8_t kind)
+{
+    uint8_t rec[RECORD_SIZE(RECORD_PAYLOAD_MAX)];
+    int32_t now[FIELDS];
+    uint8_t len, size;
+
+    if ( !usable )
+        return;
+
+    SPAN_BEGIN(SPAN_HISTORY);
+
+    now[F_TIME]    = (int32_t)hal_rtc_seconds();
+    now[F_LENGTH]  = (measured_length_um + field_scale[F_LENGTH] / 2) / field_scale[F_LENGTH];
+    now[F_LEFT]    = (laser_left.last_distance_um + 500) / 1000;
+    now[F_RIGHT]   = (laser_right.last_distance_um + 500) / 1000;
+    now[F_ANGLE]   = (angle_mdeg + field_scale[F_ANGLE] / 2) / field_scale[F_ANGLE];
+    now[F_BATTERY] = (battery_mv() + field_scale[F_BATTERY] / 2) / field_scale[F_BATTERY];
+
+    len = encode( now, unit | kind << 2, rec + 1 );
+
+    // full: the oldest sector goes, and the record starts a new delta chain
+    if ( wr + RECORD_SIZE(len) > HAL_HISTORY_SECTOR )
+    {
+        open_sector( (cur + 1) % HAL_HISTORY_SECTORS, cur_seq + 1 );
+        len = encode( now, unit | kind << 2, rec + 1 );
+    }
+
+    size = RECORD_SIZE(len);
+
+    rec[0] = len;
+    rec[len + 1] = crc8( CRC8_INIT, rec, len + 1 );
+    memset( rec + len + 2, 0xFF, size - len - 2 );
+
+    hal_history_program( (uint32_t)cur * HAL_HISTORY_SECTOR + wr, rec, size );
+
+    wr += size;
+    memcpy( prev, now, sizeof prev );
+
+    SPAN_END(SPAN_HISTORY);
+}
+
+// records in the ring, and the bytes they take up
+uint32_t history_size(uint32_t *bytes)
+{
+    uint32_t seq, records = 0;
+    uint16_t n;
+
+    *bytes = 0;
+
+    if ( !usable )
+        return 0;
+
+    for ( uint16_t s = 0; s < HAL_HISTORY_SECTORS; s++ )
+    {
+        if ( !sector_valid(s, &seq) )
+            continue;
+
+        *bytes += sector_end( s, NULL, &n ) - sizeof(struct sector_header);
+        records += n;
+    }
+
+    return records;
+}
+
+// the whole ring to USB serial, oldest sector first, as it sits in the flash
+void history_export(void)
+{
+    uint8_t buf[256];
+    uint32_t seq, crc = CRC32_INIT;
+    uint16_t s, used, n, i;
+
+    hal_usb_write( EXPORT_MAGIC, sizeof EXPORT_MAGIC );
+    crc = crc32( crc, EXPORT_MAGIC, sizeof EXPORT_MAGIC );
+
+    for ( i = 1; usable && i <= HAL_HISTORY_SECTORS; i++ )
+    {
+        s = (cur + i) % HAL_HISTORY_SECTORS; // cur itself comes last
+
+        if ( !sector_valid(s, &seq) )
+            continue;
+
+        used = sector_end( s, NULL, NULL );
+
+        hal_usb_write( &used, sizeof used );
+        crc = crc32( crc, &used, sizeof used );
+
+        for ( uint16_t pos = 0; pos < used; pos += n )
+        {
+            n = (uint16_t)(used - pos) < sizeof buf ? used - pos : sizeof buf;
+
+            hal_history_read( (uint32_t)s * HAL_HISTORY_SECTOR + pos, buf, n );
+            hal_usb_write( buf, n );
+            crc = crc32( crc, buf, n );
+        }
+    }
+
+    used = 0;
+    hal_usb_write( &used, sizeof used );
+    crc = ~crc32( crc, &used, sizeof used );
+
+    hal_usb_write( &crc, sizeof crc );
+}
+
+static bool sector_valid(uint16_t s, uint32_t *seq)
+{
+    struct sector_header h;
+
+    hal_history_read( (uint32_t)s * HAL_HISTORY_SECTOR, &h, sizeof h );
+    *seq = h.seq;
+
+    return h.magic == SECTOR_MAGIC && h.version == SECTOR_VERSION && h.seq != 0xFFFFFFFF;
+}
+
+// walk a sector's records to the first erased byte; returns the offset there.
+// optionally leaves the last good record's values in 'last' and counts them.
+// a record with a bad CRC (power lost while it was being programmed) is
+// stepped over without touching the chain, same as the host decoder does.
+static uint16_t sector_end(uint16_t s, int32_t *last, uint16_t *count)
+{
+    uint8_t rec[RECORD_SIZE(RECORD_PAYLOAD_MAX)];
+    uint32_t base = (uint32_t)s * HAL_HISTORY_SECTOR;
+    uint16_t pos = sizeof(struct sector_header);
+    uint32_t delta;
+    uint8_t len, at;
+
+    if ( last )
+        memset( last, 0, FIELDS * sizeof *last );
+    if ( count )
+        *count = 0;
+
+    while ( pos < HAL_HISTORY_SECTOR )
+    {
+        hal_history_read( base + pos, &len, 1 );
+
+        if ( len == 0xFF || len > RECORD_PAYLOAD_MAX || pos + RECORD_SIZE(len) > HAL_HISTORY_SECTOR )
+            break;
+
+        hal_history_read( base + pos, rec, len + 2 );
+
+        if ( crc8(CRC8_INIT, rec, len + 1) == rec[len + 1] )
+        {
+            if ( last )
+            {
+                at = 2; // past the length and the unit/kind byte
+
+                for ( uint8_t f = 0; f < FIELDS; f++ )
+                {
+                    at += get_varint( rec + at, len + 1 - at, &delta );
+                    last[f] += (int32_t)(delta >> 1) ^ -(int32_t)(delta & 1);
+                }
+            }
+
+            if ( count )
+                (*count)++;
+        }
+
+        pos += RECORD_SIZE(len);
+    }
+
+    return pos;
+}
+
+static void open_sector(uint16_t s, uint32_t seq)
+{
+    struct sector_header h = { SECTOR_MAGIC, SECTOR_VERSION, 0xFF, seq };
+
+    hal_history_erase( s );
+    hal_history_program( (uint32_t)s * HAL_HISTORY_SECTOR, &h, sizeof h );
+
+    cur = s;
+    cur_seq = seq;
+    wr = sizeof h;
+    memset( prev, 0, sizeof prev );
+}
+
+// the unit/kind byte, then each field's change since the last record as a
+// zigzag varint (small changes either way take one byte); returns the length
+static uint8_t encode(const int32_t *now, uint8_t tag, uint8_t *out)
+{
+    uint8_t n = 0;
+    int32_t d;
+
+    out[n++] = tag;
+
+    for ( uint8_t f = 0; f < FIELDS; f++ )
+    {
+        d = now[f] - prev[f];
+        n += put_varint( out + n, ((uint32_t)d << 1) ^ (uint32_t)(d >> 31) );
+    }
+
+    return n;
+}
+
+// 7 bits a byte, low first; the top bit says another byte follows
+static uint8_t put_varint(uint8_t *out, uint32_t v)
+{
+    uint8_t n = 0;
+
+    while ( v >= 0x80 )
+    {
+        out[n++] = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+
+    out[n++] = (uint8_t)v;
+
+    return n;
+}
+
+static uint8_t get_varint(const uint8_t *in, uint8_t max, uint32_t *v)
+{
+    uint8_t n = 0;
+
+    *v = 0;
+
+    while ( n < max && n < 5 )
+    {
+        *v |= (uint32_t)(in[n] & 0x7F) << (7 * n);
+
+        if ( !(in[n++] & 0x80) )
+            break;
+    }
+
+    return n;
+}
@@ -5,25 +5,36 @@
  * February 2017
  */
 #include "longitude.h"
-#include "Arduino.h"
 
 // laser command codes
-#define LASER_ON      "$0003260130&"
-#define LASER_MEASURE "$00022123&"
-
-// laser response codes
-#define LASER_REPLY           "$00023335"         // laser is talking
-#define LASER_ON_CONFIRM      "$0003260130"       // lights are on
-#define LASER_MEASURE_CONFIRM "$00022123"         // measurement coming in
-#define LASER_TOO_CLOSE       "$0006210000001542" // object is too close to laser
-#define LASER_NO_ECHO         "$0006210000001643" // no reflection received
-#define LASER_TOO_STRONG      "$0006210000001744" // laser reflection is too strong
-#define LASER_TOO_MUCH_LIGHT  "$0006210000001845" // too much ambient light
-
-// constants for handling the serial bus
-#define LASER_REPLY_SIZE 10
-#define LASER_ON_CONFIRM_SIZE 12
-#define LASER_MEASUREMENT_SIZE 17
+#define LASER_ON_CMD      "$0003260130&"
+#define LASER_MEASURE_CMD "$00022123&"
+#define LASER_OFF_CMD     "$0003260029&"
+
+// by LASER_CMD
+static const char *const commands[] = { LASER_ON_CMD, LASER_MEASURE_CMD, LASER_OFF_CMD };
+
+// how long we give a module to finish a transaction.  the module reports
+// measurement errors only after "about 5 seconds", so measurements get more.
+// turning the lights off gets the same as turning them on.
+#define LASER_ON_TIMEOUT_US      2000000UL
+#define LASER_MEASURE_TIMEOUT_US 6500000UL
+
+// TASK_LASERS' backstop, should a transaction never end
+#define LASER_JOB_TIMEOUT_MS (LASER_MEASURE_TIMEOUT_US / 1000 + 500)
+
+// the lasers TASK_LASERS is servicing (either may be NULL)
+static struct laser *job[2];
+#if PROFILE
+static uint32_t job_cycles;
+#endif
+
+// the result each command asks for, by LASER_CMD
+static const enum LASER_FRAME expected[] = { LASER_ON_CONFIRM, LASER_DISTANCE, LASER_OFF_CONFIRM };
+
+static uint8_t lasers_task(struct task *);
+static void laser_reset(struct laser *, uint8_t, uint8_t);
+static void laser_finish(struct laser *, enum LASER_FRAME);
 
 // initialize laser data objects
 void laser_setup(struct laser *left, struct laser *right)
@@ -32,119 +43,221 @@ void laser_setup(struct laser *left, struct laser *right)
     //Serial.begin(115200);
     //Serial.printf( "[Longitude] initializing...\n" );
     
-    Serial2.begin(115200);
-    Serial3.begin(115200);
-    
-    left->id = 0;
-    left->port = &Serial2;
-    left->enabled = false;
-    left->last_measurement = 0.0;
-
-    right->id = 1;
-    right->port = &Serial3;
-    right->enabled = false;
-    right->last_measurement = 0.0;
+    hal_uart_begin( HAL_UART_LEFT, 115200 );
+    hal_uart_begin( HAL_UART_RIGHT, 115200 );
+
+    laser_reset( left, 0, HAL_UART_LEFT );
+    laser_reset( right, 1, HAL_UART_RIGHT );
+}
+
+// [transactions]
+//
+// each command is a transaction: we send it, the module answers with a reply frame,
+// and then with the result (lights-on confirmation or a distance/error frame).  the
+// transaction is driven by laser_service(), which never blocks, so the two modules
+// can be serviced in turn while both are busy: a measurement then costs the slower
+// of the two lasers rather than the sum of both.
+
+// send a command and start the transaction clock
+void laser_start(struct laser *laser, enum LASER_CMD cmd)
+{
+    laser->cmd = cmd;
+    laser->xact = XACT_WAIT_REPLY;
+    laser->result = LASER_NONE;
+    laser->xact_start = hal_micros();
+
+    //Serial.printf( "[LASER %d] sending command %d\n", laser->id, cmd );
+
+    hal_uart_write( laser->port, commands[cmd] );
 }
 
-// turn lasers on and wait for confirmation (TODO: handle errors)
-void laser_on(struct laser *laser)
+// advance a laser's transaction with whatever has arrived; returns true once
+// the transaction is over, either with a result or by running out of time
+bool laser_service(struct laser *laser)
 {
-    String retcode;
-    
-    laser->port->print( LASER_ON );
+    enum LASER_FRAME frame;
+    uint32_t timeout;
 
-    //Serial.printf( "[LASER %d] (lights on)\n", laser->id );
-    
-    // wait for laser reply code
-    while ( laser->port->available() < LASER_REPLY_SIZE );
+    if ( laser->xact == XACT_IDLE || laser->xact == XACT_DONE )
+        return true;
 
-    retcode = laser->port->readStringUntil( '&' );
-    
-    if ( retcode == LASER_REPLY ) // laser is sending response
+    while ( (frame = laser_poll( laser )) != LASER_NONE )
     {
-      // wait for lights-up confirmation
-      while ( laser->port->available() < LASER_ON_CONFIRM_SIZE );
+        //Serial.printf( "[LASER %d] received frame: %d\n", laser->id, frame );
 
-      retcode = laser->port->readStringUntil( '&' );
+        if ( laser->xact == XACT_WAIT_REPLY )
+        {
+            if ( frame != LASER_REPLY ) // noise on the bus?
+            {
+                laser_finish( laser, frame );
+                return true;
+            }
 
-      if ( retcode == LASER_ON_CONFIRM )
-      {
-        //Serial.printf( "[LASER %d] received LASER_ON_CONFIRM: ", laser->id );
-        //Serial.println( retcode );
-        laser->enabled = true;
-        return;
-      }
-      else // TODO: handle error codes
-      {
-        //Serial.printf( "[LASER %d] got error code: ", laser->id );
-        //Serial.println( retcode );
-        return;
-      }
-    } // no LASER_REPLY string (noise on the bus?)
-    else
+            laser->xact = XACT_WAIT_RESULT;
+        }
+        else if ( frame != LASER_REPLY && frame != LASER_MEASURE_CONFIRM ) // anything else is the result
+        {
+            laser_finish( laser, frame );
+            return true;
+        }
+    }
+
+    timeout = laser->cmd == LASER_CMD_MEASURE ? LASER_MEASURE_TIMEOUT_US : LASER_ON_TIMEOUT_US;
+
+    if ( hal_micros() - laser->xact_start > timeout )
     {
-      //Serial.printf( "[LASER %d] (lasers on) received unexpected data: ", laser->id );
-      //Serial.println( retcode );
+        laser_finish( laser, LASER_TIMEOUT );
+        return true;
     }
+
+    return false;
 }
 
-// send measurement command to lasers; returns without waiting for the result
-void laser_measure(struct laser *laser)
+// send the same command to one or both lasers (either may be NULL, e.g. in
+// rangefinder mode) and service them in the background as TASK_LASERS; the
+// state machine gets EV_TASK once both are done
+void laser_start_all(struct laser *a, struct laser *b, enum LASER_CMD cmd)
 {
-    //Serial.printf( "[LASER %d] sending measure command\n", laser->id );
-    laser->port->print( LASER_MEASURE );
+    job[0] = a;
+    job[1] = b;
+
+    SPAN_MARK(job_cycles);
 
-    return;
+    if ( a ) laser_start( a, cmd );
+    if ( b ) laser_start( b, cmd );
+
+    task_start( TASK_LASERS, lasers_task, LASER_JOB_TIMEOUT_MS );
 }
 
-// read the result of a measurement from the appropriate serial bus
-void laser_read_data(struct laser *laser)
+// no new command: let whatever the lasers are doing finish, as TASK_LASERS
+void laser_finish_all(struct laser *a, struct laser *b)
 {
-    String retcode;
-    String distance;
+    job[0] = a;
+    job[1] = b;
 
-    // wait for reply code
-    while ( laser->port->available() < LASER_REPLY_SIZE );
+    SPAN_MARK(job_cycles);
 
-    retcode = laser->port->readStringUntil( '&' );
+    task_start( TASK_LASERS, lasers_task, LASER_JOB_TIMEOUT_MS );
+}
 
-    //Serial.printf( "[LASER %d] (read) received reply code: ", laser->id );
-    //Serial.println( retcode );
-    
-    if ( retcode == LASER_REPLY )
+static uint8_t lasers_task(struct task *t)
+{
+    TASK_BEGIN(t);
+
+    // the UART receive interrupt wakes the loop when more of a frame arrives
+    TASK_WAIT_UNTIL(t, laser_all_done( job[0], job[1] ));
+
+#if PROFILE
+    if ( job[0] && job[1] && job[0]->cmd == LASER_CMD_ON )
+        SPAN_SINCE(SPAN_LASERS_ON, job_cycles);
+#endif
+
+    TASK_END(t);
+}
+
+// both lasers' transactions are over; both get serviced every time, so one
+// that finishes first doesn't keep the other waiting.  either may be NULL
+bool laser_all_done(struct laser *a, struct laser *b)
+{
+    bool a_done = a == NULL || laser_service( a );
+    bool b_done = b == NULL || laser_service( b );
+
+    return a_done && b_done;
+}
+
+// which of TASK_LASERS' lasers didn't light up or measure, as MEASURE_FAULT
+// bits; an off command that goes unanswered is left to the next timeout instead
+uint8_t laser_job_faults(void)
+{
+    uint8_t faults = 0;
+
+    for ( uint8_t i = 0; i < 2; i++ )
+        if ( job[i] && job[i]->cmd != LASER_CMD_OFF && laser_failed(job[i]) )
+            faults |= 1 << job[i]->id;
+
+    return faults;
+}
+
+// the transaction is over without the result its command asks for
+bool laser_failed(const struct laser *laser)
+{
+    return laser->xact == XACT_DONE && laser->result != expected[laser->cmd];
+}
+
+// feed whatever the UART has buffered to the laser's frame parser.  stops at the
+// first complete frame, leaving any bytes behind it in the UART for the next call,
+// so it never blocks; returns LASER_NONE if no frame has completed yet.
+enum LASER_FRAME laser_poll(struct laser *laser)
+{
+    enum LASER_FRAME frame;
+
+    while ( hal_uart_available(laser->port) > 0 )
     {
-      // wait for measurement code
-      while ( laser->port->available() < LASER_MEASUREMENT_SIZE );
-
-      retcode = laser->port->readStringUntil( '&' );
-
-      //Serial.printf( "[LASER %d] measurement code: ", laser->id );
-      //Serial.println( retcode );
-
-      // parsing errors in the measurement code will be difficult: the laser module
-      // designer stupidly uses the same code format for valid and invalid measurements,
-      // so the only way to know if the result of a measurement should be interpreted as
-      // a distance or an error code is by the length of time it takes to receive the
-      // code (errors take "about 5 seconds").  dumb.
-      if ( retcode.substring(0,7) == "$000621" ) // measurement code prefix
-      {
-          distance = retcode.remove(0,7);
-          int d = distance.toInt();
-          double meters = d / 100000.0;
-          
-          laser->last_measurement = meters;
-          //Serial.printf( "[LASER %d] distance: %d [%0.8f meters]\n", laser->id, d, meters );
-          laser->enabled = false;
-          return;
-      }
-      else // this should never happen
-      {
-        //Serial.printf( "[LASER %d] received reply, but unknown return code: ", laser->id );
-        //Serial.println( retcode );
-      }
+        frame = laser_parse( &laser->rx, (char)hal_uart_read(laser->port) );
+
+        if ( frame != LASER_NONE )
+        {
+            link_laser_frame( laser, frame ); // if the host wants them
+            return frame;
+        }
     }
-    else // no LASER_REPLY string
+
+    return LASER_NONE;
+}
+
+// close out a transaction and update the laser's state from its result
+static void laser_finish(struct laser *laser, enum LASER_FRAME result)
+{
+    laser->xact = XACT_DONE;
+    laser->result = result;
+    laser->latency_us = hal_micros() - laser->xact_start;
+
+    event_post( EV_LASER, laser->id, hal_millis() );
+
+    // a module that answers anything but the confirmation (or nothing) isn't lit;
+    // laser_job_faults() reports it
+    if ( laser->cmd == LASER_CMD_ON )
     {
-      //Serial.printf( "[LASER %d] (measurement) received unexpected data\n", laser->id );
+        laser->enabled = (result == LASER_ON_CONFIRM);
+        return;
     }
+
+    if ( laser->cmd == LASER_CMD_OFF )
+    {
+        // one that didn't answer may still be lit; the next timeout tries again
+        laser->enabled = (result != LASER_OFF_CONFIRM);
+        return;
+    }
+
+    // TOO_CLOSE, NO_ECHO, TIMEOUT, etc. leave no distance, so an old one can't
+    // pass for this shot's; result says why, and the callers report it
+    if ( result == LASER_DISTANCE )
+    {
+        laser->last_distance_um = laser->rx.distance_um;
+        laser->enabled = false;
+    }
+    else
+    {
+        laser->last_distance_um = 0;
+    }
+
+#if !FIXED_POINT
+    laser->last_measurement = laser->last_distance_um / 1000000.0;
+#endif
+    //Serial.printf( "[LASER %d] result %d after %lu us\n", laser->id, result, laser->latency_us );
+}
+
+static void laser_reset(struct laser *laser, uint8_t id, uint8_t port)
+{
+    laser->id = id;
+    laser->port = port;
+    laser->enabled = false;
+    laser->last_measurement = 0.0;
+    laser->last_distance_um = 0;
+    laser->cmd = LASER_CMD_ON;
+    laser->xact = XACT_IDLE;
+    laser->result = LASER_NONE;
+    laser->xact_start = 0;
+    laser->latency_us = 0;
+    laser_parser_reset( &laser->rx );
 }
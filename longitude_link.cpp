@@ -0,0 +1,506 @@
+/*
+ * Longitude host link
+ *
+ * A binary protocol over USB serial for test rigs.  the device streams what
+ * each measurement saw (the raw angle ADC code, battery, angle, every laser
+ * frame, the length and how long the stages took), and takes commands to
+ * measure, zero the angle, change units, run unattended batches and calibrate
+ * the angle sensor.  built with TRACE, it also streams the I/O trace
+ * (longitude_trace.h).
+ * tools/longitude_link.py is the host side.
+ *
+ * a frame is [type][seq][payload][CRC-16 of the rest], COBS encoded so it has
+ * no zero bytes, then a zero.  a receiver that starts mid-stream, or loses
+ * bytes, picks up again at the next zero.  seq counts the frames sent in each
+ * direction, so a lost one shows.  everything is little endian.
+ *
+ * the device answers every command it could decode with an ACK; measurements,
+ * laser frames and the end of a batch follow as they happen.  a measurement
+ * that comes to nothing (a laser or the angle sensor failed) is a TLM_FAULT
+ * instead, and counts toward a batch without being one of its results.  commands for the
+ * state machine are refused as busy while it's in the middle of something (a
+ * task is running: booting, lasers going on or off, a burst).  the stream is off
+ * until the host asks for it, so nothing is written to a port no one reads.
+ */
+#include <string.h>
+#include "longitude.h"
+#include "longitude_crc.h"
+
+// largest frame before encoding: type, seq, payload and CRC (a TLM_PROFILE with
+// every bucket in use is the longest)
+#define FRAME_MAX 160
+
+// COBS adds a byte per 254, and the delimiter
+#define WIRE_MAX  (FRAME_MAX + FRAME_MAX / 254 + 2)
+
+// device to host frame types; the host to device ones are LINK_* in longitude.h
+enum TLM_TYPE { TLM_ACK = 0x81, TLM_MEASUREMENT, TLM_LASER_FRAME, TLM_BATCH_DONE, TLM_PROFILE, TLM_TRACE,
+                TLM_FAULT };
+
+// TLM_ACK status
+enum ACK_STATUS { ACK_OK, ACK_UNKNOWN, ACK_BAD_LENGTH, ACK_BAD_VALUE, ACK_BUSY };
+
+// LINK_STREAM mask
+#define STREAM_MEASUREMENTS 0x01
+#define STREAM_LASER_FRAMES 0x02
+#define STREAM_TRACE        0x04 // the trace's bytes, as they come; a lost frame is a gap in it
+
+// TLM_MEASUREMENT payload
+struct tlm_measurement
+{
+    uint32_t time_ms;         // when it finished
+    uint8_t kind;             // HISTORY_KIND
+    uint8_t unit;
+    uint8_t shots;            // burst shots taken (0: a single shot)
+    uint8_t result[2];        // LASER_FRAME of the last shot, left and right
+    uint32_t length_um;
+    uint32_t ci_um;           // 95% confidence half-width, bursts only
+    int32_t angle_mdeg;
+    int32_t angle_code;       // filtered ADC code behind it, 18-bit units
+    uint16_t battery_mv;
+    uint32_t distance_um[2];
+    uint32_t latency_us[2];   // last shot's command to result, per laser
+    uint32_t capture_us;      // the whole burst
+} __attribute__((packed));
+
+// TLM_FAULT payload
+struct tlm_fault
+{
+    uint32_t time_ms;
+    uint8_t faults;           // MEASURE_FAULT bits
+    uint8_t result[2];        // LASER_FRAME of the last transaction, left and right
+} __attribute__((packed));
+
+static uint8_t rx[WIRE_MAX];
+static uint8_t rx_len;
+static bool rx_overflow;          // frame too long; drop it at the next zero
+static volatile bool rx_pending;  // EV_USB posted and not yet serviced
+
+static uint8_t tx_seq;
+static uint8_t stream;            // STREAM_* mask
+static uint16_t batch_left;       // measurements the current batch still owes
+static uint16_t batch_done;
+static bool remote;               // a LINK_MEASURE is on its way to the FSM
+
+static void remote_done(bool);
+static void usb_receive(void);
+static void command(const uint8_t *, uint8_t);
+static void ack(const uint8_t *, uint8_t);
+static uint8_t angle_cal_command(const uint8_t *);
+#if PROFILE
+static void send_profile(void);
+#endif
+#if TRACE
+static void send_trace(void);
+#endif
+static void send(uint8_t, const void *, uint8_t);
+static uint8_t cobs_encode(const uint8_t *, uint8_t, uint8_t *);
+static uint8_t cobs_decode(const uint8_t *, uint8_t, uint8_t *);
+
+void link_setup(void)
+{
+    hal_usb_on_receive( usb_receive );
+}
+
+// take in whatever the host sent (EV_USB wakes the loop for it), and keep a
+// batch going; loop() calls this every pass
+void link_service(void)
+{
+    uint8_t buf[64], frame[FRAME_MAX];
+    uint32_t n = 0;
+    uint8_t len;
+
+    if ( rx_pending )
+    {
+        rx_pending = false; // before reading, so bytes arriving meanwhile post again
+        n = hal_usb_read( buf, sizeof buf );
+    }
+
+    for ( ; n > 0; n = hal_usb_read(buf, sizeof buf) )
+    {
+        for ( uint32_t i = 0; i < n; i++ )
+        {
+            if ( buf[i] != 0 )
+            {
+                if ( rx_len < sizeof rx )
+                    rx[rx_len++] = buf[i];
+                else
+                    rx_overflow = true;
+
+                continue;
+            }
+
+            // end of a frame: anything that doesn't decode and check out is dropped
+            len = rx_overflow ? 0 : cobs_decode( rx, rx_len, frame );
+
+            if ( len >= 4 && crc16(CRC16_INIT, frame, len - 2) == (frame[len - 2] | frame[len - 1] << 8) )
+                command( frame, len - 2 );
+
+            rx_len = 0;
+            rx_overflow = false;
+        }
+    }
+
+    // the next measurement of a batch, once the FSM is back to waiting for one.
+    // a burst leaves the queue full of laser events it drops one per pass, so
+    // this may take a few tries
+    if ( batch_left > 0 && !remote && !task_busy() && event_post(EV_COMMAND, LINK_MEASURE, hal_millis()) )
+        remote = true;
+
+#if TRACE
+    if ( stream & STREAM_TRACE )
+        send_trace();
+#endif
+}
+
+// a measurement finished; kind is a HISTORY_KIND
+void link_measurement(uint8_t kind)
+{
+    struct tlm_measurement m;
+
+    if ( stream & STREAM_MEASUREMENTS )
+    {
+        m.time_ms        = hal_millis();
+        m.kind           = kind;
+        m.unit           = unit;
+        m.shots          = capture_shots;
+        m.result[0]      = laser_left.result;
+        m.result[1]      = laser_right.result;
+        m.length_um      = measured_length_um;
+        m.ci_um          = measured_ci_um;
+        m.angle_mdeg     = angle_mdeg;
+        m.angle_code     = angle_code;
+        m.battery_mv     = battery_mv();
+        m.distance_um[0] = laser_left.last_distance_um;
+        m.distance_um[1] = laser_right.last_distance_um;
+        m.latency_us[0]  = laser_left.latency_us;
+        m.latency_us[1]  = laser_right.latency_us;
+        m.capture_us     = capture_shots ? capture_us : 0;
+
+        send( TLM_MEASUREMENT, &m, sizeof m );
+    }
+
+    remote_done( true );
+}
+
+// a measurement came to nothing; faults are MEASURE_FAULT bits
+void link_fault(uint8_t faults)
+{
+    struct tlm_fault f;
+
+    if ( stream & STREAM_MEASUREMENTS )
+    {
+        f.time_ms   = hal_millis();
+        f.faults    = faults;
+        f.result[0] = laser_left.result;
+        f.result[1] = laser_right.result;
+
+        send( TLM_FAULT, &f, sizeof f );
+    }
+
+    remote_done( false );
+}
+
+// the LINK_MEASURE the FSM was working on is over, with a result or not
+static void remote_done(bool measured)
+{
+    uint16_t done;
+
+    if ( !remote )
+        return;
+
+    remote = false;
+
+    if ( batch_left == 0 )
+        return;
+
+    batch_done += measured;
+
+    // the next one is link_service()'s, so buttons and commands still get in
+    if ( --batch_left > 0 )
+        return;
+
+    done = batch_done;
+    send( TLM_BATCH_DONE, &done, sizeof done );
+}
+
+// a laser frame came in (laser_poll()): the laser, what it was, and its text
+void link_laser_frame(const struct laser *laser, uint8_t frame)
+{
+    uint8_t p[6 + LASER_FRAME_MAX];
+    uint32_t now = hal_micros();
+
+    if ( !(stream & STREAM_LASER_FRAMES) )
+        return;
+
+    p[0] = laser->id;
+    p[1] = frame;
+    memcpy( p + 2, &now, 4 );
+    memcpy( p + 6, laser->rx.buf, laser->rx.len );
+
+    send( TLM_LASER_FRAME, p, 6 + laser->rx.len );
+}
+
+// 1 ms tick (or the simulator): wake the main loop, once per batch of bytes
+static void usb_receive(void)
+{
+    if ( rx_pending )
+        return;
+
+    rx_pending = true;
+    event_post( EV_USB, 0, hal_millis() );
+}
+
+// frame is [type][seq][payload], CRC already checked
+static void command(const uint8_t *frame, uint8_t len)
+{
+    const uint8_t *p = frame + 2;
+    uint8_t n = len - 2;
+    uint8_t status = ACK_OK;
+    uint16_t count;
+
+    power_activity(); // a host at work keeps the device awake, as a user would
+
+    switch ( frame[0] )
+    {
+        case LINK_PING:
+            break;
+
+        case LINK_STREAM:
+            if ( n != 1 )
+                status = ACK_BAD_LENGTH;
+            else
+                stream = p[0];
+            break;
+
+        case LINK_MEASURE:
+        case LINK_ZERO:
+            if ( n != 0 )
+                status = ACK_BAD_LENGTH;
+            else if ( task_busy() || !event_post(EV_COMMAND, frame[0], hal_millis()) )
+                status = ACK_BUSY;
+            else if ( frame[0] == LINK_MEASURE )
+                remote = true;
+            break;
+
+        case LINK_UNIT:
+            if ( n != 1 )
+                status = ACK_BAD_LENGTH;
+            else if ( p[0] > inch )
+                status = ACK_BAD_VALUE;
+            else if ( task_busy() || !event_post(EV_COMMAND, LINK_ARG(LINK_UNIT, p[0]), hal_millis()) )
+                status = ACK_BUSY;
+            break;
+
+        case LINK_BATCH:
+            if ( n == 2 )
+                memcpy( &count, p, 2 );
+
+            if ( n != 2 )
+                status = ACK_BAD_LENGTH;
+            else if ( count == 0 )
+                status = ACK_BAD_VALUE;
+            else if ( batch_left > 0 )
+                status = ACK_BUSY;
+            else
+            {
+                batch_left = count; // started at the end of link_service()
+                batch_done = 0;
+            }
+            break;
+
+#if PROFILE
+        case LINK_PROFILE: // every span that has run, then the ACK; a 1 clears them after
+            if ( n > 1 )
+                status = ACK_BAD_LENGTH;
+            else
+                send_profile();
+
+            if ( n == 1 && p[0] )
+                profile_reset();
+            break;
+#endif
+
+        case LINK_ANGLE_CAL: // bench only: the lasers off and nothing else going on
+            if ( n < 1 || n != (p[0] == ANGLE_CAL_POINT ? 5 : 1) )
+                status = ACK_BAD_LENGTH;
+            else if ( state != WAIT_LASER_ON || task_busy() )
+                status = ACK_BUSY;
+            else
+                status = angle_cal_command( p );
+            break;
+
+        case LINK_STOP: // also unsticks a batch whose command the FSM had no use for
+            batch_left = 0;
+            remote = false;
+            break;
+
+        default:
+            status = ACK_UNKNOWN;
+            break;
+    }
+
+    ack( frame, status );
+}
+
+// echo the command's type and seq, and how it went
+static void ack(const uint8_t *frame, uint8_t status)
+{
+    uint8_t p[3] = { frame[0], frame[1], status };
+
+    send( TLM_ACK, p, sizeof p );
+}
+
+// LINK_ANGLE_CAL's [op] or [ANGLE_CAL_POINT][mdeg]; a point is refused as busy
+// until a fresh filter window has filled, so the host asks until it's taken
+static uint8_t angle_cal_command(const uint8_t *p)
+{
+    int32_t mdeg;
+
+    switch ( p[0] )
+    {
+        case ANGLE_CAL_START:
+            angle_calibration_start();
+            return ACK_OK;
+
+        case ANGLE_CAL_POINT:
+            memcpy( &mdeg, p + 1, 4 );
+
+            if ( !angle_calibration_running() )
+                return ACK_BAD_VALUE;
+            if ( !angle_calibration_ready() )
+                return ACK_BUSY;
+
+            return angle_calibration_take( mdeg ) ? ACK_OK : ACK_BAD_VALUE;
+
+        case ANGLE_CAL_FINISH:
+            return angle_calibration_finish() ? ACK_OK : ACK_BAD_VALUE;
+
+        case ANGLE_CAL_CLEAR:
+            angle_calibration_clear();
+            return ACK_OK;
+    }
+
+    return ACK_BAD_VALUE;
+}
+
+#if PROFILE
+// per span: [id][counter Hz][count][max][sum, 64 bits][first bucket][buckets
+// from there to the last one in use], in counter ticks
+static void send_profile(void)
+{
+    uint8_t p[FRAME_MAX - 4];
+    const struct span_stats *s;
+    uint32_t hz = hal_cycles_hz();
+    uint8_t lo, hi;
+
+    for ( uint8_t id = 0; id < SPAN_COUNT; id++ )
+    {
+        s = profile_stats( id );
+
+        if ( s->count == 0 )
+            continue;
+
+        for ( lo = 0; !s->bucket[lo]; lo++ )
+            ;
+        for ( hi = PROFILE_BUCKETS - 1; !s->bucket[hi]; hi-- )
+            ;
+
+        p[0] = id;
+        memcpy( p + 1, &hz, 4 );
+        memcpy( p + 5, &s->count, 4 );
+        memcpy( p + 9, &s->max, 4 );
+        memcpy( p + 13, &s->sum, 8 );
+        p[21] = lo;
+        memcpy( p + 22, &s->bucket[lo], (hi - lo + 1) * 4 );
+
+        send( TLM_PROFILE, p, 22 + (hi - lo + 1) * 4 );
+    }
+}
+#endif
+
+#if TRACE
+// whatever the trace has gathered since the last pass, in as many frames as it
+// takes; the first pass after the host asks has everything since boot that fit
+static void send_trace(void)
+{
+    uint8_t p[FRAME_MAX - 4];
+    uint32_t n;
+
+    while ( (n = trace_read(p, sizeof p)) > 0 )
+        send( TLM_TRACE, p, (uint8_t)n );
+}
+#endif
+
+static void send(uint8_t type, const void *payload, uint8_t n)
+{
+    uint8_t frame[FRAME_MAX], wire[WIRE_MAX];
+    uint16_t crc;
+    uint8_t len;
+
+    frame[0] = type;
+    frame[1] = tx_seq++;
+    memcpy( frame + 2, payload, n );
+
+    crc = crc16( CRC16_INIT, frame, n + 2 );
+    frame[n + 2] = crc & 0xFF;
+    frame[n + 3] = crc >> 8;
+
+    len = cobs_encode( frame, n + 4, wire );
+    wire[len++] = 0;
+
+    hal_usb_write( wire, len );
+}
+
+// [COBS]
+//
+// each zero byte is replaced by the distance to the next one, with a leading
+// distance to the first; a run of 254 non-zero bytes gets a code of 0xFF and
+// no implied zero.  the decoder drops the implied zero at the very end.
+
+static uint8_t cobs_encode(const uint8_t *in, uint8_t n, uint8_t *out)
+{
+    uint8_t code_at = 0, len = 1, code = 1;
+
+    for ( uint8_t i = 0; i < n; i++ )
+    {
+        if ( in[i] != 0 )
+        {
+            out[len++] = in[i];
+            code++;
+        }
+
+        if ( in[i] == 0 || code == 0xFF )
+        {
+            out[code_at] = code;
+            code_at = len++;
+            code = 1;
+        }
+    }
+
+    out[code_at] = code;
+
+    return len;
+}
+
+// returns the decoded length, 0 if the input isn't valid COBS
+static uint8_t cobs_decode(const uint8_t *in, uint8_t n, uint8_t *out)
+{
+    uint8_t i = 0, len = 0, code;
+
+    while ( i < n )
+    {
+        code = in[i++];
+
+        if ( code == 0 || i + code - 1 > n || len + code > FRAME_MAX )
+            return 0;
+
+        for ( uint8_t k = 1; k < code; k++ )
+            out[len++] = in[i++];
+
+        if ( code < 0xFF && i < n )
+            out[len++] = 0;
+    }
+
+    return len;
+}
@@ -0,0 +1,594 @@
+/*
+ * Longitude measurement math
+ */
+#include <math.h>
+#include "longitude_math.h"
+
+// when the user points the lasers at the ends of an object, there is an
+// implicit triangle formed by the two laser dots and the center of the device.
+// since the laser modules tell us the distances to the dots -- giving us the
+// length of each leg -- and the angle sensor tells us the angle between the
+// legs, we can solve for the length between the two laser dots using the law
+// of cosines.  since the lasers are physically offset from each other (not
+// coincident), we add the distance between them to the derived length.
+//
+// everything here comes in two flavors: the original double-precision math, and
+// an integer version for the Teensy 3.2, which has no FPU and emulates every
+// double operation in software.  FIXED_POINT in longitude.h picks the one the
+// firmware uses.  this file doesn't touch the hardware, so it builds anywhere.
+
+double calc_length(double theta, double a, double b)
+{
+    double phi, len;
+    uint32_t um;
+
+    // convert degrees to radians (where pi/180 = 0.0174...)
+    phi = theta * 0.017453292519943295;
+
+    // solve the triangle
+    len = sqrt( a*a + b*b - 2*a*b*cos(phi) );
+
+    len += LASER_OFFSET_UM / 1000000.0;
+
+    // system error compensation (see length_cal below), added as a difference so
+    // the length keeps its sub-micrometer digits
+    um = (uint32_t)lround( len * 1000000.0 );
+    len += ((double)cal_apply( &length_cal, um ) - um) / 1000000.0;
+
+    return len;
+}
+
+// voltage-to-angle conversion, see get_angle() in longitude_adc.cpp for the derivation
+double calc_angle(double voltage, double vmax)
+{
+    return (90.0 * voltage - 7.2) / (vmax - 0.08);
+}
+
+// maximum sensor output is nominally 1.92V (after the voltage divider). however,
+// once battery voltage falls below 5.125V, sensor max becomes a linear function
+// of the battery voltage.  the function in the else clause is a linear interpolation
+// derived from measurements.
+double sensor_max(double vbat)
+{
+    if ( vbat > 5.125 )
+      return 1.92;
+    else
+      return (0.383 * vbat - 0.064);
+}
+
+// [fixed-point path]
+//
+// the law of cosines loses everything to cancellation when the angle is small
+// (a*a + b*b and 2ab*cos(phi) are nearly equal), so the integer version uses the
+// equivalent half-angle form
+//
+//    len^2 = (a - b)^2 + 4ab * sin^2(phi / 2)
+//
+// which only needs sin over [0, 90] degrees.  we get it from a cosine table,
+// sin(x) = cos(90 - x), in half-degree steps and Q30, interpolated linearly; the
+// interpolation error is largest where the curve bends most, which is at the far
+// end of the table, near sin(0), where it also matters least.
+
+#define COS_STEP_MDEG 500                  // table step, millidegrees
+#define COS_ENTRIES   (90000 / COS_STEP_MDEG + 1)
+#define Q30           1073741824.0
+
+// the table is generated at compile time: a Taylor series is plenty accurate
+// over [0, pi/2], and a parameter pack expands it into one entry per index
+template <int... I> struct index_seq {};
+template <int N, int... I> struct make_index_seq : make_index_seq<N - 1, N - 1, I...> {};
+template <int... I> struct make_index_seq<0, I...> { typedef index_seq<I...> type; };
+
+static constexpr double cos_series(double x2, int k, double term)
+{
+    return k > 14 ? 0.0 : term + cos_series( x2, k + 1, -term * x2 / ((2 * k + 1) * (2 * k + 2)) );
+}
+
+static constexpr int32_t cos_entry(int i)
+{
+    return (int32_t)(cos_series( (i * COS_STEP_MDEG * 1.7453292519943295e-5) * (i * COS_STEP_MDEG * 1.7453292519943295e-5), 0, 1.0 ) * Q30 + 0.5);
+}
+
+template <class S> struct cos_table;
+template <int... I> struct cos_table< index_seq<I...> >
+{
+    static const int32_t q30[sizeof...(I)];
+};
+template <int... I> const int32_t cos_table< index_seq<I...> >::q30[sizeof...(I)] = { cos_entry(I)... };
+
+typedef cos_table< make_index_seq<COS_ENTRIES>::type > cosines;
+
+static_assert( cos_entry(0) == (1L << 30) && cos_entry(COS_ENTRIES - 1) == 0, "cosine table endpoints" );
+static_assert( cos_entry(120) == (1L << 29), "cos(60) = 1/2" );
+
+// sin of an angle in [0, 90000] millidegrees, Q30
+static int32_t sin_q30(int32_t mdeg)
+{
+    int32_t x, i, frac;
+
+    x = 90000 - mdeg;
+    i = x / COS_STEP_MDEG;
+    frac = x % COS_STEP_MDEG;
+
+    if ( i >= COS_ENTRIES - 1 )
+        return cosines::q30[COS_ENTRIES - 1];
+
+    return cosines::q30[i] + (int32_t)(((int64_t)(cosines::q30[i + 1] - cosines::q30[i]) * frac) / COS_STEP_MDEG);
+}
+
+// floor(sqrt(n)), one result bit per iteration, no division
+uint32_t isqrt64(uint64_t n)
+{
+    uint64_t root = 0;
+    uint64_t bit = 1ULL << 62;
+
+    while ( bit > n )
+        bit >>= 2;
+
+    while ( bit )
+    {
+        if ( n >= root + bit )
+        {
+            n -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+        {
+            root >>= 1;
+        }
+
+        bit >>= 2;
+    }
+
+    return (uint32_t)root;
+}
+
+// theta in millidegrees, legs in micrometers; returns the compensated length in
+// micrometers (same compensation as calc_length)
+uint32_t calc_length_um(int32_t theta, uint32_t a, uint32_t b)
+{
+    return cal_apply( &length_cal, calc_length_raw_um(theta, a, b) );
+}
+
+// the same, straight from the geometry; what the calibration mode measures
+uint32_t calc_length_raw_um(int32_t theta, uint32_t a, uint32_t b)
+{
+    uint64_t d, m, n;
+    int32_t s;
+    uint32_t len;
+
+    if ( theta < 0 ) theta = 0;
+    if ( theta > 180000 ) theta = 180000;
+
+    s = sin_q30( theta / 2 );
+
+    // a*sin and b*sin fit easily, and the product of the two stays under 2^64
+    m = ((uint64_t)a * (uint32_t)s + (1UL << 29)) >> 30;
+    n = ((uint64_t)b * (uint32_t)s + (1UL << 29)) >> 30;
+    d = a > b ? a - b : b - a;
+
+    len = isqrt64( d * d + 4 * m * n );
+
+    return len + LASER_OFFSET_UM;
+}
+
+// sensor output and its current maximum in microvolts; returns millidegrees
+int32_t calc_angle_mdeg(int32_t uv, int32_t vmax_uv)
+{
+    return (int32_t)((90000LL * (uv - 80000)) / (vmax_uv - 80000));
+}
+
+// battery voltage in millivolts; returns the sensor's maximum output in microvolts
+int32_t sensor_max_uv(int32_t vbat_mv)
+{
+    if ( vbat_mv > 5125 )
+      return 1920000;
+    else
+      return 383 * vbat_mv - 64000;
+}
+
+// [burst statistics]
+//
+// a sample is an outlier if it sits more than 3 robust standard deviations from
+// the median, the robust sigma being 1.4826 * MAD (median absolute deviation).
+// the lasers report whole millimeters, so a steady target often has MAD = 0; the
+// band never gets narrower than OUTLIER_FLOOR_UM, or every reading a millimeter
+// off would be thrown out.  the rest are averaged, and the confidence interval
+// uses Student's t for the small sample counts we deal with.  for the same
+// reason, a few readings that agree to the millimeter don't make a standard
+// deviation of 0: it never goes below SPREAD_FLOOR_UM, the spread of the
+// rounding itself (1 mm / sqrt(12)).
+
+#define OUTLIER_FLOOR_UM 2000
+#define SPREAD_FLOOR_UM  289
+
+// 95% two-sided t values, in thousandths, for 1..15 degrees of freedom
+static const uint16_t t95[] = { 12706, 4303, 3182, 2776, 2571, 2447, 2365, 2306, 2262, 2228, 2201, 2179, 2160, 2145, 2131 };
+
+static void sort_u32(uint32_t *, uint8_t);
+
+void burst_stats(const uint32_t *samples, uint8_t n, struct burst_stats *st)
+{
+    uint32_t sorted[BURST_MAX], dev[BURST_MAX];
+    uint32_t median, mad, band;
+    uint64_t sum = 0, ss = 0, var;
+    int64_t d;
+    uint8_t i, kept = 0;
+
+    if ( n > BURST_MAX )
+        n = BURST_MAX;
+
+    st->mean_um = st->se_um = st->ci_um = 0;
+    st->kept = st->rejected = 0;
+
+    if ( n == 0 )
+        return;
+
+    for ( i = 0; i < n; i++ )
+        sorted[i] = samples[i];
+
+    sort_u32( sorted, n );
+    median = (n & 1) ? sorted[n / 2] : (uint32_t)(((uint64_t)sorted[n / 2 - 1] + sorted[n / 2]) / 2);
+
+    for ( i = 0; i < n; i++ )
+        dev[i] = samples[i] > median ? samples[i] - median : median - samples[i];
+
+    sort_u32( dev, n );
+    mad = (n & 1) ? dev[n / 2] : (dev[n / 2 - 1] + dev[n / 2]) / 2;
+
+    // 3 * 1.4826 = 4.4478
+    band = (uint32_t)(((uint64_t)mad * 44478 + 5000) / 10000);
+    if ( band < OUTLIER_FLOOR_UM )
+        band = OUTLIER_FLOOR_UM;
+
+    for ( i = 0; i < n; i++ )
+    {
+        if ( (samples[i] > median ? samples[i] - median : median - samples[i]) > band )
+            continue;
+
+        sum += samples[i];
+        kept++;
+    }
+
+    st->kept = kept;
+    st->rejected = n - kept;
+    st->mean_um = (uint32_t)((sum + kept / 2) / kept); // the median is always kept
+
+    if ( kept < 2 )
+        return;
+
+    for ( i = 0; i < n; i++ )
+    {
+        d = (int64_t)samples[i] - st->mean_um;
+
+        if ( (samples[i] > median ? samples[i] - median : median - samples[i]) <= band )
+            ss += (uint64_t)(d * d);
+    }
+
+    // se = s / sqrt(n), with s^2 = ss / (n - 1)
+    var = ss / (kept - 1);
+    if ( var < (uint64_t)SPREAD_FLOOR_UM * SPREAD_FLOOR_UM )
+        var = (uint64_t)SPREAD_FLOOR_UM * SPREAD_FLOOR_UM;
+
+    st->se_um = isqrt64( var / kept );
+    st->ci_um = (uint32_t)(((uint64_t)st->se_um * (kept - 1 <= 15 ? t95[kept - 2] : 1960) + 500) / 1000);
+}
+
+// insertion sort; n is at most BURST_MAX
+static void sort_u32(uint32_t *a, uint8_t n)
+{
+    uint32_t x;
+    uint8_t i, j;
+
+    for ( i = 1; i < n; i++ )
+    {
+        x = a[i];
+
+        for ( j = i; j > 0 && a[j - 1] > x; j-- )
+            a[j] = a[j - 1];
+
+        a[j] = x;
+    }
+}
+
+// [length compensation]
+//
+// the lengths we compute are off by an amount that depends on the length, and
+// on the device.  each device carries a table of corrections at a few computed
+// lengths ("knots"); between knots the correction is interpolated linearly, and
+// beyond the end knots it stays at the end value.  the table lives in the EEPROM (see
+// longitude_config.cpp) and is refit by the calibration mode, so a device is
+// corrected for its own errors without reflashing.
+//
+// the default table is the prototype's compensation.  the minimum length we can
+// measure is equal to the LASER_OFFSET_UM, which is presently 6 cm.  after careful
+// measurement, we determined that the system error is a constant 6.3 cm for
+// lengths greater than 31 cm.  for lengths between 7 cm and 31 cm, a linear
+// regression on the data gave us a function mapping the true length to
+// Longitude's notion of the length, whose inverse is true = 1.065 * len + 3.24 mm.
+// the steps at 7 and 31 cm take a pair of knots a micrometer apart.
+
+struct cal_table length_cal =
+{
+    4,
+    {  69999, 70000, 309999, 310000 },
+    {      0,  7790,  23390,  63000 },
+};
+
+// a table from the EEPROM or a fit is only used if it passes this
+bool cal_valid(const struct cal_table *t)
+{
+    if ( t->n > CAL_POINTS_MAX )
+        return false;
+
+    for ( uint8_t i = 0; i < t->n; i++ )
+    {
+        if ( t->corr_um[i] > CAL_CORR_MAX_UM || t->corr_um[i] < -CAL_CORR_MAX_UM )
+            return false;
+
+        if ( i > 0 && t->raw_um[i] <= t->raw_um[i - 1] )
+            return false;
+    }
+
+    return true;
+}
+
+// computed length to compensated length; binary search for the segment, so
+// O(log n), with no floating point
+uint32_t cal_apply(const struct cal_table *t, uint32_t raw)
+{
+    uint8_t lo, hi, mid;
+    int32_t corr;
+
+    if ( t->n == 0 )
+        return raw;
+
+    if ( raw <= t->raw_um[0] )
+    {
+        corr = t->corr_um[0];
+    }
+    else if ( raw >= t->raw_um[t->n - 1] )
+    {
+        corr = t->corr_um[t->n - 1];
+    }
+    else
+    {
+        // raw_um[lo] <= raw < raw_um[hi]
+        lo = 0;
+        hi = t->n - 1;
+
+        while ( hi - lo > 1 )
+        {
+            mid = (lo + hi) / 2;
+
+            if ( t->raw_um[mid] <= raw )
+                lo = mid;
+            else
+                hi = mid;
+        }
+
+        corr = t->corr_um[lo] + (int32_t)(((int64_t)(t->corr_um[hi] - t->corr_um[lo]) * (raw - t->raw_um[lo]))
+                                          / (int32_t)(t->raw_um[hi] - t->raw_um[lo]));
+    }
+
+    if ( corr < 0 && (uint32_t)-corr > raw )
+        return 0;
+
+    return raw + corr;
+}
+
+// build a table from n computed lengths of known references; references closer
+// than CAL_MERGE_UM are averaged into one knot.  returns the number of knots, or
+// 0 (and leaves the table alone) if the result would be unusable: more knots
+// than fit, or a mapping that doesn't grow with the length, which means a
+// reference was mismeasured or the wrong one was used.
+uint8_t cal_fit(struct cal_table *t, const uint32_t *raw, const uint32_t *ref, uint8_t n)
+{
+    uint64_t raw_sum, ref_sum;
+    uint32_t r[CAL_POINTS_MAX], f[CAL_POINTS_MAX], x;
+    struct cal_table fit;
+    uint8_t i, j, k, m;
+
+    if ( n == 0 || n > CAL_POINTS_MAX )
+        return 0;
+
+    // sort the pairs by computed length
+    for ( i = 0; i < n; i++ )
+    {
+        x = raw[i];
+
+        for ( j = i; j > 0 && r[j - 1] > x; j-- )
+        {
+            r[j] = r[j - 1];
+            f[j] = f[j - 1];
+        }
+
+        r[j] = x;
+        f[j] = ref[i];
+    }
+
+    fit.n = 0;
+
+    for ( i = 0; i < n; i = k )
+    {
+        raw_sum = ref_sum = 0;
+
+        for ( k = i; k < n && r[k] - r[i] < CAL_MERGE_UM; k++ )
+        {
+            raw_sum += r[k];
+            ref_sum += f[k];
+        }
+
+        m = k - i;
+        fit.raw_um[fit.n] = (uint32_t)((raw_sum + m / 2) / m);
+        fit.corr_um[fit.n] = (int32_t)((int64_t)((ref_sum + m / 2) / m) - fit.raw_um[fit.n]);
+
+        // compensated lengths must keep increasing
+        if ( fit.n > 0 && (int64_t)fit.raw_um[fit.n] + fit.corr_um[fit.n]
+                          <= (int64_t)fit.raw_um[fit.n - 1] + fit.corr_um[fit.n - 1] )
+            return 0;
+
+        fit.n++;
+    }
+
+    if ( !cal_valid(&fit) )
+        return 0;
+
+    *t = fit;
+
+    return fit.n;
+}
+
+// [angle linearisation]
+//
+// calc_angle_mdeg() takes the sensor to be a straight line between its nominal
+// end points, and the zero offset can only shift that line.  a real sensor has a
+// gain error and bows away from the line, so a device can carry the codes it
+// read at a few known angles instead.  a monotone cubic (Fritsch-Carlson) runs
+// through them, carried on straight past the end points, and is sampled at every
+// 2^ANGLE_LUT_SHIFT codes into a table.  a reading is then an index and a linear
+// interpolation between two entries: constant time, integers only.  the curve
+// is worked out in doubles, but only when a calibration is loaded or made.
+
+#define ANGLE_CAL_CODE_MAX (1L << 17) // the ADC's full scale at gain 1, in 18-bit units
+#define ANGLE_CAL_MDEG_MIN -10000
+#define ANGLE_CAL_MDEG_MAX 100000
+
+static_assert(((ANGLE_LUT_SIZE - 1) << ANGLE_LUT_SHIFT) == ANGLE_CAL_CODE_MAX, "the table covers the ADC's range");
+
+struct angle_cal angle_cal; // no points: the straight line
+
+static int32_t angle_lut[ANGLE_LUT_SIZE];
+
+// points from the EEPROM or a calibration are only used if they pass this: none
+// at all, or two or more going up in both code and angle
+bool angle_cal_valid(const struct angle_cal *c)
+{
+    if ( c->n == 1 || c->n > ANGLE_CAL_POINTS_MAX )
+        return false;
+
+    for ( uint8_t i = 0; i < c->n; i++ )
+    {
+        if ( c->code[i] < 0 || c->code[i] >= ANGLE_CAL_CODE_MAX )
+            return false;
+
+        if ( c->mdeg[i] < ANGLE_CAL_MDEG_MIN || c->mdeg[i] > ANGLE_CAL_MDEG_MAX )
+            return false;
+
+        if ( i > 0 && (c->code[i] <= c->code[i - 1] || c->mdeg[i] <= c->mdeg[i - 1]) )
+            return false;
+    }
+
+    return true;
+}
+
+// use these points from now on, and build their table; returns false (and
+// changes nothing) if they're unusable
+bool angle_cal_set(const struct angle_cal *c)
+{
+    double d[ANGLE_CAL_POINTS_MAX], m[ANGLE_CAL_POINTS_MAX];
+    double x, y, h, t, a, b, s;
+    uint8_t n = c->n, k = 0;
+
+    if ( !angle_cal_valid(c) )
+        return false;
+
+    angle_cal = *c;
+
+    if ( n == 0 )
+        return true;
+
+    // slopes of the segments, in mdeg per code
+    for ( k = 0; k + 1 < n; k++ )
+        d[k] = (double)(c->mdeg[k + 1] - c->mdeg[k]) / (c->code[k + 1] - c->code[k]);
+
+    // tangents: the mean of the slopes either side, then cut back wherever
+    // they'd let a segment overshoot its end points
+    m[0] = d[0];
+    m[n - 1] = d[n - 2];
+
+    for ( k = 1; k + 1 < n; k++ )
+        m[k] = (d[k - 1] + d[k]) / 2;
+
+    for ( k = 0; k + 1 < n; k++ )
+    {
+        a = m[k] / d[k];
+        b = m[k + 1] / d[k];
+        s = a * a + b * b;
+
+        if ( s > 9 )
+        {
+            m[k] = 3 * a * d[k] / sqrt(s);
+            m[k + 1] = 3 * b * d[k] / sqrt(s);
+        }
+    }
+
+    k = 0;
+
+    for ( uint8_t i = 0; i < ANGLE_LUT_SIZE; i++ )
+    {
+        x = (double)((int32_t)i << ANGLE_LUT_SHIFT);
+
+        while ( k + 2 < n && x >= c->code[k + 1] )
+            k++;
+
+        if ( x <= c->code[0] )
+        {
+            y = c->mdeg[0] + m[0] * (x - c->code[0]);
+        }
+        else if ( x >= c->code[n - 1] )
+        {
+            y = c->mdeg[n - 1] + m[n - 1] * (x - c->code[n - 1]);
+        }
+        else
+        {
+            // cubic Hermite on the segment the code is in
+            h = c->code[k + 1] - c->code[k];
+            t = (x - c->code[k]) / h;
+
+            y = (2*t*t*t - 3*t*t + 1) * c->mdeg[k] + (t*t*t - 2*t*t + t) * h * m[k]
+              + (-2*t*t*t + 3*t*t) * c->mdeg[k + 1] + (t*t*t - t*t) * h * m[k + 1];
+        }
+
+        // far out on a steep line; the table only has to stay in range
+        if ( y > 1e9 ) y = 1e9;
+        if ( y < -1e9 ) y = -1e9;
+
+        angle_lut[i] = (int32_t)lround( y );
+    }
+
+    return true;
+}
+
+// a code (scaled to the nominal maximum) to millidegrees, through the table;
+// only meaningful while angle_cal has points
+int32_t angle_lut_mdeg(int32_t code)
+{
+    int32_t i, f;
+
+    if ( code < 0 )
+        code = 0;
+    if ( code >= (ANGLE_LUT_SIZE - 1) << ANGLE_LUT_SHIFT )
+        code = ((ANGLE_LUT_SIZE - 1) << ANGLE_LUT_SHIFT) - 1;
+
+    i = code >> ANGLE_LUT_SHIFT;
+    f = code & ((1 << ANGLE_LUT_SHIFT) - 1);
+
+    return angle_lut[i] + (int32_t)(((int64_t)angle_lut[i + 1] - angle_lut[i]) * f >> ANGLE_LUT_SHIFT);
+}
+
+// unit conversions, rounded to the nearest thousandth: 1 ft = 304800 um, 1 in = 25400 um
+uint32_t um_to_milli_meter(uint32_t um)
+{
+    return (um + 500) / 1000;
+}
+
+uint32_t um_to_milli_foot(uint32_t um)
+{
+    return (um * 5ULL + 762) / 1524;
+}
+
+uint32_t um_to_milli_inch(uint32_t um)
+{
+    return (um * 5ULL + 63) / 127;
+}
@@ -0,0 +1,83 @@
+/*
+ * Longitude measurement math
+ */
+#ifndef LONGITUDE_MATH_HEADER
+#define LONGITUDE_MATH_HEADER
+
+#include <stdint.h>
+
+// geometry, in integer micrometers
+#define LASER_OFFSET_UM 60000  // distance between the two lasers
+#define RANGE_OFFSET_UM 165000 // distance from back of device to front of laser
+
+// double-precision path
+double calc_length(double, double, double);
+double calc_angle(double, double);
+double sensor_max(double);
+
+// fixed-point path: micrometers, microvolts, millivolts and millidegrees
+uint32_t calc_length_um(int32_t, uint32_t, uint32_t);
+uint32_t calc_length_raw_um(int32_t, uint32_t, uint32_t);
+int32_t calc_angle_mdeg(int32_t, int32_t);
+int32_t sensor_max_uv(int32_t);
+uint32_t isqrt64(uint64_t);
+
+// statistics over a burst of length samples, after outlier rejection
+#define BURST_MAX 16 // most samples burst_stats() takes
+
+struct burst_stats
+{
+    uint32_t mean_um;  // of the samples kept
+    uint32_t se_um;    // standard error of the mean
+    uint32_t ci_um;    // 95% confidence half-width
+    uint8_t kept;
+    uint8_t rejected;
+};
+
+void burst_stats(const uint32_t *, uint8_t, struct burst_stats *);
+
+// length compensation: a piecewise-linear correction per device, indexed by the
+// computed (uncompensated) length
+#define CAL_POINTS_MAX  8
+#define CAL_MERGE_UM    5000   // references closer than this make one knot
+#define CAL_CORR_MAX_UM 200000 // larger corrections mean a broken table
+
+struct cal_table
+{
+    uint8_t n;                       // knots in use; 0 is no compensation
+    uint32_t raw_um[CAL_POINTS_MAX]; // computed length at each knot, increasing
+    int32_t corr_um[CAL_POINTS_MAX]; // what to add to it there
+};
+
+extern struct cal_table length_cal; // used by calc_length and calc_length_um
+
+uint32_t cal_apply(const struct cal_table *, uint32_t);
+uint8_t cal_fit(struct cal_table *, const uint32_t *, const uint32_t *, uint8_t);
+bool cal_valid(const struct cal_table *);
+
+// angle linearisation: the angle sensor's code at a few known angles, per
+// device, resampled into a table at regular codes for the lookup.  codes are
+// 18-bit units scaled to the sensor's nominal 1.92 V maximum.
+#define ANGLE_CAL_POINTS_MAX 8
+#define ANGLE_LUT_SHIFT      11 // codes per table step, as a power of two
+#define ANGLE_LUT_SIZE       65 // steps cover codes 0..131072, the ADC's full scale
+
+struct angle_cal
+{
+    uint8_t n;                          // points in use; 0 is the straight line
+    int32_t code[ANGLE_CAL_POINTS_MAX]; // increasing
+    int32_t mdeg[ANGLE_CAL_POINTS_MAX]; // the angle there, increasing
+};
+
+extern struct angle_cal angle_cal; // set with angle_cal_set()
+
+bool angle_cal_valid(const struct angle_cal *);
+bool angle_cal_set(const struct angle_cal *);
+int32_t angle_lut_mdeg(int32_t);
+
+// micrometers to thousandths of a display unit
+uint32_t um_to_milli_meter(uint32_t);
+uint32_t um_to_milli_foot(uint32_t);
+uint32_t um_to_milli_inch(uint32_t);
+
+#endif
@@ -0,0 +1,151 @@
+/*
+ * Longitude MCP342x delta-sigma ADC formats
+ */
+#ifndef LONGITUDE_MCP342X_HEADER
+#define LONGITUDE_MCP342X_HEADER
+
+#include <stdint.h>
+
+// [MCP342x resolution details]
+//
+// resolution | data rate | min code | max code | LSB (uV) | measured rate
+// -----------------------------------------------------------------------
+//  18-bit     3.75 SPS     -131072    131071     15.625       4.15 SPS
+//  16-bit       15 SPS     -32768     32767      62.500      16.50 SPS
+//  14-bit       60 SPS     -8192      8191      250.000      64.47 SPS
+//  12-bit      240 SPS     -2048      2047     1000.000     235.85 SPS
+//
+// MCP342x configuration register
+// ------------------------------
+// bit #   :  7    | 6   5  | 4    | 3   2  | 1   0
+// bit name:  /RDY | C1  C0 | /O,C | S1  S0 | G1  G0
+// desc    :  flag | chans  | mode | res    | pga
+//
+// the MCP3421 has one channel; the MCP3422/3423 have two and the MCP3424 four.
+// each conversion covers one channel, selected by C1 C0.
+//
+// an 18-bit result is three data bytes followed by the config byte; the others
+// are two data bytes (already sign-extended by the ADC) and the config byte.
+
+#define MCP342X_RDY        0x80
+#define MCP342X_CONTINUOUS 0x10
+#define MCP342X_RES_MASK   0x0C
+
+// PGA gain policies
+template <uint8_t GAIN, uint8_t BITS> struct mcp342x_pga
+{
+    static constexpr uint8_t gain = GAIN;
+    static constexpr uint8_t bits = BITS;
+};
+typedef mcp342x_pga<1, 0x00> pga_x1;
+typedef mcp342x_pga<2, 0x01> pga_x2;
+typedef mcp342x_pga<4, 0x02> pga_x4;
+typedef mcp342x_pga<8, 0x03> pga_x8;
+
+// per-resolution layout; only the four specialisations below exist
+template <uint8_t BITS> struct mcp342x_format;
+
+template <> struct mcp342x_format<18>
+{
+    static constexpr uint8_t  res_bits = 0x0C;
+    static constexpr uint8_t  packet   = 4;
+    static constexpr int32_t  max_code = 0x1FFFF;
+    static constexpr uint32_t poll_us  = 120000; // about twice per conversion
+
+    static constexpr int32_t decode(uint8_t b0, uint8_t b1, uint8_t b2)
+    {
+        // park the 24-bit result at the top of a word and let the arithmetic shift sign-extend it
+        return (int32_t)(((uint32_t)b0 << 24) | ((uint32_t)b1 << 16) | ((uint32_t)b2 << 8)) >> 8;
+    }
+};
+
+// 16/14/12-bit results all arrive as sign-extended 16-bit words
+struct mcp342x_word
+{
+    static constexpr uint8_t packet = 3;
+
+    static constexpr int32_t decode(uint8_t b0, uint8_t b1, uint8_t)
+    {
+        return (int16_t)(((uint16_t)b0 << 8) | b1);
+    }
+};
+
+template <> struct mcp342x_format<16> : mcp342x_word
+{
+    static constexpr uint8_t  res_bits = 0x08;
+    static constexpr int32_t  max_code = 0x7FFF;
+    static constexpr uint32_t poll_us  = 30000;
+};
+
+template <> struct mcp342x_format<14> : mcp342x_word
+{
+    static constexpr uint8_t  res_bits = 0x04;
+    static constexpr int32_t  max_code = 0x1FFF;
+    static constexpr uint32_t poll_us  = 8000;
+};
+
+template <> struct mcp342x_format<12> : mcp342x_word
+{
+    static constexpr uint8_t  res_bits = 0x00;
+    static constexpr int32_t  max_code = 0x7FF;
+    static constexpr uint32_t poll_us  = 2000;
+};
+
+// one resolution/gain combination of the converter.  everything is resolved at
+// compile time; codes are also offered scaled up to 18-bit units, so samples
+// taken at different resolutions can be mixed and compared directly.
+template <uint8_t BITS, class PGA = pga_x1>
+struct MCP342x
+{
+    typedef mcp342x_format<BITS> format;
+
+    static constexpr uint8_t  bits     = BITS;
+    static constexpr uint8_t  packet   = format::packet;
+    static constexpr int32_t  max_code = format::max_code;
+    static constexpr uint32_t poll_us  = format::poll_us;
+    static constexpr uint8_t  shift    = 18 - BITS;
+
+    // LSB at the input pins, in picovolts: 2.048 V full scale over 2^(BITS-1) codes
+    static constexpr uint32_t lsb_pv = (15625000UL << (18 - BITS)) / PGA::gain;
+
+    static constexpr uint8_t config(uint8_t channel, bool continuous)
+    {
+        return (uint8_t)(((channel & 0x03) << 5) | (continuous ? MCP342X_CONTINUOUS : 0) | format::res_bits | PGA::bits);
+    }
+
+    // raw conversion code from a read packet
+    static constexpr int32_t decode(const uint8_t *buf)
+    {
+        return format::decode(buf[0], buf[1], buf[2]);
+    }
+
+    // same, scaled to 18-bit units
+    static constexpr int32_t decode18(const uint8_t *buf)
+    {
+        return format::decode(buf[0], buf[1], buf[2]) * (1L << shift);
+    }
+
+    // true if the packet holds a result we haven't read before, at this resolution
+    static constexpr bool fresh(const uint8_t *buf)
+    {
+        return !(buf[packet - 1] & MCP342X_RDY) && (buf[packet - 1] & MCP342X_RES_MASK) == format::res_bits;
+    }
+};
+
+// datasheet output codes (table 5-3) at the limits of each resolution
+static_assert(mcp342x_format<18>::decode(0x01, 0xFF, 0xFF) ==  131071, "18-bit max");
+static_assert(mcp342x_format<18>::decode(0xFE, 0x00, 0x00) == -131072, "18-bit min");
+static_assert(mcp342x_format<18>::decode(0x00, 0x00, 0x01) ==       1, "18-bit +1");
+static_assert(mcp342x_format<18>::decode(0xFF, 0xFF, 0xFF) ==      -1, "18-bit -1");
+static_assert(mcp342x_format<16>::decode(0x7F, 0xFF, 0)    ==   32767, "16-bit max");
+static_assert(mcp342x_format<16>::decode(0x80, 0x00, 0)    ==  -32768, "16-bit min");
+static_assert(mcp342x_format<14>::decode(0x1F, 0xFF, 0)    ==    8191, "14-bit max");
+static_assert(mcp342x_format<14>::decode(0xE0, 0x00, 0)    ==   -8192, "14-bit min");
+static_assert(mcp342x_format<12>::decode(0x07, 0xFF, 0)    ==    2047, "12-bit max");
+static_assert(mcp342x_format<12>::decode(0xF8, 0x00, 0)    ==   -2048, "12-bit min");
+static_assert(mcp342x_format<12>::decode(0xFF, 0xFF, 0)    ==      -1, "12-bit -1");
+static_assert(MCP342x<18>::lsb_pv == 15625000 && MCP342x<12>::lsb_pv == 1000000000, "LSB");
+static_assert(MCP342x<18, pga_x8>::lsb_pv == 1953125, "LSB at 8x gain");
+static_assert(MCP342x<16>::config(0, true) == 0x18 && MCP342x<18, pga_x2>::config(3, false) == 0x6D, "config");
+
+#endif
@@ -0,0 +1,155 @@
+/*
+ * Longitude power management
+ *
+ * A one-second tick counts how long it's been since a button press or a host
+ * command.  past the timeouts the backlight dims, then the display goes to
+ * sleep, and lasers left lit are turned off (by the state machine, on a
+ * TIMER_LASERS event, so it can leave the aiming screen).
+ *
+ * between events the MCU waits with its clocks running (hal_sleep()).  once
+ * the display is asleep and nothing else is going on, it goes down to stop mode
+ * instead, until a button wakes it.  a press that wakes the display does
+ * nothing else, so nothing starts that the user can't see.
+ */
+#include "longitude.h"
+
+#define POWER_TICK_MS 1000
+
+// inactivity timeouts, in seconds, until changed
+#define POWER_DIM_S         30
+#define POWER_DISPLAY_OFF_S 120
+#define POWER_LASERS_OFF_S  60
+
+// backlight PWM levels
+#define BACKLIGHT_FULL 255
+#define BACKLIGHT_DIM  40
+
+enum DISPLAY_POWER { DISPLAY_ON, DISPLAY_DIM, DISPLAY_OFF };
+
+// 0 turns a timeout off
+uint16_t power_dim_s         = POWER_DIM_S;
+uint16_t power_display_off_s = POWER_DISPLAY_OFF_S;
+uint16_t power_lasers_off_s  = POWER_LASERS_OFF_S;
+
+static volatile uint32_t idle_s;  // since the last button or command
+static volatile uint8_t wanted;   // DISPLAY_*: what the tick and power_activity() ask for
+static volatile uint8_t display;  // what the display is set to (changed by the main loop only)
+
+static void power_tick(void);
+static void set_display(uint8_t);
+static bool can_stop(void);
+
+void power_setup(void)
+{
+  idle_s = 0;
+  wanted = DISPLAY_ON;
+  display = DISPLAY_ON; // display_setup() woke the panel
+
+  hal_backlight( backlight_pin, BACKLIGHT_FULL );
+  hal_timer_start( HAL_TIMER_POWER, POWER_TICK_MS * 1000UL, power_tick );
+}
+
+// a button edge or a host command; safe from interrupts.  returns true if the
+// display was asleep, in which case a button press should only wake it
+bool power_activity(void)
+{
+  bool asleep = (display == DISPLAY_OFF);
+
+  idle_s = 0;
+
+  if ( wanted != DISPLAY_ON )
+  {
+    wanted = DISPLAY_ON;
+    event_post( EV_TIMER, TIMER_POWER, hal_millis() );
+  }
+
+  return asleep;
+}
+
+// call from the main loop; the tick's (or a button's) event wakes it up when
+// the display should change.  sleeps right here, in stop mode, when it can.
+void power_service(void)
+{
+  if ( wanted != display )
+    set_display( wanted );
+
+  if ( !can_stop() )
+    return;
+
+  config_flush();   // in case the battery comes out while it sleeps
+  hal_i2c_finish(); // no transfer left hanging when the clocks stop
+
+  // masked, so a button pressed after the check still wakes it (see event_wait())
+  hal_irq_off();
+
+  if ( !event_pending() && wanted == DISPLAY_OFF )
+  {
+    SPAN_BEGIN(SPAN_SLEEP);
+    hal_stop();
+    SPAN_END(SPAN_SLEEP);
+  }
+
+  hal_irq_on();
+
+  // the button that woke it wants the display back
+  if ( wanted != display )
+    set_display( wanted );
+}
+
+// timer interrupt
+static void power_tick(void)
+{
+  uint8_t want;
+
+  if ( state == TRACKING ) // someone's watching the live reading
+    idle_s = 0;
+  else
+    idle_s++;
+
+  if ( power_display_off_s && idle_s >= power_display_off_s )
+    want = DISPLAY_OFF;
+  else if ( power_dim_s && idle_s >= power_dim_s )
+    want = DISPLAY_DIM;
+  else
+    want = DISPLAY_ON;
+
+  if ( want != wanted )
+  {
+    wanted = want;
+    event_post( EV_TIMER, TIMER_POWER, hal_millis() );
+  }
+
+  // lit lasers past their timeout; posted every tick until they're off, since
+  // states that aren't waiting for the user drop it
+  if ( power_lasers_off_s && idle_s >= power_lasers_off_s && (laser_left.enabled || laser_right.enabled) )
+    event_post( EV_TIMER, TIMER_LASERS, hal_millis() );
+}
+
+// the panel is woken before the backlight comes up, and the backlight goes
+// out before the panel sleeps, so neither shows a blank or garbled screen
+static void set_display(uint8_t level)
+{
+  if ( display == DISPLAY_OFF && level != DISPLAY_OFF )
+    display_sleep( false );
+
+  if ( level == DISPLAY_OFF )
+  {
+    hal_backlight( backlight_pin, 0 );
+    display_sleep( true );
+  }
+  else
+  {
+    hal_backlight( backlight_pin, level == DISPLAY_DIM ? BACKLIGHT_DIM : BACKLIGHT_FULL );
+  }
+
+  display = level;
+}
+
+// nothing the clocks are needed for: the lasers are off, no melody is playing,
+// no task is waiting on a device, no host is on USB, and the state machine is
+// only waiting for the user
+static bool can_stop(void)
+{
+  return display == DISPLAY_OFF && (state == WAIT_LASER_ON || state == WAIT_IDLE)
+      && !laser_left.enabled && !laser_right.enabled && !sound_busy() && !task_busy() && !hal_usb_connected();
+}
@@ -0,0 +1,79 @@
+/*
+ * Longitude profiler
+ */
+#include <string.h>
+#include "longitude_profile.h"
+
+#if PROFILE
+
+static struct span_stats spans[SPAN_COUNT];
+
+static uint32_t slept;       // cycles in SPAN_SLEEP since boot (wraps; only differences matter)
+static uint32_t pass_start;
+static uint32_t pass_slept;
+static uint8_t pass_state;
+
+void profile_setup(void)
+{
+    hal_cycles_start();
+}
+
+// main loop only
+void profile_record(uint8_t id, uint32_t cycles)
+{
+    struct span_stats *s;
+    uint8_t b = 0;
+
+    if ( id >= SPAN_COUNT )
+        return;
+
+    s = &spans[id];
+
+    // bucket by bit length
+    for ( uint32_t c = cycles; c; c >>= 1 )
+        b++;
+
+    s->count++;
+    s->sum += cycles;
+    s->bucket[b]++;
+
+    if ( cycles > s->max )
+        s->max = cycles;
+
+    if ( id == SPAN_SLEEP )
+        slept += cycles;
+}
+
+// hal_micros() since reset, in counter ticks
+void profile_since_reset(uint8_t id)
+{
+    uint64_t ticks = (uint64_t)hal_micros() * hal_cycles_hz() / 1000000;
+
+    profile_record( id, ticks > UINT32_MAX ? UINT32_MAX : (uint32_t)ticks );
+}
+
+void profile_pass_begin(uint8_t state)
+{
+    pass_state = state;
+    pass_slept = slept;
+    pass_start = hal_cycles();
+}
+
+void profile_pass_end(void)
+{
+    uint32_t busy = hal_cycles() - pass_start - (slept - pass_slept);
+
+    profile_record( SPAN_STATE + pass_state, busy );
+}
+
+const struct span_stats *profile_stats(uint8_t id)
+{
+    return id < SPAN_COUNT ? &spans[id] : NULL;
+}
+
+void profile_reset(void)
+{
+    memset( spans, 0, sizeof spans );
+}
+
+#endif
@@ -0,0 +1,99 @@
+/*
+ * Longitude profiler
+ *
+ * Spans around the hot paths, timed with the cycle counter (the Cortex-M4's
+ * DWT on the board, the host's steady clock in the simulator), go into a
+ * log2-bucketed histogram per span in static RAM.  the host link dumps them
+ * (LINK_PROFILE), and tools/longitude_link.py turns them into p50/p99/max.
+ *
+ * set PROFILE to 1 to build it in; at 0 the macros expand to nothing.
+ *
+ *   SPAN_BEGIN(SPAN_LENGTH);
+ *   ...
+ *   SPAN_END(SPAN_LENGTH);
+ *
+ * a span a task waits in (longitude_task.h) keeps its start in a static:
+ *
+ *   SPAN_MARK(shot_start);
+ *   ...
+ *   SPAN_SINCE(SPAN_LASER_SHOT, shot_start);
+ *
+ * and one that starts at reset, before the counter runs, is timed by the clock:
+ *
+ *   SPAN_SINCE_RESET(SPAN_BOOT_READY);
+ *
+ * No Arduino dependencies.
+ */
+#ifndef LONGITUDE_PROFILE_HEADER
+#define LONGITUDE_PROFILE_HEADER
+
+#include <stdint.h>
+#include "longitude_hal.h"
+
+#ifndef PROFILE
+#define PROFILE 0
+#endif
+
+// what gets timed; the numbers go over the link, so new spans go before
+// SPAN_STATE, and tools/longitude_link.py has the same list
+enum SPAN_ID
+{
+    SPAN_GET_ANGLE,    // get_angle()
+    SPAN_LASERS_ON,    // both modules lit and confirmed
+    SPAN_LASER_SHOT,   // both modules measure, command to last result
+    SPAN_LENGTH,       // compute_length()
+    SPAN_CAPTURE,      // a whole burst
+    SPAN_BEEP,         // beep(), queueing a melody
+    SPAN_DISPLAY,      // update_display()
+    SPAN_HISTORY,      // history_add()
+    SPAN_CONFIG,       // config_flush(), the EEPROM writes
+    SPAN_SLEEP,        // asleep waiting for an event or a laser byte
+    SPAN_BOOT_CORE,    // reset to setup(): the core's startup, USB included
+    SPAN_BOOT_DEVICES, // setup(): the ADC, buttons, lasers and battery
+    SPAN_BOOT_DISPLAY, // setup(): the panel and the glyph cache
+    SPAN_BOOT_CONFIG,  // setup(): load_config()
+    SPAN_BOOT_HISTORY, // setup(): history_setup()
+    SPAN_BOOT_READY,   // reset to the idle screen, ready to measure
+    SPAN_STATE,        // one loop() pass, less any sleep, per FSM state: SPAN_STATE + state
+    SPAN_COUNT = SPAN_STATE + 17 // one per FSM state
+};
+
+#define PROFILE_BUCKETS 33 // by bit length: 0, 1, 2..3, 4..7, .. 2^31..2^32-1
+
+struct span_stats
+{
+    uint32_t count;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t bucket[PROFILE_BUCKETS];
+};
+
+// a loop() pass is charged to the state it started in; time in SPAN_SLEEP
+// within it isn't counted
+#if PROFILE
+#define SPAN_BEGIN(id)         uint32_t span_start_##id = hal_cycles()
+#define SPAN_END(id)           profile_record( (id), hal_cycles() - span_start_##id )
+#define SPAN_MARK(at)          ((at) = hal_cycles())
+#define SPAN_SINCE(id, at)     profile_record( (id), hal_cycles() - (at) )
+#define SPAN_SINCE_RESET(id)   profile_since_reset( id )
+#define PROFILE_PASS_BEGIN(st) profile_pass_begin( st )
+#define PROFILE_PASS_END()     profile_pass_end()
+#else
+#define SPAN_BEGIN(id)
+#define SPAN_END(id)
+#define SPAN_MARK(at)
+#define SPAN_SINCE(id, at)
+#define SPAN_SINCE_RESET(id)
+#define PROFILE_PASS_BEGIN(st)
+#define PROFILE_PASS_END()
+#endif
+
+void profile_setup(void);
+void profile_record(uint8_t, uint32_t);
+void profile_since_reset(uint8_t);
+void profile_pass_begin(uint8_t);
+void profile_pass_end(void);
+const struct span_stats *profile_stats(uint8_t);
+void profile_reset(void);
+
+#endif
@@ -0,0 +1,136 @@
+/*
+ * Longitude laser module frame parser
+ */
+#include "longitude_protocol.h"
+
+// [frame format]
+//
+// every frame is '$', a run of decimal digits, and a terminating '&'. the digits
+// are read in pairs, each pair being one "byte" in decimal:
+//
+//   $ LLLL CC DD.. SS &
+//
+//   LLLL  number of pairs that follow (command, data and checksum)
+//   CC    command code
+//   DD..  data pairs, if any
+//   SS    checksum: decimal sum of all preceding pairs
+//
+// e.g. the measure confirm "$00022123" is length 2, command 21, checksum 0+2+21 = 23,
+// and the lights-off command (and its echo) "$0003260029" is command 26 with data 00.
+// a measurement comes back as command 21 with four data pairs holding the distance
+// in millimeters.  the module reports its error conditions as "distances" of 15, 16,
+// 17 and 18 mm, which are below its minimum range anyway.
+//
+// we don't reject frames on checksum: the module docs never say how the sum wraps
+// past 99, and a wrong guess would throw away every long-range measurement.
+
+// command codes
+#define CMD_MEASURE 21
+#define CMD_LASER   26
+#define CMD_REPLY   33
+
+// error codes, as they appear in the distance field
+#define ERR_TOO_CLOSE      15
+#define ERR_NO_ECHO        16
+#define ERR_TOO_STRONG     17
+#define ERR_TOO_MUCH_LIGHT 18
+
+static enum LASER_FRAME decode(struct laser_parser *);
+static uint32_t digits(const char *, uint8_t);
+
+void laser_parser_reset(struct laser_parser *p)
+{
+    p->len = 0;
+    p->in_frame = false;
+    p->distance_um = 0;
+}
+
+// feed one received byte to the parser; returns the frame type when the byte
+// completes a frame, LASER_NONE otherwise.  anything outside a '$'...'&' pair is
+// line noise and gets dropped; a '$' in the middle of a frame starts over.
+enum LASER_FRAME laser_parse(struct laser_parser *p, char c)
+{
+    if ( c == '$' )
+    {
+        p->in_frame = true;
+        p->len = 0;
+        return LASER_NONE;
+    }
+
+    if ( !p->in_frame )
+        return LASER_NONE;
+
+    if ( c == '&' )
+    {
+        p->in_frame = false;
+        return decode( p );
+    }
+
+    if ( c < '0' || c > '9' || p->len == LASER_FRAME_MAX ) // garbage; hunt for the next '$'
+    {
+        p->in_frame = false;
+        return LASER_NONE;
+    }
+
+    p->buf[p->len++] = c;
+
+    return LASER_NONE;
+}
+
+// classify a complete frame body sitting in p->buf
+static enum LASER_FRAME decode(struct laser_parser *p)
+{
+    uint32_t pairs, cmd, d;
+
+    // shortest valid frame is length, command and checksum
+    if ( p->len < 8 || (p->len & 1) )
+        return LASER_UNKNOWN;
+
+    pairs = digits( p->buf, 4 );
+
+    if ( p->len != 4 + 2 * pairs )
+        return LASER_UNKNOWN;
+
+    cmd = digits( p->buf + 4, 2 );
+
+    if ( cmd == CMD_REPLY && pairs == 2 )
+        return LASER_REPLY;
+
+    if ( cmd == CMD_LASER && pairs == 3 ) // the data pair is 01 for on, 00 for off
+        return digits( p->buf + 6, 2 ) ? LASER_ON_CONFIRM : LASER_OFF_CONFIRM;
+
+    if ( cmd == CMD_MEASURE && pairs == 2 )
+        return LASER_MEASURE_CONFIRM;
+
+    if ( cmd == CMD_MEASURE && pairs == 6 )
+    {
+        d = digits( p->buf + 6, 8 );
+
+        switch ( d )
+        {
+            case ERR_TOO_CLOSE:      return LASER_TOO_CLOSE;
+            case ERR_NO_ECHO:        return LASER_NO_ECHO;
+            case ERR_TOO_STRONG:     return LASER_TOO_STRONG;
+            case ERR_TOO_MUCH_LIGHT: return LASER_TOO_MUCH_LIGHT;
+        }
+
+        if ( d > UINT32_MAX / 1000 ) // corrupted; would overflow micrometers
+            return LASER_UNKNOWN;
+
+        p->distance_um = d * 1000;
+        return LASER_DISTANCE;
+    }
+
+    return LASER_UNKNOWN;
+}
+
+// convert n ascii digits to an integer (digits already validated by laser_parse)
+static uint32_t digits(const char *s, uint8_t n)
+{
+    uint32_t val = 0;
+
+    while ( n-- )
+        val = val * 10 + (uint32_t)(*s++ - '0');
+
+    return val;
+}
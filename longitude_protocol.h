@@ -0,0 +1,41 @@
+/*
+ * Longitude laser module serial protocol
+ */
+#ifndef LONGITUDE_PROTOCOL_HEADER
+#define LONGITUDE_PROTOCOL_HEADER
+
+#include <stdint.h>
+
+// longest frame the modules send (a distance frame, "$0006210000001542"), plus slack
+#define LASER_FRAME_MAX 20
+
+// what a completed frame turned out to be
+enum LASER_FRAME
+{
+    LASER_NONE,            // no complete frame yet
+    LASER_REPLY,           // laser is talking
+    LASER_ON_CONFIRM,      // lights are on
+    LASER_MEASURE_CONFIRM, // measurement coming in
+    LASER_DISTANCE,        // valid distance, see distance_um
+    LASER_TOO_CLOSE,       // object is too close to laser
+    LASER_NO_ECHO,         // no reflection received
+    LASER_TOO_STRONG,      // laser reflection is too strong
+    LASER_TOO_MUCH_LIGHT,  // too much ambient light
+    LASER_UNKNOWN,         // well-formed frame we don't understand
+    LASER_TIMEOUT,         // not a frame: the transaction ran out of time waiting for one
+    LASER_OFF_CONFIRM      // lights are off (last, as the numbers go over the host link)
+};
+
+// per-port receive state; fixed size, lives inside struct laser
+struct laser_parser
+{
+    char buf[LASER_FRAME_MAX]; // frame body, without the '$' and '&'
+    uint8_t len;
+    bool in_frame;             // true once we've seen a '$'
+    uint32_t distance_um;      // payload of the last LASER_DISTANCE frame
+};
+
+void laser_parser_reset(struct laser_parser *);
+enum LASER_FRAME laser_parse(struct laser_parser *, char);
+
+#endif
@@ -0,0 +1,134 @@
+/*
+ * Longitude sound functions
+ *
+ * beep() only queues a melody and returns; a timer interrupt steps through the
+ * note tables and starts each note with hal_tone(), so the state machine keeps
+ * running (lasers, ADC, display) while the speaker plays.
+ */
+#include "longitude.h"
+
+#define BEEP_PIN 3 // speaker output pin
+
+// sequencer resolution; every note length and spacing below is a multiple of it
+#define TICK_MS 10
+
+// melodies waiting to be played (power of 2)
+#define QUEUE_SIZE 4
+
+// one note: frequency and length (handed to hal_tone()), and the time until the next
+// note starts.  the last note of a melody has its own length as its step, so a
+// queued melody doesn't cut it off; a zero step ends the table.
+struct note
+{
+    uint16_t hz;
+    uint16_t ms;
+    uint16_t step_ms;
+};
+
+// note tables; const, so they stay in flash
+static const struct note booting_notes[] = { // g, d, a, b
+    { 196, 250, 300 }, { 294, 250, 300 }, { 440, 1000, 600 }, { 494, 1000, 1000 }, { 0, 0, 0 }
+};
+
+static const struct note finished_notes[] = { // a short trill
+    { 2000, 50, 50 }, { 3000, 150, 50 }, { 1000, 50, 50 }, { 0, 0, 0 }
+};
+
+static const struct note mode_change_notes[] = { // quick beep
+    { 5500, 10, 10 }, { 0, 0, 0 }
+};
+
+static const struct note special_notes[] = { // a grunt
+    { 300, 10, 10 }, { 0, 0, 0 }
+};
+
+static const struct note beethoven_notes[] = { // beethoven's 5th
+    { 311, 100, 200 }, { 311, 100, 200 }, { 311, 100, 200 }, { 262, 1000, 1000 },
+    { 294, 150, 200 }, { 294, 150, 200 }, { 294, 150, 200 }, { 247, 1250, 1250 }, { 0, 0, 0 }
+};
+
+static const struct note charge_notes[] = { // charge! fanfare
+    { 196, 100, 150 }, { 262, 100, 150 }, { 330, 100, 150 }, { 392, 300, 300 },
+    { 330, 50, 150 }, { 392, 500, 500 }, { 523, 500, 500 }, { 0, 0, 0 }
+};
+
+// indexed by the BEEPS enum
+static const struct note *const melodies[] = {
+    booting_notes, finished_notes, mode_change_notes, special_notes, beethoven_notes, charge_notes
+};
+
+// written by beep() at the head, consumed by the timer at the tail
+static volatile BEEPS queue[QUEUE_SIZE];
+static volatile uint8_t queue_head;
+static volatile uint8_t queue_tail;
+
+static const struct note *volatile playing; // current note, or NULL between melodies
+static volatile uint16_t wait_ticks;        // until the next note starts
+static volatile bool running;               // sequencer timer is active
+
+static void sequencer_tick(void);
+
+// queue a melody and return right away
+void beep(BEEPS action)
+{
+  if ( (unsigned)action >= sizeof melodies / sizeof melodies[0] )
+    return;
+
+  SPAN_BEGIN(SPAN_BEEP);
+
+  // the tick handler may stop the timer when the queue runs dry, so check and
+  // restart with it held off
+  hal_irq_off();
+
+  if ( (uint8_t)(queue_head - queue_tail) < QUEUE_SIZE ) // otherwise drop it
+  {
+    queue[queue_head & (QUEUE_SIZE - 1)] = action;
+    queue_head++;
+  }
+
+  if ( !running )
+  {
+    running = true;
+    wait_ticks = 0;
+    hal_timer_start( HAL_TIMER_SOUND, TICK_MS * 1000, sequencer_tick );
+  }
+
+  hal_irq_on();
+
+  SPAN_END(SPAN_BEEP);
+}
+
+// true while anything is playing or queued
+bool sound_busy(void)
+{
+  return running;
+}
+
+// timer interrupt: start the next note when the current one's step is up
+static void sequencer_tick(void)
+{
+  if ( wait_ticks && --wait_ticks )
+    return;
+
+  // advance within the melody, or pick up the next queued one
+  if ( playing && playing->step_ms )
+    playing++;
+
+  if ( !playing || !playing->step_ms )
+  {
+    if ( queue_tail == queue_head )
+    {
+      event_post( EV_TIMER, TIMER_SOUND, hal_millis() );
+      playing = NULL;
+      running = false;
+      hal_timer_stop( HAL_TIMER_SOUND );
+      return;
+    }
+
+    playing = melodies[queue[queue_tail & (QUEUE_SIZE - 1)]];
+    queue_tail++;
+  }
+
+  hal_tone( BEEP_PIN, playing->hz, playing->ms );
+  wait_ticks = playing->step_ms / TICK_MS;
+}
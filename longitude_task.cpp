@@ -0,0 +1,157 @@
+/*
+ * Longitude tasks
+ *
+ * The scheduler is a table with a slot per task, run in id order from the main
+ * loop.  a task that's waiting costs a call to its function per pass, which is
+ * a jump to its wait and a test.  all of it is main loop only.
+ */
+#include <string.h>
+#include "longitude_task.h"
+
+static struct task tasks[TASK_COUNT];
+static struct task_stats stats[TASK_COUNT];
+
+static uint32_t last_pass;  // micros() at the end of the last task_service() that had work
+static bool was_busy;       // and whether it left any running
+static uint32_t gap_max;
+
+static void (*trace)(uint8_t, uint8_t);
+
+void task_init(void)
+{
+    memset( tasks, 0, sizeof tasks );
+    memset( stats, 0, sizeof stats );
+    was_busy = false;
+    gap_max = 0;
+}
+
+// (re)start a task from the top; it first runs on the next task_service()
+void task_start(uint8_t id, uint8_t (*fn)(struct task *), uint32_t timeout_ms)
+{
+    struct task *t = &tasks[id];
+
+    t->fn = fn;
+    t->lc = 0;
+    t->running = true;
+    t->expired = false;
+    t->deadline = hal_millis() + timeout_ms;
+
+    stats[id].runs++;
+
+    if ( trace )
+        trace( id, TRACE_START );
+}
+
+bool task_running(uint8_t id)
+{
+    return tasks[id].running;
+}
+
+// any task at all
+bool task_busy(void)
+{
+    for ( uint8_t id = 0; id < TASK_COUNT; id++ )
+        if ( tasks[id].running )
+            return true;
+
+    return false;
+}
+
+// for the task itself: its deadline has passed (the waits check this)
+bool task_expired(struct task *t)
+{
+    if ( !t->expired && (int32_t)(hal_millis() - t->deadline) >= 0 )
+        t->expired = true;
+
+    return t->expired;
+}
+
+// the given task's EV_TASK
+bool task_done(const struct event *ev, uint8_t id)
+{
+    return ev->type == EV_TASK && ev->arg == id;
+}
+
+// one step of every running task; loop() calls this every pass.  returns true
+// while any is still running
+bool task_service(void)
+{
+    struct task *t;
+    uint32_t start, took;
+    bool busy = false;
+
+    // how long the tasks went without a look
+    if ( was_busy && hal_micros() - last_pass > gap_max )
+        gap_max = hal_micros() - last_pass;
+
+    for ( uint8_t id = 0; id < TASK_COUNT; id++ )
+    {
+        t = &tasks[id];
+
+        if ( !t->running )
+            continue;
+
+        start = hal_micros();
+
+        if ( t->fn(t) == TASK_WAITING )
+        {
+            busy = true;
+        }
+        else
+        {
+            t->running = false;
+
+            if ( t->expired )
+                stats[id].expired++;
+
+            if ( trace )
+                trace( id, t->expired ? TRACE_EXPIRED : TRACE_DONE );
+
+            event_post( EV_TASK, id, hal_millis() );
+        }
+
+        took = hal_micros() - start;
+        stats[id].steps++;
+
+        if ( took > stats[id].max_step_us )
+            stats[id].max_step_us = took;
+    }
+
+    last_pass = hal_micros();
+    was_busy = busy;
+
+    return busy;
+}
+
+// event_wait(), except the tasks keep running until the event comes
+void task_wait(struct event *ev)
+{
+    while ( !event_get(ev) )
+    {
+        if ( !task_service() )
+        {
+            event_wait( ev );
+            return;
+        }
+
+        // a byte from a laser, the ADC or the 1 ms tick, whichever is first
+        event_idle();
+    }
+}
+
+const struct task_stats *task_stats(uint8_t id)
+{
+    return &stats[id];
+}
+
+// the longest the running tasks went between steps, in us
+uint32_t task_gap_max_us(void)
+{
+    return gap_max;
+}
+
+// for the simulator's trace: called as each task starts and finishes
+void task_on_trace(void (*fn)(uint8_t, uint8_t))
+{
+    trace = fn;
+}
@@ -0,0 +1,87 @@
+/*
+ * Longitude tasks
+ *
+ * Work that waits on a device (a laser transaction, a burst of shots, the ADC
+ * powering up) runs as a task: a stackless protothread that returns to the main
+ * loop wherever it would wait, and carries on from there the next time it's
+ * run.  loop() runs the tasks every pass (task_service()), so while one waits
+ * the link, the battery and the power manager keep going, and tasks waiting on
+ * different devices overlap.
+ *
+ * every task has a deadline.  a wait still going past it ends anyway, and
+ * task_expired() tells the task to give up rather than hang the device.  a task
+ * that has finished posts EV_TASK with its id.
+ *
+ *   static uint8_t warm_up(struct task *t)
+ *   {
+ *       TASK_BEGIN(t);
+ *       TASK_WAIT_UNTIL(t, device_ready());
+ *       if ( task_expired(t) )
+ *           TASK_EXIT(t);
+ *       TASK_SLEEP(t, 10);
+ *       TASK_END(t);
+ *   }
+ *
+ * the waits are case labels, so a task's locals don't survive them (keep its
+ * state in statics), and it can't wait inside a switch of its own.
+ *
+ * No Arduino dependencies.
+ */
+#ifndef LONGITUDE_TASK_HEADER
+#define LONGITUDE_TASK_HEADER
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "longitude_hal.h"
+#include "longitude_events.h"
+
+// one slot each; the ids go out as EV_TASK's argument
+enum TASK_ID { TASK_ADC, TASK_SPLASH, TASK_LASERS, TASK_CAPTURE, TASK_ZERO, TASK_COUNT };
+
+// what a task function returns
+enum TASK_STATUS { TASK_WAITING, TASK_DONE };
+
+// for task_on_trace()
+enum TASK_TRACE { TRACE_START, TRACE_DONE, TRACE_EXPIRED };
+
+struct task
+{
+    uint8_t (*fn)(struct task *);
+    uint16_t lc;       // where it carries on: the line of the wait it's in, 0 at the top
+    bool running;
+    bool expired;      // a wait ran past the deadline
+    uint32_t deadline; // millis()
+    uint32_t wake;     // millis() a TASK_SLEEP is up
+};
+
+// per task, since boot
+struct task_stats
+{
+    uint32_t runs;
+    uint32_t steps;       // calls to its function
+    uint32_t expired;     // runs that hit the deadline
+    uint32_t max_step_us; // longest call; waiting in one is a bug
+};
+
+#define TASK_BEGIN(t)            switch ( (t)->lc ) { case 0:
+#define TASK_WAIT_UNTIL(t, cond) do { (t)->lc = __LINE__; if ( 0 ) { case __LINE__: ; } \
+                                      if ( !(cond) && !task_expired(t) ) return TASK_WAITING; } while (0)
+#define TASK_YIELD(t)            do { (t)->lc = __LINE__; return TASK_WAITING; case __LINE__: ; } while (0)
+#define TASK_SLEEP(t, ms)        do { (t)->wake = hal_millis() + (ms); \
+                                      TASK_WAIT_UNTIL(t, (int32_t)(hal_millis() - (t)->wake) >= 0); } while (0)
+#define TASK_EXIT(t)             do { (t)->lc = 0; return TASK_DONE; } while (0)
+#define TASK_END(t)              } (t)->lc = 0; return TASK_DONE
+
+void task_init(void);
+void task_start(uint8_t id, uint8_t (*fn)(struct task *), uint32_t timeout_ms);
+bool task_running(uint8_t id);
+bool task_busy(void);
+bool task_expired(struct task *);
+bool task_done(const struct event *, uint8_t id);
+bool task_service(void);
+void task_wait(struct event *);
+const struct task_stats *task_stats(uint8_t id);
+uint32_t task_gap_max_us(void);
+void task_on_trace(void (*)(uint8_t id, uint8_t what));
+
+#endif
@@ -0,0 +1,315 @@
+/*
+ * Longitude I/O trace
+ */
+#include <string.h>
+#include "longitude.h"
+
+// payload bytes by kind; the ones marked VAR have a length byte in front
+#define VAR 0xFF
+
+static const uint8_t payload_len[TRACE_KINDS] =
+{
+    1,   // TRACE_BOOT
+    1,   // TRACE_UART
+    VAR, // TRACE_I2C
+    3,   // TRACE_ANALOG
+    2,   // TRACE_PIN
+    VAR, // TRACE_USB
+    0,   // TRACE_USB_HOST
+    VAR, // TRACE_EEPROM
+    4,   // TRACE_RTC
+    8,   // TRACE_RESULT
+    0,   // TRACE_LOST
+};
+
+static void (*result_fn)(uint8_t);
+
+#if TRACE
+
+// head and tail run free; the ring is written with interrupts masked, from
+// anywhere, and read by the main loop only
+static uint8_t ring[TRACE_RING];
+static volatile uint32_t ring_head, ring_tail;
+
+static uint32_t last_us;  // hal_micros() of the last event kept
+static bool lost;         // events were dropped since; TRACE_LOST goes in first
+static int8_t usb_host = -1;
+static void (*sink)(const uint8_t *, uint32_t);
+
+static void add(uint8_t, uint8_t, const void *, uint8_t);
+static uint32_t encode(uint8_t *, uint8_t, uint8_t, uint32_t, const uint8_t *, uint8_t);
+static void put(const uint8_t *, uint32_t);
+
+#endif
+
+// first thing in setup(), so the trace has everything the firmware reads
+void trace_start(void)
+{
+#if TRACE
+    uint8_t format = TRACE_FORMAT;
+
+    ring_head = ring_tail = 0;
+    last_us = 0; // the first event's time is from boot
+    lost = false;
+    usb_host = -1;
+
+    add( TRACE_BOOT, 0, &format, 1 );
+#endif
+}
+
+// a measurement finished; kind is a HISTORY_KIND
+void trace_result(uint8_t kind)
+{
+#if TRACE
+    uint8_t p[8];
+
+    memcpy( p, &measured_length_um, 4 );
+    memcpy( p + 4, &angle_mdeg, 4 );
+
+    add( TRACE_RESULT, kind, p, sizeof p );
+#endif
+
+    if ( result_fn )
+        result_fn( kind );
+}
+
+// main loop only: up to max bytes of events, which may stop partway through one
+uint32_t trace_read(uint8_t *buf, uint32_t max)
+{
+#if TRACE
+    uint32_t tail = ring_tail;
+    uint32_t n = ring_head - tail;
+
+    if ( n > max )
+        n = max;
+
+    for ( uint32_t i = 0; i < n; i++ )
+        buf[i] = ring[(tail + i) & (TRACE_RING - 1)];
+
+    ring_tail = tail + n;
+
+    return n;
+#else
+    (void)buf; (void)max;
+    return 0;
+#endif
+}
+
+// the simulator's, to see each result as it comes
+void trace_on_result(void (*fn)(uint8_t))
+{
+    result_fn = fn;
+}
+
+// the simulator's: events go straight to fn as they happen, and not the ring
+void trace_sink(void (*fn)(const uint8_t *, uint32_t))
+{
+#if TRACE
+    sink = fn;
+#else
+    (void)fn;
+#endif
+}
+
+// decode the event at pos of a trace's events (TRACE_MAGIC left off), adding
+// its time to ev->us, which starts at 0.  returns where the next one starts, or
+// 0 at the end, or on an event that's cut short or of an unknown kind.
+uint32_t trace_next(const uint8_t *buf, uint32_t n, uint32_t pos, struct trace_event *ev)
+{
+    uint32_t dt = 0;
+    uint8_t kind, shift = 0, len;
+
+    if ( pos >= n )
+        return 0;
+
+    kind = buf[pos] >> 4;
+    ev->arg = buf[pos++] & 0x0F;
+
+    if ( kind >= TRACE_KINDS )
+        return 0;
+
+    do
+    {
+        if ( pos >= n || shift > 28 )
+            return 0;
+
+        dt |= (uint32_t)(buf[pos] & 0x7F) << shift;
+        shift += 7;
+    } while ( buf[pos++] & 0x80 );
+
+    len = payload_len[kind];
+
+    if ( len == VAR )
+    {
+        if ( pos >= n )
+            return 0;
+
+        len = buf[pos++];
+    }
+
+    if ( pos + len > n )
+        return 0;
+
+    ev->kind = kind;
+    ev->us += dt;
+    ev->n = len;
+    ev->data = buf + pos;
+
+    return pos + len;
+}
+
+#if TRACE
+
+// [inputs]
+
+// a byte, or the -1 of an empty UART, which isn't an input
+void trace_uart(uint8_t port, int c)
+{
+    uint8_t b = (uint8_t)c;
+
+    if ( c >= 0 )
+        add( TRACE_UART, port, &b, 1 );
+}
+
+void trace_i2c(const uint8_t *buf, uint8_t n)
+{
+    add( TRACE_I2C, 0, buf, n );
+}
+
+void trace_analog(uint8_t pin, uint16_t value)
+{
+    uint8_t p[3] = { pin, (uint8_t)value, (uint8_t)(value >> 8) };
+
+    add( TRACE_ANALOG, 0, p, sizeof p );
+}
+
+void trace_pin(uint8_t pin, uint8_t level)
+{
+    uint8_t p[2] = { pin, level };
+
+    add( TRACE_PIN, 0, p, sizeof p );
+}
+
+void trace_usb(const void *buf, uint32_t n)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+    uint32_t k;
+
+    for ( ; n > 0; n -= k, p += k )
+    {
+        k = n < TRACE_EVENT_MAX ? n : TRACE_EVENT_MAX;
+        add( TRACE_USB, 0, p, (uint8_t)k );
+    }
+}
+
+// polled every loop() pass, so only a change goes in
+void trace_usb_host(bool connected)
+{
+    if ( usb_host == connected )
+        return;
+
+    usb_host = connected;
+    add( TRACE_USB_HOST, connected, NULL, 0 );
+}
+
+void trace_eeprom(uint32_t addr, const void *buf, uint32_t n)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+    uint8_t ev[TRACE_EVENT_MAX];
+    uint32_t k;
+
+    for ( ; n > 0; n -= k, p += k, addr += k )
+    {
+        k = n < TRACE_EVENT_MAX - 2 ? n : TRACE_EVENT_MAX - 2;
+
+        ev[0] = (uint8_t)addr;
+        ev[1] = (uint8_t)(addr >> 8);
+        memcpy( ev + 2, p, k );
+
+        add( TRACE_EEPROM, 0, ev, (uint8_t)(k + 2) );
+    }
+}
+
+void trace_rtc(uint32_t seconds)
+{
+    add( TRACE_RTC, 0, &seconds, 4 );
+}
+
+// [recording]
+
+// safe from interrupts
+static void add(uint8_t kind, uint8_t arg, const void *payload, uint8_t n)
+{
+    uint8_t mark[6], ev[1 + 5 + 1 + TRACE_EVENT_MAX];
+    uint32_t m = 0, len, now, irq;
+
+    irq = hal_irq_save();
+    now = hal_micros();
+
+    // the gap is marked where the next event that fits goes
+    if ( lost )
+    {
+        m = encode( mark, TRACE_LOST, 0, now - last_us, NULL, 0 );
+        len = encode( ev, kind, arg, 0, (const uint8_t *)payload, n );
+    }
+    else
+    {
+        len = encode( ev, kind, arg, now - last_us, (const uint8_t *)payload, n );
+    }
+
+    if ( sink )
+    {
+        if ( m )
+            sink( mark, m );
+        sink( ev, len );
+    }
+    else if ( TRACE_RING - (ring_head - ring_tail) < m + len )
+    {
+        lost = true;
+        hal_irq_restore( irq );
+        return;
+    }
+    else
+    {
+        put( mark, m );
+        put( ev, len );
+    }
+
+    lost = false;
+    last_us = now;
+
+    hal_irq_restore( irq );
+}
+
+// an event into out; returns its length
+static uint32_t encode(uint8_t *out, uint8_t kind, uint8_t arg, uint32_t dt, const uint8_t *p, uint8_t n)
+{
+    uint32_t len = 0;
+
+    out[len++] = kind << 4 | (arg & 0x0F);
+
+    // LEB128: seven bits at a time, low first, the top bit set on all but the last
+    for ( ; dt >= 0x80; dt >>= 7 )
+        out[len++] = (uint8_t)(dt | 0x80);
+    out[len++] = (uint8_t)dt;
+
+    if ( payload_len[kind] == VAR )
+        out[len++] = n;
+
+    if ( n )
+        memcpy( out + len, p, n );
+
+    return len + n;
+}
+
+static void put(const uint8_t *p, uint32_t n)
+{
+    uint32_t head = ring_head;
+
+    for ( uint32_t i = 0; i < n; i++ )
+        ring[(head + i) & (TRACE_RING - 1)] = p[i];
+
+    ring_head = head + n;
+}
+
+#endif
@@ -0,0 +1,84 @@
+/*
+ * Longitude I/O trace
+ *
+ * With TRACE built in, the HAL logs every input the firmware takes from the
+ * board as it takes it (laser UART bytes, ADC reads off the I2C bus, the
+ * battery's analogRead(), button levels, USB bytes and whether a host is
+ * there, EEPROM reads, the RTC),
+ * with the time, from setup() on; each measurement's result goes in too.  the
+ * host link streams the log to tools/longitude_link.py ("record"), and the
+ * simulator ("replay") feeds it back to the unchanged firmware on its virtual
+ * clock and checks it comes to the same results.  the history flash isn't
+ * traced, so a replay starts with an empty history.
+ *
+ * set TRACE to 1 to build it in; at 0 the HAL logs nothing, and only
+ * trace_result() (a call per measurement) is left.
+ *
+ * an event is [kind << 4 | arg][microseconds since the last event, LEB128]
+ * [length, for the kinds without a fixed one][payload].  a trace file is
+ * TRACE_MAGIC and the events, starting with TRACE_BOOT.
+ *
+ * No Arduino dependencies.
+ */
+#ifndef LONGITUDE_TRACE_HEADER
+#define LONGITUDE_TRACE_HEADER
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "longitude_hal.h"
+
+#ifndef TRACE
+#define TRACE 0
+#endif
+
+#define TRACE_MAGIC   "LGTR"
+#define TRACE_FORMAT  1    // TRACE_BOOT's payload
+#define TRACE_RING    8192 // bytes held for the host, power of two: a few seconds from boot
+#define TRACE_EVENT_MAX 255 // payload bytes
+
+// the numbers are in trace files, so new kinds go at the end
+enum TRACE_KIND
+{
+    TRACE_BOOT,    // [format]
+    TRACE_UART,    // arg port: [byte]
+    TRACE_I2C,     // a read: [bytes]
+    TRACE_ANALOG,  // [pin][value, 16 bits]
+    TRACE_PIN,     // [pin][level]
+    TRACE_USB,     // [bytes]
+    TRACE_USB_HOST, // arg 1 when a host has the port open, logged when it changes
+    TRACE_EEPROM,  // a read: [address, 16 bits][bytes]
+    TRACE_RTC,     // [seconds, 32 bits]
+    TRACE_RESULT,  // arg HISTORY_KIND: [length um, 32 bits][angle mdeg, 32 bits]
+    TRACE_LOST,    // events were dropped here
+    TRACE_KINDS
+};
+
+struct trace_event
+{
+    uint64_t us;          // since boot, as the events are added up
+    uint8_t kind;
+    uint8_t arg;
+    uint8_t n;
+    const uint8_t *data;
+};
+
+void trace_start(void);
+void trace_result(uint8_t kind);
+uint32_t trace_read(uint8_t *, uint32_t);
+void trace_on_result(void (*)(uint8_t kind));
+void trace_sink(void (*)(const uint8_t *, uint32_t));
+uint32_t trace_next(const uint8_t *, uint32_t, uint32_t, struct trace_event *);
+
+// the HAL's, as the firmware takes each input (from interrupts too)
+#if TRACE
+void trace_uart(uint8_t port, int);
+void trace_i2c(const uint8_t *, uint8_t);
+void trace_analog(uint8_t pin, uint16_t);
+void trace_pin(uint8_t pin, uint8_t level);
+void trace_usb(const void *, uint32_t);
+void trace_usb_host(bool);
+void trace_eeprom(uint32_t addr, const void *, uint32_t);
+void trace_rtc(uint32_t);
+#endif
+
+#endif
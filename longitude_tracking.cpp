@@ -0,0 +1,121 @@
+/*
+ * Longitude tracking mode
+ *
+ * For sizing parts one after another: both lasers measure back to back, and
+ * every time each has delivered a fresh distance the length is recomputed with
+ * the angle at that moment and put on the screen, until the user clicks again.
+ */
+#include "longitude.h"
+
+// smoothing of the update interval behind the rate readout (alpha = 2^-shift)
+#define RATE_SHIFT 2
+
+uint32_t tracking_rate_milli; // updates per second, in thousandths
+uint32_t tracking_latency_us; // last laser frame to pixels
+
+static uint8_t fresh;            // bit per laser: new result since the last update
+static uint8_t valid;            // bit per laser: that result was a distance
+static uint32_t frame_us[2];     // when each laser's latest result arrived
+static uint32_t pair_us;         // when the current update's pair completed
+static uint32_t last_pair_us;
+static uint32_t interval_us;     // smoothed time between updates
+
+static void track_laser(struct laser *);
+
+// the modules' continuous mode isn't documented well enough to rely on, so each
+// laser gets its next single-shot command the moment it answers the last one
+void tracking_start(void)
+{
+    fresh = 0;
+    valid = 0;
+    interval_us = 0;
+    last_pair_us = 0;
+    tracking_rate_milli = 0;
+    tracking_latency_us = 0;
+    capture_shots = 0; // live readings carry no statistics
+
+    laser_start( &laser_left, LASER_CMD_MEASURE );
+    laser_start( &laser_right, LASER_CMD_MEASURE );
+}
+
+// collect results and restart the lasers; returns true when both have a new
+// distance and measured_length_um has been updated.  never blocks.
+bool tracking_service(void)
+{
+    uint32_t dt;
+
+    track_laser( &laser_left );
+    track_laser( &laser_right );
+
+    if ( fresh != 0x03 )
+        return false;
+
+    fresh = 0;
+
+    // errors (no echo, too close...) just skip an update
+    if ( valid != 0x03 )
+        return false;
+
+    // the pair is as old as its second frame
+    pair_us = (int32_t)(frame_us[0] - frame_us[1]) > 0 ? frame_us[0] : frame_us[1];
+
+    // and so does an angle filter refilling after a resolution switch, or a
+    // converter that has stopped answering
+    if ( !adc_settled() )
+        return false;
+
+    get_angle();
+    compute_length();
+
+    if ( last_pair_us )
+    {
+        dt = pair_us - last_pair_us;
+        interval_us = interval_us ? interval_us + ((int32_t)(dt - interval_us) >> RATE_SHIFT) : dt;
+
+        if ( interval_us )
+            tracking_rate_milli = 1000000000UL / interval_us;
+    }
+
+    last_pair_us = pair_us;
+
+    return true;
+}
+
+// call once the update is on the screen
+void tracking_shown(void)
+{
+    tracking_latency_us = hal_micros() - pair_us;
+}
+
+// stop restarting the lasers, and let the commands in flight finish in the
+// background (TASK_LASERS), so the modules end up idle; tracking_hold() once
+// that's done
+void tracking_stop(void)
+{
+    laser_finish_all( &laser_left, &laser_right );
+}
+
+// keep the lasers' last results as the held reading.  an angle filter that
+// isn't settled (or a converter that stopped) would make get_angle() wait, so
+// then the last update's length stands
+void tracking_hold(void)
+{
+    if ( laser_left.result == LASER_DISTANCE && laser_right.result == LASER_DISTANCE && adc_settled() && get_angle() )
+        compute_length();
+}
+
+static void track_laser(struct laser *laser)
+{
+    if ( !laser_service(laser) )
+        return;
+
+    frame_us[laser->id] = laser->xact_start + laser->latency_us;
+    fresh |= 1 << laser->id;
+
+    if ( laser->result == LASER_DISTANCE )
+        valid |= 1 << laser->id;
+    else
+        valid &= ~(1 << laser->id);
+
+    laser_start( laser, LASER_CMD_MEASURE );
+}
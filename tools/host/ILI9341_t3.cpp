@@ -0,0 +1,405 @@
+/*
+ * Longitude host model of the ILI9341_t3 display library
+ *
+ * see ILI9341_t3.h
+ */
+#include <stdio.h>
+#include <stdarg.h>
+#include "ILI9341_t3.h"
+#include "longitude_hal_host.h"
+
+static uint32_t fetchbit(const uint8_t *, uint32_t);
+static uint32_t fetchbits_unsigned(const uint8_t *, uint32_t, uint32_t);
+static int32_t fetchbits_signed(const uint8_t *, uint32_t, uint32_t);
+
+ILI9341_t3::ILI9341_t3(uint8_t, uint8_t, uint8_t, uint8_t, uint8_t, uint8_t)
+{
+    memset( glass, 0, sizeof glass );
+    w = ILI9341_TFTWIDTH;
+    h = ILI9341_TFTHEIGHT;
+    cursor_x = cursor_y = 0;
+    textcolor = ILI9341_WHITE;
+    font = NULL;
+    written = 0;
+    spi = 0;
+    chars = 0;
+    sleeping = false;
+}
+
+// the panel comes out of reset with whatever was in its RAM; black will do
+void ILI9341_t3::begin(void)
+{
+    memset( glass, 0, sizeof glass );
+    sleeping = false;
+}
+
+// the picture stays; only the power accounting cares
+void ILI9341_t3::sleep(bool enable)
+{
+    sleeping = enable;
+    sim_panel_sleep( enable );
+}
+
+// odd rotations are landscape
+void ILI9341_t3::setRotation(uint8_t m)
+{
+    w = (m & 1) ? ILI9341_TFTHEIGHT : ILI9341_TFTWIDTH;
+    h = (m & 1) ? ILI9341_TFTWIDTH : ILI9341_TFTHEIGHT;
+}
+
+void ILI9341_t3::fillScreen(uint16_t color)
+{
+    fillRect( 0, 0, w, h, color );
+}
+
+void ILI9341_t3::drawPixel(int16_t x, int16_t y, uint16_t color)
+{
+    fillRect( x, y, 1, 1, color );
+}
+
+void ILI9341_t3::drawFastHLine(int16_t x, int16_t y, int16_t len, uint16_t color)
+{
+    fillRect( x, y, len, 1, color );
+}
+
+void ILI9341_t3::drawFastVLine(int16_t x, int16_t y, int16_t len, uint16_t color)
+{
+    fillRect( x, y, 1, len, color );
+}
+
+// one address window, then the color for every pixel in it
+void ILI9341_t3::fillRect(int16_t x, int16_t y, int16_t rw, int16_t rh, uint16_t color)
+{
+    if ( !window(&x, &y, &rw, &rh) )
+        return;
+
+    for ( int16_t j = 0; j < rh; j++ )
+        for ( int16_t i = 0; i < rw; i++ )
+            plot( x + i, y + j, color );
+}
+
+void ILI9341_t3::drawRect(int16_t x, int16_t y, int16_t rw, int16_t rh, uint16_t color)
+{
+    drawFastHLine( x, y, rw, color );
+    drawFastHLine( x, y + rh - 1, rw, color );
+    drawFastVLine( x, y + 1, rh - 2, color );
+    drawFastVLine( x + rw - 1, y + 1, rh - 2, color );
+}
+
+// the curved shapes go out the way the library fills them, a run of a row at a time
+void ILI9341_t3::fillRoundRect(int16_t x, int16_t y, int16_t rw, int16_t rh, int16_t r, uint16_t color)
+{
+    int16_t run;
+
+    for ( int16_t j = 0; j < rh; j++ )
+    {
+        run = 0;
+
+        for ( int16_t i = 0; i <= rw; i++ )
+        {
+            if ( i < rw && in_round_rect(x + i, y + j, x, y, rw, rh, r) )
+                run++;
+            else if ( run )
+            {
+                fillRect( x + i - run, y + j, run, 1, color );
+                run = 0;
+            }
+        }
+    }
+}
+
+// the pixels of the shape that a one pixel smaller one doesn't cover
+void ILI9341_t3::drawRoundRect(int16_t x, int16_t y, int16_t rw, int16_t rh, int16_t r, uint16_t color)
+{
+    int16_t run;
+
+    for ( int16_t j = 0; j < rh; j++ )
+    {
+        run = 0;
+
+        for ( int16_t i = 0; i <= rw; i++ )
+        {
+            if ( i < rw && in_round_rect(x + i, y + j, x, y, rw, rh, r) &&
+                 !in_round_rect(x + i, y + j, x + 1, y + 1, rw - 2, rh - 2, r - 1) )
+                run++;
+            else if ( run )
+            {
+                fillRect( x + i - run, y + j, run, 1, color );
+                run = 0;
+            }
+        }
+    }
+}
+
+// every pixel on the same side of all three edges
+void ILI9341_t3::fillTriangle(int16_t x0, int16_t y0, int16_t x1, int16_t y1, int16_t x2, int16_t y2, uint16_t color)
+{
+    int16_t xmin = x0 < x1 ? (x0 < x2 ? x0 : x2) : (x1 < x2 ? x1 : x2);
+    int16_t xmax = x0 > x1 ? (x0 > x2 ? x0 : x2) : (x1 > x2 ? x1 : x2);
+    int16_t ymin = y0 < y1 ? (y0 < y2 ? y0 : y2) : (y1 < y2 ? y1 : y2);
+    int16_t ymax = y0 > y1 ? (y0 > y2 ? y0 : y2) : (y1 > y2 ? y1 : y2);
+    int32_t e0, e1, e2;
+    int16_t run;
+
+    for ( int16_t y = ymin; y <= ymax; y++ )
+    {
+        run = 0;
+
+        for ( int16_t x = xmin; x <= xmax + 1; x++ )
+        {
+            e0 = (int32_t)(x1 - x0) * (y - y0) - (int32_t)(y1 - y0) * (x - x0);
+            e1 = (int32_t)(x2 - x1) * (y - y1) - (int32_t)(y2 - y1) * (x - x1);
+            e2 = (int32_t)(x0 - x2) * (y - y2) - (int32_t)(y0 - y2) * (x - x2);
+
+            if ( x <= xmax && ((e0 >= 0 && e1 >= 0 && e2 >= 0) || (e0 <= 0 && e1 <= 0 && e2 <= 0)) )
+                run++;
+            else if ( run )
+            {
+                fillRect( x - run, y, run, 1, color );
+                run = 0;
+            }
+        }
+    }
+}
+
+void ILI9341_t3::writeRect(int16_t x, int16_t y, int16_t rw, int16_t rh, const uint16_t *pcolors)
+{
+    int16_t x0 = x, y0 = y, w0 = rw;
+
+    if ( !window(&x, &y, &rw, &rh) )
+        return;
+
+    for ( int16_t j = 0; j < rh; j++ )
+        for ( int16_t i = 0; i < rw; i++ )
+            plot( x + i, y + j, pcolors[(y + j - y0) * w0 + (x + i - x0)] );
+}
+
+void ILI9341_t3::setFont(const ILI9341_t3_font_t &f)
+{
+    font = &f;
+}
+
+// the background is ignored with these fonts, as in the library
+void ILI9341_t3::setTextColor(uint16_t c)
+{
+    textcolor = c;
+}
+
+void ILI9341_t3::setTextColor(uint16_t c, uint16_t)
+{
+    textcolor = c;
+}
+
+void ILI9341_t3::setCursor(int16_t x, int16_t y)
+{
+    cursor_x = x;
+    cursor_y = y;
+}
+
+size_t ILI9341_t3::write(uint8_t c)
+{
+    if ( font == NULL )
+        return 1;
+
+    if ( c == '\n' )
+    {
+        cursor_y += font->line_space;
+        cursor_x = 0;
+    }
+    else if ( c != '\r' )
+    {
+        draw_font_char( c );
+        chars++;
+    }
+
+    return 1;
+}
+
+size_t ILI9341_t3::print(const char *s)
+{
+    size_t n = 0;
+
+    while ( *s )
+        n += write( (uint8_t)*s++ );
+
+    return n;
+}
+
+size_t ILI9341_t3::println(const char *s)
+{
+    return print( s ) + write( '\r' ) + write( '\n' );
+}
+
+size_t ILI9341_t3::printf(const char *format, ...)
+{
+    char buf[128];
+    va_list ap;
+
+    va_start( ap, format );
+    vsnprintf( buf, sizeof buf, format, ap );
+    va_end( ap );
+
+    return print( buf );
+}
+
+uint16_t ILI9341_t3::pixel(int16_t x, int16_t y) const
+{
+    if ( x < 0 || y < 0 || x >= w || y >= h )
+        return 0;
+
+    return glass[y * w + x];
+}
+
+// the picture as a binary PPM, for a look at it; false if it couldn't be written
+bool ILI9341_t3::write_ppm(const char *path) const
+{
+    FILE *f = fopen( path, "wb" );
+    uint16_t c;
+    uint8_t rgb[3];
+
+    if ( f == NULL )
+        return false;
+
+    fprintf( f, "P6\n%d %d\n255\n", w, h );
+
+    for ( int32_t i = 0; i < (int32_t)w * h; i++ )
+    {
+        c = glass[i];
+        rgb[0] = (uint8_t)(((c >> 11) & 0x1F) * 255 / 31);
+        rgb[1] = (uint8_t)(((c >> 5) & 0x3F) * 255 / 63);
+        rgb[2] = (uint8_t)((c & 0x1F) * 255 / 31);
+        fwrite( rgb, 1, 3, f );
+    }
+
+    return fclose( f ) == 0;
+}
+
+// clip a rectangle to the screen, as the library does before anything reaches
+// the bus, and count its address window: the column and page commands with
+// their four bytes of coordinates each, and the memory write command.  the
+// pixels that follow are 2 bytes each.  false if nothing is left of it.
+bool ILI9341_t3::window(int16_t *x, int16_t *y, int16_t *rw, int16_t *rh)
+{
+    if ( *x < 0 ) { *rw += *x; *x = 0; }
+    if ( *y < 0 ) { *rh += *y; *y = 0; }
+    if ( *x + *rw > w ) *rw = w - *x;
+    if ( *y + *rh > h ) *rh = h - *y;
+
+    if ( *rw <= 0 || *rh <= 0 )
+        return false;
+
+    spi += 11 + 2 * (uint32_t)*rw * *rh;
+    return true;
+}
+
+// every pixel the firmware sends lands here, inside a window()
+void ILI9341_t3::plot(int16_t x, int16_t y, uint16_t color)
+{
+    glass[y * w + x] = color;
+    written++;
+}
+
+// (x, y) inside the rectangle at (rx, ry) with corners of radius r
+bool ILI9341_t3::in_round_rect(int16_t x, int16_t y, int16_t rx, int16_t ry, int16_t rw, int16_t rh, int16_t r) const
+{
+    int32_t cx, cy, dx, dy;
+
+    if ( rw <= 0 || rh <= 0 || x < rx || y < ry || x >= rx + rw || y >= ry + rh )
+        return false;
+
+    if ( r < 0 )
+        r = 0;
+
+    // the nearest point of the rectangle shrunk by r
+    cx = x < rx + r ? rx + r : (x > rx + rw - 1 - r ? rx + rw - 1 - r : x);
+    cy = y < ry + r ? ry + r : (y > ry + rh - 1 - r ? ry + rh - 1 - r : y);
+    dx = x - cx;
+    dy = y - cy;
+
+    return dx * dx + dy * dy <= (int32_t)r * r + r;
+}
+
+// the font format's glyph stream; see unpack() in longitude_glyphs.cpp
+void ILI9341_t3::draw_font_char(uint8_t c)
+{
+    uint32_t bitoffset, width, height, delta, y, x, n, run;
+    int32_t xoffset, yoffset, top;
+    const uint8_t *data;
+    bool repeat;
+
+    if ( c >= font->index1_first && c <= font->index1_last )
+        bitoffset = (c - font->index1_first) * font->bits_index;
+    else if ( c >= font->index2_first && c <= font->index2_last )
+        bitoffset = (c - font->index2_first + font->index1_last - font->index1_first + 1) * font->bits_index;
+    else
+        return;
+
+    data = font->data + fetchbits_unsigned(font->index, bitoffset, font->bits_index);
+
+    if ( fetchbits_unsigned(data, 0, 3) != 0 )
+        return;
+
+    bitoffset = 3;
+    width   = fetchbits_unsigned(data, bitoffset, font->bits_width);   bitoffset += font->bits_width;
+    height  = fetchbits_unsigned(data, bitoffset, font->bits_height);  bitoffset += font->bits_height;
+    xoffset = fetchbits_signed(data, bitoffset, font->bits_xoffset);   bitoffset += font->bits_xoffset;
+    yoffset = fetchbits_signed(data, bitoffset, font->bits_yoffset);   bitoffset += font->bits_yoffset;
+    delta   = fetchbits_unsigned(data, bitoffset, font->bits_delta);   bitoffset += font->bits_delta;
+
+    top = cursor_y + font->cap_height - (int32_t)height - yoffset;
+
+    for ( y = 0; y < height; y += n )
+    {
+        repeat = fetchbit(data, bitoffset++);
+        n = 1;
+
+        if ( repeat )
+        {
+            n = fetchbits_unsigned(data, bitoffset, 3) + 2;
+            bitoffset += 3;
+        }
+
+        // each run of set bits goes out as a rectangle of the repeated rows
+        run = 0;
+
+        for ( x = 0; x <= width; x++ )
+        {
+            if ( x < width && fetchbit(data, bitoffset + x) )
+                run++;
+            else if ( run )
+            {
+                fillRect( cursor_x + xoffset + x - run, top + y, run, y + n < height ? n : height - y, textcolor );
+                run = 0;
+            }
+        }
+
+        bitoffset += width;
+    }
+
+    cursor_x += delta;
+}
+
+static uint32_t fetchbit(const uint8_t *p, uint32_t index)
+{
+    return (p[index >> 3] >> (7 - (index & 7))) & 1;
+}
+
+static uint32_t fetchbits_unsigned(const uint8_t *p, uint32_t index, uint32_t required)
+{
+    uint32_t val = 0;
+
+    while ( required-- )
+        val = (val << 1) | fetchbit(p, index++);
+
+    return val;
+}
+
+static int32_t fetchbits_signed(const uint8_t *p, uint32_t index, uint32_t required)
+{
+    uint32_t val = fetchbits_unsigned(p, index, required);
+
+    if ( required && (val & (1UL << (required - 1))) )
+        return (int32_t)val - (int32_t)(1UL << required);
+
+    return (int32_t)val;
+}
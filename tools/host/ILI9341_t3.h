@@ -0,0 +1,128 @@
+/*
+ * Longitude host model of the ILI9341_t3 display library
+ *
+ * The part of PJRC's ILI9341_t3 that longitude_display.cpp and
+ * longitude_glyphs.cpp use, drawing into a framebuffer instead of over SPI, so
+ * the simulator runs the real display code.  the picture is kept the way the
+ * user sees it (after setRotation()); pixel() and write_ppm() look at it.
+ * pixels_written() counts what the firmware sent, drawn over or not,
+ * spi_bytes() what that costs on the bus, and chars_drawn() the characters
+ * that went through the library's own text path: the library sends each rectangle
+ * (a fill, a line, a run of a glyph's row) as an address window and then its
+ * pixels, see window().
+ *
+ * text uses the library's packed font format (font_*.h here are stand-ins, see
+ * fonts.cpp), drawn the way drawFontChar() does: foreground pixels only.
+ */
+#ifndef ILI9341_t3_H_
+#define ILI9341_t3_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define ILI9341_TFTWIDTH  240
+#define ILI9341_TFTHEIGHT 320
+
+// the library's color names, RGB565
+#define ILI9341_BLACK       0x0000
+#define ILI9341_NAVY        0x000F
+#define ILI9341_DARKGREEN   0x03E0
+#define ILI9341_DARKCYAN    0x03EF
+#define ILI9341_MAROON      0x7800
+#define ILI9341_PURPLE      0x780F
+#define ILI9341_OLIVE       0x7BE0
+#define ILI9341_LIGHTGREY   0xC618
+#define ILI9341_DARKGREY    0x7BEF
+#define ILI9341_BLUE        0x001F
+#define ILI9341_GREEN       0x07E0
+#define ILI9341_CYAN        0x07FF
+#define ILI9341_RED         0xF800
+#define ILI9341_MAGENTA     0xF81F
+#define ILI9341_YELLOW      0xFFE0
+#define ILI9341_WHITE       0xFFFF
+#define ILI9341_ORANGE      0xFD20
+#define ILI9341_GREENYELLOW 0xAFE5
+#define ILI9341_PINK        0xF81F
+
+typedef struct
+{
+    const unsigned char *index;
+    const unsigned char *unicode;
+    const unsigned char *data;
+    unsigned char version;
+    unsigned char reserved;
+    unsigned char index1_first;
+    unsigned char index1_last;
+    unsigned char index2_first;
+    unsigned char index2_last;
+    unsigned char bits_index;
+    unsigned char bits_width;
+    unsigned char bits_height;
+    unsigned char bits_xoffset;
+    unsigned char bits_yoffset;
+    unsigned char bits_delta;
+    unsigned char line_space;
+    unsigned char cap_height;
+} ILI9341_t3_font_t;
+
+class ILI9341_t3
+{
+public:
+    ILI9341_t3(uint8_t cs, uint8_t dc, uint8_t rst = 255, uint8_t mosi = 11, uint8_t sclk = 13, uint8_t miso = 12);
+
+    void begin(void);
+    void sleep(bool);
+    void setRotation(uint8_t);
+    int16_t width(void) const { return w; }
+    int16_t height(void) const { return h; }
+
+    void fillScreen(uint16_t);
+    void drawPixel(int16_t, int16_t, uint16_t);
+    void drawFastHLine(int16_t, int16_t, int16_t, uint16_t);
+    void drawFastVLine(int16_t, int16_t, int16_t, uint16_t);
+    void fillRect(int16_t, int16_t, int16_t, int16_t, uint16_t);
+    void drawRect(int16_t, int16_t, int16_t, int16_t, uint16_t);
+    void fillRoundRect(int16_t, int16_t, int16_t, int16_t, int16_t, uint16_t);
+    void drawRoundRect(int16_t, int16_t, int16_t, int16_t, int16_t, uint16_t);
+    void fillTriangle(int16_t, int16_t, int16_t, int16_t, int16_t, int16_t, uint16_t);
+    void writeRect(int16_t, int16_t, int16_t, int16_t, const uint16_t *);
+
+    void setFont(const ILI9341_t3_font_t &);
+    void setTextColor(uint16_t);
+    void setTextColor(uint16_t, uint16_t);
+    void setCursor(int16_t, int16_t);
+    int16_t getCursorX(void) const { return cursor_x; }
+    int16_t getCursorY(void) const { return cursor_y; }
+
+    size_t write(uint8_t);
+    size_t print(const char *);
+    size_t println(const char *);
+    size_t printf(const char *, ...) __attribute__((format(printf, 2, 3)));
+
+    // host model only
+    uint16_t pixel(int16_t, int16_t) const;
+    uint64_t pixels_written(void) const { return written; }
+    uint64_t spi_bytes(void) const { return spi; }
+    uint64_t chars_drawn(void) const { return chars; }
+    bool asleep(void) const { return sleeping; }
+    bool write_ppm(const char *) const;
+
+private:
+    bool window(int16_t *, int16_t *, int16_t *, int16_t *);
+    void plot(int16_t, int16_t, uint16_t);
+    bool in_round_rect(int16_t, int16_t, int16_t, int16_t, int16_t, int16_t, int16_t) const;
+    void draw_font_char(uint8_t);
+
+    uint16_t glass[ILI9341_TFTWIDTH * ILI9341_TFTHEIGHT];
+    int16_t w, h;
+    int16_t cursor_x, cursor_y;
+    uint16_t textcolor;
+    const ILI9341_t3_font_t *font;
+    uint64_t written;
+    uint64_t spi;
+    uint64_t chars;
+    bool sleeping;
+};
+
+#endif
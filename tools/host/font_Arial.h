@@ -0,0 +1,13 @@
+/*
+ * Longitude host stand-in for the ILI9341_fonts Arial header
+ *
+ * only the sizes the firmware uses; see fonts.cpp
+ */
+#ifndef _FONT_ARIAL_H_
+#define _FONT_ARIAL_H_
+
+#include "ILI9341_t3.h"
+
+extern const ILI9341_t3_font_t Arial_12, Arial_14;
+
+#endif
@@ -0,0 +1,13 @@
+/*
+ * Longitude host stand-in for the ILI9341_fonts LiberationSans header
+ *
+ * only the sizes the firmware uses; see fonts.cpp
+ */
+#ifndef _FONT_LIBERATIONSANS_H_
+#define _FONT_LIBERATIONSANS_H_
+
+#include "ILI9341_t3.h"
+
+extern const ILI9341_t3_font_t LiberationSans_16, LiberationSans_18, LiberationSans_20, LiberationSans_28;
+
+#endif
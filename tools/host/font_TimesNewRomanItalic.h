@@ -0,0 +1,13 @@
+/*
+ * Longitude host stand-in for the ILI9341_fonts TimesNewRomanItalic header
+ *
+ * only the sizes the firmware uses; see fonts.cpp
+ */
+#ifndef _FONT_TIMESNEWROMANITALIC_H_
+#define _FONT_TIMESNEWROMANITALIC_H_
+
+#include "ILI9341_t3.h"
+
+extern const ILI9341_t3_font_t TimesNewRoman_40_Italic;
+
+#endif
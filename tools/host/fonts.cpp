@@ -0,0 +1,175 @@
+/*
+ * Longitude host stand-ins for the ILI9341_t3 fonts
+ *
+ * The real faces come with PJRC's ILI9341_fonts library, which only builds for
+ * the board.  these are one 5x8 pixel face scaled to each size and packed at
+ * startup in the library's bit stream format, so the glyph cache and the model's
+ * text path decode them the way they decode the real ones.  cap heights and
+ * line spacing are close to the real faces; the shapes are not.
+ */
+#include "font_Arial.h"
+#include "font_LiberationSans.h"
+#include "font_TimesNewRomanItalic.h"
+
+#define FIRST     ' '
+#define LAST      '~'
+#define GLYPHS    (LAST - FIRST + 1)
+#define DATA_MAX  12000 // bytes of packed glyphs, enough for the 40 point face
+
+// header field sizes, in bits
+#define BITS_INDEX   16
+#define BITS_WIDTH   6
+#define BITS_HEIGHT  6
+#define BITS_XOFFSET 2
+#define BITS_YOFFSET 5
+#define BITS_DELTA   6
+
+// a face's cap height and line spacing, from its point size
+#define CAP(size)  ((size) * 18 / 25)
+#define LINE(size) ((size) * 6 / 5)
+
+// ' ' to '~', a column per byte, top row in bit 0; row 7 is the descender
+static const uint8_t face[GLYPHS][5] =
+{
+    { 0x00, 0x00, 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x5F, 0x00, 0x00 }, { 0x00, 0x07, 0x00, 0x07, 0x00 },
+    { 0x14, 0x7F, 0x14, 0x7F, 0x14 }, { 0x24, 0x2A, 0x7F, 0x2A, 0x12 }, { 0x23, 0x13, 0x08, 0x64, 0x62 },
+    { 0x36, 0x49, 0x56, 0x20, 0x50 }, { 0x00, 0x08, 0x07, 0x03, 0x00 }, { 0x00, 0x1C, 0x22, 0x41, 0x00 },
+    { 0x00, 0x41, 0x22, 0x1C, 0x00 }, { 0x2A, 0x1C, 0x7F, 0x1C, 0x2A }, { 0x08, 0x08, 0x3E, 0x08, 0x08 },
+    { 0x00, 0x80, 0x70, 0x30, 0x00 }, { 0x08, 0x08, 0x08, 0x08, 0x08 }, { 0x00, 0x00, 0x60, 0x60, 0x00 },
+    { 0x20, 0x10, 0x08, 0x04, 0x02 }, { 0x3E, 0x51, 0x49, 0x45, 0x3E }, { 0x00, 0x42, 0x7F, 0x40, 0x00 },
+    { 0x72, 0x49, 0x49, 0x49, 0x46 }, { 0x21, 0x41, 0x49, 0x4D, 0x33 }, { 0x18, 0x14, 0x12, 0x7F, 0x10 },
+    { 0x27, 0x45, 0x45, 0x45, 0x39 }, { 0x3C, 0x4A, 0x49, 0x49, 0x31 }, { 0x41, 0x21, 0x11, 0x09, 0x07 },
+    { 0x36, 0x49, 0x49, 0x49, 0x36 }, { 0x46, 0x49, 0x49, 0x29, 0x1E }, { 0x00, 0x00, 0x14, 0x00, 0x00 },
+    { 0x00, 0x40, 0x34, 0x00, 0x00 }, { 0x00, 0x08, 0x14, 0x22, 0x41 }, { 0x14, 0x14, 0x14, 0x14, 0x14 },
+    { 0x00, 0x41, 0x22, 0x14, 0x08 }, { 0x02, 0x01, 0x59, 0x09, 0x06 }, { 0x3E, 0x41, 0x5D, 0x59, 0x4E },
+    { 0x7C, 0x12, 0x11, 0x12, 0x7C }, { 0x7F, 0x49, 0x49, 0x49, 0x36 }, { 0x3E, 0x41, 0x41, 0x41, 0x22 },
+    { 0x7F, 0x41, 0x41, 0x41, 0x3E }, { 0x7F, 0x49, 0x49, 0x49, 0x41 }, { 0x7F, 0x09, 0x09, 0x09, 0x01 },
+    { 0x3E, 0x41, 0x41, 0x51, 0x73 }, { 0x7F, 0x08, 0x08, 0x08, 0x7F }, { 0x00, 0x41, 0x7F, 0x41, 0x00 },
+    { 0x20, 0x40, 0x41, 0x3F, 0x01 }, { 0x7F, 0x08, 0x14, 0x22, 0x41 }, { 0x7F, 0x40, 0x40, 0x40, 0x40 },
+    { 0x7F, 0x02, 0x1C, 0x02, 0x7F }, { 0x7F, 0x04, 0x08, 0x10, 0x7F }, { 0x3E, 0x41, 0x41, 0x41, 0x3E },
+    { 0x7F, 0x09, 0x09, 0x09, 0x06 }, { 0x3E, 0x41, 0x51, 0x21, 0x5E }, { 0x7F, 0x09, 0x19, 0x29, 0x46 },
+    { 0x26, 0x49, 0x49, 0x49, 0x32 }, { 0x03, 0x01, 0x7F, 0x01, 0x03 }, { 0x3F, 0x40, 0x40, 0x40, 0x3F },
+    { 0x1F, 0x20, 0x40, 0x20, 0x1F }, { 0x3F, 0x40, 0x38, 0x40, 0x3F }, { 0x63, 0x14, 0x08, 0x14, 0x63 },
+    { 0x03, 0x04, 0x78, 0x04, 0x03 }, { 0x61, 0x59, 0x49, 0x4D, 0x43 }, { 0x00, 0x7F, 0x41, 0x41, 0x41 },
+    { 0x02, 0x04, 0x08, 0x10, 0x20 }, { 0x00, 0x41, 0x41, 0x41, 0x7F }, { 0x04, 0x02, 0x01, 0x02, 0x04 },
+    { 0x40, 0x40, 0x40, 0x40, 0x40 }, { 0x00, 0x03, 0x07, 0x08, 0x00 }, { 0x20, 0x54, 0x54, 0x78, 0x40 },
+    { 0x7F, 0x28, 0x44, 0x44, 0x38 }, { 0x38, 0x44, 0x44, 0x44, 0x28 }, { 0x38, 0x44, 0x44, 0x28, 0x7F },
+    { 0x38, 0x54, 0x54, 0x54, 0x18 }, { 0x00, 0x08, 0x7E, 0x09, 0x02 }, { 0x18, 0xA4, 0xA4, 0x9C, 0x78 },
+    { 0x7F, 0x08, 0x04, 0x04, 0x78 }, { 0x00, 0x44, 0x7D, 0x40, 0x00 }, { 0x20, 0x40, 0x40, 0x3D, 0x00 },
+    { 0x7F, 0x10, 0x28, 0x44, 0x00 }, { 0x00, 0x41, 0x7F, 0x40, 0x00 }, { 0x7C, 0x04, 0x78, 0x04, 0x78 },
+    { 0x7C, 0x08, 0x04, 0x04, 0x78 }, { 0x38, 0x44, 0x44, 0x44, 0x38 }, { 0xFC, 0x18, 0x24, 0x24, 0x18 },
+    { 0x18, 0x24, 0x24, 0x18, 0xFC }, { 0x7C, 0x08, 0x04, 0x04, 0x08 }, { 0x48, 0x54, 0x54, 0x54, 0x24 },
+    { 0x04, 0x04, 0x3F, 0x44, 0x24 }, { 0x3C, 0x40, 0x40, 0x20, 0x7C }, { 0x1C, 0x20, 0x40, 0x20, 0x1C },
+    { 0x3C, 0x40, 0x30, 0x40, 0x3C }, { 0x44, 0x28, 0x10, 0x28, 0x44 }, { 0x4C, 0x90, 0x90, 0x90, 0x7C },
+    { 0x44, 0x64, 0x54, 0x4C, 0x44 }, { 0x00, 0x08, 0x36, 0x41, 0x00 }, { 0x00, 0x00, 0x77, 0x00, 0x00 },
+    { 0x00, 0x41, 0x36, 0x08, 0x00 }, { 0x02, 0x01, 0x02, 0x04, 0x02 },
+};
+
+struct packed
+{
+    uint8_t size;
+    uint8_t index[GLYPHS * BITS_INDEX / 8];
+    uint8_t data[DATA_MAX];
+};
+
+#define STAND_IN(name, points) \
+    static struct packed name##_packed = { points, {}, {} }; \
+    const ILI9341_t3_font_t name = { name##_packed.index, NULL, name##_packed.data, 1, 0, FIRST, LAST, 1, 0, \
+                                     BITS_INDEX, BITS_WIDTH, BITS_HEIGHT, BITS_XOFFSET, BITS_YOFFSET, BITS_DELTA, \
+                                     LINE(points), CAP(points) };
+
+STAND_IN(Arial_12, 12)
+STAND_IN(Arial_14, 14)
+STAND_IN(LiberationSans_16, 16)
+STAND_IN(LiberationSans_18, 18)
+STAND_IN(LiberationSans_20, 20)
+STAND_IN(LiberationSans_28, 28)
+STAND_IN(TimesNewRoman_40_Italic, 40)
+
+static struct packed *const fonts[] =
+{
+    &Arial_12_packed, &Arial_14_packed, &LiberationSans_16_packed, &LiberationSans_18_packed,
+    &LiberationSans_20_packed, &LiberationSans_28_packed, &TimesNewRoman_40_Italic_packed,
+};
+
+static void put_bits(uint8_t *, uint32_t *, uint32_t, uint32_t);
+static uint32_t face_row(uint8_t, uint32_t, uint32_t, uint32_t);
+static void pack(struct packed *);
+
+// before main(), so before setup() caches any glyphs
+static struct packer
+{
+    packer() { for ( uint8_t i = 0; i < sizeof fonts / sizeof fonts[0]; i++ ) pack( fonts[i] ); }
+} packer;
+
+// every glyph is the face scaled to the cap height, nearest neighbour, with the
+// descender below the baseline and a column's gap per pixel of the face
+static void pack(struct packed *f)
+{
+    uint32_t cap = CAP(f->size);
+    uint32_t height = (8 * cap + 3) / 7;
+    uint32_t width = (5 * cap + 3) / 7;
+    uint32_t gap = cap / 7 ? cap / 7 : 1;
+    uint32_t bit = 0, at, row, n;
+
+    for ( uint32_t g = 0; g < GLYPHS; g++ )
+    {
+        bit = (bit + 7) & ~7u; // glyphs start on a byte
+        at = g * BITS_INDEX;
+        put_bits( f->index, &at, bit / 8, BITS_INDEX );
+
+        put_bits( f->data, &bit, 0, 3 ); // encoding 0
+        put_bits( f->data, &bit, width, BITS_WIDTH );
+        put_bits( f->data, &bit, height, BITS_HEIGHT );
+        put_bits( f->data, &bit, 0, BITS_XOFFSET );
+        put_bits( f->data, &bit, (uint32_t)(cap - height) & ((1u << BITS_YOFFSET) - 1), BITS_YOFFSET );
+        put_bits( f->data, &bit, width + gap, BITS_DELTA );
+
+        // a row followed by copies of itself goes out once, with a count
+        for ( uint32_t y = 0; y < height; y += n )
+        {
+            row = face_row( g, y, width, height );
+
+            for ( n = 1; n < 9 && y + n < height && face_row(g, y + n, width, height) == row; n++ )
+                ;
+
+            if ( n > 1 )
+            {
+                put_bits( f->data, &bit, 1, 1 );
+                put_bits( f->data, &bit, n - 2, 3 );
+            }
+            else
+            {
+                put_bits( f->data, &bit, 0, 1 );
+            }
+
+            put_bits( f->data, &bit, row, width );
+        }
+    }
+}
+
+// row y of glyph g at the given size, leftmost pixel in the top bit
+static uint32_t face_row(uint8_t g, uint32_t y, uint32_t width, uint32_t height)
+{
+    uint32_t row = 0;
+
+    for ( uint32_t x = 0; x < width; x++ )
+        row = (row << 1) | ((face[g][x * 5 / width] >> (y * 8 / height)) & 1);
+
+    return row;
+}
+
+// n bits at bit 'at', most significant first, the way the library reads them;
+// 'at' moves on past them
+static void put_bits(uint8_t *p, uint32_t *at, uint32_t value, uint32_t n)
+{
+    while ( n-- )
+    {
+        if ( (value >> n) & 1 )
+            p[*at >> 3] |= 0x80 >> (*at & 7);
+        else
+            p[*at >> 3] &= ~(0x80 >> (*at & 7));
+
+        (*at)++;
+    }
+}
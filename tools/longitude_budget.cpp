@@ -0,0 +1,519 @@
+/*
+ * Longitude error budget
+ *
+ * Monte Carlo over the length pipeline.  for every cell of a distance x angle
+ * grid (both lasers at the same distance, the lasers' angle apart), it draws
+ * samples of everything the firmware can't know exactly, runs them through the
+ * firmware's own math (longitude_math.cpp, in the flavor FIXED_POINT picks) and
+ * bins the length error:
+ *
+ *   - laser noise: gaussian per shot, then rounded to the whole millimeters the
+ *     modules report
+ *   - the angle ADC: its noise (what's left after the angle filter), then
+ *     quantisation to the LSB of the chosen resolution
+ *   - battery drift: the battery anywhere in a range, read with an error; below
+ *     5.125 V the sensor's maximum follows the true battery, and sensor_max()
+ *     the reading
+ *   - the laser spacing: LASER_OFFSET_UM off by a gaussian tolerance
+ *
+ * the length compensation is switched off: it's fit per device against its own
+ * systematic errors, which none of these are.
+ *
+ * cells are split into chunks of CHUNK samples, and the chunks are shared out
+ * to one worker per core.  each worker takes chunks from the front of its own
+ * range and, once that's empty, steals the back half of the fullest range
+ * left, so cores that finish early (or run faster) take work off the others.
+ * every chunk seeds its own generator from its index, so the results don't
+ * depend on the number of threads or on who ran what.
+ *
+ * the output is a CSV heatmap per statistic (PREFIX_p50.csv, _p95, _p99 of the
+ * absolute error, and _bias, the mean signed error), in millimeters, a row per
+ * distance and a column per angle.
+ *
+ * build from this directory:
+ *
+ *   g++ -O2 -std=gnu++14 -pthread -I.. ../longitude_math.cpp longitude_budget.cpp -o longitude_budget
+ *
+ * (or with the top directory's CMakeLists.txt.)
+ *
+ * add -DFIXED_POINT=0 for the budget of the double-precision math.
+ *
+ * usage: longitude_budget [samples per cell] [option value]...
+ *
+ *   -d FROM:TO:N    distances, meters (0.2:10:16)
+ *   -a FROM:TO:N    angles, degrees (2:86:15)
+ *   -r BITS         angle ADC resolution, 12 to 18 (CAPTURE_RESOLUTION)
+ *   -l UM           laser noise, 1 sigma (1000)
+ *   -n UV           angle ADC noise after the filter, 1 sigma (2)
+ *   -b FROM:TO      battery range, volts (4.8:6.0)
+ *   -e MV           battery reading error, 1 sigma (25)
+ *   -o UM           laser spacing tolerance, 1 sigma (250)
+ *   -t N            threads (all cores)
+ *   -p PREFIX       output files (budget)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include "longitude.h"
+#include "longitude_mcp342x.h"
+
+#define CHUNK       65536 // samples per job
+#define SAMPLES     (1UL << 20)
+#define CELLS_MAX   4096
+
+// |error| histogram in micrometers: by bit length, each split in SUB_BUCKETS,
+// so a bucket is at most 1/16 of its value wide
+#define SUB_BITS    4
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define BUCKETS     ((33 - SUB_BITS) * SUB_BUCKETS)
+
+struct grid
+{
+    double from, to;
+    uint32_t n;
+};
+
+struct model
+{
+    uint8_t bits;           // angle ADC resolution
+    double laser_um;        // noise per shot
+    double adc_uv;          // noise at the converter
+    double bat_lo, bat_hi;  // battery range, volts
+    double bat_mv;          // battery reading error
+    double offset_um;       // laser spacing tolerance
+};
+
+struct cell
+{
+    std::atomic<uint32_t> bucket[BUCKETS];
+    std::atomic<int64_t> sum_um; // signed
+    std::atomic<uint32_t> count;
+};
+
+// a worker's share of the jobs, [next, end).  they only change under the lock,
+// but others look at them without it to pick a victim, so they're atomic
+struct range
+{
+    std::mutex lock;
+    std::atomic<uint32_t> next, end;
+};
+
+static struct grid dist = { 0.2, 10.0, 16 };
+static struct grid ang  = { 2.0, 86.0, 15 };
+static struct model mdl = { CAPTURE_RESOLUTION, 1000, 2, 4.8, 6.0, 25, 250 };
+
+static struct cell *cells;
+static struct range *ranges;
+static uint32_t workers;
+static uint32_t samples, chunks_per_cell, jobs;
+static std::atomic<uint32_t> steals;
+
+static bool parse_grid(const char *, struct grid *);
+static double grid_at(const struct grid *, uint32_t);
+static void worker(uint32_t);
+static bool take(uint32_t, uint32_t *);
+static void run_chunk(uint32_t);
+static uint32_t bucket_of(uint32_t);
+static double percentile_mm(const struct cell *, double);
+static bool write_csv(const char *, const char *, double (*)(const struct cell *));
+
+int main(int argc, char **argv)
+{
+    const char *prefix = "budget";
+    char path[256];
+    std::thread *pool;
+    double secs;
+    int a = 1;
+    bool ok = true;
+
+    samples = argc > 1 && argv[1][0] != '-' ? strtoul(argv[a++], NULL, 0) : SAMPLES;
+    workers = std::thread::hardware_concurrency();
+
+    for ( ; a + 1 < argc && argv[a][0] == '-'; a += 2 )
+    {
+        const char *v = argv[a + 1];
+
+        switch ( argv[a][1] )
+        {
+            case 'd': ok &= parse_grid( v, &dist ); break;
+            case 'a': ok &= parse_grid( v, &ang ); break;
+            case 'r': mdl.bits = (uint8_t)atoi( v ); break;
+            case 'l': mdl.laser_um = atof( v ); break;
+            case 'n': mdl.adc_uv = atof( v ); break;
+            case 'b': ok &= sscanf( v, "%lf:%lf", &mdl.bat_lo, &mdl.bat_hi ) == 2; break;
+            case 'e': mdl.bat_mv = atof( v ); break;
+            case 'o': mdl.offset_um = atof( v ); break;
+            case 't': workers = strtoul( v, NULL, 0 ); break;
+            case 'p': prefix = v; break;
+            default: ok = false; break;
+        }
+    }
+
+    if ( !ok || a != argc || mdl.bits < 12 || mdl.bits > 18 || (mdl.bits & 1) || samples == 0
+         || dist.n * ang.n > CELLS_MAX || ang.from < 0 || ang.to > 90 || dist.from <= 0 )
+    {
+        fprintf( stderr, "usage: longitude_budget [samples per cell] [-d m:m:n] [-a deg:deg:n] [-r bits] [-l um]\n"
+                         "                        [-n uV] [-b V:V] [-e mV] [-o um] [-t threads] [-p prefix]\n" );
+        return 2;
+    }
+
+    if ( workers == 0 )
+        workers = 1;
+
+    length_cal.n = 0; // see above
+
+    chunks_per_cell = (samples + CHUNK - 1) / CHUNK;
+    jobs = dist.n * ang.n * chunks_per_cell;
+
+    cells = new struct cell[dist.n * ang.n]();
+    ranges = new struct range[workers];
+    pool = new std::thread[workers];
+
+    // contiguous shares, so a worker mostly sticks to a few cells
+    for ( uint32_t w = 0; w < workers; w++ )
+    {
+        ranges[w].next.store( (uint32_t)((uint64_t)jobs * w / workers), std::memory_order_relaxed );
+        ranges[w].end.store( (uint32_t)((uint64_t)jobs * (w + 1) / workers), std::memory_order_relaxed );
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    for ( uint32_t w = 0; w < workers; w++ )
+        pool[w] = std::thread( worker, w );
+
+    for ( uint32_t w = 0; w < workers; w++ )
+        pool[w].join();
+
+    secs = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+    printf( "%u x %u cells, %lu samples each, %u threads (%u steals): %.2f s, %.1f M samples/s\n",
+            dist.n, ang.n, (unsigned long)chunks_per_cell * CHUNK, workers, steals.load(), secs,
+            (double)jobs * CHUNK / secs / 1e6 );
+    printf( "%u-bit angle, laser %.0f um, ADC %.1f uV, battery %.2f..%.2f V read to %.0f mV, spacing %.0f um\n",
+            mdl.bits, mdl.laser_um, mdl.adc_uv, mdl.bat_lo, mdl.bat_hi, mdl.bat_mv, mdl.offset_um );
+
+    static const struct { const char *name; double (*stat)(const struct cell *); } stats[] =
+    {
+        { "p50",  [](const struct cell *c) { return percentile_mm( c, 0.50 ); } },
+        { "p95",  [](const struct cell *c) { return percentile_mm( c, 0.95 ); } },
+        { "p99",  [](const struct cell *c) { return percentile_mm( c, 0.99 ); } },
+        { "bias", [](const struct cell *c) { return c->sum_um.load() / 1000.0 / c->count.load(); } },
+    };
+
+    for ( const auto &s : stats )
+    {
+        snprintf( path, sizeof path, "%s_%s.csv", prefix, s.name );
+        ok &= write_csv( path, s.name, s.stat );
+    }
+
+    delete[] pool;
+    delete[] ranges;
+    delete[] cells;
+
+    return ok ? 0 : 1;
+}
+
+// FROM:TO:N
+static bool parse_grid(const char *s, struct grid *g)
+{
+    return sscanf( s, "%lf:%lf:%u", &g->from, &g->to, &g->n ) == 3 && g->n > 0 && g->to >= g->from;
+}
+
+static double grid_at(const struct grid *g, uint32_t i)
+{
+    return g->n > 1 ? g->from + (g->to - g->from) * i / (g->n - 1) : g->from;
+}
+
+// [work stealing]
+
+static void worker(uint32_t self)
+{
+    uint32_t job;
+
+    while ( take(self, &job) )
+        run_chunk( job );
+}
+
+// the next job off the front of our own range; once that's empty, the back
+// half of the fullest other range becomes ours.  false when there's nothing left
+static bool take(uint32_t self, uint32_t *job)
+{
+    struct range *r = &ranges[self], *v;
+    uint32_t victim, most, left, mid, next, end;
+
+    for ( ;; )
+    {
+        {
+            std::lock_guard<std::mutex> g( r->lock );
+
+            next = r->next.load( std::memory_order_relaxed );
+
+            if ( next < r->end.load(std::memory_order_relaxed) )
+            {
+                *job = next;
+                r->next.store( next + 1, std::memory_order_relaxed );
+                return true;
+            }
+        }
+
+        // unlocked look, to pick a victim; the steal itself rechecks.  relaxed
+        // loads are enough for a guess, and the two can be from either side of
+        // a steal, so next may even be past end
+        most = 0;
+        victim = self;
+
+        for ( uint32_t w = 0; w < workers; w++ )
+        {
+            next = ranges[w].next.load( std::memory_order_relaxed );
+            end = ranges[w].end.load( std::memory_order_relaxed );
+            left = end > next ? end - next : 0;
+
+            if ( w != self && left > most )
+            {
+                most = left;
+                victim = w;
+            }
+        }
+
+        if ( victim == self )
+            return false;
+
+        v = &ranges[victim];
+
+        std::lock( r->lock, v->lock );
+        std::lock_guard<std::mutex> a( r->lock, std::adopt_lock );
+        std::lock_guard<std::mutex> b( v->lock, std::adopt_lock );
+
+        // the locks order these; the atomics are only for the look above
+        next = v->next.load( std::memory_order_relaxed );
+        end = v->end.load( std::memory_order_relaxed );
+
+        if ( next >= end )
+            continue;
+
+        mid = next + (end - next) / 2; // a single job left goes whole
+        r->next.store( mid, std::memory_order_relaxed );
+        r->end.store( end, std::memory_order_relaxed );
+        v->end.store( mid, std::memory_order_relaxed );
+
+        steals++;
+    }
+}
+
+// [sampling]
+
+// splitmix64: small, fast, and fine for a Monte Carlo of this size
+static inline uint64_t next_u64(uint64_t *s)
+{
+    uint64_t z = (*s += 0x9E3779B97F4A7C15ULL);
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+    return z ^ (z >> 31);
+}
+
+// (0, 1)
+static inline double uniform(uint64_t *s)
+{
+    return ((next_u64(s) >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+// standard normal, Marsaglia's polar method; the spare of each pair is kept
+struct normal
+{
+    uint64_t s;
+    double spare;
+    bool have;
+};
+
+static inline double gauss(struct normal *g)
+{
+    double u, v, r;
+
+    if ( g->have )
+    {
+        g->have = false;
+        return g->spare;
+    }
+
+    do
+    {
+        u = 2 * uniform(&g->s) - 1;
+        v = 2 * uniform(&g->s) - 1;
+        r = u * u + v * v;
+    } while ( r >= 1 || r == 0 );
+
+    r = sqrt( -2 * log(r) / r );
+    g->spare = v * r;
+    g->have = true;
+
+    return u * r;
+}
+
+// one measurement of a target d_um from both lasers, deg apart; returns the
+// measured length less the true one, in micrometers
+static double sample(double d_um, double deg, struct normal *g)
+{
+    const double lsb_uv = MCP342x<18, pga_x1>::lsb_pv / 1e6 * (1 << (18 - mdl.bits));
+    double truth, vbat, v_uv;
+    uint32_t a, b, len;
+    int32_t code, bat_mv;
+
+    truth = 2 * d_um * sin(deg * M_PI / 360) + LASER_OFFSET_UM + mdl.offset_um * gauss(g);
+
+    a = (uint32_t)fmax( 0, lround((d_um + mdl.laser_um * gauss(g)) / 1000) * 1000.0 );
+    b = (uint32_t)fmax( 0, lround((d_um + mdl.laser_um * gauss(g)) / 1000) * 1000.0 );
+
+    // the sensor follows the true battery; the firmware only has the reading
+    vbat = mdl.bat_lo + (mdl.bat_hi - mdl.bat_lo) * uniform(&g->s);
+    bat_mv = (int32_t)lround( vbat * 1000 + mdl.bat_mv * gauss(g) );
+
+    v_uv = 80000 + (sensor_max(vbat) * 1e6 - 80000) * deg / 90 + mdl.adc_uv * gauss(g);
+    code = (int32_t)floor( v_uv / lsb_uv );
+
+    if ( code > (1L << (mdl.bits - 1)) - 1 )
+        code = (1L << (mdl.bits - 1)) - 1;
+
+    code <<= 18 - mdl.bits; // get_angle() works in 18-bit units
+
+#if FIXED_POINT
+    int32_t uv, mdeg;
+
+    uv = (int32_t)(((int64_t)code * MCP342x<18, pga_x1>::lsb_pv) / 1000000);
+    mdeg = calc_angle_mdeg( uv, sensor_max_uv(bat_mv) );
+    if ( mdeg < 0 ) mdeg = 0;
+
+    len = calc_length_um( mdeg, a, b );
+#else
+    double angle;
+
+    angle = calc_angle( code * (MCP342x<18, pga_x1>::lsb_pv * 1e-12), sensor_max(bat_mv / 1000.0) );
+    if ( angle < 0 ) angle = 0.0;
+
+    len = (uint32_t)lround( calc_length(angle, a / 1e6, b / 1e6) * 1e6 );
+#endif
+
+    return len - truth;
+}
+
+static void run_chunk(uint32_t job)
+{
+    uint32_t local[BUCKETS];
+    uint32_t c = job / chunks_per_cell;
+    double d_um = grid_at(&dist, c / ang.n) * 1e6;
+    double deg = grid_at(&ang, c % ang.n);
+    struct normal g = { job * 0xD1B54A32D192ED03ULL + 1, 0, false };
+    double err, sum = 0;
+
+    memset( local, 0, sizeof local );
+
+    for ( uint32_t i = 0; i < CHUNK; i++ )
+    {
+        err = sample( d_um, deg, &g );
+        sum += err;
+        local[bucket_of( (uint32_t)fmin(fabs(err) + 0.5, 4e9) )]++;
+    }
+
+    for ( uint32_t b = 0; b < BUCKETS; b++ )
+        if ( local[b] )
+            cells[c].bucket[b].fetch_add( local[b], std::memory_order_relaxed );
+
+    cells[c].sum_um.fetch_add( llround(sum), std::memory_order_relaxed );
+    cells[c].count.fetch_add( CHUNK, std::memory_order_relaxed );
+}
+
+// [statistics]
+
+// values under SUB_BUCKETS get a bucket each; above, the top SUB_BITS bits
+// after the leading one pick the bucket within the bit length
+static uint32_t bucket_of(uint32_t e)
+{
+    uint32_t shift;
+
+    if ( e < SUB_BUCKETS )
+        return e;
+
+    shift = 31 - __builtin_clz(e) - SUB_BITS;
+
+    return (shift + 1) * SUB_BUCKETS + ((e >> shift) & (SUB_BUCKETS - 1));
+}
+
+// from the histogram, taking the samples to be spread evenly within a bucket
+static double percentile_mm(const struct cell *c, double q)
+{
+    double rank = q * c->count.load(), seen = 0, lo, width, n;
+    uint32_t shift;
+
+    for ( uint32_t b = 0; b < BUCKETS; b++ )
+    {
+        n = c->bucket[b].load();
+
+        if ( n == 0 || seen + n < rank )
+        {
+            seen += n;
+            continue;
+        }
+
+        if ( b < SUB_BUCKETS )
+        {
+            lo = b;
+            width = 1;
+        }
+        else
+        {
+            shift = b / SUB_BUCKETS - 1;
+            lo = (double)((SUB_BUCKETS + b % SUB_BUCKETS) << shift);
+            width = (double)(1UL << shift);
+        }
+
+        return (lo + width * (rank - seen) / n) / 1000;
+    }
+
+    return 0;
+}
+
+// a row per distance, a column per angle
+static bool write_csv(const char *path, const char *name, double (*stat)(const struct cell *))
+{
+    FILE *f = fopen( path, "w" );
+    double worst = 0, x;
+
+    if ( f == NULL )
+    {
+        perror( path );
+        return false;
+    }
+
+    fprintf( f, "%s mm; distance m \\ angle deg", name );
+    for ( uint32_t j = 0; j < ang.n; j++ )
+        fprintf( f, ",%g", grid_at(&ang, j) );
+    fprintf( f, "\n" );
+
+    for ( uint32_t i = 0; i < dist.n; i++ )
+    {
+        fprintf( f, "%g", grid_at(&dist, i) );
+
+        for ( uint32_t j = 0; j < ang.n; j++ )
+        {
+            x = stat( &cells[i * ang.n + j] );
+            fprintf( f, ",%.3f", x );
+
+            if ( fabs(x) > fabs(worst) )
+                worst = x;
+        }
+
+        fprintf( f, "\n" );
+    }
+
+    fclose( f );
+
+    printf( "%-22s worst cell %8.3f mm\n", path, worst );
+
+    return true;
+}
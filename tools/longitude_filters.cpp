@@ -0,0 +1,222 @@
+/*
+ * Longitude filter benchmark
+ *
+ * Runs every filter in longitude_filter.h, in a few configurations, on a
+ * synthetic angle sensor signal in 18-bit codes, and reports for each:
+ *
+ *   - settling: samples until the output of a clean step is within a code of
+ *     the new level, and stays there
+ *   - noise: the output's standard deviation on a steady noisy signal, and how
+ *     many times smaller than the input's it is
+ *   - outliers: the worst output error when the odd sample is off by a lot
+ *   - cost: nanoseconds per sample, on this PC's clock.  the board has the DSP
+ *     versions of the arithmetic; time those with PROFILE (SPAN_GET_ANGLE).
+ *
+ * it fails (exit status 1) if a filter makes the noise worse, or a boxcar
+ * misses the sqrt(n) reduction it should get on white noise by over 15%.
+ *
+ * build from this directory:
+ *
+ *   g++ -O2 -std=gnu++14 -I.. ../longitude_filter.cpp longitude_filters.cpp -o longitude_filters
+ *
+ * (or with the top directory's CMakeLists.txt.)
+ *
+ * usage: longitude_filters [noise, codes] [outliers per 1000] [samples]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "longitude_filter.h"
+
+#define LEVEL    60000    // a steady signal, about 0.94 V
+#define STEP     1000     // and a step away from it
+#define OUTLIER  400      // how far off a wild sample is, either way
+#define SETTLE_MAX 2000   // give up on settling after this many samples
+#define WARMUP   64       // samples before the noise is measured
+
+struct config
+{
+    const char *name;
+    enum FILTER_TYPE type;
+    uint8_t param;        // window or shift
+    int32_t q, r;         // Kalman
+    bool firmware;        // what longitude_adc.cpp runs
+};
+
+static const struct config configs[] =
+{
+    { "boxcar 4",     FILTER_BOXCAR, 4,  0, 0, true },
+    { "boxcar 8",     FILTER_BOXCAR, 8,  0, 0, false },
+    { "boxcar 16",    FILTER_BOXCAR, 16, 0, 0, false },
+    { "ema 1/4",      FILTER_EMA,    2,  0, 0, false },
+    { "ema 1/8",      FILTER_EMA,    3,  0, 0, false },
+    { "ema 1/16",     FILTER_EMA,    4,  0, 0, false },
+    { "median 5",     FILTER_MEDIAN, 5,  0, 0, false },
+    { "median 9",     FILTER_MEDIAN, 9,  0, 0, false },
+    { "kalman 1/64",  FILTER_KALMAN, 0,  1 << FILTER_Q, 64 << FILTER_Q, false },
+    { "kalman 1/256", FILTER_KALMAN, 0,  1 << FILTER_Q, 256 << FILTER_Q, false },
+};
+
+#define CONFIGS (sizeof configs / sizeof configs[0])
+
+static uint64_t rng = 0x2545F4914F6CDD1DULL;
+
+static void setup(struct filter *, const struct config *);
+static uint32_t settling(const struct config *);
+static double noise(const struct config *, double, uint32_t, uint32_t, int32_t *);
+static double ns_per_sample(const struct config *, const int32_t *, uint32_t);
+static int32_t sample(double, uint32_t);
+static double gauss(void);
+static double uniform(void);
+
+int main(int argc, char **argv)
+{
+    double sigma = argc > 1 ? atof(argv[1]) : 8.0;
+    uint32_t outliers = argc > 2 ? strtoul(argv[2], NULL, 0) : 5;
+    uint32_t n = argc > 3 ? strtoul(argv[3], NULL, 0) : 1000000;
+    int32_t *input, worst;
+    double out, ns;
+    int failed = 0;
+    bool ok;
+
+    if ( sigma <= 0 || n < 10 * WARMUP )
+    {
+        fprintf( stderr, "usage: longitude_filters [noise, codes] [outliers per 1000] [samples]\n" );
+        return 2;
+    }
+
+    // the same noisy samples for every filter's timing
+    input = (int32_t *)malloc( n * sizeof *input );
+
+    for ( uint32_t i = 0; i < n; i++ )
+        input[i] = sample( sigma, outliers );
+
+    printf( "noise %.1f codes, %lu outliers per 1000 of %d codes, %lu samples\n\n",
+            sigma, (unsigned long)outliers, OUTLIER, (unsigned long)n );
+    printf( "filter        settles  noise   reduced  worst with outliers   ns/sample (host)\n" );
+
+    for ( uint32_t c = 0; c < CONFIGS; c++ )
+    {
+        const struct config *f = &configs[c];
+        uint32_t settle = settling( f );
+
+        out = noise( f, sigma, 0, n, NULL );
+        noise( f, sigma, outliers, n, &worst );
+        ns = ns_per_sample( f, input, n );
+
+        ok = out < sigma && settle < SETTLE_MAX;
+
+        if ( f->type == FILTER_BOXCAR )
+            ok &= fabs( out * sqrt((double)f->param) / sigma - 1 ) < 0.15;
+
+        failed |= !ok;
+
+        printf( "%-13s %5lu   %6.2f   %5.2fx   %6ld codes        %6.2f%s%s\n",
+                f->name, (unsigned long)settle, out, sigma / out, (long)worst, ns,
+                f->firmware ? "   (firmware)" : "", ok ? "" : "   WRONG" );
+    }
+
+    free( input );
+
+    return failed;
+}
+
+static void setup(struct filter *filter, const struct config *f)
+{
+    if ( f->type == FILTER_KALMAN )
+        filter_kalman_init( filter, f->q, f->r );
+    else
+        filter_init( filter, f->type, f->param );
+}
+
+// a clean step from LEVEL to LEVEL + STEP, after the filter has settled on LEVEL
+static uint32_t settling(const struct config *f)
+{
+    struct filter filter;
+    uint32_t last_out = 0;
+
+    setup( &filter, f );
+
+    for ( uint32_t i = 0; i < SETTLE_MAX; i++ )
+        filter_update( &filter, LEVEL );
+
+    for ( uint32_t i = 1; i <= SETTLE_MAX; i++ )
+        if ( abs(filter_update(&filter, LEVEL + STEP) - (LEVEL + STEP)) > 1 )
+            last_out = i;
+
+    return last_out;
+}
+
+// standard deviation of the output around LEVEL; the worst error goes to *worst
+static double noise(const struct config *f, double sigma, uint32_t outliers, uint32_t n, int32_t *worst)
+{
+    struct filter filter;
+    double sum2 = 0;
+    int32_t e, w = 0;
+
+    setup( &filter, f );
+
+    for ( uint32_t i = 0; i < n; i++ )
+    {
+        e = filter_update( &filter, sample(sigma, outliers) ) - LEVEL;
+
+        if ( i < WARMUP )
+            continue;
+
+        sum2 += (double)e * e;
+
+        if ( abs(e) > w )
+            w = abs( e );
+    }
+
+    if ( worst )
+        *worst = w;
+
+    return sqrt( sum2 / (n - WARMUP) );
+}
+
+static double ns_per_sample(const struct config *f, const int32_t *input, uint32_t n)
+{
+    struct filter filter;
+    struct timespec t0, t1;
+    volatile int32_t sink = 0;
+
+    setup( &filter, f );
+    clock_gettime( CLOCK_MONOTONIC, &t0 );
+
+    for ( uint32_t i = 0; i < n; i++ )
+        sink = sink + filter_update( &filter, input[i] );
+
+    clock_gettime( CLOCK_MONOTONIC, &t1 );
+
+    return ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / n;
+}
+
+// LEVEL plus gaussian noise, rounded to a code as the converter does, and the
+// odd wild one
+static int32_t sample(double sigma, uint32_t outliers_per_mille)
+{
+    double x = LEVEL + sigma * gauss();
+
+    if ( uniform() * 1000 < outliers_per_mille )
+        x += uniform() < 0.5 ? -OUTLIER : OUTLIER;
+
+    return (int32_t)lround( x );
+}
+
+// standard normal, Box-Muller
+static double gauss(void)
+{
+    return sqrt( -2 * log(uniform()) ) * cos( 2 * M_PI * uniform() );
+}
+
+// (0, 1), from xorshift64*
+static double uniform(void)
+{
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+
+    return ((rng * 0x2545F4914F6CDD1DULL >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
@@ -0,0 +1,177 @@
+#!/usr/bin/env python3
+"""
+Longitude measurement history to CSV
+
+Hold Mode on the device's idle screen and it sends its measurement history
+over USB serial (longitude_history.cpp).  this reads that export, straight
+from the serial port (needs pyserial) or from a file it was saved to, checks
+its CRC and writes one CSV row per measurement, oldest first.
+
+usage: longitude_history.py /dev/ttyACM0 [out.csv]    then hold Mode
+       longitude_history.py export.bin [out.csv]
+"""
+import csv
+import datetime
+import os
+import struct
+import sys
+import time
+import zlib
+
+MAGIC = b"LGH1"
+
+SECTOR_MAGIC = 0x484C
+SECTOR_VERSION = 1
+SECTOR_HEADER = 8
+
+# must match longitude_history.cpp: the fields in encoding order, their
+# resolution, and the CSV columns they become
+FIELDS = ("time", "length", "left", "right", "angle", "battery")
+UNITS = ("m", "ft", "in")
+KINDS = ("burst", "range", "track", "?")
+COLUMNS = ("time", "kind", "unit", "length_mm", "left_mm", "right_mm", "angle_deg", "battery_v")
+
+
+def crc8(data):
+    crc = 0
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+
+def varints(data, at, count):
+    """count zigzag varints from data[at:]"""
+    out = []
+    for _ in range(count):
+        v = shift = 0
+        while True:
+            b = data[at]
+            at += 1
+            v |= (b & 0x7F) << shift
+            shift += 7
+            if not b & 0x80:
+                break
+        out.append((v >> 1) ^ -(v & 1))
+    return out
+
+
+def records(sector):
+    """the good records of one sector, as dicts of the stored units"""
+    magic, version, _, seq = struct.unpack_from("<HBBI", sector)
+    if magic != SECTOR_MAGIC or version != SECTOR_VERSION:
+        return
+
+    prev = [0] * len(FIELDS)
+    pos = SECTOR_HEADER
+
+    while pos < len(sector) and sector[pos] != 0xFF:
+        n = sector[pos]
+        size = (n + 2 + 3) & ~3
+        rec = sector[pos:pos + n + 2]
+        pos += size
+
+        # power lost while it was written; the device skips it too
+        if len(rec) < n + 2 or crc8(rec[:n + 1]) != rec[n + 1]:
+            continue
+
+        tag = rec[1]
+        prev = [p + d for p, d in zip(prev, varints(rec, 2, len(FIELDS)))]
+
+        r = dict(zip(FIELDS, prev))
+        r["unit"] = UNITS[tag & 3] if tag & 3 < len(UNITS) else "?"
+        r["kind"] = KINDS[tag >> 2 & 3]
+        yield r
+
+
+def read_export(f):
+    """the sectors of one export from a binary stream, CRC checked"""
+    def take(n):
+        data = b""
+        while len(data) < n:
+            chunk = f.read(n - len(data))
+            if not chunk:
+                raise EOFError("export cut short")
+            data += chunk
+        return data
+
+    # anything the port had buffered before the export starts
+    window = b""
+    while window != MAGIC:
+        window = (window + take(1))[-4:]
+
+    crc = zlib.crc32(MAGIC)
+    sectors = []
+
+    while True:
+        raw = take(2)
+        crc = zlib.crc32(raw, crc)
+        (n,) = struct.unpack("<H", raw)
+        if n == 0:
+            break
+        sector = take(n)
+        crc = zlib.crc32(sector, crc)
+        sectors.append(sector)
+
+    (sent,) = struct.unpack("<I", take(4))
+    if sent != crc & 0xFFFFFFFF:
+        raise ValueError("export CRC mismatch (%08x, computed %08x)" % (sent, crc & 0xFFFFFFFF))
+
+    return sectors
+
+
+def open_source(name):
+    if os.path.isfile(name):
+        return open(name, "rb")
+
+    try:
+        import serial
+    except ImportError:
+        sys.exit("%s: not a file, and reading a serial port needs pyserial" % name)
+
+    print("waiting for the export; hold Mode on the idle screen", file=sys.stderr)
+    port = serial.Serial(name, 115200, timeout=None)
+    return port
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit(__doc__.strip().split("\n\n")[2])
+
+    with open_source(sys.argv[1]) as f:
+        t0 = time.perf_counter()
+        sectors = read_export(f)
+        t1 = time.perf_counter()
+
+    out = open(sys.argv[2], "w", newline="") if len(sys.argv) > 2 else sys.stdout
+    w = csv.writer(out)
+    w.writerow(COLUMNS)
+
+    count = 0
+    for sector in sectors:
+        for r in records(sector):
+            w.writerow((
+                datetime.datetime.fromtimestamp(r["time"], datetime.timezone.utc).strftime("%Y-%m-%dT%H:%M:%SZ"),
+                r["kind"],
+                r["unit"],
+                "%.2f" % (r["length"] / 100.0),
+                r["left"],
+                r["right"],
+                "%.2f" % (r["angle"] / 100.0),
+                "%.2f" % (r["battery"] / 100.0),
+            ))
+            count += 1
+
+    t2 = time.perf_counter()
+    size = sum(len(s) for s in sectors)
+
+    print("%d records from %d sectors (%d bytes); read in %.3f s, decoded in %.3f s" %
+          (count, len(sectors), size, t1 - t0, t2 - t1), file=sys.stderr)
+
+    if out is not sys.stdout:
+        out.close()
+
+
+if __name__ == "__main__":
+    main()
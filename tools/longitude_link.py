@@ -0,0 +1,582 @@
+#!/usr/bin/env python3
+"""
+Longitude host link
+
+Drives the device over its binary USB protocol (longitude_link.cpp): one
+measurement, a batch of them, zeroing the angle, changing units or
+calibrating the angle sensor on a fixture, with every
+measurement streamed back in full (raw angle ADC code, battery, angle, laser
+distances and results, the length and the stage timings), and optionally
+every laser frame as it arrives.  A measurement that fails (a laser or the
+angle sensor) comes back as a Fault, saying which part and why.
+
+As a library:
+
+    from longitude_link import Link
+    with Link.serial("/dev/ttyACM0") as dev:
+        dev.stream(measurements=True)
+        for m in dev.batch(100):
+            print(m.length_um, m.ci_um)
+
+usage: longitude_link.py PORT ping | measure | zero | unit m|ft|in | listen
+       longitude_link.py PORT batch N [--csv FILE] [--frames]
+       longitude_link.py PORT profile [N] [--reset]
+       longitude_link.py PORT anglecal DEG DEG... | clear
+       longitude_link.py PORT record FILE [SECONDS]
+       longitude_link.py --sim LONGITUDE_SIM selftest | (any of the above)
+
+--sim runs the host simulator (tools/longitude_sim.cpp, "link" mode) in place
+of a device; "selftest" is the loopback test of both ends.  "profile" needs
+firmware built with PROFILE 1 (longitude_profile.h); it runs a batch of N
+first if asked, then prints where the time went per span and FSM state.
+"anglecal" asks for the fixture to be set to each angle in turn (increasing,
+two or more), records the sensor there, and stores the device's new angle
+table; "clear" goes back to the nominal sensor line.  "record" saves the
+I/O trace of firmware built with TRACE 1 (longitude_trace.h) for the
+simulator to replay ("longitude_sim replay FILE"), until SECONDS are up or
+^C; start it before the device boots, so the trace has the boot in it.
+"""
+import binascii
+import collections
+import csv
+import select
+import struct
+import subprocess
+import sys
+import time
+
+# host to device (LINK_* in longitude.h)
+PING, STREAM, MEASURE, ZERO, UNIT, BATCH, STOP, PROFILE, ANGLE_CAL = range(1, 10)
+
+# ANGLE_CAL operations
+ANGLE_CAL_START, ANGLE_CAL_POINT, ANGLE_CAL_FINISH, ANGLE_CAL_CLEAR = range(4)
+
+# device to host
+ACK, MEASUREMENT, LASER_FRAME, BATCH_DONE, PROFILE_SPAN, TRACE_DATA, FAULT = range(0x81, 0x88)
+
+ACK_STATUS = ("ok", "unknown command", "bad length", "bad value", "busy")
+
+STREAM_MEASUREMENTS = 0x01
+STREAM_LASER_FRAMES = 0x02
+STREAM_TRACE = 0x04
+
+# trace files (longitude_trace.h): TRACE_MAGIC, then the events as they came;
+# a TRACE_LOST event with no time marks frames that went missing
+TRACE_MAGIC = b"LGTR"
+TRACE_LOST_MARK = bytes((10 << 4, 0))
+
+UNITS = ("m", "ft", "in")
+KINDS = ("burst", "range", "track")
+# MEASURE_FAULT bits, low first
+FAULTS = ("left laser", "right laser", "angle sensor")
+RESULTS = ("none", "reply", "on", "measuring", "distance", "too close", "no echo",
+           "too strong", "too much light", "unknown", "timeout", "off")
+
+# SPAN_ID in longitude_profile.h, then one per FSM state
+SPANS = ("get_angle", "lasers on", "laser shot", "compute_length", "burst", "beep",
+         "update_display", "history_add", "config_flush", "sleep", "boot: core", "boot: devices",
+         "boot: display", "boot: config", "boot: history", "boot: ready")
+STATES = ("STATE_INIT", "STATE_IDLE", "WAIT_LASER_ON", "STATE_LASERS_ON", "STATE_ONE_LASER",
+          "WAIT_MEASURE", "STATE_MEASURE", "WAIT_IDLE", "STATE_TRACKING", "TRACKING",
+          "STATE_CALIBRATE", "WAIT_CALIBRATE", "WAIT_BOOT", "WAIT_LASERS", "STATE_CAPTURE",
+          "WAIT_CAPTURE", "WAIT_TRACKING")
+
+# struct tlm_measurement
+MEASUREMENT_FORMAT = struct.Struct("<I5BIIiiH5I")
+
+Measurement = collections.namedtuple("Measurement", (
+    "time_ms kind unit shots left_result right_result length_um ci_um angle_mdeg "
+    "angle_code battery_mv left_um right_um left_latency_us right_latency_us capture_us"))
+
+# struct tlm_fault: a measurement that came to nothing
+FAULT_FORMAT = struct.Struct("<I3B")
+
+Fault = collections.namedtuple("Fault", "time_ms faults left_result right_result")
+
+LaserFrame = collections.namedtuple("LaserFrame", "laser frame time_us text")
+
+Span = collections.namedtuple("Span", "name hz count max sum buckets")
+
+
+class LinkError(Exception):
+    pass
+
+
+class MeasurementFailed(LinkError):
+    def __init__(self, fault):
+        LinkError.__init__(self, describe(fault))
+        self.fault = fault
+
+
+def crc16(data):
+    """CCITT, as longitude_crc.cpp computes it"""
+    return binascii.crc_hqx(data, 0xFFFF)
+
+
+def cobs_encode(data):
+    out = bytearray()
+    for block in data.split(b"\0"):
+        while len(block) >= 254:
+            out += b"\xff" + block[:254]
+            block = block[254:]
+        out += bytes((len(block) + 1,)) + block
+    return bytes(out)
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        block = data[i + 1:i + code]
+        if code == 0 or len(block) != code - 1:
+            raise ValueError("bad COBS")
+        out += block
+        i += code
+        if code < 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+class Link:
+    """one connection; read() returns whatever bytes are available, waiting
+    at most the timeout, and write() sends bytes"""
+
+    def __init__(self, read, write, close=lambda: None, timeout=10.0):
+        self._read = read
+        self._write = write
+        self._close = close
+        self.timeout = timeout
+        self.seq = 0
+        self.rx = bytearray()
+        self.pending = collections.deque()  # frames that arrived while waiting for another
+        self.last_seq = None
+        self.lost = 0       # frames the seq numbers say went missing
+        self.bad = 0        # frames that failed COBS or the CRC
+        self.frames = 0
+
+    @classmethod
+    def serial(cls, port, timeout=10.0):
+        try:
+            import serial
+        except ImportError:
+            sys.exit("talking to a serial port needs pyserial")
+        s = serial.Serial(port, 115200, timeout=0.05)
+
+        def read(wait):
+            s.timeout = wait
+            return s.read(max(1, s.in_waiting))
+
+        return cls(read, s.write, s.close, timeout)
+
+    @classmethod
+    def sim(cls, path, timeout=10.0):
+        p = subprocess.Popen([path, "link"], stdin=subprocess.PIPE, stdout=subprocess.PIPE, bufsize=0)
+
+        def read(wait):
+            if not select.select([p.stdout], [], [], wait)[0]:
+                return b""
+            data = p.stdout.read1(65536) if hasattr(p.stdout, "read1") else p.stdout.read(1)
+            if not data:
+                raise LinkError("simulator exited")
+            return data
+
+        def write(data):
+            p.stdin.write(data)
+            p.stdin.flush()
+
+        def close():
+            p.stdin.close()
+            p.wait(timeout=5)
+
+        return cls(read, write, close, timeout)
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self._close()
+
+    # [frames]
+
+    def send(self, cmd, payload=b""):
+        """send a command frame; returns its seq"""
+        seq = self.seq
+        self.seq = (self.seq + 1) & 0xFF
+        frame = bytes((cmd, seq)) + payload
+        frame += struct.pack("<H", crc16(frame))
+        self._write(cobs_encode(frame) + b"\0")
+        return seq
+
+    def raw(self, data):
+        """bytes as they are, for testing the device's framing"""
+        self._write(data)
+
+    def _next(self, deadline):
+        while True:
+            end = self.rx.find(b"\0")
+            if end >= 0:
+                wire, self.rx = bytes(self.rx[:end]), self.rx[end + 1:]
+                if not wire:
+                    continue
+                try:
+                    frame = cobs_decode(wire)
+                except ValueError:
+                    self.bad += 1
+                    continue
+                if len(frame) < 4 or crc16(frame[:-2]) != struct.unpack("<H", frame[-2:])[0]:
+                    self.bad += 1
+                    continue
+                seq = frame[1]
+                if self.last_seq is not None:
+                    self.lost += (seq - self.last_seq - 1) & 0xFF
+                self.last_seq = seq
+                self.frames += 1
+                return frame[0], seq, frame[2:-2]
+
+            wait = deadline - time.monotonic()
+            if wait <= 0:
+                raise LinkError("no answer from the device")
+            self.rx += self._read(wait)
+
+    def receive(self, types=None):
+        """the next frame (of one of the given types), as (type, seq, payload)"""
+        for i, f in enumerate(self.pending):
+            if types is None or f[0] in types:
+                del self.pending[i]
+                return f
+        deadline = time.monotonic() + self.timeout
+        while True:
+            f = self._next(deadline)
+            if types is None or f[0] in types:
+                return f
+            self.pending.append(f)
+
+    def command(self, cmd, payload=b"", retry_busy=False):
+        """send a command and wait for its ACK; raises LinkError unless it's ok.
+        with retry_busy, a device that's busy (booting, or in the middle of a
+        measurement) is asked again until the timeout"""
+        deadline = time.monotonic() + self.timeout
+        while True:
+            seq = self.send(cmd, payload)
+            while True:
+                _, _, p = self.receive((ACK,))
+                if p[0] == cmd and p[1] == seq:
+                    break
+            if not (retry_busy and ACK_STATUS[p[2]:p[2] + 1] == ("busy",) and time.monotonic() < deadline):
+                break
+            time.sleep(0.05)
+        if p[2] != 0:
+            raise LinkError("command %d: %s" % (cmd, ACK_STATUS[p[2]] if p[2] < len(ACK_STATUS) else p[2]))
+
+    # [commands]
+
+    def ping(self):
+        self.command(PING)
+
+    def stream(self, measurements=True, laser_frames=False, trace=False):
+        self.command(STREAM, bytes(((STREAM_MEASUREMENTS if measurements else 0) |
+                                    (STREAM_LASER_FRAMES if laser_frames else 0) |
+                                    (STREAM_TRACE if trace else 0),)))
+
+    def zero(self):
+        self.command(ZERO, retry_busy=True)
+
+    def unit(self, name):
+        self.command(UNIT, bytes((UNITS.index(name),)), retry_busy=True)
+
+    def measure(self):
+        """one burst measurement; needs the measurement stream on"""
+        self.command(MEASURE, retry_busy=True)
+        return self.measurement()
+
+    def batch(self, n):
+        """n measurements back to back, as they come in; one that failed is a
+        Fault in their place"""
+        self.command(BATCH, struct.pack("<H", n))
+        while True:
+            t, _, p = self.receive((MEASUREMENT, FAULT, BATCH_DONE))
+            if t == BATCH_DONE:
+                return
+            yield decode(t, p)
+
+    def stop(self):
+        self.command(STOP)
+
+    def profile(self, reset=False):
+        """the device's span histograms, as Span tuples"""
+        self.command(PROFILE, b"\1" if reset else b"")
+        spans = [decode(*f[::2]) for f in self.pending if f[0] == PROFILE_SPAN]
+        self.pending = collections.deque(f for f in self.pending if f[0] != PROFILE_SPAN)
+        return spans
+
+    def angle_cal(self, op, mdeg=0):
+        """one step of the angle sensor calibration; the device has to be idle
+        with the lasers off, and a point waits for a settled reading"""
+        payload = bytes((op,)) + (struct.pack("<i", mdeg) if op == ANGLE_CAL_POINT else b"")
+        self.command(ANGLE_CAL, payload, retry_busy=True)
+
+    def record(self, out, seconds):
+        """write the device's I/O trace to the file out for the given time, or
+        until ^C; returns the bytes of events"""
+        n = 0
+        out.write(TRACE_MAGIC)
+        lost = self.lost
+        self.stream(measurements=False, trace=True)
+        # what came in ahead of the ACK first
+        frames = [f for f in self.pending if f[0] == TRACE_DATA]
+        self.pending = collections.deque(f for f in self.pending if f[0] != TRACE_DATA)
+        deadline = time.monotonic() + seconds
+        try:
+            while True:
+                if not frames:
+                    lost = self.lost
+                    try:
+                        frames.append(self._next(deadline))
+                    except LinkError:
+                        break
+                t, _, p = frames.pop(0)
+                if t != TRACE_DATA:
+                    continue
+                if self.lost != lost:
+                    out.write(TRACE_LOST_MARK)
+                    lost = self.lost
+                out.write(p)
+                n += len(p)
+        except KeyboardInterrupt:
+            pass
+        return n
+
+    def measurement(self):
+        """the next measurement; raises MeasurementFailed if it came to nothing"""
+        t, _, p = self.receive((MEASUREMENT, FAULT))
+        if t == FAULT:
+            raise MeasurementFailed(decode(t, p))
+        return decode(t, p)
+
+    def laser_frames(self):
+        """laser frames received so far"""
+        out = [decode(*f[::2]) for f in self.pending if f[0] == LASER_FRAME]
+        self.pending = collections.deque(f for f in self.pending if f[0] != LASER_FRAME)
+        return out
+
+
+def decode(t, payload):
+    if t == MEASUREMENT:
+        return Measurement(*MEASUREMENT_FORMAT.unpack(payload))
+    if t == FAULT:
+        return Fault(*FAULT_FORMAT.unpack(payload))
+    if t == LASER_FRAME:
+        laser, frame, t_us = struct.unpack_from("<BBI", payload)
+        return LaserFrame(laser, frame, t_us, payload[6:].decode("ascii", "replace"))
+    if t == BATCH_DONE:
+        return struct.unpack("<H", payload)[0]
+    if t == PROFILE_SPAN:
+        span, hz, count, top, total, lo = struct.unpack_from("<BIIIQB", payload)
+        buckets = [0] * lo + list(struct.unpack_from("<%dI" % ((len(payload) - 22) // 4), payload, 22))
+        if span < len(SPANS):
+            name = SPANS[span]
+        else:
+            name = STATES[span - len(SPANS)] if span - len(SPANS) < len(STATES) else "state %d" % (span - len(SPANS))
+        return Span(name, hz, count, top, total, buckets)
+    return payload
+
+
+def percentile(span, q):
+    """from the histogram: bucket b holds 2^(b-1) up to 2^b - 1 ticks; assume
+    the samples are spread evenly within it"""
+    rank = q * span.count
+    seen = 0
+    for b, n in enumerate(span.buckets):
+        if n and seen + n >= rank:
+            lo = (1 << (b - 1)) if b else 0
+            hi = (1 << b) - 1 if b else 0
+            return min(lo + (hi - lo) * (rank - seen) / n, span.max)
+        seen += n
+    return span.max
+
+
+def profile_table(spans):
+    lines = ["%-16s %8s %12s %12s %12s %12s" % ("span", "count", "mean us", "p50 us", "p99 us", "max us")]
+    for s in spans:
+        us = 1e6 / s.hz
+        lines.append("%-16s %8d %12.1f %12.1f %12.1f %12.1f" % (
+            s.name, s.count, s.sum / s.count * us, percentile(s, 0.5) * us, percentile(s, 0.99) * us, s.max * us))
+    return "\n".join(lines)
+
+
+def describe(m):
+    if isinstance(m, Fault):
+        return "failed: %s (lasers: %s/%s)" % (
+            ", ".join(name for i, name in enumerate(FAULTS) if m.faults & 1 << i),
+            RESULTS[m.left_result], RESULTS[m.right_result])
+    return "%.3f mm +/- %.3f (%d shots, %s), %.3f deg (code %d), %.2f V, lasers %d/%d um, %d ms" % (
+        m.length_um / 1000.0, m.ci_um / 1000.0, m.shots, UNITS[m.unit], m.angle_mdeg / 1000.0,
+        m.angle_code, m.battery_mv / 1000.0, m.left_um, m.right_um, m.capture_us // 1000)
+
+
+# [loopback test]
+
+def selftest(dev):
+    failures = []
+
+    def check(ok, what):
+        print("%s  %s" % ("ok  " if ok else "FAIL", what))
+        if not ok:
+            failures.append(what)
+
+    dev.ping()
+    check(True, "ping")
+
+    try:
+        dev.command(0x7F)
+        check(False, "unknown command refused")
+    except LinkError as e:
+        check("unknown" in str(e), "unknown command refused")
+
+    # a frame with a bad CRC is dropped without an answer; the next one gets through
+    before = dev.frames
+    frame = bytes((PING, dev.seq, 0, 0))
+    dev.raw(cobs_encode(frame) + b"\0")
+    dev.seq = (dev.seq + 1) & 0xFF
+    dev.ping()
+    check(dev.frames - before == 1 and not dev.pending, "bad CRC ignored")
+
+    # the angle calibration takes points in order only, and needs two of them
+    def refused(op, mdeg=0):
+        try:
+            dev.angle_cal(op, mdeg)
+            return False
+        except LinkError as e:
+            return "bad value" in str(e)
+
+    dev.angle_cal(ANGLE_CAL_START)
+    dev.angle_cal(ANGLE_CAL_POINT, 45000)
+    check(refused(ANGLE_CAL_POINT, 30000), "angle calibration: point out of order refused")
+    check(refused(ANGLE_CAL_FINISH), "angle calibration: one point refused")
+    dev.angle_cal(ANGLE_CAL_CLEAR)
+
+    dev.stream(measurements=True, laser_frames=True)
+    dev.unit("ft")
+    m = dev.measure()
+    frames = dev.laser_frames()
+    distances = sum(1 for f in frames if f.frame == RESULTS.index("distance"))
+    check(m.unit == UNITS.index("ft"), "unit change: %s" % describe(m))
+    check(distances >= m.shots * 2 - 2, "laser frames: %d, %d of them distances, for %d shots" %
+          (len(frames), distances, m.shots))
+
+    dev.zero()
+    m = dev.measure()
+    check(abs(m.angle_mdeg) < 200, "zeroed angle: %.3f deg" % (m.angle_mdeg / 1000.0))
+
+    dev.stream(measurements=True, laser_frames=False)
+    dev.unit("m")
+
+    n = 25
+    t0 = time.monotonic()
+    got = list(dev.batch(n))
+    wall = time.monotonic() - t0
+    sim_s = (got[-1].time_ms - got[0].time_ms) / 1000.0 if got else 0
+    got = [g for g in got if isinstance(g, Measurement)]
+    check(len(got) == n, "batch of %d: %d measurements, %.1f s on the device clock, %.2f s here" %
+          (n, len(got), sim_s, wall))
+    check(all(g.left_result == RESULTS.index("distance") for g in got), "every batch measurement has a distance")
+
+    dev.ping()
+    check(dev.lost == 0 and dev.bad == 0, "%d frames, %d lost, %d bad" % (dev.frames, dev.lost, dev.bad))
+
+    print("%d failed" % len(failures))
+    return 1 if failures else 0
+
+
+def main(argv):
+    if len(argv) >= 2 and argv[0] == "--sim":
+        link = Link.sim(argv[1])
+        argv = argv[2:]
+    elif len(argv) >= 1:
+        link = Link.serial(argv[0])
+        argv = argv[1:]
+    else:
+        argv = []
+
+    if not argv:
+        sys.exit(__doc__.strip().split("\n\n")[3])
+
+    cmd, args = argv[0], argv[1:]
+
+    with link as dev:
+        if cmd == "selftest":
+            return selftest(dev)
+
+        if cmd == "ping":
+            dev.ping()
+            print("ok")
+        elif cmd == "zero":
+            dev.zero()
+        elif cmd == "unit":
+            dev.unit(args[0])
+        elif cmd == "measure":
+            dev.stream(measurements=True)
+            try:
+                print(describe(dev.measure()))
+            except MeasurementFailed as e:
+                sys.exit(str(e))
+        elif cmd == "batch":
+            frames = "--frames" in args
+            out = None
+            if "--csv" in args:
+                out = csv.writer(open(args[args.index("--csv") + 1], "w", newline=""))
+                out.writerow(Measurement._fields)
+            dev.stream(measurements=True, laser_frames=frames)
+            for m in dev.batch(int(args[0])):
+                if out and isinstance(m, Measurement):
+                    out.writerow(m)
+                print(describe(m))
+                for f in dev.laser_frames():
+                    print("  laser %d %-10s %10d us  $%s&" % (f.laser, RESULTS[f.frame], f.time_us, f.text))
+        elif cmd == "profile":
+            nums = [a for a in args if a.isdigit()]
+            if nums:
+                dev.stream(measurements=False)
+                for _ in dev.batch(int(nums[0])):
+                    pass
+            try:
+                print(profile_table(dev.profile(reset="--reset" in args)))
+            except LinkError:
+                sys.exit("no profiler in this firmware; build it with PROFILE 1 (longitude_profile.h)")
+        elif cmd == "anglecal":
+            if args == ["clear"]:
+                dev.angle_cal(ANGLE_CAL_CLEAR)
+            else:
+                dev.angle_cal(ANGLE_CAL_START)
+                try:
+                    for deg in sorted(float(a) for a in args):
+                        input("set the fixture to %g deg, then press enter " % deg)
+                        dev.angle_cal(ANGLE_CAL_POINT, int(round(deg * 1000)))
+                finally:
+                    try:
+                        dev.angle_cal(ANGLE_CAL_FINISH) # also puts the ADC back
+                    except LinkError:
+                        sys.exit("calibration refused: it needs two or more angles, and readings that increase with them")
+                print("stored")
+        elif cmd == "record":
+            with open(args[0], "wb") as out:
+                n = dev.record(out, float(args[1]) if len(args) > 1 else 1e9)
+            if n == 0:
+                sys.exit("no trace in this firmware; build it with TRACE 1 (longitude_trace.h)")
+            print("%d bytes, %d frames lost" % (n, dev.lost))
+        elif cmd == "listen":
+            dev.stream(measurements=True, laser_frames=True)
+            dev.timeout = 1e9
+            while True:
+                t, _, p = dev.receive()
+                x = decode(t, p)
+                print(describe(x) if t in (MEASUREMENT, FAULT) else x)
+        else:
+            sys.exit("unknown command: %s" % cmd)
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,198 @@
+/*
+ * Longitude fixed-point math check
+ *
+ * Sweeps the operating range of the integer measurement path in
+ * longitude_math.cpp (what FIXED_POINT builds run) against its double-precision
+ * path, and against the exact geometry in long double:
+ *
+ *   - length: both legs 0.1 to 10 m, the angle between them 0 to 95 degrees,
+ *     both paths against the half-angle form in long double
+ *   - angle: every sensor output from the 80 mV floor to the maximum, on
+ *     batteries from 4.6 to 6.0 V; and the sensor maximum itself
+ *   - units: meters, feet and inches, in thousandths, up to 20 m
+ *
+ * and times both paths per call.  those times are this PC's, which has an FPU:
+ * on the Teensy 3.2 every double operation is a soft-float library call, so
+ * uncomment MATH_BENCH in longitude.ino for the board's cycle counts.
+ *
+ * the length compensation is off, as it's the same table on both paths.  it
+ * fails (exit status 1) if the integer path is off the exact length by more
+ * than LENGTH_MAX_UM, the angle by more than a millidegree, or a unit
+ * conversion by more than half a digit.
+ *
+ * build from this directory:
+ *
+ *   g++ -O2 -std=gnu++14 -I.. ../longitude_math.cpp longitude_mathcheck.cpp -o longitude_mathcheck
+ *
+ * (or with the top directory's CMakeLists.txt.)
+ *
+ * usage: longitude_mathcheck [steps per axis]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "longitude_math.h"
+
+#define LENGTH_MAX_UM 300 // the cosine table's interpolation: 257 um at 10 m legs
+#define LEG_MIN_UM    100000
+#define LEG_MAX_UM    10000000
+#define ANGLE_MAX_MDEG 95000
+#define UNITS_MAX_UM  20000000
+
+struct error
+{
+    double max, sum;
+    uint64_t n;
+    double at[3]; // where the worst one was
+};
+
+static void add(struct error *, double, double, double, double);
+static void show(const char *, const char *, const struct error *);
+static long double exact_um(int32_t, uint32_t, uint32_t);
+static double elapsed_ns(const struct timespec *);
+
+int main(int argc, char **argv)
+{
+    uint32_t steps = argc > 1 ? strtoul(argv[1], NULL, 0) : 200;
+    struct error fixed = {}, dbl = {}, ang = {}, vmax = {}, units[3] = {};
+    static uint32_t (*const to_units[3])(uint32_t) = { um_to_milli_meter, um_to_milli_foot, um_to_milli_inch };
+    static const double um_per_unit[3] = { 1000.0, 304.8, 25.4 };
+    struct timespec t0;
+    volatile double sink_d = 0;
+    volatile uint32_t sink_u = 0;
+    uint32_t a, b, calls;
+    int32_t theta;
+    long double exact;
+    double ns_d, ns_f;
+    int failed = 0;
+
+    if ( steps < 2 )
+    {
+        fprintf( stderr, "usage: longitude_mathcheck [steps per axis]\n" );
+        return 2;
+    }
+
+    length_cal.n = 0; // see above
+
+    // [length]
+    for ( uint32_t i = 0; i < steps; i++ )
+    {
+        a = LEG_MIN_UM + (uint32_t)((uint64_t)(LEG_MAX_UM - LEG_MIN_UM) * i / (steps - 1));
+
+        for ( uint32_t j = 0; j < steps; j++ )
+        {
+            b = LEG_MIN_UM + (uint32_t)((uint64_t)(LEG_MAX_UM - LEG_MIN_UM) * j / (steps - 1));
+
+            for ( uint32_t k = 0; k < steps; k++ )
+            {
+                theta = (int32_t)((uint64_t)ANGLE_MAX_MDEG * k / (steps - 1));
+                exact = exact_um( theta, a, b );
+
+                add( &fixed, (double)(calc_length_um(theta, a, b) - exact), a, b, theta );
+                add( &dbl, (double)(calc_length(theta / 1000.0, a / 1e6, b / 1e6) * 1e6 - exact), a, b, theta );
+            }
+        }
+    }
+
+    // [angle]: every 100 uV, every 10 mV of battery
+    for ( int32_t mv = 4600; mv <= 6000; mv += 10 )
+    {
+        add( &vmax, sensor_max_uv(mv) - sensor_max(mv / 1000.0) * 1e6, mv, 0, 0 );
+
+        for ( int32_t uv = 80000; uv <= sensor_max_uv(mv); uv += 100 )
+            add( &ang, calc_angle_mdeg(uv, sensor_max_uv(mv)) - calc_angle(uv / 1e6, sensor_max(mv / 1000.0)) * 1000,
+                 uv, mv, 0 );
+    }
+
+    // [units]: every 7 um, which hits every remainder of the divisions
+    for ( uint32_t um = 0; um <= UNITS_MAX_UM; um += 7 )
+        for ( uint8_t u = 0; u < 3; u++ )
+            add( &units[u], to_units[u](um) - um / um_per_unit[u], um, 0, 0 );
+
+    printf( "length, %u x %u x %u: legs %.1f..%.1f m, 0..%.0f degrees\n",
+            steps, steps, steps, LEG_MIN_UM / 1e6, LEG_MAX_UM / 1e6, ANGLE_MAX_MDEG / 1000.0 );
+    show( "  integer vs exact", "um", &fixed );
+    show( "  double  vs exact", "um", &dbl );
+    show( "angle, integer vs double", "mdeg", &ang );
+    show( "sensor max, integer vs double", "uV", &vmax );
+    show( "meters, integer vs double", "mm/1000", &units[0] );
+    show( "feet, integer vs double", "ft/1000", &units[1] );
+    show( "inches, integer vs double", "in/1000", &units[2] );
+
+    failed |= fixed.max > LENGTH_MAX_UM;
+    failed |= ang.max > 1 + 1e-6;
+    failed |= vmax.max > 1 + 1e-6;
+    for ( uint8_t u = 0; u < 3; u++ )
+        failed |= units[u].max > 0.5 + 1e-6;
+
+    // [cost], on the same inputs for both paths
+    calls = 1000000;
+
+    clock_gettime( CLOCK_MONOTONIC, &t0 );
+    for ( uint32_t i = 0; i < calls; i++ )
+        sink_d = sink_d + calc_length( (i % 90000) / 1000.0, 1.234 + (i & 255) / 1e6, 2.345 );
+    ns_d = elapsed_ns( &t0 ) / calls;
+
+    clock_gettime( CLOCK_MONOTONIC, &t0 );
+    for ( uint32_t i = 0; i < calls; i++ )
+        sink_u = sink_u + calc_length_um( (int32_t)(i % 90000), 1234000 + (i & 255), 2345000 );
+    ns_f = elapsed_ns( &t0 ) / calls;
+
+    printf( "length on the host: %.1f ns double, %.1f ns integer\n", ns_d, ns_f );
+
+    clock_gettime( CLOCK_MONOTONIC, &t0 );
+    for ( uint32_t i = 0; i < calls; i++ )
+        sink_d = sink_d + calc_angle( 0.08 + (i % 1840000) / 1e6, sensor_max(4.6 + (i & 1023) / 1000.0) );
+    ns_d = elapsed_ns( &t0 ) / calls;
+
+    clock_gettime( CLOCK_MONOTONIC, &t0 );
+    for ( uint32_t i = 0; i < calls; i++ )
+        sink_u = sink_u + (uint32_t)calc_angle_mdeg( 80000 + (int32_t)(i % 1840000), sensor_max_uv(4600 + (i & 1023)) );
+    ns_f = elapsed_ns( &t0 ) / calls;
+
+    printf( "angle on the host:  %.1f ns double, %.1f ns integer\n", ns_d, ns_f );
+    printf( "%s\n", failed ? "WRONG" : "ok" );
+
+    return failed;
+}
+
+static void add(struct error *e, double err, double x, double y, double z)
+{
+    err = fabs( err );
+    e->sum += err;
+    e->n++;
+
+    if ( err > e->max )
+    {
+        e->max = err;
+        e->at[0] = x;
+        e->at[1] = y;
+        e->at[2] = z;
+    }
+}
+
+static void show(const char *name, const char *unit, const struct error *e)
+{
+    printf( "%-30s max %9.3f %-8s mean %8.3f   (worst at %.0f, %.0f, %.0f)\n",
+            name, e->max, unit, e->n ? e->sum / e->n : 0.0, e->at[0], e->at[1], e->at[2] );
+}
+
+// the length the firmware should report, from the half-angle form in long
+// double
+static long double exact_um(int32_t theta, uint32_t a, uint32_t b)
+{
+    long double s = sinl( theta * 3.14159265358979323846264338327950288L / 360000.0L );
+    long double d = (long double)a - b;
+
+    return sqrtl( d * d + 4.0L * a * b * s * s ) + LASER_OFFSET_UM;
+}
+
+static double elapsed_ns(const struct timespec *t0)
+{
+    struct timespec t1;
+
+    clock_gettime( CLOCK_MONOTONIC, &t1 );
+
+    return (t1.tv_sec - t0->tv_sec) * 1e9 + (t1.tv_nsec - t0->tv_nsec);
+}
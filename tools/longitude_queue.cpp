@@ -0,0 +1,121 @@
+/*
+ * Longitude event queue stress test
+ *
+ * Runs longitude_events.cpp on the PC with several producer threads posting
+ * into it at once, as fast as they can, and the main thread taking events off
+ * with event_wait() as the loop does.  on the board the producers are
+ * interrupts, which preempt each other and the loop but never run side by
+ * side; threads on several cores race harder than that, on every slot.
+ *
+ * each producer posts its id (arg) and a running count (time), and yields and
+ * posts again whenever the queue is full.  it fails (exit status 1) if an event
+ * is lost, comes twice or out of its producer's order, or the overflows the
+ * queue counted aren't the posts that were turned away.
+ *
+ * build from this directory:
+ *
+ *   g++ -O2 -std=gnu++14 -pthread -I.. ../longitude_events.cpp ../longitude_profile.cpp longitude_queue.cpp -o longitude_queue
+ *
+ * (or with the top directory's CMakeLists.txt.)  add -fsanitize=thread to
+ * have the race detector watch it too.  it builds with -DPROFILE=1 as well:
+ * the profiler is linked in for event_wait()'s sleep span, on a clock that
+ * doesn't move.
+ *
+ * usage: longitude_queue [producers] [events each]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "longitude_events.h"
+#include "longitude_hal.h"
+
+#define PRODUCERS_MAX 64
+
+static std::atomic<uint64_t> refused; // posts that found the queue full
+
+// what longitude_events.cpp and the profiler need of the HAL.  the latency it
+// keeps is in milliseconds since a post, and the spans in cycles, which mean
+// nothing here.
+uint32_t hal_millis(void) { return 0; }
+void hal_irq_off(void) {}
+void hal_irq_on(void) {}
+void hal_sleep(void) { std::this_thread::yield(); }
+uint32_t hal_micros(void) { return 0; }
+void hal_cycles_start(void) {}
+uint32_t hal_cycles(void) { return 0; }
+uint32_t hal_cycles_hz(void) { return 1000000; }
+
+static void producer(uint8_t id, uint32_t n)
+{
+    for ( uint32_t i = 0; i < n; i++ )
+        while ( !event_post(EV_TIMER, id, i) )
+        {
+            refused.fetch_add( 1, std::memory_order_relaxed );
+            std::this_thread::yield(); // let the consumer catch up, with fewer cores than threads
+        }
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t producers = argc > 1 ? strtoul(argv[1], NULL, 0) : 8;
+    uint32_t n = argc > 2 ? strtoul(argv[2], NULL, 0) : 200000;
+    static uint32_t next[PRODUCERS_MAX]; // the count each producer's next event should have
+    std::thread pool[PRODUCERS_MAX];
+    uint64_t total, lost = 0, wrong = 0;
+    struct event ev;
+    double s;
+    int failed;
+
+    if ( producers < 1 || producers > PRODUCERS_MAX || n < 1 )
+    {
+        fprintf( stderr, "usage: longitude_queue [producers, up to %d] [events each]\n", PRODUCERS_MAX );
+        return 2;
+    }
+
+    event_init();
+    total = (uint64_t)producers * n;
+
+    auto t0 = std::chrono::steady_clock::now();
+
+    for ( uint32_t p = 0; p < producers; p++ )
+        pool[p] = std::thread( producer, (uint8_t)p, n );
+
+    for ( uint64_t got = 0; got < total; got++ )
+    {
+        event_wait( &ev );
+
+        if ( ev.type != EV_TIMER || ev.arg >= producers || ev.time != next[ev.arg] )
+        {
+            if ( wrong++ < 10 )
+                fprintf( stderr, "event %lu: type %u from %u, count %lu, expected %lu\n",
+                         (unsigned long)got, ev.type, ev.arg, (unsigned long)ev.time,
+                         ev.arg < producers ? (unsigned long)next[ev.arg] : 0UL );
+            continue;
+        }
+
+        next[ev.arg]++;
+    }
+
+    for ( uint32_t p = 0; p < producers; p++ )
+        pool[p].join();
+
+    s = std::chrono::duration<double>( std::chrono::steady_clock::now() - t0 ).count();
+
+    for ( uint32_t p = 0; p < producers; p++ )
+        lost += n - next[p];
+
+    // nothing left over either
+    wrong += event_get( &ev );
+
+    failed = lost || wrong || event_overflows() != refused.load();
+
+    printf( "%u producers x %lu events through %d slots: %.2f s, %.1f M events/s\n",
+            producers, (unsigned long)n, EVENT_QUEUE_SIZE, s, total / s / 1e6 );
+    printf( "lost %lu, wrong %lu; queue full %lu times, %lu overflows counted  %s\n",
+            (unsigned long)lost, (unsigned long)wrong, (unsigned long)refused.load(),
+            (unsigned long)event_overflows(), failed ? "WRONG" : "ok" );
+
+    return failed;
+}
@@ -0,0 +1,2273 @@
+/*
+ * Longitude host simulator
+ *
+ * Runs the firmware's own setup() and loop() against the host HAL
+ * (longitude_hal_host.cpp): two scripted laser modules, an MCP3421 model, a
+ * RAM EEPROM and button presses on a virtual clock.  the display code draws
+ * into a framebuffer model of its library (tools/host).
+ *
+ * the default scenario clicks the measure button whenever the firmware waits
+ * for it (lasers on, measure, back to idle), so thousands of measurements run
+ * in well under a second.  "track" instead holds the button to start tracking
+ * mode, moves the right laser's target a millimeter every 100 ms, and reports
+ * the update rate, and that the click holding the reading doesn't hold up the
+ * loop while the last shots land.  "burst" adds noise to the lasers and
+ * compares the burst capture's early stop with always taking every shot.
+ * "cal" gives the lasers a nonlinear error, runs the calibration mode on the
+ * preset references, and compares the length error before and after; it also
+ * checks that the default compensation table matches the prototype's
+ * hardcoded formula.  "config"
+ * exercises the settings log: coalescing of unit clicks, wear per EEPROM cell
+ * over many changes, power cuts at every point of a write, and the migration
+ * from the old fixed layout.  "history" takes measurements until the history
+ * ring has wrapped (on a draining battery, whose shown level should step down
+ * once per step), checks it survives a reboot, and saves the USB export for
+ * tools/longitude_history.py; a sketch grown into the history flash has to
+ * leave it alone.  "link" connects the firmware's USB serial to
+ * stdin and stdout, for tools/longitude_link.py --sim (noisy lasers, so the
+ * bursts vary).  "power" plays a usage trace (built in, or from a file) twice,
+ * with the power manager's timeouts and with everything left on, and turns the
+ * time each part spent in each power state into average current and runtime.
+ * "tasks" traces the task scheduler through a boot, a few measurements, lighting
+ * up with one laser unplugged (which has to fail), a burst it drops out of, a
+ * rangefinder shot without an echo, a zero, and a zero and a burst without the
+ * angle sensor, and checks that no task step blocks and that the loop takes every event within a
+ * tick of it being posted.  "anglecal" gives
+ * the angle sensor a gain error and a bow, sweeps it from 0 to 90 degrees,
+ * calibrates it at every 15 degrees, and compares the angle error before and
+ * after; the table has to survive a reboot.  "record" (built with TRACE) saves
+ * the I/O traces (longitude_trace.h) of a few scenarios: clicking through
+ * measurements with a unit change, tracking, and a laser that stops answering.
+ * "replay" runs the firmware on recorded traces, these or the board's (see
+ * "record" in tools/longitude_link.py), as fast as it can, and fails any whose
+ * measurements come out different from the recording's; given a directory, it
+ * replays every .trace file in it, as a regression suite.  "boot" times the
+ * boot on the virtual clock, stage by stage, to the first measurement; setup()
+ * itself takes no simulated time (the "boot" spans of a PROFILE build on the
+ * board have that part).  it then boots without the angle ADC, which has to end
+ * on the fault screen.  "screens" steps through the idle, aiming, length and
+ * fault screens and a unit change, checks the framebuffer model for what each
+ * should show, and saves them as PPM pictures if given a directory.  "parser"
+ * feeds the laser frame parser every frame the modules send, noise around and
+ * inside them, frames cut between reads at every byte and several in one read,
+ * then times it on a stream of them.  "ports" gives the modules different
+ * measuring times and checks that a command to both, waited for or run as
+ * TASK_LASERS, takes as long as the slower one, not the two added up.  "i2c"
+ * counts the angle converter's bus transactions and bus time per sample, and
+ * how long samples wait to be read, idle, aiming and measuring.  "sound" plays
+ * the longest melody and clicks through measurements meanwhile, and checks on
+ * the virtual clock that the loop never waited on the speaker: no loop pass
+ * busy waiting for as long as a tick while it played, a measurement done before
+ * it ended, and every event taken within a tick.  "buttons" clicks the measure
+ * button quicker than the debounce window, and with contact bounce on the press
+ * and on the release, and checks each comes out as one press and one release.
+ * "glyphs" draws each kind of readout from the glyph cache and through the
+ * display library's text path, and compares what each costs on the SPI bus and
+ * on this PC's clock, with the RAM the cache takes; the cache has to send
+ * fewer bytes.
+ *
+ * build from this directory:
+ *
+ *   g++ -O2 -std=gnu++14 -I.. -Ihost -x c++ ../longitude.ino -x none \
+ *       ../longitude_{events,lasers,adc,buttons,battery,sound,config,filter,math,protocol,hal_host,tracking,capture,calibration,crc,history,link,profile,power,task,trace,display,glyphs}.cpp \
+ *       host/{ILI9341_t3,fonts}.cpp longitude_sim.cpp -o longitude_sim
+ *
+ * or build it with the other tools, and run the scenarios as tests, with the
+ * top directory's CMakeLists.txt.
+ *
+ * add -DPROFILE=1 to time the firmware's spans (on the PC's clock); see
+ * "profile" in tools/longitude_link.py.  add -DTRACE=1 for "record", or to
+ * record over the link, and -DFIXED_POINT=0 to run the double-precision math
+ *
+ * usage: longitude_sim [cycles] [left mm] [right mm] [angle sensor uV]
+ *        longitude_sim track [seconds] [left mm] [right mm] [angle sensor uV]
+ *        longitude_sim burst [measurements] [sigma um] [outliers per 1000]
+ *        longitude_sim cal [laser scale error, ppm] [laser ripple, um]
+ *        longitude_sim config [changes]
+ *        longitude_sim history [measurements] [export file]
+ *        longitude_sim link
+ *        longitude_sim power [hours | trace file]
+ *        longitude_sim tasks [measurements]
+ *        longitude_sim anglecal [sensor gain error, ppm] [sensor bow, uV]
+ *        longitude_sim boot
+ *        longitude_sim screens [directory]
+ *        longitude_sim parser [megabytes]
+ *        longitude_sim ports [left measure ms] [right measure ms]
+ *        longitude_sim i2c [seconds]
+ *        longitude_sim sound [melodies]
+ *        longitude_sim buttons
+ *        longitude_sim glyphs [repeats]
+ *        longitude_sim record [directory] [measurements]
+ *        longitude_sim replay trace|directory...
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <poll.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include "longitude.h"
+#include "longitude_mcp342x.h"
+#include "longitude_glyphs.h"
+#include "longitude_hal_host.h"
+#include "ILI9341_t3.h"
+#include "font_Arial.h"
+#include "font_LiberationSans.h"
+
+#define MEASURE_PIN 5
+#define MODE_PIN    4
+
+void setup(void);
+void loop(void);
+
+// [display]
+//
+// longitude_display.cpp draws into the model of its library in tools/host; the
+// scenarios go by what reaches the glass
+extern ILI9341_t3 tft;
+
+static uint32_t redraws;      // loop passes that drew something
+static uint32_t live_redraws; // in tracking mode
+
+// a full frame on the bus: one address window and every pixel
+#define FRAME_SPI_BYTES (11 + 2UL * ILI9341_TFTWIDTH * ILI9341_TFTHEIGHT)
+
+// the firmware has drawn since the last call
+static bool drawn(void)
+{
+    static uint64_t seen;
+    bool changed = tft.pixels_written() != seen;
+
+    seen = tft.pixels_written();
+    return changed;
+}
+
+static void boot(uint32_t, uint32_t, int32_t);
+static bool next_measurement(void);
+static int measure_cycles(uint32_t);
+static int track(uint32_t, uint32_t);
+static int burst(uint32_t, uint32_t, uint16_t);
+static int calibrate(int32_t, int32_t);
+static int config(uint32_t);
+static int history(uint32_t, const char *);
+static int host_link(void);
+static int power(const char *);
+static int tasks(uint32_t);
+static int angle_calibrate(int32_t, int32_t);
+static int record(const char *, uint32_t);
+static int replay(int, char **);
+static int boot_time(void);
+static int screens(const char *);
+static int parser(uint32_t);
+static int ports(uint32_t, uint32_t);
+static int i2c(uint32_t);
+static int sound(uint32_t);
+static int buttons(void);
+static int glyphs(uint32_t);
+static void run_until(uint32_t);
+
+int main(int argc, char **argv)
+{
+    const char *mode = argc > 1 && (argv[1][0] < '0' || argv[1][0] > '9') ? argv[1] : "";
+    int a = *mode ? 2 : 1; // first numeric argument
+    uint32_t count  = argc > a ? strtoul(argv[a], NULL, 0) : 0;
+
+    if ( !strcmp(mode, "burst") )
+    {
+        return burst( count ? count : 200,
+                      argc > a + 1 ? strtoul(argv[a + 1], NULL, 0) : 1500,
+                      argc > a + 2 ? strtoul(argv[a + 2], NULL, 0) : 20 );
+    }
+
+    if ( !strcmp(mode, "config") )
+        return config( count ? count : 3000 );
+
+    if ( !strcmp(mode, "link") )
+        return host_link();
+
+    if ( !strcmp(mode, "tasks") )
+        return tasks( count ? count : 3 );
+
+    if ( !strcmp(mode, "power") )
+        return power( argc > a ? argv[a] : "4" );
+
+    if ( !strcmp(mode, "history") )
+        return history( count ? count : 12000, argc > a + 1 ? argv[a + 1] : "history.bin" );
+
+    if ( !strcmp(mode, "boot") )
+        return boot_time();
+
+    if ( !strcmp(mode, "screens") )
+        return screens( argc > 2 ? argv[2] : NULL );
+
+    if ( !strcmp(mode, "parser") )
+        return parser( count ? count : 100 );
+
+    if ( !strcmp(mode, "ports") )
+        return ports( count ? count : 300, argc > a + 1 ? strtoul(argv[a + 1], NULL, 0) : 900 );
+
+    if ( !strcmp(mode, "i2c") )
+        return i2c( count ? count : 10 );
+
+    if ( !strcmp(mode, "sound") )
+        return sound( count ? count : 3 );
+
+    if ( !strcmp(mode, "buttons") )
+        return buttons();
+
+    if ( !strcmp(mode, "glyphs") )
+        return glyphs( count ? count : 2000 );
+
+    if ( !strcmp(mode, "record") )
+        return record( argc > 2 ? argv[2] : ".", argc > 3 ? strtoul(argv[3], NULL, 0) : 20 );
+
+    if ( !strcmp(mode, "replay") )
+        return replay( argc - 2, argv + 2 );
+
+    if ( !strcmp(mode, "anglecal") )
+        return angle_calibrate( argc > a ? strtol(argv[a], NULL, 0) : 15000,
+                                argc > a + 1 ? strtol(argv[a + 1], NULL, 0) : 15000 );
+
+    if ( !strcmp(mode, "cal") )
+        return calibrate( argc > a ? strtol(argv[a], NULL, 0) : 20000,
+                          argc > a + 1 ? strtol(argv[a + 1], NULL, 0) : 8000 );
+
+    boot( argc > a + 1 ? strtoul(argv[a + 1], NULL, 0) : 1500,
+          argc > a + 2 ? strtoul(argv[a + 2], NULL, 0) : 2500,
+          argc > a + 3 ? strtol(argv[a + 3], NULL, 0) : 1000000 );
+
+    if ( !strcmp(mode, "track") )
+        return track( count ? count : 60, argc > a + 2 ? strtoul(argv[a + 2], NULL, 0) : 2500 );
+
+    return measure_cycles( count ? count : 1000 );
+}
+
+static void boot(uint32_t left, uint32_t right, int32_t uv)
+{
+    sim_reset();
+    sim_analog_mv( bat_pin, 2900 ); // full battery
+    sim_adc_input_uv( uv );
+    sim_laser_distance( HAL_UART_LEFT, left );
+    sim_laser_distance( HAL_UART_RIGHT, right );
+
+    setup();
+}
+
+// click whenever the firmware waits for the measure button; returns true once
+// a measurement has been taken, or has failed (measure_faults)
+static bool next_measurement(void)
+{
+    static enum FSM clicked_in = STATE_INIT;
+    enum FSM before = state;
+
+    if ( state != clicked_in && (state == WAIT_LASER_ON || state == WAIT_MEASURE || state == WAIT_IDLE) )
+    {
+        // far enough out that the previous click has been released and debounced
+        sim_press( MEASURE_PIN, hal_millis() + 100, 50 );
+        clicked_in = state;
+    }
+
+    loop();
+
+    if ( state != before && state != clicked_in )
+        clicked_in = STATE_INIT; // moved on; the next wait gets a fresh click
+
+    return before != STATE_MEASURE && state == STATE_MEASURE;
+}
+
+// click, click, click: lasers on, measure, back to idle
+static int measure_cycles(uint32_t cycles)
+{
+    uint32_t done = 0, failed = 0;
+    uint64_t spi = tft.spi_bytes(); // the boot's aside
+    bool measured;
+
+    while ( done < cycles )
+    {
+        measured = next_measurement();
+
+        redraws += drawn();
+
+        if ( measured )
+        {
+            done++;
+
+            if ( measure_faults || laser_left.result != LASER_DISTANCE || laser_right.result != LASER_DISTANCE )
+                failed++;
+        }
+    }
+
+    printf( "%lu measurements (%lu failed) in %.1f s simulated\n",
+            (unsigned long)done, (unsigned long)failed, sim_now_us() / 1e6 );
+    printf( "last: %lu um at %ld mdeg; laser latency %lu/%lu us\n",
+            (unsigned long)measured_length_um, (long)angle_mdeg,
+            (unsigned long)laser_left.latency_us, (unsigned long)laser_right.latency_us );
+    printf( "%lu display updates, %.0f SPI bytes each (a frame is %lu), %lu notes, %lu events dropped\n",
+            (unsigned long)redraws, redraws ? (double)(tft.spi_bytes() - spi) / redraws : 0.0, (unsigned long)FRAME_SPI_BYTES,
+            (unsigned long)sim_tones(), (unsigned long)event_overflows() );
+
+    return failed ? 1 : 0;
+}
+
+// lasers on, hold to track for a while, click to hold the reading
+static int track(uint32_t seconds, uint32_t right)
+{
+    uint32_t boot_ms, start, stop, step, stop_ms;
+    uint64_t spi, live_spi = 0;
+
+    while ( state != WAIT_LASER_ON ) // buttons do nothing during the splash screen
+        loop();
+
+    boot_ms = hal_millis();
+    start = boot_ms + 4000;
+    stop = start + seconds * 1000;
+    step = start;
+
+    sim_press( MEASURE_PIN, boot_ms + 2000, 50 );   // lasers on
+    sim_press( MEASURE_PIN, boot_ms + 3000, 1000 ); // hold: tracking starts on the release
+    sim_press( MEASURE_PIN, stop, 50 );             // hold the reading
+
+    while ( state != WAIT_IDLE )
+    {
+        // the part moves under the right laser
+        if ( hal_millis() >= step )
+        {
+            sim_laser_distance( HAL_UART_RIGHT, right++ );
+            step += 100;
+        }
+
+        spi = tft.spi_bytes();
+        loop();
+
+        if ( drawn() && state == TRACKING )
+        {
+            live_redraws++;
+            live_spi += tft.spi_bytes() - spi;
+        }
+    }
+
+    printf( "tracked %lu s: %lu updates (%.2f/s) of %.0f SPI bytes, firmware says %.2f/s, %lu us frame to pixels\n",
+            (unsigned long)seconds, (unsigned long)live_redraws, live_redraws / (double)seconds,
+            live_redraws ? (double)live_spi / live_redraws : 0.0, tracking_rate_milli / 1000.0,
+            (unsigned long)tracking_latency_us );
+    // holding waits for the shots in flight without holding up the loop: the
+    // release of the click that held it is taken at once
+    stop_ms = hal_millis() - stop;
+    run_until( hal_millis() + 100 ); // whatever's still queued
+    printf( "held: %lu um at %ld mdeg (right laser at %lu um), %lu ms after the click; "
+            "the longest an event waited: %lu ms\n",
+            (unsigned long)measured_length_um, (long)angle_mdeg, (unsigned long)laser_right.last_distance_um,
+            (unsigned long)stop_ms, (unsigned long)event_latency_max() );
+
+    return live_redraws && event_latency_max() <= 1 ? 0 : 1;
+}
+
+// one run of n measurements; returns the RMS error against 'truth' and the
+// average number of shots
+static double burst_run(uint32_t n, uint32_t truth, double *shots)
+{
+    uint32_t done = 0, total = 0;
+    double err, sq = 0;
+
+    while ( done < n )
+    {
+        if ( !next_measurement() )
+            continue;
+
+        err = (double)measured_length_um - truth;
+        sq += err * err;
+        total += capture_shots;
+        done++;
+    }
+
+    *shots = total / (double)n;
+
+    return sqrt(sq / n);
+}
+
+// early stop against a fixed ten shots, on the same noisy lasers
+static int burst(uint32_t n, uint32_t sigma_um, uint16_t outliers)
+{
+    uint32_t truth;
+    double rms_early, rms_fixed, shots_early, shots_fixed;
+
+    // the noise-free length is the reference
+    boot( 1500, 2500, 1000000 );
+    burst_run( 1, 0, &shots_early );
+    truth = measured_length_um;
+
+    boot( 1500, 2500, 1000000 );
+    sim_laser_noise( HAL_UART_LEFT, sigma_um, outliers );
+    sim_laser_noise( HAL_UART_RIGHT, sigma_um, outliers );
+    rms_early = burst_run( n, truth, &shots_early );
+
+    boot( 1500, 2500, 1000000 );
+    sim_laser_noise( HAL_UART_LEFT, sigma_um, outliers );
+    sim_laser_noise( HAL_UART_RIGHT, sigma_um, outliers );
+    capture_se_target_um = 0; // never good enough: every burst takes all its shots
+    rms_fixed = burst_run( n, truth, &shots_fixed );
+
+    printf( "%lu measurements, laser sigma %lu um, %u outliers per 1000, true length %lu um\n",
+            (unsigned long)n, (unsigned long)sigma_um, outliers, (unsigned long)truth );
+    printf( "early stop: %.2f shots, RMS error %.0f um\n", shots_early, rms_early );
+    printf( "fixed N:    %.2f shots, RMS error %.0f um\n", shots_fixed, rms_fixed );
+
+    return 0;
+}
+
+// [calibration]
+
+static int32_t scale_ppm, ripple_um; // the lasers' error
+static double half_sin;              // sin(theta / 2) for the sensor's angle
+
+// the compensation the prototype had hardcoded, which the default table replaces
+static uint32_t prototype_um(uint32_t len)
+{
+    if ( (len >= 70000) && (len < 310000) )
+        return (len * 1065 + 500) / 1000 + 3240;
+    else if ( len >= 310000 )
+        return len + 63000;
+
+    return len;
+}
+
+// point both lasers so the true length (dot to dot, plus the laser offset) is
+// 'um'; each laser then misreads its distance by a scale error and a ripple
+static void aim(uint32_t um)
+{
+    double d = (um - LASER_OFFSET_UM) / (2.0 * half_sin);
+    double reading = d * (1.0 + scale_ppm / 1e6) + ripple_um * sin(d / 150000.0);
+
+    sim_laser_distance( HAL_UART_LEFT, (uint32_t)lround(reading / 1000.0) );
+    sim_laser_distance( HAL_UART_RIGHT, (uint32_t)lround(reading / 1000.0) );
+}
+
+// press a button and run the firmware until it's waiting for the next one
+static bool waiting(void)
+{
+    return state == WAIT_LASER_ON || state == WAIT_MEASURE || state == WAIT_IDLE || state == WAIT_CALIBRATE;
+}
+
+static void press(uint8_t pin, uint32_t hold_ms)
+{
+    enum FSM before;
+
+    while ( !waiting() )
+        loop();
+
+    before = state;
+    sim_press( pin, hal_millis() + 100, hold_ms );
+
+    while ( state == before )
+        loop();
+
+    while ( !waiting() )
+        loop();
+}
+
+// measure true lengths from 10 cm to 2.5 m; from WAIT_MEASURE back to it
+static void length_errors(double *rms, double *worst)
+{
+    double err, sq = 0;
+    uint32_t n = 0;
+
+    *worst = 0;
+
+    for ( uint32_t um = 100000; um <= 2500000; um += 40000, n++ )
+    {
+        aim( um );
+        press( MEASURE_PIN, 50 ); // measure
+        press( MEASURE_PIN, 50 ); // back to idle
+        press( MEASURE_PIN, 50 ); // lasers on
+
+        err = (double)measured_length_um - um;
+        sq += err * err;
+        if ( fabs(err) > *worst )
+            *worst = fabs(err);
+    }
+
+    *rms = sqrt(sq / n);
+}
+
+static int calibrate(int32_t scale, int32_t ripple)
+{
+    struct cal_table stored;
+    uint32_t um, mismatches = 0;
+    double rms_before, worst_before, rms_after, worst_after;
+    bool reloaded;
+    int failed = 0;
+
+    boot( 1500, 2500, 1000000 );
+
+    // the default table against the formula it replaces, every 10 um up to 5 m
+    for ( um = 0; um <= 5000000; um += 10 )
+    {
+        uint32_t a = cal_apply( &length_cal, um ), b = prototype_um( um );
+
+        if ( (a > b ? a - b : b - a) > 1 )
+            mismatches++;
+    }
+
+    printf( "default table vs hardcoded compensation: %lu mismatches over 1 um\n", (unsigned long)mismatches );
+    failed |= mismatches != 0;
+
+    // one measurement for the angle the sensor reports, then everything is aimed
+    press( MEASURE_PIN, 50 ); // lasers on
+    press( MEASURE_PIN, 50 ); // measure
+    half_sin = sin( angle_mdeg / 2000.0 * M_PI / 180.0 );
+    press( MEASURE_PIN, 50 ); // back to idle
+    press( MEASURE_PIN, 50 ); // lasers on
+
+    scale_ppm = scale;
+    ripple_um = ripple;
+
+    length_errors( &rms_before, &worst_before );
+
+    // hold mode, then measure each reference as it's asked for
+    press( MODE_PIN, 2500 );
+
+    while ( state == WAIT_CALIBRATE )
+    {
+        aim( calibration_reference_um() );
+        press( MEASURE_PIN, 50 );
+    }
+
+    press( MEASURE_PIN, 50 ); // lasers on
+
+    length_errors( &rms_after, &worst_after );
+
+    // the table survives a reboot
+    stored = length_cal;
+    length_cal.n = 0;
+    load_config();
+    reloaded = !memcmp( &stored, &length_cal, sizeof stored );
+    failed |= !reloaded;
+
+    printf( "laser error %ld ppm + %ld um ripple; %u references\n", (long)scale, (long)ripple, cal_taken );
+    for ( uint8_t i = 0; i < length_cal.n; i++ )
+        printf( "  knot %u: at %lu um add %ld um\n", i, (unsigned long)length_cal.raw_um[i], (long)length_cal.corr_um[i] );
+    printf( "stored table %s\n", reloaded ? "reloaded" : "lost" );
+    printf( "before: RMS error %.0f um, worst %.0f um\n", rms_before, worst_before );
+    printf( "after:  RMS error %.0f um, worst %.0f um\n", rms_after, worst_after );
+
+    return failed || rms_after >= rms_before;
+}
+
+// [settings log]
+
+struct settings
+{
+    double angle;
+    enum UNITS unit;
+    struct cal_table cal;
+};
+
+static struct cal_table default_cal;
+
+static void settings_get(struct settings *x)
+{
+    memset( x, 0, sizeof *x );
+    x->angle = angle_offset;
+    x->unit = unit;
+    x->cal = length_cal;
+}
+
+static bool settings_equal(const struct settings *a, const struct settings *b)
+{
+    return a->angle == b->angle && a->unit == b->unit && !memcmp( &a->cal, &b->cal, sizeof a->cal );
+}
+
+// power back on: the defaults setup() starts from, then the EEPROM
+static void reboot_config(void)
+{
+    angle_offset = 0.0;
+    unit = meter;
+    length_cal = default_cal;
+    load_config();
+}
+
+static uint32_t eeprom_writes(uint32_t *worst)
+{
+    uint32_t total = 0;
+
+    *worst = 0;
+
+    for ( uint32_t i = 0; i < SIM_EEPROM_SIZE; i++ )
+    {
+        total += sim_eeprom_wear()[i];
+        if ( sim_eeprom_wear()[i] > *worst )
+            *worst = sim_eeprom_wear()[i];
+    }
+
+    return total;
+}
+
+static int config(uint32_t changes)
+{
+    struct settings before, after, wanted;
+    uint32_t i, written, worst, start, rnd = 1, newer = 0, older = 0, lost = 0;
+    int failed = 0;
+
+    boot( 1500, 2500, 1000000 );
+    default_cal = length_cal;
+
+    // five quick unit clicks after a measurement make one record
+    press( MEASURE_PIN, 50 ); // lasers on
+    press( MEASURE_PIN, 50 ); // measure
+    written = eeprom_writes( &worst );
+    start = hal_millis();
+
+    for ( i = 0; i < 5; i++ )
+        sim_press( MODE_PIN, start + 100 + i * 300, 50 );
+
+    // until the coalescing timer wakes the loop, 3 s after the last click; the
+    // next pass would start with config_service() and then sleep for good
+    while ( hal_millis() < start + 100 + 4 * 300 + 3000 )
+        loop();
+
+    config_service();
+
+    printf( "5 unit clicks: record written %lu ms after the last one",
+            (unsigned long)(hal_millis() - (start + 100 + 4 * 300)) );
+
+    written = eeprom_writes( &worst ) - written;
+    printf( ", %lu bytes, unit now %s\n", (unsigned long)written, data[unit].id );
+    failed |= written > 16 || unit != foot + 1;
+
+    // wear: every change written on its own, the worst case
+    sim_reset();
+    reboot_config();
+
+    for ( i = 0; i < changes; i++ )
+    {
+        if ( i & 1 )
+        {
+            unit = (UNITS)((unit + 1) % 3);
+            config_changed( CONFIG_UNIT );
+        }
+        else
+        {
+            angle_offset += 0.01;
+            config_changed( CONFIG_ANGLE_OFFSET );
+        }
+
+        config_flush();
+    }
+
+    written = eeprom_writes( &worst );
+    printf( "%lu changes: %lu bytes written, busiest cell written %lu times (at fixed addresses: %lu)\n",
+            (unsigned long)changes, (unsigned long)written, (unsigned long)worst, (unsigned long)(changes / 2) );
+    failed |= worst * 10 > changes / 2;
+
+    // power cuts: a change per round, cut off after a random number of bytes;
+    // after the reboot the settings are the old ones or the new ones, nothing else
+    sim_reset();
+    reboot_config();
+    settings_get( &before );
+
+    for ( i = 0; i < changes; i++ )
+    {
+        rnd = rnd * 1103515245 + 12345;
+
+        switch ( (rnd >> 16) % 3 )
+        {
+            case 0: angle_offset += 0.5; config_changed( CONFIG_ANGLE_OFFSET ); break;
+            case 1: unit = (UNITS)((unit + 1) % 3); config_changed( CONFIG_UNIT ); break;
+            case 2: length_cal.corr_um[0] = (rnd >> 8) % 1000; config_changed( CONFIG_CAL ); break;
+        }
+
+        settings_get( &wanted );
+        sim_eeprom_cut( (rnd >> 20) % 100 );
+        config_flush();
+        sim_eeprom_cut( -1 );
+
+        reboot_config();
+        settings_get( &after );
+
+        if ( settings_equal(&after, &wanted) )
+            newer++;
+        else if ( settings_equal(&after, &before) )
+            older++;
+        else
+            lost++;
+
+        before = after;
+    }
+
+    printf( "%lu power cuts: %lu kept the change, %lu kept the old settings, %lu lost settings\n",
+            (unsigned long)changes, (unsigned long)newer, (unsigned long)older, (unsigned long)lost );
+    failed |= lost != 0;
+
+    // a device configured with the old layout
+    sim_reset();
+    {
+        uint16_t sig = 0xBEEF, u = inch;
+        double a = 1.25;
+
+        memcpy( sim_eeprom() + 0, &sig, 2 );
+        memcpy( sim_eeprom() + 2, &a, 8 );
+        memcpy( sim_eeprom() + 10, &u, 2 );
+    }
+    reboot_config();
+    settings_get( &before );
+    reboot_config(); // again, from the log this time
+    settings_get( &after );
+
+    printf( "old layout: angle offset %.2f, unit %s; %s after the next boot\n",
+            before.angle, data[before.unit].id, settings_equal(&before, &after) ? "same" : "different" );
+    failed |= before.angle != 1.25 || before.unit != inch || !settings_equal(&before, &after);
+
+    return failed;
+}
+
+// [history]
+
+// measurements in small jobs (a few shots of one thing, then something else),
+// on a battery running down, until the ring has wrapped; then a reboot, and
+// the export, written to 'path' for tools/longitude_history.py
+#define EMPTY_EXPORT_BYTES 10 // magic, the ending count and the CRC
+
+static int history(uint32_t measurements, const char *path)
+{
+    static uint8_t kept[HAL_HISTORY_SECTORS * HAL_HISTORY_SECTOR];
+    uint32_t i, done = 0, records, bytes, before, n, worst = 0, rnd = 1;
+    uint32_t left = 1500, right = 2500;
+    uint32_t battery_redraws = 0;
+    uint8_t full, shown;
+    const uint8_t *dump;
+    FILE *f;
+    int failed = 0;
+    bool measured;
+
+    boot( left, right, 1000000 );
+    update_bat_level();
+    full = shown = voltage_percentage;
+
+    while ( done < measurements )
+    {
+        measured = next_measurement();
+
+        // each change of the shown level redraws the battery widgets
+        if ( voltage_percentage != shown )
+        {
+            battery_redraws++;
+            shown = voltage_percentage;
+        }
+
+        if ( !measured )
+            continue;
+
+        done++;
+        rnd = rnd * 1103515245 + 12345;
+
+        if ( (rnd >> 16) % 8 == 0 ) // a new job
+        {
+            left = 300 + (rnd >> 8) % 4000;
+            right = 300 + (rnd >> 12) % 4000;
+            sim_adc_input_uv( 200000 + (rnd >> 4) % 1600000 );
+        }
+
+        // a few mm of aiming either way
+        sim_laser_distance( HAL_UART_LEFT, left + (rnd >> 20) % 5 - 2 );
+        sim_laser_distance( HAL_UART_RIGHT, right + (rnd >> 24) % 5 - 2 );
+        sim_analog_mv( bat_pin, 2900 - done * 600 / measurements );
+    }
+
+    while ( state != WAIT_LASER_ON )
+        next_measurement();
+
+    records = history_size( &bytes );
+
+    for ( i = 0; i < HAL_HISTORY_SECTORS; i++ )
+        if ( sim_history_erases()[i] > worst )
+            worst = sim_history_erases()[i];
+
+    printf( "%lu measurements: %lu kept in %lu bytes (%.1f records per KB), sectors erased up to %lu times\n",
+            (unsigned long)done, (unsigned long)records, (unsigned long)bytes,
+            records * 1024.0 / bytes, (unsigned long)worst );
+    failed |= records * 1024 < 50 * bytes || records >= done;
+
+    // the battery ran down steadily: each 5% step shown once, no flicker
+    update_bat_level();
+    printf( "battery: %u%% to %u%% (%u mV), shown level redrawn %lu times\n", full, voltage_percentage,
+            battery_mv(), (unsigned long)battery_redraws );
+    failed |= voltage_percentage >= full || battery_redraws > (full - voltage_percentage) / 5u;
+
+    // power back on: the ring carries on where it was
+    before = records;
+    history_setup();
+    history_add( HISTORY_RANGE );
+    records = history_size( &bytes );
+
+    printf( "after a reboot: %lu records%s\n", (unsigned long)records,
+            records == before + 1 || records < before ? "" : " (lost track of the ring)" );
+    failed |= records != before + 1 && records >= before;
+
+    // hold mode on the idle screen
+    press( MODE_PIN, 2500 );
+    dump = sim_usb_take( &n );
+
+    if ( (f = fopen(path, "wb")) )
+    {
+        fwrite( dump, 1, n, f );
+        fclose( f );
+    }
+
+    printf( "export: %lu bytes to %s\n", (unsigned long)n, f ? path : "(could not open)" );
+    failed |= !f || n < bytes;
+
+    // a sketch that has grown into the history flash: hands off it
+    memcpy( kept, sim_history(), sizeof kept );
+    sim_history_overlap( true );
+    history_setup();
+    history_add( HISTORY_RANGE );
+    records = history_size( &bytes );
+    press( MODE_PIN, 2500 );
+    sim_usb_take( &n );
+    sim_history_overlap( false );
+
+    i = memcmp( kept, sim_history(), sizeof kept );
+    printf( "sketch over the history: %lu records, flash %s, export %lu bytes\n",
+            (unsigned long)records, i ? "changed" : "untouched", (unsigned long)n );
+    failed |= records || i || n != EMPTY_EXPORT_BYTES;
+
+    return failed;
+}
+
+// [host link]
+
+// whatever the host has sent so far; the firmware polls this as it sleeps
+static uint32_t stdin_read(uint8_t *buf, uint32_t max)
+{
+    struct pollfd p = { 0, POLLIN, 0 };
+    ssize_t n;
+
+    if ( poll(&p, 1, 0) <= 0 )
+        return 0;
+
+    if ( (n = read(0, buf, max)) <= 0 )
+        exit( 0 ); // the host hung up
+
+    return (uint32_t)n;
+}
+
+static void stdout_write(const uint8_t *buf, uint32_t n)
+{
+    fwrite( buf, 1, n, stdout );
+    fflush( stdout );
+}
+
+static int host_link(void)
+{
+    boot( 1500, 2500, 1000000 );
+    sim_laser_noise( HAL_UART_LEFT, 1500, 20 );
+    sim_laser_noise( HAL_UART_RIGHT, 1500, 20 );
+    sim_usb_pipe( stdin_read, stdout_write );
+
+    for ( ;; )
+        loop();
+}
+
+// [energy model]
+//
+// current from the battery for each part in each of its power states, in mA.
+// rough figures from the datasheets (the laser modules' from their seller), not
+// measured on the device; the point is the comparison.
+#define MA_MCU_RUN    32.0  // MK20DX256 at 72 MHz
+#define MA_MCU_WAIT   12.0  // wfi, with the clocks running
+#define MA_MCU_STOP    0.5  // normal stop, with the regulator's own draw
+#define MA_SENSORS     5.0  // angle sensor and MCP3421, always on
+#define MA_PANEL       6.0  // ILI9341 logic, while awake
+#define MA_BACKLIGHT  60.0  // at full brightness
+#define MA_LASER_IDLE 10.0  // each module, beam off
+#define MA_LASER_LIT  35.0  // beam on for aiming
+#define MA_LASER_SHOT 90.0  // measuring
+#define MA_SPEAKER    25.0  // while a note plays
+
+#define BATTERY_MAH 2400.0  // four alkaline AA cells, at this sort of drain
+
+#define JOBS_MAX 1024
+
+// someone comes back at 'start' to measure: lights on, aims for 'aim', measures,
+// reads the result for 'read' and goes back to the idle screen.  'away' turns
+// the lasers on and walks off.
+struct job
+{
+    uint32_t start_ms, aim_ms, read_ms;
+    bool away;
+};
+
+enum PART { PART_MCU, PART_SENSORS, PART_DISPLAY, PART_LASERS, PART_SPEAKER, PARTS };
+static const char *const part_names[PARTS] = { "MCU", "sensors", "display", "lasers", "speaker" };
+
+// the trace file: "start_s aim_s read_s" or "start_s away" per line, # comments
+static uint32_t load_trace(const char *path, struct job *jobs)
+{
+    char line[128], word[16];
+    double start, aim, read;
+    uint32_t n = 0;
+    FILE *f = fopen( path, "r" );
+
+    if ( !f )
+        return 0;
+
+    while ( n < JOBS_MAX && fgets(line, sizeof line, f) )
+    {
+        if ( sscanf(line, "%lf %lf %lf", &start, &aim, &read) == 3 )
+            jobs[n++] = (struct job){ (uint32_t)(start * 1000), (uint32_t)(aim * 1000), (uint32_t)(read * 1000), false };
+        else if ( sscanf(line, "%lf %15s", &start, word) == 2 && !strcmp(word, "away") )
+            jobs[n++] = (struct job){ (uint32_t)(start * 1000), 0, 0, true };
+    }
+
+    fclose( f );
+
+    return n;
+}
+
+// a job every 10 minutes, 8 s of aiming and 20 s to read it; every fourth time
+// the lasers are left on
+static uint32_t default_trace(uint32_t hours, struct job *jobs)
+{
+    uint32_t n = 0;
+
+    for ( uint32_t t = 60; t < hours * 3600 && n < JOBS_MAX; t += 600, n++ )
+        jobs[n] = (struct job){ t * 1000, 8000, 20000, n % 4 == 3 };
+
+    return n;
+}
+
+// an event for the firmware to drop, so loop() comes back to us
+static void nudge(void)
+{
+    event_post( EV_NONE, 0, hal_millis() );
+}
+
+// let the firmware run on its own (timeouts and all) until 'at'
+static void run_until(uint32_t at)
+{
+    if ( at <= hal_millis() )
+        return;
+
+    sim_at( at, nudge );
+
+    while ( hal_millis() < at )
+        loop();
+}
+
+// a click of the measure button, run until it has been handled; the release
+// always posts an event, so loop() comes back then
+static void click(void)
+{
+    uint32_t at = hal_millis() + 100;
+
+    sim_press( MEASURE_PIN, at, 50 );
+
+    while ( hal_millis() < at + 50 )
+        loop();
+
+    while ( !waiting() && state != STATE_ONE_LASER && state != TRACKING )
+        loop();
+}
+
+// click until the firmware is in 'goal' (a click that only wakes the display
+// needs another)
+static void click_until(enum FSM goal)
+{
+    for ( int tries = 0; tries < 4 && state != goal; tries++ )
+        click();
+}
+
+// the time each part spent in each state, weighted by its current, in mAh
+static void charge_used(double mah[PARTS])
+{
+    const struct sim_power *p = sim_power_states();
+    double hours = sim_now_us() / 3.6e9;
+    uint64_t panel_on_us = p->panel_on_us;
+
+    mah[PART_MCU] = (p->mcu_us[SIM_MCU_RUN] * MA_MCU_RUN + p->mcu_us[SIM_MCU_WAIT] * MA_MCU_WAIT
+                     + p->mcu_us[SIM_MCU_STOP] * MA_MCU_STOP) / 3.6e9;
+    mah[PART_SENSORS] = hours * MA_SENSORS;
+    mah[PART_DISPLAY] = (panel_on_us * MA_PANEL + p->backlight_us * MA_BACKLIGHT) / 3.6e9;
+    mah[PART_LASERS] = 0;
+    mah[PART_SPEAKER] = p->tone_us * MA_SPEAKER / 3.6e9;
+
+    for ( int l = 0; l < 2; l++ )
+    {
+        mah[PART_LASERS] += (sim_now_us() - p->laser_lit_us[l] - p->laser_measuring_us[l]) * MA_LASER_IDLE / 3.6e9
+                          + (p->laser_lit_us[l] * MA_LASER_LIT + p->laser_measuring_us[l] * MA_LASER_SHOT) / 3.6e9;
+    }
+}
+
+// play the jobs to 'end'; returns the charge used per part, and how many
+// measurements were taken
+static uint32_t play(const struct job *jobs, uint32_t n, uint32_t end, bool managed, double mah[PARTS])
+{
+    uint32_t measured = 0;
+
+    boot( 1500, 2500, 1000000 );
+
+    power_dim_s         = managed ? 30 : 0;
+    power_display_off_s = managed ? 120 : 0;
+    power_lasers_off_s  = managed ? 60 : 0;
+
+    for ( uint32_t j = 0; j < n; j++ )
+    {
+        run_until( jobs[j].start_ms );
+
+        // the last job's result may still be up, or its lasers still on
+        if ( state == WAIT_IDLE )
+            click_until( WAIT_LASER_ON );
+
+        click_until( WAIT_MEASURE );
+
+        if ( jobs[j].away )
+            continue;
+
+        run_until( hal_millis() + jobs[j].aim_ms );
+        click_until( WAIT_IDLE );
+        measured += (state == WAIT_IDLE);
+
+        run_until( hal_millis() + jobs[j].read_ms );
+        click_until( WAIT_LASER_ON );
+    }
+
+    run_until( end );
+    charge_used( mah );
+
+    return measured;
+}
+
+static int power(const char *arg)
+{
+    static struct job jobs[JOBS_MAX];
+    double mah[2][PARTS], ma[2] = { 0, 0 }, hours;
+    uint32_t n, end, measured[2];
+
+    n = load_trace( arg, jobs );
+
+    if ( n == 0 )
+        n = default_trace( strtoul(arg, NULL, 0) ? strtoul(arg, NULL, 0) : 4, jobs );
+
+    if ( n == 0 )
+        return 1;
+
+    // ten minutes past the last one, so its timeouts play out
+    end = jobs[n - 1].start_ms + 600000;
+    hours = end / 3.6e6;
+
+    for ( int run = 0; run < 2; run++ )
+    {
+        measured[run] = play( jobs, n, end, run == 0, mah[run] );
+
+        for ( int i = 0; i < PARTS; i++ )
+            ma[run] += mah[run][i] / hours;
+    }
+
+    printf( "%lu jobs over %.2f h, %lu measurements (%lu with everything on)\n", (unsigned long)n, hours,
+            (unsigned long)measured[0], (unsigned long)measured[1] );
+    printf( "average mA    managed  always on\n" );
+
+    for ( int i = 0; i < PARTS; i++ )
+        printf( "%-12s %8.2f %10.2f\n", part_names[i], mah[0][i] / hours, mah[1][i] / hours );
+
+    printf( "%-12s %8.2f %10.2f\n", "total", ma[0], ma[1] );
+    printf( "runtime on %.0f mAh: %.1f h managed, %.1f h always on\n", BATTERY_MAH, BATTERY_MAH / ma[0], BATTERY_MAH / ma[1] );
+
+    return measured[0] != measured[1] || ma[0] >= ma[1];
+}
+
+// [scheduler trace]
+
+static const char *const task_names[TASK_COUNT] = { "adc", "splash", "lasers", "capture", "zero" };
+static const char *const trace_names[] = { "start", "done", "expired" };
+
+static bool tracing;
+
+static void trace_task(uint8_t id, uint8_t what)
+{
+    if ( tracing )
+        printf( "%10.3f ms  %-8s %s\n", sim_now_us() / 1000.0, task_names[id], trace_names[what] );
+}
+
+static int tasks(uint32_t measurements)
+{
+    const struct task_stats *st;
+    uint32_t done = 0, worst_step = 0, t;
+    uint32_t records, bytes;
+    bool on_failed, burst_failed, range_failed, zeroed, zero_failed, angle_failed;
+
+    task_on_trace( trace_task );
+    tracing = true;
+
+    boot( 1500, 2500, 1000000 );
+
+    while ( done < measurements )
+        done += next_measurement();
+
+    while ( state != WAIT_LASER_ON )
+        next_measurement();
+
+    // the right module stops answering: it times out lighting up, and the
+    // firmware says so instead of aiming with one laser
+    printf( "right laser unplugged\n" );
+    sim_laser_unplugged( HAL_UART_RIGHT, true );
+
+    t = hal_millis();
+    press( MEASURE_PIN, 50 ); // lasers on
+    on_failed = state == WAIT_IDLE && measure_faults == FAULT_RIGHT;
+
+    printf( "lasers on: %s after %.1f s\n", on_failed ? "failed, right laser" : "NOT FAILED", (hal_millis() - t) / 1000.0 );
+
+    // plugged back in, lit, and out again while aiming: the burst's first shot
+    // times out, which ends it, while a button comes in
+    sim_laser_unplugged( HAL_UART_RIGHT, false );
+    press( MEASURE_PIN, 50 ); // back to the idle screen
+    press( MEASURE_PIN, 50 ); // lasers on
+
+    printf( "right laser unplugged while aiming\n" );
+    sim_laser_unplugged( HAL_UART_RIGHT, true );
+    sim_press( MEASURE_PIN, hal_millis() + 100, 50 );
+
+    while ( state != WAIT_CAPTURE )
+        loop();
+
+    t = hal_millis();
+    sim_press( MODE_PIN, t + 3000, 50 ); // dropped, but taken at once
+
+    while ( state == WAIT_CAPTURE )
+        loop();
+
+    // no length out of it, nothing recorded, and no retrying the right laser
+    // after its first timeout (LASER_MEASURE_TIMEOUT_US, 6.5 s)
+    burst_failed = measure_faults == FAULT_RIGHT && state == STATE_MEASURE && hal_millis() - t < 7000;
+
+    printf( "burst: %u shots in %.1f s, laser results %u/%u, %s\n", capture_shots, (hal_millis() - t) / 1000.0,
+            laser_left.result, laser_right.result, burst_failed ? "failed, right laser" : "NOT FAILED" );
+
+    tracing = false;
+
+    // rangefinder mode on a target the left laser can't see: the fault screen,
+    // not a range made of no distance, and nothing in the history
+    sim_laser_unplugged( HAL_UART_RIGHT, false );
+    sim_laser_distance( HAL_UART_LEFT, 16 ); // the module's "no echo"
+    records = history_size( &bytes );
+
+    press( MEASURE_PIN, 50 ); // back to the idle screen
+    sim_press( MODE_PIN, hal_millis() + 100, 50 );
+
+    while ( state != STATE_ONE_LASER )
+        loop();
+
+    sim_press( MEASURE_PIN, hal_millis() + 100, 50 );
+
+    while ( state == STATE_ONE_LASER )
+        loop();
+
+    range_failed = state == STATE_MEASURE && measure_faults == FAULT_LEFT && history_size( &bytes ) == records;
+    printf( "rangefinder shot: %s\n", range_failed ? "failed, left laser" : "NOT FAILED" );
+
+    // zeroing the angle takes a full-resolution window, while the loop goes on
+    sim_laser_distance( HAL_UART_LEFT, 1000 );
+    press( MEASURE_PIN, 50 ); // back to the idle screen
+    press( MEASURE_PIN, 50 ); // lasers on
+
+    sim_press( MODE_PIN, hal_millis() + 100, 50 );
+
+    while ( !task_running(TASK_ZERO) )
+        loop();
+
+    t = hal_millis();
+
+    while ( task_running(TASK_ZERO) )
+        loop();
+
+    zeroed = angle_zeroed && state == WAIT_MEASURE;
+    printf( "zero: %s in %.1f s\n", zeroed ? "taken" : "NOT TAKEN", (hal_millis() - t) / 1000.0 );
+
+    // the angle sensor drops off the bus while aiming: the zero and then the
+    // burst give up on it a few conversion times after the switch to capture
+    // resolution, rather than wait for a filter window that never fills
+    printf( "angle sensor unplugged while aiming\n" );
+    sim_adc_unplugged( true );
+    press( MODE_PIN, 50 );
+    zero_failed = measure_faults == FAULT_ANGLE && state == WAIT_IDLE;
+    printf( "zero: %s\n", zero_failed ? "failed, angle sensor" : "NOT FAILED" );
+
+    press( MEASURE_PIN, 50 ); // back to the idle screen
+    press( MEASURE_PIN, 50 ); // lasers on
+    sim_press( MEASURE_PIN, hal_millis() + 100, 50 );
+
+    while ( state != WAIT_CAPTURE )
+        loop();
+
+    t = hal_millis();
+
+    while ( state == WAIT_CAPTURE )
+        loop();
+
+    angle_failed = measure_faults == FAULT_ANGLE && state == STATE_MEASURE && history_size( &bytes ) == records;
+    printf( "burst: %u shots in %.1f s, %s\n", capture_shots, (hal_millis() - t) / 1000.0,
+            angle_failed ? "failed, angle sensor" : "NOT FAILED" );
+
+    sim_adc_unplugged( false );
+
+    printf( "task      runs   steps  expired  longest step\n" );
+
+    for ( uint8_t id = 0; id < TASK_COUNT; id++ )
+    {
+        st = task_stats( id );
+        printf( "%-8s %5lu %7lu %8lu %10lu us\n", task_names[id], (unsigned long)st->runs, (unsigned long)st->steps,
+                (unsigned long)st->expired, (unsigned long)st->max_step_us );
+
+        if ( st->max_step_us > worst_step )
+            worst_step = st->max_step_us;
+    }
+
+    printf( "longest between task steps: %lu us; longest an event waited: %lu ms; %lu events dropped\n",
+            (unsigned long)task_gap_max_us(), (unsigned long)event_latency_max(), (unsigned long)event_overflows() );
+
+    task_on_trace( NULL );
+
+    // a step never waits on the virtual clock, and nothing waits past the next tick
+    return !on_failed || !burst_failed || !range_failed || !zeroed || !zero_failed || !angle_failed ||
+           worst_step > 0 || task_gap_max_us() > 1000 || event_latency_max() > 1;
+}
+
+// [boot]
+
+#define BOOT_READY_MS 500
+
+static uint64_t task_done_us[TASK_COUNT];
+
+static void boot_task(uint8_t id, uint8_t what)
+{
+    if ( what != TRACE_START )
+        task_done_us[id] = sim_now_us();
+}
+
+// from reset to the idle screen, and on to a measurement
+static int boot_time(void)
+{
+    uint64_t ready, measured;
+    bool lengths, no_adc;
+
+    task_on_trace( boot_task );
+    boot( 1500, 2500, 1000000 );
+
+    while ( state != WAIT_LASER_ON )
+        loop();
+
+    ready = sim_now_us();
+    task_on_trace( NULL );
+
+    while ( !next_measurement() )
+        ;
+
+    measured = sim_now_us();
+    lengths = laser_left.result == LASER_DISTANCE && laser_right.result == LASER_DISTANCE;
+
+    printf( "angle ADC answering   %8.1f ms\n", task_done_us[TASK_ADC] / 1000.0 );
+    printf( "splash screen down    %8.1f ms\n", task_done_us[TASK_SPLASH] / 1000.0 );
+    printf( "idle screen, ready    %8.1f ms\n", ready / 1000.0 );
+    printf( "first measurement     %8.1f ms (clicks at 100 ms each)\n", measured / 1000.0 );
+
+    // a converter that never answers: the boot ends on the fault screen once the
+    // probe gives up, not on an idle screen that can't measure
+    sim_reset();
+    sim_analog_mv( bat_pin, 2900 );
+    sim_adc_unplugged( true );
+    setup();
+
+    while ( state != WAIT_IDLE && state != WAIT_LASER_ON )
+        loop();
+
+    no_adc = state == WAIT_IDLE && measure_faults == FAULT_ANGLE;
+    printf( "no angle ADC          %8.1f ms (%s)\n", sim_now_us() / 1000.0, no_adc ? "reported" : "NOT REPORTED" );
+
+    return ready >= BOOT_READY_MS * 1000ULL || !lengths || !no_adc;
+}
+
+// [angle calibration]
+
+static int32_t gain_ppm, bow_uv; // the angle sensor's error
+
+// what the sensor puts out at an angle: the nominal line, off by a gain error,
+// and bowed away from it in the middle
+static int32_t sensor_at(double deg)
+{
+    return (int32_t)lround( 80000 + 1840000 * deg / 90 * (1 + gain_ppm / 1e6) + bow_uv * sin(deg / 90 * M_PI) );
+}
+
+// set the sensor to an angle and let a fresh filter window fill
+static void tilt(double deg)
+{
+    sim_adc_input_uv( sensor_at(deg) );
+    adc_set_resolution( CAPTURE_RESOLUTION );
+
+    while ( !adc_settled() )
+        sim_advance( 1000 );
+}
+
+// angle error every 2.5 degrees over the sensor's range
+static void angle_errors(double *rms, double *worst)
+{
+    double err, sq = 0;
+    uint32_t n = 0;
+
+    *worst = 0;
+
+    for ( double deg = 0; deg <= 90; deg += 2.5, n++ )
+    {
+        tilt( deg );
+        get_angle();
+
+        err = angle_mdeg / 1000.0 - deg;
+        sq += err * err;
+        if ( fabs(err) > *worst )
+            *worst = fabs(err);
+    }
+
+    *rms = sqrt(sq / n);
+}
+
+static int angle_calibrate(int32_t gain, int32_t bow)
+{
+    struct angle_cal stored, none = {};
+    double rms_before, worst_before, rms_after, worst_after;
+    bool reloaded, ok = true;
+    int failed = 0;
+
+    gain_ppm = gain;
+    bow_uv = bow;
+
+    boot( 1500, 2500, sensor_at(0) );
+
+    while ( state != WAIT_LASER_ON )
+        loop();
+
+    angle_errors( &rms_before, &worst_before );
+
+    // what the host does over LINK_ANGLE_CAL, with the fixture at each angle
+    angle_calibration_start();
+
+    for ( int32_t mdeg = 0; mdeg <= 90000; mdeg += 15000 )
+    {
+        sim_adc_input_uv( sensor_at(mdeg / 1000.0) );
+
+        while ( !angle_calibration_ready() )
+            sim_advance( 1000 );
+
+        ok &= angle_calibration_take( mdeg );
+    }
+
+    ok &= angle_calibration_finish();
+    failed |= !ok;
+
+    angle_errors( &rms_after, &worst_after );
+
+    // the table survives a reboot
+    stored = angle_cal;
+    angle_cal_set( &none );
+    load_config();
+    reloaded = !memcmp( &stored, &angle_cal, sizeof stored );
+    failed |= !reloaded;
+
+    printf( "angle sensor error %ld ppm gain + %ld uV bow; calibration %s\n", (long)gain, (long)bow,
+            ok ? "taken" : "refused" );
+    for ( uint8_t i = 0; i < angle_cal.n; i++ )
+        printf( "  point %u: code %ld is %ld mdeg\n", i, (long)angle_cal.code[i], (long)angle_cal.mdeg[i] );
+    printf( "stored table %s\n", reloaded ? "reloaded" : "lost" );
+    printf( "before: RMS error %.3f deg, worst %.3f deg\n", rms_before, worst_before );
+    printf( "after:  RMS error %.3f deg, worst %.3f deg\n", rms_after, worst_after );
+
+    return failed || rms_after >= rms_before;
+}
+
+// [record and replay]
+
+#define RESULTS_MAX 4096
+
+static const char *const kind_names[] = { "burst", "range", "track", "?" };
+
+struct result
+{
+    uint8_t kind;
+    uint32_t length_um;
+    int32_t angle_mdeg;
+};
+
+static struct result results[RESULTS_MAX];
+static uint32_t results_n;
+
+// the firmware's results as they come, in record and replay
+static void collect(uint8_t kind)
+{
+    if ( results_n < RESULTS_MAX )
+        results[results_n++] = (struct result){ kind, measured_length_um, angle_mdeg };
+}
+
+#if TRACE
+static FILE *trace_file;
+
+static void trace_write(const uint8_t *buf, uint32_t n)
+{
+    fwrite( buf, 1, n, trace_file );
+}
+
+// one scenario's trace, from boot, into dir/name.trace
+static int record_scenario(const char *dir, const char *name, int scenario, uint32_t measurements)
+{
+    char path[512];
+    uint32_t done = 0, t;
+
+    snprintf( path, sizeof path, "%s/%s.trace", dir, name );
+
+    if ( !(trace_file = fopen(path, "wb")) )
+    {
+        fprintf( stderr, "can't write %s\n", path );
+        return 1;
+    }
+
+    fwrite( TRACE_MAGIC, 1, sizeof TRACE_MAGIC - 1, trace_file );
+    trace_sink( trace_write );
+    trace_on_result( collect );
+    results_n = 0;
+
+    boot( 1500, 2500, 1000000 );
+    sim_laser_noise( HAL_UART_LEFT, 1500, 20 );
+    sim_laser_noise( HAL_UART_RIGHT, 1500, 20 );
+
+    switch ( scenario )
+    {
+        case 0: // clicking through measurements, with a unit change halfway
+            for ( bool changed = false; done < measurements; done += next_measurement() )
+            {
+                if ( !changed && done >= measurements / 2 && state == WAIT_IDLE )
+                {
+                    sim_press( MODE_PIN, hal_millis() + 100, 50 );
+                    run_until( hal_millis() + 300 );
+                    changed = true;
+                }
+            }
+            break;
+
+        case 1: // tracking a part that moves under the right laser, then holding it
+            while ( state != WAIT_LASER_ON )
+                loop();
+
+            t = hal_millis();
+            sim_press( MEASURE_PIN, t + 500, 50 );
+            sim_press( MEASURE_PIN, t + 1500, 1000 );
+            sim_press( MEASURE_PIN, t + 3000 + measurements * 1000, 50 );
+
+            for ( uint32_t step = t + 2500; state != WAIT_IDLE; loop() )
+            {
+                if ( hal_millis() >= step )
+                {
+                    sim_laser_distance( HAL_UART_RIGHT, 2500 + (step - t) / 100 );
+                    step += 100;
+                }
+            }
+            break;
+
+        case 2: // the right module stops answering halfway
+            while ( done < measurements )
+            {
+                if ( done == measurements / 2 )
+                    sim_laser_unplugged( HAL_UART_RIGHT, true );
+
+                done += next_measurement();
+            }
+            break;
+    }
+
+    run_until( hal_millis() + 500 ); // whatever follows the last one
+
+    trace_sink( NULL );
+    trace_on_result( NULL );
+    printf( "%s: %lu results in %.1f s, %ld bytes\n", path, (unsigned long)results_n, sim_now_us() / 1e6,
+            ftell(trace_file) );
+    fclose( trace_file );
+
+    return 0;
+}
+#endif
+
+// seed a trace library with the simulator's own scenarios
+static int record(const char *dir, uint32_t measurements)
+{
+#if TRACE
+    return record_scenario( dir, "clicks", 0, measurements )
+         | record_scenario( dir, "track", 1, measurements )
+         | record_scenario( dir, "one_laser", 2, measurements );
+#else
+    (void)dir; (void)measurements;
+    fprintf( stderr, "no trace in this build; add -DTRACE=1\n" );
+    return 1;
+#endif
+}
+
+// the whole file, or NULL
+static uint8_t *load_file(const char *path, uint32_t *n)
+{
+    FILE *f = fopen( path, "rb" );
+    uint8_t *buf = NULL;
+    long size;
+
+    if ( !f )
+        return NULL;
+
+    if ( fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) > 0 && fseek(f, 0, SEEK_SET) == 0
+         && (buf = (uint8_t *)malloc(size)) && fread(buf, 1, size, f) == (size_t)size )
+        *n = (uint32_t)size;
+    else
+        *n = 0;
+
+    fclose( f );
+
+    return buf;
+}
+
+// run the firmware on a trace's inputs and compare what it measures with what
+// it measured then; 0 if it's all the same
+static int replay_file(const char *path)
+{
+    static struct result expected[RESULTS_MAX];
+    struct trace_event ev = {};
+    uint32_t n, pos, next, want = 0, magic = sizeof TRACE_MAGIC - 1;
+    uint8_t *buf = load_file( path, &n );
+    bool gap = false;
+    clock_t cpu;
+    int failed = 0;
+
+    sim_reset();
+
+    if ( !buf || !sim_replay(buf, n) )
+    {
+        printf( "FAIL %s: not a trace\n", path );
+        free( buf );
+        return 1;
+    }
+
+    // what it measured, up to a gap if there is one (the replay stops there)
+    for ( pos = 0; (next = trace_next(buf + magic, n - magic, pos, &ev)) != 0; pos = next )
+    {
+        if ( ev.kind == TRACE_LOST )
+        {
+            gap = true;
+            break;
+        }
+
+        if ( ev.kind == TRACE_RESULT && want < RESULTS_MAX )
+        {
+            expected[want].kind = ev.arg;
+            memcpy( &expected[want].length_um, ev.data, 4 );
+            memcpy( &expected[want].angle_mdeg, ev.data + 4, 4 );
+            want++;
+        }
+    }
+
+    free( buf );
+
+    results_n = 0;
+    trace_on_result( collect );
+    cpu = clock();
+
+    setup();
+    run_until( sim_replay_end_ms() + 1000 );
+
+    cpu = clock() - cpu;
+    trace_on_result( NULL );
+
+    for ( uint32_t i = 0; i < want || i < results_n; i++ )
+    {
+        if ( i < want && i < results_n && !memcmp(&expected[i], &results[i], sizeof results[i]) )
+            continue;
+
+        if ( i < want )
+            printf( "  result %lu: %s %lu um at %ld mdeg", (unsigned long)i, kind_names[expected[i].kind & 3],
+                    (unsigned long)expected[i].length_um, (long)expected[i].angle_mdeg );
+        else
+            printf( "  result %lu: none", (unsigned long)i );
+
+        if ( i < results_n )
+            printf( ", replayed %s %lu um at %ld mdeg\n", kind_names[results[i].kind & 3],
+                    (unsigned long)results[i].length_um, (long)results[i].angle_mdeg );
+        else
+            printf( ", none replayed\n" );
+
+        failed = 1;
+    }
+
+    printf( "%s %s: %lu results, %.1f s in %.0f ms%s\n", failed ? "FAIL" : "PASS", path, (unsigned long)want,
+            sim_now_us() / 1e6, cpu * 1000.0 / CLOCKS_PER_SEC, gap ? " (stopped at a gap in the trace)" : "" );
+
+    return failed;
+}
+
+// each file, and the .trace files in each directory, in name order
+static int replay(int argc, char **argv)
+{
+    struct dirent **names;
+    char path[512];
+    int n, failed = 0, runs = 0;
+
+    for ( int i = 0; i < argc; i++ )
+    {
+        if ( (n = scandir(argv[i], &names, NULL, alphasort)) < 0 )
+        {
+            failed += replay_file( argv[i] );
+            runs++;
+            continue;
+        }
+
+        for ( int k = 0; k < n; k++ )
+        {
+            const char *dot = strrchr( names[k]->d_name, '.' );
+
+            if ( dot && !strcmp(dot, ".trace") )
+            {
+                snprintf( path, sizeof path, "%s/%s", argv[i], names[k]->d_name );
+                failed += replay_file( path );
+                runs++;
+            }
+
+            free( names[k] );
+        }
+
+        free( names );
+    }
+
+    printf( "%d of %d traces replayed the same\n", runs - failed, runs );
+
+    return failed || runs == 0;
+}
+
+// [screens]
+
+// pixels that aren't background in a rectangle of the glass
+static uint32_t lit(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color)
+{
+    uint32_t n = 0;
+
+    for ( int16_t j = y; j < y + h; j++ )
+        for ( int16_t i = x; i < x + w; i++ )
+            n += color ? tft.pixel(i, j) == color : tft.pixel(i, j) != ILI9341_BLACK;
+
+    return n;
+}
+
+// a rectangle's contents, to tell whether they changed
+static uint32_t region_hash(int16_t x, int16_t y, int16_t w, int16_t h)
+{
+    uint32_t hash = 2166136261u;
+
+    for ( int16_t j = y; j < y + h; j++ )
+        for ( int16_t i = x; i < x + w; i++ )
+            hash = (hash ^ tft.pixel(i, j)) * 16777619u;
+
+    return hash;
+}
+
+// what reached the panel since the last snap()
+static uint64_t snap_pixels, snap_spi;
+
+static int snap(const char *dir, const char *name, bool ok)
+{
+    char path[256];
+
+    printf( "%-8s %6lu pixels lit, %6lu sent in %7lu SPI bytes  %s\n", name,
+            (unsigned long)lit(0, 0, tft.width(), tft.height(), 0), (unsigned long)(tft.pixels_written() - snap_pixels),
+            (unsigned long)(tft.spi_bytes() - snap_spi), ok ? "ok" : "WRONG" );
+
+    snap_pixels = tft.pixels_written();
+    snap_spi = tft.spi_bytes();
+
+    if ( dir )
+    {
+        snprintf( path, sizeof path, "%s/%s.ppm", dir, name );
+
+        if ( !tft.write_ppm(path) )
+            printf( "couldn't write %s\n", path );
+    }
+
+    return ok ? 0 : 1;
+}
+
+// each screen, by what should be in its widgets' places (longitude_display.cpp)
+static int screens(const char *dir)
+{
+    uint64_t chars;
+    uint32_t before;
+    int failed = 0;
+
+    boot( 1500, 2500, 1000000 );
+
+    while ( state != WAIT_LASER_ON )
+        loop();
+
+    // the last length in its box, the laser state under it
+    failed |= snap( dir, "idle", lit(40, 70, 120, 30, ILI9341_WHITE) > 0 && lit(20, 130, 200, 20, ILI9341_WHITE) > 0 );
+
+    press( MEASURE_PIN, 50 ); // lasers on
+    failed |= snap( dir, "aiming", state == WAIT_MEASURE && lit(20, 130, 200, 20, ILI9341_WHITE) > 0 );
+
+    press( MEASURE_PIN, 50 ); // a burst
+    failed |= snap( dir, "length", state == WAIT_IDLE && lit(40, 90, 130, 30, ILI9341_WHITE) > 0 );
+
+    // a unit change rewrites the number and the unit, and nothing else.  it
+    // changes only readouts (the laser distances too), so every character of
+    // it comes from the glyph cache, not the library's text path
+    before = region_hash( 40, 90, 200, 30 );
+    chars = tft.chars_drawn();
+    sim_press( MODE_PIN, hal_millis() + 100, 50 );
+    run_until( hal_millis() + 200 ); // the screen stays up
+    chars = tft.chars_drawn() - chars;
+    failed |= snap( dir, "unit", region_hash(40, 90, 200, 30) != before && tft.spi_bytes() - snap_spi < FRAME_SPI_BYTES / 10 &&
+                    chars == 0 );
+
+    printf( "glyph cache: %u readout characters left out, %lu drawn the slow way on the unit change  %s\n",
+            glyph_dropped(), (unsigned long)chars, glyph_dropped() || chars ? "WRONG" : "ok" );
+    failed |= glyph_dropped() != 0;
+
+    // the fault screen's title is red
+    press( MEASURE_PIN, 50 ); // back to the idle screen
+    sim_laser_unplugged( HAL_UART_RIGHT, true );
+    press( MEASURE_PIN, 50 ); // lasers on, and one doesn't answer
+    failed |= snap( dir, "fault", measure_faults == FAULT_RIGHT && lit(20, 50, 280, 25, ILI9341_RED) > 0 );
+
+    return failed;
+}
+
+
+// [parser]
+//
+// the frame parser (longitude_protocol.cpp) on every frame the modules send,
+// and on what a noisy line makes of them; each line goes through laser_parse()
+// byte by byte, then through a UART and laser_poll(), split in two at every
+// point, so a frame can arrive over any number of reads
+struct parse_case
+{
+    const char *line;
+    enum LASER_FRAME want[4];  // the frames it holds, in order, to LASER_NONE
+    uint32_t distance_um;      // after the last LASER_DISTANCE
+};
+
+static const struct parse_case parse_cases[] =
+{
+    // one of everything
+    { "$00023335&",          { LASER_REPLY },            0 },
+    { "$0003260130&",        { LASER_ON_CONFIRM },       0 },
+    { "$0003260029&",        { LASER_OFF_CONFIRM },      0 },
+    { "$00022123&",          { LASER_MEASURE_CONFIRM },  0 },
+    { "$0006210000154284&",  { LASER_DISTANCE },         1542000 },
+    { "$0006210000001542&",  { LASER_TOO_CLOSE },        0 },
+    { "$0006210000001643&",  { LASER_NO_ECHO },          0 },
+    { "$0006210000001744&",  { LASER_TOO_STRONG },       0 },
+    { "$0006210000001845&",  { LASER_TOO_MUCH_LIGHT },   0 },
+    { "$00029901&",          { LASER_UNKNOWN },          0 },
+
+    // not frames, or broken ones
+    { "\r\n#?x&&$00023335&",     { LASER_REPLY },            0 }, // noise before a frame
+    { "$0002x3335&$00022123&",   { LASER_MEASURE_CONFIRM },  0 }, // noise inside one drops it
+    { "$000233$00022123&",       { LASER_MEASURE_CONFIRM },  0 }, // a '$' starts over
+    { "$0002333&",               { LASER_UNKNOWN },          0 }, // half a pair
+    { "$00053335&",              { LASER_UNKNOWN },          0 }, // length doesn't match
+    { "$0006219999999999&",      { LASER_UNKNOWN },          0 }, // too far for micrometers
+    { "$0006210000154284000000000&$00023335&", { LASER_REPLY }, 0 }, // too long for the buffer
+
+    // back to back, as a burst leaves them
+    { "$00022123&$0006210000154284&$0006210000000102&",
+      { LASER_MEASURE_CONFIRM, LASER_DISTANCE, LASER_DISTANCE },          1000 },
+    { "$0003260130&garbage$00022123&$0006210000001643&",
+      { LASER_ON_CONFIRM, LASER_MEASURE_CONFIRM, LASER_NO_ECHO },         0 },
+};
+
+#define PARSE_CASES (sizeof parse_cases / sizeof parse_cases[0])
+
+// the frames laser_poll() has for us until the UART runs dry
+static uint8_t poll_all(struct laser *laser, enum LASER_FRAME *got, uint8_t n)
+{
+    enum LASER_FRAME frame;
+
+    while ( (frame = laser_poll(laser)) != LASER_NONE )
+        if ( n < 4 )
+            got[n++] = frame;
+
+    return n;
+}
+
+static bool parse_ok(const struct parse_case *c, const enum LASER_FRAME *got, uint8_t n, uint32_t distance_um)
+{
+    uint8_t want = 0;
+
+    while ( want < 4 && c->want[want] != LASER_NONE )
+        want++;
+
+    return n == want && !memcmp( got, c->want, n * sizeof *got ) &&
+           (c->distance_um == 0 || distance_um == c->distance_um);
+}
+
+static int parser(uint32_t megabytes)
+{
+    enum LASER_FRAME got[4], frame;
+    struct laser laser;
+    struct timespec t0, t1;
+    char head[64];
+    uint32_t failed = 0, splits = 0, len, frames = 0, bytes;
+    uint8_t n;
+    double ns;
+
+    sim_reset();
+    memset( &laser, 0, sizeof laser );
+    laser.port = HAL_UART_LEFT;
+
+    for ( uint32_t i = 0; i < PARSE_CASES; i++ )
+    {
+        const struct parse_case *c = &parse_cases[i];
+        bool ok;
+
+        // a byte at a time
+        laser_parser_reset( &laser.rx );
+        n = 0;
+
+        for ( const char *s = c->line; *s; s++ )
+            if ( (frame = laser_parse(&laser.rx, *s)) != LASER_NONE && n < 4 )
+                got[n++] = frame;
+
+        ok = parse_ok( c, got, n, laser.rx.distance_um );
+
+        // in two reads, split everywhere
+        len = strlen( c->line );
+
+        for ( uint32_t k = 0; k <= len && ok; k++, splits++ )
+        {
+            laser_parser_reset( &laser.rx );
+            memcpy( head, c->line, k );
+            head[k] = '\0';
+
+            sim_laser_line( laser.port, head );
+            n = poll_all( &laser, got, 0 );
+            sim_laser_line( laser.port, c->line + k );
+            n = poll_all( &laser, got, n );
+
+            ok = parse_ok( c, got, n, laser.rx.distance_um ) && hal_uart_available( laser.port ) == 0;
+        }
+
+        if ( !ok )
+        {
+            printf( "WRONG: \"%s\"\n", c->line );
+            failed++;
+        }
+    }
+
+    printf( "%lu lines, %lu splits: %lu wrong\n", (unsigned long)PARSE_CASES, (unsigned long)splits,
+            (unsigned long)failed );
+
+    // throughput, on this PC's clock: the board's is another matter (see
+    // PROFILE), but a parser this far ahead of the line won't be the problem
+    laser_parser_reset( &laser.rx );
+    bytes = 0;
+    clock_gettime( CLOCK_MONOTONIC, &t0 );
+
+    while ( bytes < megabytes * 1000000 )
+    {
+        const char *line = parse_cases[bytes % PARSE_CASES].line;
+
+        for ( const char *s = line; *s; s++ )
+            frames += laser_parse( &laser.rx, *s ) != LASER_NONE;
+
+        bytes += strlen( line );
+    }
+
+    clock_gettime( CLOCK_MONOTONIC, &t1 );
+    ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+
+    // two ports at 115200 baud, 10 bits a byte
+    printf( "%lu bytes, %lu frames: %.2f ns a byte on the host, %.0f times two ports' line rate\n",
+            (unsigned long)bytes, (unsigned long)frames, ns / bytes, 1e9 / (ns / bytes) / (2 * 11520.0) );
+
+    return failed ? 1 : 0;
+}
+
+// [ports]
+//
+// the two modules are serviced in turn (longitude_lasers.cpp), so a command to
+// both costs the slower of the two, not the sum: time each module alone, one
+// after the other, and both at once, the blocking way and as TASK_LASERS
+
+// spin in place until the lasers' transactions are over, as the firmware's
+// blocking calls used to; either may be NULL
+static void wait_lasers(struct laser *a, struct laser *b)
+{
+    while ( !laser_all_done(a, b) )
+        event_idle();
+}
+
+static uint64_t lasers_alone(struct laser *laser, enum LASER_CMD cmd)
+{
+    uint64_t start = sim_now_us();
+
+    laser_start( laser, cmd );
+    wait_lasers( laser, NULL );
+
+    return sim_now_us() - start;
+}
+
+static uint64_t lasers_together(enum LASER_CMD cmd, bool as_task)
+{
+    uint64_t start = sim_now_us();
+    struct event ev;
+
+    if ( !as_task )
+    {
+        laser_start( &laser_left, cmd );
+        laser_start( &laser_right, cmd );
+        wait_lasers( &laser_left, &laser_right );
+
+        return sim_now_us() - start;
+    }
+
+    laser_start_all( &laser_left, &laser_right, cmd );
+
+    while ( task_service() )
+        event_idle();
+
+    while ( event_get(&ev) ) // the state machine's, which isn't running
+        ;
+
+    return sim_now_us() - start;
+}
+
+static int ports(uint32_t left_ms, uint32_t right_ms)
+{
+    static const char *const names[] = { "on", "measure", "off" };
+    static const enum LASER_CMD cmds[] = { LASER_CMD_ON, LASER_CMD_MEASURE, LASER_CMD_OFF };
+    uint64_t left, right, slower, both, task;
+    int failed = 0;
+    bool ok;
+
+    boot( 1500, 2500, 1000000 );
+
+    while ( state != WAIT_LASER_ON )
+        loop();
+
+    sim_laser_measure_time( HAL_UART_LEFT, left_ms );
+    sim_laser_measure_time( HAL_UART_RIGHT, right_ms );
+
+    printf( "           left    right   one by one   together   as a task  (ms)\n" );
+
+    for ( uint8_t i = 0; i < 3; i++ )
+    {
+        left = lasers_alone( &laser_left, cmds[i] );
+        right = lasers_alone( &laser_right, cmds[i] );
+        slower = left > right ? left : right;
+        both = lasers_together( cmds[i], false );
+        task = lasers_together( cmds[i], true );
+
+        // within a tick of the 1 ms wakeups that service them
+        ok = both <= slower + 1000 && task <= slower + 1000 &&
+             !laser_failed( &laser_left ) && !laser_failed( &laser_right );
+        failed |= !ok;
+
+        printf( "%-8s %7.1f  %7.1f  %11.1f  %9.1f  %10.1f  %s\n", names[i], left / 1000.0, right / 1000.0,
+                (left + right) / 1000.0, both / 1000.0, task / 1000.0, ok ? "ok" : "WRONG" );
+    }
+
+    return failed;
+}
+
+// [i2c]
+//
+// the angle converter's bus traffic (sim_i2c_stats()) while the firmware sits
+// idle, aims and measures: what each new sample costs in transactions and bus
+// time, and how long it waited in the converter before a read picked it up.
+// a sample should wait no longer than the poll interval at that resolution.
+static uint32_t poll_us(uint8_t bits)
+{
+    switch ( bits )
+    {
+        case 12: return mcp342x_format<12>::poll_us;
+        case 14: return mcp342x_format<14>::poll_us;
+        case 16: return mcp342x_format<16>::poll_us;
+        default: return mcp342x_format<18>::poll_us;
+    }
+}
+
+static int i2c_line(const char *name, uint8_t bits, uint64_t us)
+{
+    const struct sim_i2c *s = sim_i2c_stats();
+    bool ok = s->samples > 0 && s->latency_max_us <= poll_us(bits) + 1000;
+    double n = s->samples ? s->samples : 1;
+
+    printf( "%-10s %2u bit %5.1f s  %5lu samples  %4.2f reads and %4.2f writes a sample  bus %5.2f%%  "
+            "waited %5.1f ms, %5.1f at most  %s\n",
+            name, bits, us / 1e6, (unsigned long)s->samples, s->reads / n, s->writes / n, 100.0 * s->bus_us / us,
+            s->latency_us / 1000.0 / n, s->latency_max_us / 1000.0, ok ? "ok" : "WRONG" );
+
+    return ok ? 0 : 1;
+}
+
+static int i2c(uint32_t seconds)
+{
+    uint64_t start, took;
+    int failed = 0;
+    bool got;
+
+    boot( 1500, 2500, 1000000 );
+
+    while ( state != WAIT_LASER_ON )
+        loop();
+
+    sim_i2c_clear();
+    start = sim_now_us();
+    run_until( hal_millis() + seconds * 1000 );
+    failed |= i2c_line( "idle", adc_resolution(), sim_now_us() - start );
+
+    press( MEASURE_PIN, 50 ); // lasers on
+    sim_i2c_clear();
+    start = sim_now_us();
+    run_until( hal_millis() + seconds * 1000 );
+    failed |= i2c_line( "aiming", adc_resolution(), sim_now_us() - start );
+
+    // what the old blocking get_angle() took a quarter second for
+    start = sim_now_us();
+    got = get_angle();
+    took = sim_now_us() - start;
+    printf( "get_angle() took %lu us on the virtual clock\n", (unsigned long)took );
+    failed |= !got || took != 0;
+
+    sim_i2c_clear();
+    start = sim_now_us();
+
+    for ( uint32_t n = 0; n < 10; )
+        n += next_measurement();
+
+    failed |= i2c_line( "measuring", CAPTURE_RESOLUTION, sim_now_us() - start );
+
+    return failed;
+}
+
+// [sound]
+//
+// beep() only queues the melody, and the timer plays it, so the loop should
+// carry on as if nothing were playing.  time only passes in hal_sleep() (idle,
+// waiting for an event) and in hal_delay() and the like, which count as MCU
+// run time: the run time in a loop pass is how long it busy waited.  the only
+// such waits are for an I2C transfer to land (hal_i2c_finish()), a fraction of
+// a tick; waiting on the speaker would take a note's length.
+static int sound(uint32_t melodies)
+{
+    uint64_t run_us, busy_us, pass_us, worst_us, start;
+    uint32_t measured, tones, total = 0;
+    int failed = 0;
+    bool ok;
+
+    boot( 1500, 2500, 1000000 );
+
+    while ( state != WAIT_LASER_ON )
+        loop();
+
+    printf( "idle screen at %lu ms, the boot melody %s\n",
+            (unsigned long)hal_millis(), sound_busy() ? "still playing" : "done" );
+
+    while ( sound_busy() ) // the boot melody, out of the way
+        run_until( hal_millis() + 100 );
+
+    for ( uint32_t m = 0; m < melodies; m++ )
+    {
+        tones = sim_tones();
+        start = sim_now_us();
+        busy_us = worst_us = 0;
+        measured = 0;
+
+        beep( beethoven );
+
+        while ( sound_busy() )
+        {
+            run_us = sim_power_states()->mcu_us[SIM_MCU_RUN];
+            measured += next_measurement();
+            pass_us = sim_power_states()->mcu_us[SIM_MCU_RUN] - run_us;
+
+            busy_us += pass_us;
+            if ( pass_us > worst_us )
+                worst_us = pass_us;
+        }
+
+        tones = sim_tones() - tones;
+        total += measured;
+
+        ok = worst_us < 1000 && measured > 0 && tones > 0;
+        failed |= !ok;
+
+        printf( "melody %lu: %lu notes over %lu ms, %lu measurements meanwhile, "
+                "busy waiting %lu us, %lu in one pass at most  %s\n",
+                (unsigned long)m + 1, (unsigned long)tones, (unsigned long)((sim_now_us() - start) / 1000),
+                (unsigned long)measured, (unsigned long)busy_us, (unsigned long)worst_us, ok ? "ok" : "WRONG" );
+    }
+
+    ok = event_latency_max() <= 1;
+    failed |= !ok;
+
+    printf( "%lu measurements in all; the longest an event waited: %lu ms  %s\n",
+            (unsigned long)total, (unsigned long)event_latency_max(), ok ? "ok" : "WRONG" );
+
+    return failed;
+}
+
+// [buttons]
+//
+// edges as the switch makes them, and the events they come out as.  the events
+// are taken here rather than by the loop, and the clock runs on hal_sleep().
+struct click_case
+{
+    const char *name;
+    uint16_t edges[10]; // ms from the start, down and up in pairs; 0 ends
+};
+
+static const struct click_case click_cases[] =
+{
+    { "a 10 ms click",               { 1, 11 } },
+    { "a 20 ms click",               { 1, 21 } },
+    { "bouncing down",               { 1, 2, 3, 4, 5, 200 } },
+    { "a 1 ms click",                { 1, 2 } },
+    { "bouncing up",                 { 1, 200, 201, 202, 203, 204 } },
+    { "bouncing both ways",          { 1, 2, 4, 5, 7, 150, 151, 153, 154, 156 } },
+    { "bouncing, and up at once",    { 1, 2, 3, 4, 5, 6 } },
+};
+
+static int buttons(void)
+{
+    struct event ev;
+    uint32_t start, downs, ups;
+    int failed = 0;
+    bool ok;
+
+    boot( 1500, 2500, 1000000 );
+
+    while ( state != WAIT_LASER_ON )
+        loop();
+
+    for ( const struct click_case *c = click_cases; c < click_cases + sizeof click_cases / sizeof click_cases[0]; c++ )
+    {
+        start = hal_millis() + 100;
+        downs = ups = 0;
+
+        for ( uint8_t i = 0; i < 10 && c->edges[i]; i += 2 )
+            sim_press( MEASURE_PIN, start + c->edges[i], c->edges[i + 1] - c->edges[i] );
+
+        while ( hal_millis() < start + 400 )
+        {
+            hal_sleep();
+
+            while ( event_get(&ev) )
+            {
+                downs += ev.type == EV_BTN_DOWN && ev.arg == BTN_MEASURE;
+                ups += ev.type == EV_BTN_UP && ev.arg == BTN_MEASURE;
+            }
+        }
+
+        ok = downs == 1 && ups == 1 && !b_measure.down;
+        failed |= !ok;
+
+        printf( "%-28s %lu down, %lu up, %s  %s\n", c->name, (unsigned long)downs, (unsigned long)ups,
+                b_measure.down ? "held" : "released", ok ? "ok" : "WRONG" );
+    }
+
+    return failed;
+}
+
+// [glyphs]
+//
+// a readout drawn from the glyph cache (longitude_glyphs.cpp) against the way
+// it was drawn before, and still is for anything not cached: erase the old
+// text, then print it through the library.  the SPI bytes are what the board
+// sends, and what its time goes on; the time is the host's, mostly the model's
+// drawing, so it says little about the board.
+struct readout
+{
+    const char *name;
+    const ILI9341_t3_font_t *font;
+    const char *text;
+};
+
+static const struct readout readouts[] =
+{
+    { "length",  &LiberationSans_28, "12.345" },
+    { "unit",    &LiberationSans_20, "ft" },
+    { "angle",   &Arial_14,          "-12.34" },
+    { "laser",   &Arial_14,          "2.500" },
+    { "battery", &Arial_14,          "85" },
+    { "burst",   &Arial_14,          "+/- 0.3 mm" },
+};
+
+static double draw_ns(const struct readout *r, bool cached, uint32_t repeats, uint64_t *spi, int16_t *width)
+{
+    struct timespec t0, t1;
+    uint64_t before = tft.spi_bytes();
+
+    clock_gettime( CLOCK_MONOTONIC, &t0 );
+
+    for ( uint32_t i = 0; i < repeats; i++ )
+    {
+        if ( cached )
+        {
+            *width = glyph_draw( r->font, 20, 100, r->text, ILI9341_WHITE, ILI9341_BLACK );
+            continue;
+        }
+
+        tft.fillRect( 20, 100, *width, r->font->line_space, ILI9341_BLACK );
+        tft.setFont( *r->font );
+        tft.setTextColor( ILI9341_WHITE, ILI9341_BLACK );
+        tft.setCursor( 20, 100 );
+        tft.print( r->text );
+    }
+
+    clock_gettime( CLOCK_MONOTONIC, &t1 );
+    *spi = (tft.spi_bytes() - before) / repeats;
+
+    return ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / repeats;
+}
+
+static int glyphs(uint32_t repeats)
+{
+    uint64_t spi_cached, spi_print;
+    double ns_cached, ns_print;
+    uint16_t ram, pool;
+    int16_t width;
+    int failed = 0;
+
+    boot( 1500, 2500, 1000000 ); // display_setup() fills the cache
+
+    printf( "readout  text          SPI bytes: cached   printed     host ns: cached   printed\n" );
+
+    for ( const struct readout *r = readouts; r < readouts + sizeof readouts / sizeof readouts[0]; r++ )
+    {
+        ns_cached = draw_ns( r, true, repeats, &spi_cached, &width );
+
+        if ( width < 0 )
+        {
+            printf( "%-8s \"%s\" isn't in the cache  WRONG\n", r->name, r->text );
+            failed = 1;
+            continue;
+        }
+
+        ns_print = draw_ns( r, false, repeats, &spi_print, &width );
+
+        // the whole cell goes in one window, where the text path sends a window
+        // per run of pixels and erases first
+        failed |= spi_cached > spi_print;
+
+        printf( "%-8s %-12s %16lu %9lu %17.0f %9.0f  %s\n", r->name, r->text,
+                (unsigned long)spi_cached, (unsigned long)spi_print, ns_cached, ns_print,
+                spi_cached > spi_print ? "WRONG" : "ok" );
+    }
+
+    ram = glyph_ram( &pool );
+    printf( "cache: %u bytes of RAM, %u of its %u byte pool in use (the stand-in fonts'; the real faces differ)\n",
+            ram, pool, GLYPH_POOL );
+
+    return failed;
+}